@@ -0,0 +1,169 @@
+// Microbenchmark of the sample kernels against the scalar loops record() used before
+#include "samplekernels.h"
+#include "debug.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+namespace
+{
+    const size_t FRAMES_NUMBER = 1 << 20;
+    const size_t BLOCK_FRAMES_NUMBER = 4099;
+    const int    REPEATS = 20;
+
+    double now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    void report(const char *kernel, const char *impl, u_int chansNumber, double seconds)
+    {
+        double samplesPerSec = (double)FRAMES_NUMBER * chansNumber * REPEATS / seconds;
+
+        PRINT(kernel << "\t" << impl << "\tchannels " << chansNumber << "\t" << samplesPerSec / 1e6 << " Msamples/s");
+    }
+
+    // Keep the compiler from dropping or hoisting repeated work
+    inline void clobber()
+    {
+        asm volatile("" : : : "memory");
+    }
+
+    // Gain loop of the original record()
+    __attribute__((noinline)) void legacyGain(short *dataBuf, size_t itemsCount, float coeff)
+    {
+        for (size_t i = 0; i < itemsCount; ++i)
+            dataBuf[i] *= coeff;
+    }
+
+    // Peak scan of the original record()
+    __attribute__((noinline)) void legacyPeaks(const short *dataBuf, size_t itemsCount, short &minValue, short &maxValue)
+    {
+        for (size_t i = 0; i < itemsCount; ++i)
+        {
+            if (minValue > dataBuf[i])
+                minValue = dataBuf[i];
+
+            if (maxValue < dataBuf[i])
+                maxValue = dataBuf[i];
+        }
+    }
+}
+
+int main()
+{
+    const u_int chansNumbers[] = {1, 2, 6, 8};
+    const SampleKernels::Impl impls[] = {SampleKernels::IMPL_SCALAR, SampleKernels::IMPL_SSE2, SampleKernels::IMPL_AVX2};
+
+    PRINT("Default implementation: " << SampleKernels::getImplName(SampleKernels::getImpl()));
+
+    for (size_t c = 0; c < sizeof(chansNumbers) / sizeof(chansNumbers[0]); ++c)
+    {
+        u_int chansNumber = chansNumbers[c];
+        size_t samplesNumber = FRAMES_NUMBER * chansNumber;
+
+        std::vector<short> in(samplesNumber), out(samplesNumber), ref(samplesNumber);
+        std::vector<short> refMin, refMax;
+        std::vector<float> refSquares;
+        srand(1);
+        for (size_t i = 0; i < samplesNumber; ++i)
+            in[i] = rand() % 20000 - 10000;
+
+        std::vector<float> coeffs(chansNumber);
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+            coeffs[ch] = 1.5 + 0.25 * ch;
+
+        // Legacy loops
+        {
+            double start = now();
+            for (int r = 0; r < REPEATS; ++r)
+            {
+                out = in;
+                legacyGain(&out[0], samplesNumber, coeffs[0]);
+                clobber();
+            }
+            report("gain", "legacy", chansNumber, now() - start);
+
+            short minValue = 0x7FFF, maxValue = -0x8000;
+            start = now();
+            for (int r = 0; r < REPEATS; ++r)
+            {
+                legacyPeaks(&in[0], samplesNumber, minValue, maxValue);
+                clobber();
+            }
+            report("peaks", "legacy", chansNumber, now() - start);
+        }
+
+        SampleKernels::FixedGain gain;
+        SampleKernels::makeGain(gain, &coeffs[0], chansNumber);
+
+        for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); ++k)
+        {
+            if (!SampleKernels::setImpl(impls[k]))
+                continue;
+
+            const char *implName = SampleKernels::getImplName(impls[k]);
+
+            double start = now();
+            for (int r = 0; r < REPEATS; ++r)
+            {
+                SampleKernels::applyGain(&in[0], &out[0], FRAMES_NUMBER, chansNumber, gain);
+                clobber();
+            }
+            report("gain", implName, chansNumber, now() - start);
+
+            std::vector<short> minValues(chansNumber, 0x7FFF), maxValues(chansNumber, -0x8000);
+            start = now();
+            for (int r = 0; r < REPEATS; ++r)
+            {
+                SampleKernels::findPeaks(&in[0], FRAMES_NUMBER, chansNumber, &minValues[0], &maxValues[0]);
+                clobber();
+            }
+            report("peaks", implName, chansNumber, now() - start);
+
+            // Peaks and sums of squares in one pass. Sums are accumulated in float, so they are
+            // compared on one period-sized block, like the limiter uses them
+            std::vector<float> sumSquares(chansNumber, 0);
+            start = now();
+            for (int r = 0; r < REPEATS; ++r)
+            {
+                SampleKernels::findPeaks(&in[0], FRAMES_NUMBER, chansNumber, &minValues[0], &maxValues[0], &sumSquares[0]);
+                clobber();
+            }
+            report("levels", implName, chansNumber, now() - start);
+
+            sumSquares.assign(chansNumber, 0);
+            SampleKernels::findPeaks(&in[0], BLOCK_FRAMES_NUMBER, chansNumber, &minValues[0], &maxValues[0], &sumSquares[0]);
+
+            // Vector results must match the scalar ones
+            if (impls[k] == SampleKernels::IMPL_SCALAR)
+            {
+                ref = out;
+                refMin = minValues;
+                refMax = maxValues;
+                refSquares = sumSquares;
+            }
+            else
+            {
+                if (out != ref)
+                    ERR(implName << " gain result differs from scalar for " << chansNumber << " channels!");
+
+                if (minValues != refMin || maxValues != refMax)
+                    ERR(implName << " peaks differ from scalar for " << chansNumber << " channels!");
+
+                // Summation order differs, so the sums are compared with a relative tolerance
+                for (u_int ch = 0; ch < chansNumber; ++ch)
+                    if (fabs(sumSquares[ch] - refSquares[ch]) > 1e-4 * refSquares[ch])
+                        ERR(implName << " sums of squares differ from scalar for " << chansNumber << " channels!");
+            }
+        }
+    }
+
+    return 0;
+}
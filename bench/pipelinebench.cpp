@@ -0,0 +1,461 @@
+// Benchmark of the capture -> [resample ->] gain -> write pipeline of AudioRecorder.
+// A synthetic source replaces the ALSA device, so the pipeline runs faster than
+// real time and without sound hardware. Both threads do the same work per chunk
+// as AudioRecorder::captureProcess() and AudioRecorder::writeLoop().
+#include "debug.h"
+#include "flacencoder.h"
+#include "gainlimiter.h"
+#include "outputfile.h"
+#include "resampler.h"
+#include "ringbuffer.h"
+#include "sampleformat.h"
+#include "samplekernels.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const char *helpStr = "Usage: pipelinebench [options]\n"
+                          "Options:\n"
+                          "  -c, --chans_number  Number of channels, default 32\n"
+                          "  -f, --format        Sample format: S16_LE, S24_3LE, S32_LE or FLOAT_LE, default S16_LE\n"
+                          "  -g, --gain          Gain factor, dB, default 10.5\n"
+                          "  -h, --help          Show help\n"
+                          "  -m, --chans_map     Captured channels to record, e.g. 0,2,5\n"
+                          "  -o, --out_file      Output file, default /dev/null (pipeline cost without storage).\n"
+                          "                      \".flac\" adds the FLAC encoder to the pipeline\n"
+                          "  -p, --period_size   Period size, frames, default 4096\n"
+                          "  -r, --ring_time     Ring buffer length, ms, default 4000\n"
+                          "  -R, --resample      Output rate, the source is converted from --sample_rate to it\n"
+                          "  -s, --sample_rate   Sample rate of the source, default 192000\n"
+                          "  -t, --time_to_rec   Amount of audio to process, seconds, default 60";
+
+    // Number of periods in the synthetic audio buffer
+    const size_t SOURCE_PERIODS = 16;
+
+    uint64_t nowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // Keeps the per-chunk durations of one stage. Memory is allocated before the run
+    class StageStats
+    {
+    public:
+        StageStats(const char *name, size_t capacity) : name(name) { samples.reserve(capacity); }
+
+        void add(uint64_t ns)
+        {
+            if (samples.size() < samples.capacity())
+                samples.push_back(ns);
+        }
+
+        void report()
+        {
+            if (samples.empty())
+                return;
+
+            std::sort(samples.begin(), samples.end());
+
+            PRINT(name << "\tchunks " << samples.size()
+                  << "\tp50 " << percentile(0.5) << " us"
+                  << "\tp99 " << percentile(0.99) << " us"
+                  << "\tp99.9 " << percentile(0.999) << " us"
+                  << "\tmax " << samples.back() / 1000.0 << " us");
+        }
+
+    private:
+        const char *name;
+        std::vector<uint64_t> samples;
+
+        double percentile(double p) { return samples[(size_t)(p * (samples.size() - 1))] / 1000.0; }
+    };
+
+    // Interleaved test signal: a sine of its own frequency and a little noise in every channel.
+    // The signal is generated once into a buffer of several periods, which is then read
+    // period by period in a loop like the mmap area of a capture device.
+    class SyntheticSource
+    {
+    public:
+        SyntheticSource(SampleFormat::Id format, u_int chansNumber, u_int sampleRate, size_t periodFrames) :
+            periodSize(periodFrames * SampleFormat::getBytes(format) * chansNumber),
+            periodIndex(0)
+        {
+            size_t framesNumber = periodFrames * SOURCE_PERIODS;
+            size_t sampleSize = SampleFormat::getBytes(format);
+
+            buf.resize(periodSize * SOURCE_PERIODS);
+            srand(1);
+
+            char *p = &buf[0];
+            for (size_t i = 0; i < framesNumber; ++i)
+            {
+                for (u_int ch = 0; ch < chansNumber; ++ch, p += sampleSize)
+                {
+                    float value = 0.5 * sin(2 * M_PI * (100.0 + 50.0 * ch) * i / sampleRate) +
+                                  0.01 * (rand() % 2001 - 1000) / 1000.0;
+
+                    switch (format)
+                    {
+                        case SampleFormat::S16_LE:
+                            SampleS16::store(p, value * 32767);
+                            break;
+
+                        case SampleFormat::S24_3LE:
+                            SampleS24::store(p, value * 8388607);
+                            break;
+
+                        case SampleFormat::S32_LE:
+                            SampleS32::store(p, value * 2147483647.0);
+                            break;
+
+                        case SampleFormat::FLOAT_LE:
+                            SampleFloat::store(p, value);
+                            break;
+                    }
+                }
+            }
+        }
+
+        // Next period of captured data
+        const char *read()
+        {
+            const char *data = &buf[periodIndex * periodSize];
+            periodIndex = (periodIndex + 1) % SOURCE_PERIODS;
+
+            return data;
+        }
+
+    private:
+        std::vector<char> buf;
+        size_t periodSize;
+        size_t periodIndex;
+    };
+
+    bool stringToIntList(const char *str, std::vector<u_int> &values)
+    {
+        std::stringstream ss(str);
+        std::string item;
+
+        values.clear();
+        while (std::getline(ss, item, ','))
+        {
+            std::stringstream itemSs(item);
+            u_int value;
+            if (item.find('-') != std::string::npos || !(itemSs >> value))
+                return false;
+
+            values.push_back(value);
+        }
+
+        return !values.empty();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option cmdLineOptions[] =
+    {
+        {"chans_number", required_argument, NULL, 'c'},
+        {"format",       required_argument, NULL, 'f'},
+        {"gain",         required_argument, NULL, 'g'},
+        {"help",         no_argument,       NULL, 'h'},
+        {"chans_map",    required_argument, NULL, 'm'},
+        {"out_file",     required_argument, NULL, 'o'},
+        {"period_size",  required_argument, NULL, 'p'},
+        {"ring_time",    required_argument, NULL, 'r'},
+        {"resample",     required_argument, NULL, 'R'},
+        {"sample_rate",  required_argument, NULL, 's'},
+        {"time_to_rec",  required_argument, NULL, 't'},
+        {0, 0, 0, 0}
+    };
+
+    u_int chansNumber = 32;
+    SampleFormat::Id sampleFormat = SampleFormat::S16_LE;
+    float gainFactor = 10.5;
+    std::vector<u_int> chansMap;
+    std::string outFileStr = "/dev/null";
+    u_int periodSize = 4096;
+    u_int ringTimeMs = 4000;
+    u_int outRate = 0;
+    u_int sampleRate = 192000;
+    u_int timeToRec = 60;
+
+    for (int res = 0; res != -1; )
+    {
+        int optionIndex = 0;
+        res = getopt_long(argc, argv, "c:f:g:hm:o:p:r:R:s:t:", cmdLineOptions, &optionIndex);
+
+        if (res == 'c')
+            chansNumber = atoi(optarg);
+        else if (res == 'f')
+        {
+            if (!SampleFormat::fromName(optarg, sampleFormat))
+            {
+                ERR("Wrong sample format! Must be S16_LE, S24_3LE, S32_LE or FLOAT_LE!");
+                return 1;
+            }
+        }
+        else if (res == 'g')
+            gainFactor = atof(optarg);
+        else if (res == 'h' || res == '?')
+        {
+            PRINT(helpStr);
+            return res == 'h' ? 0 : 1;
+        }
+        else if (res == 'm')
+        {
+            if (!stringToIntList(optarg, chansMap))
+            {
+                ERR("Wrong channels map! Must be a comma-separated list of channel indexes, e.g. 0,2,5");
+                return 1;
+            }
+        }
+        else if (res == 'o')
+            outFileStr = optarg;
+        else if (res == 'p')
+            periodSize = atoi(optarg);
+        else if (res == 'r')
+            ringTimeMs = atoi(optarg);
+        else if (res == 'R')
+            outRate = atoi(optarg);
+        else if (res == 's')
+            sampleRate = atoi(optarg);
+        else if (res == 't')
+            timeToRec = atoi(optarg);
+    }
+
+    if (chansNumber < 1 || periodSize < 1 || sampleRate < 1 || timeToRec < 1)
+    {
+        ERR("Channels number, period size, sample rate and time must be positive!");
+        return 1;
+    }
+
+    for (size_t i = 0; i < chansMap.size(); ++i)
+    {
+        if (chansMap[i] >= chansNumber)
+        {
+            ERR("Wrong channels map! Channel indexes must be less than the channels number");
+            return 1;
+        }
+    }
+
+    u_int sampleSize = SampleFormat::getBytes(sampleFormat);
+    u_int frameSize = sampleSize * chansNumber;
+    u_int outChansNumber = chansMap.empty() ? chansNumber : chansMap.size();
+    u_int outFrameSize = sampleSize * outChansNumber;
+    uint64_t framesCountMax = (uint64_t)sampleRate * timeToRec;
+    size_t chunksMax = framesCountMax / periodSize + 1;
+
+    if (outRate == 0)
+        outRate = sampleRate;
+
+    Resampler resampler;
+    if (!resampler.setup(sampleFormat, outChansNumber, sampleRate, outRate, periodSize))
+    {
+        ERR(resampler.getLastErrorInfo());
+        return 1;
+    }
+
+    std::vector<char> resampleBuf(resampler.getMaxOutFrames(periodSize) * outFrameSize);
+    uint64_t outFramesMax = resampler.isActive() ? resampler.getMaxOutFrames(framesCountMax) : framesCountMax;
+
+    PRINT("Pipeline: " << chansNumber << " -> " << outChansNumber << " channels, " << SampleFormat::getName(sampleFormat)
+          << ", " << sampleRate << " Hz" << (resampler.isActive() ? " -> " + std::to_string(outRate) + " Hz" : "") << ", period " << periodSize << " frames, " << timeToRec << " s of audio, kernels "
+          << SampleKernels::getImplName(SampleKernels::getImpl()) << ", output \"" << outFileStr << '\"');
+
+    SyntheticSource source(sampleFormat, chansNumber, sampleRate, periodSize);
+    std::vector<char> selectBuf(chansMap.empty() ? 0 : (size_t)periodSize * outFrameSize);
+
+    RingBuffer ringBuf;
+    if (!ringBuf.create((size_t)sampleRate * ringTimeMs / 1000 * outFrameSize))
+    {
+        ERR("Can not allocate memory space for ring buffer!");
+        return 1;
+    }
+
+    bool flacOut = outFileStr.size() > 5 && outFileStr.compare(outFileStr.size() - 5, 5, ".flac") == 0;
+    if (flacOut && !FlacEncoder::isFormatSupported(sampleFormat, outChansNumber))
+    {
+        ERR("FLAC output supports S16_LE and S24_3LE with 1 to 8 channels!");
+        return 1;
+    }
+
+    OutputFile outFile;
+    if (!outFile.open(outFileStr, flacOut ? 0 : outFramesMax * outFrameSize, resampleBuf.size()))
+        return 1;
+
+    FlacEncoder flacEncoder;
+    std::vector<char> flacBuf(flacOut ? resampleBuf.size() : 0);
+    if (flacOut && !flacEncoder.open(&outFile, sampleFormat, outChansNumber, outRate))
+        return 1;
+
+    GainLimiter gainLimiter;
+    gainLimiter.setStreamFormat(outRate, outChansNumber, sampleFormat);
+    gainLimiter.setGain(gainFactor);
+
+    StageStats captureStats("capture", chunksMax);
+    StageStats resampleStats("resample", chunksMax);
+    StageStats gainStats("gain", chunksMax);
+    StageStats writeStats("write", chunksMax);
+    std::atomic<bool> captureDone(false);
+    uint64_t ringFullWaits = 0;
+
+    uint64_t start = nowNs();
+
+    // Writer thread, the same steps as AudioRecorder::writeLoop() without segments.
+    // It yields instead of sleeping when the ring is empty, so the wall time is the pipeline cost.
+    std::thread writerThread([&]()
+    {
+        for (;;)
+        {
+            bool done = captureDone;
+
+            const char *data;
+            size_t size = ringBuf.peek(&data);
+            if (size == 0)
+            {
+                if (done)
+                    break;
+
+                std::this_thread::yield();
+                continue;
+            }
+
+            size_t frames = size / outFrameSize;
+            if (frames > periodSize)
+                frames = periodSize;
+
+            size = frames * outFrameSize;
+
+            // The rest of the pipeline runs at the output rate
+            const char *outData = data;
+            size_t outFrames = frames;
+            if (resampler.isActive())
+            {
+                uint64_t t0 = nowNs();
+                outFrames = resampler.process(data, frames, &resampleBuf[0]);
+                outData = &resampleBuf[0];
+                resampleStats.add(nowNs() - t0);
+            }
+
+            // Encoding is a part of the write stage
+            if (flacOut)
+            {
+                uint64_t t0 = nowNs();
+                gainLimiter.process(outData, &flacBuf[0], outFrames);
+
+                uint64_t t1 = nowNs();
+                flacEncoder.write(&flacBuf[0], outFrames);
+
+                uint64_t t2 = nowNs();
+                ringBuf.pop(size);
+
+                gainStats.add(t1 - t0);
+                writeStats.add(t2 - t1);
+                continue;
+            }
+
+            uint64_t t0 = nowNs();
+            size_t outSize = outFrames * outFrameSize;
+            char *fileData = outFile.reserve(outSize);
+            if (fileData == NULL)
+            {
+                ringBuf.pop(size);
+                continue;
+            }
+
+            uint64_t t1 = nowNs();
+            gainLimiter.process(outData, fileData, outFrames);
+
+            uint64_t t2 = nowNs();
+            outFile.commit(outSize);
+
+            uint64_t t3 = nowNs();
+            ringBuf.pop(size);
+
+            gainStats.add(t2 - t1);
+            writeStats.add(t1 - t0 + t3 - t2);
+        }
+    });
+
+    // Capture thread, the same steps as AudioRecorder::captureProcess(). The source is
+    // faster than real time, so a full ring buffer is waited for instead of dropping the chunk.
+    for (uint64_t framesCount = 0; framesCount < framesCountMax; )
+    {
+        size_t frames = periodSize;
+        if (frames > framesCountMax - framesCount)
+            frames = framesCountMax - framesCount;
+
+        uint64_t t0 = nowNs();
+        const char *data = source.read();
+        if (!chansMap.empty())
+        {
+            SampleKernels::selectChannels(data, &selectBuf[0], frames, chansNumber, &chansMap[0], outChansNumber, sampleSize);
+            data = &selectBuf[0];
+        }
+
+        // Time spent waiting for the writer is not a part of the capture stage
+        uint64_t waitNs = 0;
+        while (!ringBuf.push(data, frames * outFrameSize))
+        {
+            uint64_t w0 = nowNs();
+            ++ringFullWaits;
+            std::this_thread::yield();
+            waitNs += nowNs() - w0;
+        }
+
+        captureStats.add(nowNs() - t0 - waitNs);
+        framesCount += frames;
+    }
+
+    captureDone = true;
+    writerThread.join();
+
+    if (flacOut)
+        flacEncoder.close();
+
+    double seconds = (nowNs() - start) / 1e9;
+    bool mapped = outFile.isMapped();
+    uint64_t fileSize = outFile.getSize();
+    outFile.close();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double inBytes = (double)framesCountMax * frameSize;
+    double outBytes = (double)framesCountMax * outRate / sampleRate * outFrameSize;
+
+    PRINT("Processed " << timeToRec << " s of audio in " << seconds << " s, " << timeToRec / seconds << "x real time");
+    PRINT("Throughput: in " << inBytes / seconds / 1e6 << " MB/s, out " << outBytes / seconds / 1e6 << " MB/s, "
+          << framesCountMax * chansNumber / seconds / 1e6 << " Msamples/s");
+    captureStats.report();
+    resampleStats.report();
+    gainStats.report();
+    writeStats.report();
+    PRINT("Ring buffer: size " << ringBuf.getSize() << " bytes, high-water mark " << ringBuf.getHighWaterMark()
+          << " bytes, full waits " << ringFullWaits);
+    if (resampler.isActive())
+        PRINT("Resampler: " << resampler.getTapsNumber() << " taps per phase, " << resampler.getWorkersNumber() << " thread(s)");
+    if (flacOut)
+        PRINT("FLAC: " << flacEncoder.getWorkersNumber() << " workers, compression ratio " << outBytes / fileSize);
+
+    PRINT("Output: " << (mapped ? "memory-mapped file" : "write()") << ", peak RSS " << usage.ru_maxrss / 1024.0 << " MB");
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "realtime.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+// Replacements of the global allocation functions which count the calls per thread.
+// This file is linked into programs only, so the library does not take over the
+// allocator of the programs which embed it
+namespace
+{
+    // Plain TLS, it is used before any constructor of the thread runs
+    thread_local uint64_t threadAllocations = 0;
+
+    void *countedAlloc(size_t size)
+    {
+        ++threadAllocations;
+
+        return malloc(size ? size : 1);
+    }
+}
+
+uint64_t realtimeThreadAllocations()
+{
+    return threadAllocations;
+}
+
+void *operator new(size_t size)
+{
+    void *p = countedAlloc(size);
+    if (p == NULL)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+// The memory is freed where it was allocated
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
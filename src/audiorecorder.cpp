@@ -1,295 +1,548 @@
 #include "audiorecorder.h"
 #include "debug.h"
+#include "capturescheduler.h"
+#include "rangeextractor.h"
+#include "realtime.h"
 
 #include <math.h>
 #include <getopt.h>
+#include <limits.h>
+#include <poll.h>
 
 #include <sstream>
 
 // Static public members
 const char *AudioRecorder::helpStr = "Usage: audiorecording [options]\n"
+                                     "       audiorecording [common options] -C <device 1> [options] -C <device 2> [options] ...\n"
+                                     "       audiorecording -x <start>:<duration> -o <out_file> <recording>\n"
+                                     "Several devices are recorded at once if more than one -C is given,\n"
+                                     "options after each -C apply to that device only.\n"
                                      "Options:\n"
+                                     "  -A, --analysis      Write spectral features of the recorded channels (mixed down) to\n"
+                                     "                      <out_file>.spec: peak, RMS, spectral centroid and 24 band energies\n"
+                                     "                      per frame. The value is the FFT size, a power of 2 from 64 to 65536,\n"
+                                     "                      frames overlap by half\n"
+                                     "  -a, --trigger       Triggered recording: \"level\" starts writing when a peak exceeds the threshold,\n"
+                                     "                      \"vad\" when the RMS exceeds it and the signal looks like voice (few zero\n"
+                                     "                      crossings). Every triggered event is written to its own output file\n"
+                                     "  -B, --blocks        Write a block index to <out_file>.bix with blocks of N frames: the byte\n"
+                                     "                      offset and wall clock of every block, and the per-channel peaks and RMS\n"
+                                     "                      in levels of 4, 16, 64... blocks for waveform overviews. Enables --index\n"
+                                     "  -b, --preroll       Audio before the trigger to include in the event, ms, default 500\n"
                                      "  -C, --capture_dev   Capture device Id, for examle \"plughw:0,0\"\n"
+                                     "  -F, --fifo          Real-time capture: the capture thread runs with SCHED_FIFO at this\n"
+                                     "                      priority (1-99), its stack and buffers are locked with mlock() before\n"
+                                     "                      streaming starts, heap allocations of the capture loop are reported.\n"
+                                     "                      Needs CAP_SYS_NICE and CAP_IPC_LOCK or the rtprio and memlock limits\n"
+                                     "  -f, --format        Sample format: S16_LE, S24_3LE, S32_LE or FLOAT_LE, default S16_LE\n"
                                      "  -c, --chans_number  Number of channels, default 1\n"
-                                     "  -g, --gain          Gain factor. Must be from -40.0 to 40.0, default 10.5\n"
+                                     "  -d, --threshold     Trigger threshold, dBFS, default -40\n"
+                                     "  -D, --daemon        Run as a daemon controlled over this Unix socket. Devices are kept open\n"
+                                     "                      and prepared, recordings start and stop on commands, one per line:\n"
+                                     "                      start|stop|rotate|status [device], list [refresh], quit\n"
+                                     "  -e, --agc           Automatic gain control to this RMS level, dBFS (-60.0 to 0.0), instead of\n"
+                                     "                      the fixed gain. --gain and --chans_gain are the largest gain then, a\n"
+                                     "                      look-ahead limiter keeps the peaks below the full scale\n"
+                                     "  -E, --agc_times     AGC attack, release and look-ahead times, ms, default 20,500,5. The output\n"
+                                     "                      is delayed by the look-ahead (at most 100ms), it is flushed at the end\n"
+                                     "  -g, --gain          Gain factor, dB. Must be from -40.0 to 40.0, default 10.5.\n"
+                                     "                      Applied while capturing, peaks are limited to avoid clipping\n"
+                                     "  -G, --chans_gain    Per-channel gain factors, dB, e.g. 6,0,-3. Channels without a value use --gain\n"
                                      "  -h, --help          Show help\n"
-                                     "  -l, --list          Show list of all audio devices\n"
-                                     "  -o, --out_file      Output file for audio data name and path\n"
+                                     "  -H, --hangover      The event is finished after this time below the threshold, ms, default 2000\n"
+                                     "  -i, --stats         Print a JSON stats line every N seconds: xruns, lost frames, buffer fill\n"
+                                     "                      levels, chunk sizes, write latency and capture-to-disk delay\n"
+                                     "  -I, --index         Write a timing index to <out_file>.idx every N ms: the device timestamp\n"
+                                     "                      (CLOCK_MONOTONIC_RAW) and the wall clock of the recorded frame position,\n"
+                                     "                      with the drift of the device clock. recindex finds frames by wall clock\n"
+                                     "  -k, --capture_cpus  Pin the capture thread to these CPUs, e.g. 2 or 2,3\n"
+                                     "  -K, --writer_cpus   Pin the writer thread to these CPUs\n"
+                                     "  -l, --list          Show list of all audio devices with their channels, rates and formats\n"
+                                     "  -m, --chans_map     Captured channels to record, in output order, e.g. 0,2,5.\n"
+                                     "                      Other channels are dropped before the data is buffered\n"
+                                     "  -M, --monitor       Live monitoring of the captured channels before gain, may be repeated:\n"
+                                     "                      alsa:<device> plays them, rtp:<host>:<port> sends an RTP stream\n"
+                                     "                      (L16/L24, payload type 96), pipe:<path> or - writes raw data.\n"
+                                     "                      A slow monitor loses data, the recording never waits for it\n"
+                                     "  -o, --out_file      Output file for audio data name and path, \"-\" for standard output.\n"
+                                     "                      \".wav\" is written as WAV (RF64 above 4GB), \".flac\" is compressed losslessly\n"
+                                     "                      (S16_LE or S24_3LE, up to 8 channels), anything else is raw data\n"
+                                     "  -x, --extract       Copy a range of a recording with a block index to --out_file and exit:\n"
+                                     "                      <start>:<duration>, seconds, the start may be a wall clock time after '@',\n"
+                                     "                      e.g. -x 90:30 -o part.wav rec.wav, -x \"@2024-05-01 12:00:00:10\" ...\n"
+                                     "  -z, --direct_io     Raw output at 0dB gain is written straight from the capture buffer to\n"
+                                     "                      disk, with O_DIRECT and io_uring where available. Segments are cut\n"
+                                     "                      at 4KiB-aligned boundaries\n"
+                                     "  -p, --period_size   Period size, frames. Capture thread wakes up once per period, default 1/4 of 500ms\n"
+                                     "  -P, --periods       Number of periods in the audio buffer, default 4\n"
+                                     "  -r, --ring_time     Length of the buffer between capture and writer threads, ms, default 4000\n"
+                                     "  -R, --resample      Capture at the device's native rate and convert to --sample_rate\n"
+                                     "                      (polyphase filter), instead of the ALSA plugin resampling\n"
                                      "  -s, --sample_rate   Sample rate\n"
-                                     "  -t, --time_to_rec   Recording duration, seconds";
+                                     "  -S, --segment_size  Start a new output file every N megabytes\n"
+                                     "  -T, --segment_time  Start a new output file every N seconds. With segments the output\n"
+                                     "                      file name may contain strftime() patterns, e.g. out_%Y%m%d_%H%M%S.wav\n"
+                                     "  -t, --time_to_rec   Recording duration, seconds\n"
+                                     "  -U, --stats_socket  Publish the stats lines on this Unix socket instead of stderr,\n"
+                                     "                      every second unless --stats is given. A common path of several\n"
+                                     "                      devices gets the device index appended: <path>.0, <path>.1...\n"
+                                     "  -u, --continuous    Record until SIGINT/SIGTERM, --time_to_rec is not needed\n"
+                                     "  -W, --header_time   Update the WAV header sizes every N seconds, so a recording\n"
+                                     "                      interrupted by a crash stays readable, 0 disables, default 5\n"
+                                     "  -v, --verbose       Print statistics after recording";
+
+
+std::atomic<bool> AudioRecorder::stopRequested(false);
+std::map<std::string, AudioRecorder *> AudioRecorder::statsSockets;
 
 
 // Public members
 AudioRecorder::AudioRecorder() :
-    audioBuf(NULL),
+    agc(false),
+    agcTargetDb(-20.0),
+    analysisFftSize(0),
+    blockIndexFrames(0),
     chansNumber(1),
+    continuous(false),
+    directIo(false),
+    fifoPriority(0),
     gainFactor(10.5),
-    inited(false),
+    hangoverMs(2000),
+    headerInterval(5),
+    indexIntervalMs(0),
+    periodSize(0),
+    periodsNumber(4),
+    preRollMs(500),
+    resample(false),
+    ringTimeMs(4000),
+    sampleFormat(SampleFormat::S16_LE),
     sampleRate(0),
+    captureRate(0),
+    segmentSizeMb(0),
+    segmentTime(0),
+    statsInterval(0),
     timeToRec(0),
+    trigger(false),
+    triggerMode(TriggerGate::MODE_LEVEL),
+    triggerThresholdDb(-40.0),
+    outChansNumber(1),
+    outFrameSize(0),
+    writerFailed(false),
+    stopFlag(false),
+    rotateFlag(false),
+    spectrumAnalyzer(NULL),
+    inited(false),
     verbose(false)
 {
 //    HERE();
-    wavHeaderInit();
 }
 
 AudioRecorder::AudioRecorder(int argc, char **argv) :
-    audioBuf(NULL),
+    agc(false),
+    agcTargetDb(-20.0),
+    analysisFftSize(0),
+    blockIndexFrames(0),
     chansNumber(1),
+    continuous(false),
+    directIo(false),
+    fifoPriority(0),
     gainFactor(10.5),
-    inited(false),
+    hangoverMs(2000),
+    headerInterval(5),
+    indexIntervalMs(0),
+    periodSize(0),
+    periodsNumber(4),
+    preRollMs(500),
+    resample(false),
+    ringTimeMs(4000),
+    sampleFormat(SampleFormat::S16_LE),
     sampleRate(0),
+    captureRate(0),
+    segmentSizeMb(0),
+    segmentTime(0),
+    statsInterval(0),
     timeToRec(0),
+    trigger(false),
+    triggerMode(TriggerGate::MODE_LEVEL),
+    triggerThresholdDb(-40.0),
+    outChansNumber(1),
+    outFrameSize(0),
+    writerFailed(false),
+    stopFlag(false),
+    rotateFlag(false),
+    spectrumAnalyzer(NULL),
+    inited(false),
     verbose(false)
 {
 //    HERE();
-    wavHeaderInit();
     init(argc, argv);
 }
 
 AudioRecorder::~AudioRecorder()
 {
 //    HERE();
-    if (!audioBuf)
-        return;
+    // The engine closes the device
 
-//    HERE();
-    snd_pcm_close(audioBuf);
+    releaseStatsSocket();
 }
 
 
 // Public methods
 std::vector<std::string> AudioRecorder::getAudioDevsList()
 {
-    std::vector<std::string> hwInfo;
+    DeviceEnumerator enumerator;
 
-    for (int cardIndex = -1;;)
-    {
-        // Get next sound card index
-        if (snd_card_next(&cardIndex) != 0 || cardIndex == -1)
-            break;
+    return DeviceEnumerator::toText(enumerator.getDevices());
+}
 
-        std::string soundCardInfo;
-        if (getSoundCardInfo(soundCardInfo, cardIndex))
-            hwInfo.push_back(soundCardInfo);
-    }
+bool AudioRecorder::record()
+{
+    CaptureScheduler scheduler;
+    scheduler.addRecorder(this);
 
-    return hwInfo;
+    return scheduler.run();
 }
 
-bool AudioRecorder::record()
+bool AudioRecorder::recordStart()
 {
-    if (!audioBuf)
+    if (!engine.isOpened())
         return false;
 
-    // Open temporary file for write data
-    std::string tmpFileName;
+    // Create ring buffer between capture and writer threads.
+    // Its size is a multiple of the frame size, so frames never wrap around the buffer end.
+    // A daemon keeps the buffer between recordings, so a new one starts without allocation.
+    size_t ringSize = (size_t)captureRate * ringTimeMs / 1000 * outFrameSize;
+
+    // Direct writes need aligned data, the buffer end must not break it
+    directBlockSize = outFrameSize;
+    while (directBlockSize % DirectWriter::ALIGNMENT)
+        directBlockSize += outFrameSize;
+
+    if (directIo)
+        ringSize = (ringSize + directBlockSize - 1) / directBlockSize * directBlockSize;
+    if (ringBuf.getSize() == ringSize)
+        ringBuf.reset();
+    else if (!ringBuf.create(ringSize))
     {
-        std::stringstream ss;
-        ss << time(0);
+        errStr = "Can not allocate memory space for ring buffer!";
+        ERR(errStr);
 
-        tmpFileName = "tmp" + ss.str() + ".bin";
+        return false;
     }
-//    DBG("tmpFileName = \"" << tmpFileName << '\"');
 
-    FILE *fdTmp = fopen(tmpFileName.c_str(), "w+");
-    if (fdTmp == NULL)
+    // Captured frames are converted to the output rate by the writer thread
+    if (resample && !resampler.setup(sampleFormat, outChansNumber, captureRate, sampleRate, bufSize / frameSize))
     {
-        errStr = "Can not open tmp output file!";
+        errStr = resampler.getLastErrorInfo();
         ERR(errStr);
+        ringBuf.destroy();
         return false;
     }
 
-    // Start streaming
-    if (snd_pcm_start(audioBuf) != 0)
+    resampleBuf.resize(resampler.isActive() ? resampler.getMaxOutFrames(bufSize / frameSize) * outFrameSize : 0);
+
+    if (verbose && resampler.isActive())
+        INFO(captureDevIdStr << ": resampling " << captureRate << " -> " << sampleRate << "Hz, "
+             << resampler.getTapsNumber() << " taps per phase, " << resampler.getWorkersNumber() << " thread(s)");
+
+    // Open the first output segment
+    wavOut = isWavFile();
+    flacOut = isFlacFile();
+    wavHeader.setFormat(sampleFormat, outChansNumber, sampleRate);
+    segmentIndex = 0;
+    segmentBaseStr.clear();
+    framesCountMax = timeToRec ? (uint64_t)captureRate * timeToRec : UINT64_MAX;
+
+    // Segment length, output frames. Without rotation the whole recording is one segment
+    segmentFramesMax = timeToRec ? (uint64_t)sampleRate * timeToRec : UINT64_MAX;
+    if (segmentTime && (uint64_t)segmentTime * sampleRate < segmentFramesMax)
+        segmentFramesMax = (uint64_t)segmentTime * sampleRate;
+
+    if (segmentSizeMb && (uint64_t)segmentSizeMb * 1024 * 1024 / outFrameSize < segmentFramesMax)
+        segmentFramesMax = (uint64_t)segmentSizeMb * 1024 * 1024 / outFrameSize;
+
+    // Direct segments end at aligned boundaries, so only the last one has an unaligned end
+    if (directIo && segmentFramesMax < framesCountMax)
     {
-        errStr = "snd_pcm_start(audioBuf) error!";
-        ERR(errStr);
-        fclose(fdTmp);
+        uint64_t blockFrames = directBlockSize / outFrameSize;
+        segmentFramesMax = segmentFramesMax > blockFrames ? segmentFramesMax / blockFrames * blockFrames : blockFrames;
+    }
+
+    if (directIo)
+        directWriter.start(ringBuf.getData(), ringBuf.getSize());
 
+    // Triggered events open their segments when they start
+    if (trigger)
+        triggerGate.setup(triggerMode, triggerThresholdDb, preRollMs, hangoverMs, sampleRate, outChansNumber, sampleFormat);
+    else if (!segmentOpen())
+    {
+        directWriter.stop();
+        ringBuf.destroy();
         return false;
     }
 
-    int res = 0;
-    // Read audio samples from audio buffer and write to temporary file
-    for (u_int framesCount = 0, framesCountMax = sampleRate * timeToRec; framesCount < framesCountMax; )
+    // Gain is applied while writing
+    gainLimiter.setStreamFormat(sampleRate, outChansNumber, sampleFormat);
+    gainLimiter.setGain(gainFactor);
+    gainLimiter.setChannelGains(chansGain);
+
+    // Missing AGC times are the default ones
+    if (agc)
     {
-        if (res < 0)
-        {
-            if (abufHandleError(res) != 0)
-            {
-                errStr = "abufHandleError(res)";
-                ERR(errStr);
-                fclose(fdTmp);
+        static const float defaultTimesMs[] = {20.0, 500.0, 5.0};
+        float timesMs[3];
+        for (size_t i = 0; i < 3; ++i)
+            timesMs[i] = i < agcTimesMs.size() ? agcTimesMs[i] : defaultTimesMs[i];
 
-                return false;
-            }
+        autoGain.setup(sampleFormat, outChansNumber, sampleRate, agcTargetDb, timesMs[0], timesMs[1], timesMs[2]);
+        autoGain.setMaxGain(gainFactor, chansGain);
+    }
 
-            // Start streaming if necessary
-            if (snd_pcm_state(audioBuf) != SND_PCM_STATE_RUNNING)
-                if (snd_pcm_start(audioBuf) != 0)
-                {
-                    errStr = "Streaming restart error!";
-                    ERR(errStr);
-                    fclose(fdTmp);
+    // Gain is applied into a staging buffer before FLAC encoding
+    flacBuf.resize(flacOut ? bufSize / frameSize * outFrameSize : 0);
 
-                    return false;
-                }
+    // Scratch buffer for the channels selection, so the capture loop does not allocate
+    selectBuf.resize(chansMap.empty() ? 0 : bufSize / frameSize * outFrameSize);
+
+    // Stats are published by the writer thread
+    if (!statsSocketStr.empty())
+    {
+        if (statsInterval == 0)
+            statsInterval = 1;
+
+        if (!statsServer.open(statsSocketStr))
+        {
+            errStr = statsServer.getLastErrorInfo();
+            if (outFile.isOpened())
+                outFile.close();
+            directWriter.close();
+            directWriter.stop();
+            ringBuf.destroy();
+            return false;
         }
+    }
 
-        // Refresh audio buffer state
-        if ((res = snd_pcm_avail_update(audioBuf)) < 0)
-            continue;
+    // Features are written next to the output, one file per recording
+    if (spectrumAnalyzer)
+        spectrumAnalyzer->setFileName(expandFileName() + ".spec");
 
-        // Get audio data region available for reading
-        const snd_pcm_channel_area_t *areas;
-        snd_pcm_uframes_t offset;
-        snd_pcm_uframes_t frames = bufSize / frameSize;
-        if ((res = snd_pcm_mmap_begin(audioBuf, &areas, &offset, &frames)) != 0)
-            continue;
+    if (indexIntervalMs && !timingIndex.open(expandFileName() + ".idx", captureRate, sampleRate, indexIntervalMs, engine.getStampClock()))
+    {
+        errStr = timingIndex.getLastErrorInfo();
+        statsServer.close();
+        if (outFile.isOpened())
+            outFile.close();
+        directWriter.close();
+        directWriter.stop();
+        ringBuf.destroy();
+        return false;
+    }
 
-        if (frames == 0)
+    // Monitor blocks are one period long, the pool holds about a second of audio
+    if (monitorTap.isActive())
+    {
+        size_t blocksNumber = captureRate / periodSize + periodsNumber;
+        if (!monitorTap.start(sampleFormat, outChansNumber, captureRate, periodSize, blocksNumber))
         {
-            // Buffer is empty. Wait 100ms until some new data is available
-            int period_ms = 100;
-            usleep(period_ms * 1000);
-
-            continue;
+            errStr = monitorTap.getLastErrorInfo();
+            timingIndex.close();
+            statsServer.close();
+            if (outFile.isOpened())
+                outFile.close();
+            directWriter.close();
+            directWriter.stop();
+            ringBuf.destroy();
+            return false;
         }
+    }
 
-        framesCount += frames;
+    stats.reset(CaptureStats::nowNs());
+    statsNextNs = CaptureStats::nowNs() + statsInterval * 1000000000ULL;
+
+    overrunsAbsorbed = 0;
+    ringOverflows = 0;
+    captureDone = false;
+    captureFailed = false;
+    writerFailed = false;
+    overrun = false;
+    framesCount = 0;
+    recordedFrames = 0;
+    writtenFrames = 0;
+    chunkWallNs = 0;
+
+    // Capture thread only moves data from the audio buffer to the ring buffer,
+    // all file I/O and processing is done by the writer thread.
+    writerThread = std::thread(&AudioRecorder::writeLoop, this);
+
+    // The buffers the capture loop writes are allocated now, their pages are locked and faulted in
+    // before streaming starts. The output is not locked, it may be gigabytes of mapped file.
+    // The capture thread itself is set up by the scheduler, it starts streaming when it is ready
+    std::string rtErrStr;
+    if (fifoPriority && (!Realtime::lockMemory(ringBuf.getData(), ringBuf.getSize(), rtErrStr) ||
+                         !Realtime::lockMemory(selectBuf.data(), selectBuf.size(), rtErrStr)))
+        ERR(captureDevIdStr << ": " << rtErrStr);
 
-        // Write to file
-        fwrite((char *)areas[0].addr + offset * areas[0].step / 8, sizeof(char), frames * frameSize, fdTmp);
+    return true;
+}
 
-        // Mark the data chunk as read
-        res = snd_pcm_mmap_commit(audioBuf, offset, frames);
-        if (res >= 0 && (snd_pcm_uframes_t)res != frames)
-            // Not all frames are processed
-            res = -EPIPE;
+bool AudioRecorder::captureStart()
+{
+    // The recording is stopped by recordFinish()
+    if (!engine.start())
+    {
+        errStr = engine.getLastErrorInfo();
+        return false;
     }
 
-    fclose(fdTmp);
-    // End of write to tmp file, now we need add .wav-header and apply gain
+    return true;
+}
 
-    // Create buffer for proccesing data
-    #define     SIZE_OF_BUF     2048
-    short *dataBuf = (short *)malloc(SIZE_OF_BUF * sizeof(short));
-    if (dataBuf == NULL)
-    {
-        errStr = "Can not allocate memory space for data buffer!";
-        ERR(errStr);
+AudioRecorder::CaptureState AudioRecorder::captureProcess()
+{
+    // Everything available is taken first, then the capture stops
+    if (stopRequested || stopFlag)
+        engine.requestStop();
 
-        return false;
+    // Nobody drains the ring buffer any more
+    if (writerFailed)
+    {
+        ERR(captureDevIdStr << ": writing failed, the recording is stopped: " << errStr);
+        captureStop(false);
+        return CAPTURE_ERROR;
     }
 
-    // Open tmp file for read
-    fdTmp = fopen(tmpFileName.c_str(), "r");
-    if (fdTmp == NULL)
+    // Read audio samples from audio buffer and pass them to the writer thread
+    switch (engine.process([this](const CaptureBlock &block) { captureChunk(block); }, framesCountMax))
     {
-        free((void *)dataBuf);
-        errStr = "Can not open tmp file for read!";
-        ERR(errStr);
+        case CaptureEngine::STATUS_WAIT:
+            return CAPTURE_WAIT;
 
-        return false;
+        case CaptureEngine::STATUS_DONE:
+            captureStop(true);
+            return CAPTURE_DONE;
+
+        default:
+            errStr = engine.getLastErrorInfo();
+            captureStop(false);
+            return CAPTURE_ERROR;
     }
+}
 
-    // Determine the gain
-    float coeff = powf(10.0, gainFactor / 20.0);
-    {
-        // Determine the maximum permissible gain
-        float coeffMax = 1.0;
-        {
-            short minValue = 0x7FFF, maxValue = 0x8000;
-            for (size_t itemsCount = SIZE_OF_BUF; itemsCount == SIZE_OF_BUF; )
-            {
-                itemsCount = fread(dataBuf, sizeof(short), SIZE_OF_BUF, fdTmp);
+u_int AudioRecorder::getPollFds(struct pollfd *fds)
+{
+    return engine.getPollFds(fds);
+}
 
-                for (int i = 0; i < itemsCount; ++i)
-                {
-                    if (minValue > dataBuf[i])
-                        minValue = dataBuf[i];
+int AudioRecorder::getWaitTimeoutMs()
+{
+    return engine.getWaitTimeoutMs();
+}
 
-                    if (maxValue < dataBuf[i])
-                        maxValue = dataBuf[i];
-                }
-            }
+void AudioRecorder::handlePollEvents(struct pollfd *fds)
+{
+    engine.handlePollEvents(fds);
+}
 
-            if (minValue != 0x8000 && maxValue != 0x7FFF)
-            {
-                minValue = minValue < 0 ? -minValue : minValue;
-                maxValue = maxValue > minValue ? maxValue : minValue;
+bool AudioRecorder::recordFinish()
+{
+    // Capture is interrupted
+    if (!captureDone)
+        captureStop(false);
 
-                coeffMax = 32768.0 / maxValue;
-            }
+    if (writerThread.joinable())
+        writerThread.join();
 
-            if (coeff > coeffMax)
-            {
-                coeff = coeffMax;
-                ERR("It is not possible to apply a gain of " << gainFactor << "dB, " << 20 * log10(coeffMax) << "dB will be applied!");
-            }
-        }
-    }
-//    DBG("coeff = " << coeff);
+    monitorTap.stop();
 
-    // Open file for save data
-    FILE *fdOut = fopen(outFileStr.c_str(), "w+");
-    if (fdOut == NULL)
+    for (u_int ch = 0; ch < (agc ? 0 : gainLimiter.getChansNumber()); ++ch)
     {
-        fclose(fdTmp);
-        free((void *)dataBuf);
-        errStr = "Can not open output file: \"" + outFileStr + "\"!";
-        ERR(errStr);
-
-        return false;
+        if (gainLimiter.isLimited(ch))
+            ERR(captureDevIdStr << ": channel " << ch << ": it is not possible to apply a gain of "
+                << (ch < chansGain.size() ? chansGain[ch] : gainFactor) << "dB, "
+                << gainLimiter.getMinAppliedGain(ch) << "dB was applied on peaks!");
     }
 
-    // Determine if a wav-header is needed
-    {
-        size_t pos1, pos2,
-               strSize = outFileStr.size();;
+    if (ringOverflows)
+        ERR(captureDevIdStr << ": ring buffer overflow, " << ringOverflows << " data chunks are lost!");
 
-        pos1 = outFileStr.rfind(".wav");
-        pos2 = outFileStr.rfind(".WAV");
+    if (stats.getXruns())
+        ERR(captureDevIdStr << ": " << stats.getXruns() << " overrun(s), about " << stats.getXrunFramesLost() << " frames are lost!");
 
-        if (strSize - pos1 == 4 || strSize - pos2 == 4)
-        {
-            // Prepare wav-header
-            fseek(fdTmp, 0, SEEK_END);
-            int tmpFileSize = ftell(fdTmp);
+    // Final stats line
+    if (statsInterval)
+        reportStats();
 
-            wavHeader.fields.chunkSize = tmpFileSize + sizeof(wavHeader.data) - sizeof(wavHeader.fields.chunkId) - sizeof(wavHeader.fields.chunkSize);
-            wavHeader.fields.numChannels = chansNumber;
-            wavHeader.fields.sampleRate = sampleRate;
-            wavHeader.fields.byteRate = chansNumber * sampleRate * 2;
-            wavHeader.fields.blockAlign = chansNumber * 2;
-            wavHeader.fields.subchunk2Size = tmpFileSize;
+    statsServer.close();
 
-            fwrite(wavHeader.data, sizeof(char), sizeof(wavHeader.data), fdOut);
-        }
-    }
+    if (!timingIndex.close())
+        ERR(captureDevIdStr << ": " << timingIndex.getLastErrorInfo());
 
-    fseek(fdTmp, 0, SEEK_SET);
+    bool mapped = outFile.isMapped();
+    bool res = !(directIo ? directWriter.isOpened() : outFile.isOpened()) || segmentClose();
 
-    for (size_t itemsCount = SIZE_OF_BUF; itemsCount == SIZE_OF_BUF; )
+    if (verbose)
     {
-        itemsCount = fread(dataBuf, sizeof(short), SIZE_OF_BUF, fdTmp);
+        INFO(captureDevIdStr << ": ring buffer: size " << ringBuf.getSize() << " bytes, high-water mark " << ringBuf.getHighWaterMark()
+             << " bytes, overruns absorbed " << overrunsAbsorbed << ", overflows " << ringOverflows);
+        std::string outMode = mapped ? "memory-mapped file" : "write()";
+        if (directIo)
+            outMode = directWriter.isUring() ? "direct I/O, io_uring" : "direct I/O, pwrite()";
+
+        INFO(captureDevIdStr << ": output: " << (flacOut ? "FLAC, " : "") << outMode
+             << ", " << framesCount << " frames in " << segmentIndex << " segment(s)");
+
+        if (trigger)
+            INFO(captureDevIdStr << ": " << triggerGate.getEventsNumber() << " triggered event(s)");
+
+        if (spectrumAnalyzer)
+            INFO(captureDevIdStr << ": " << spectrumAnalyzer->getFramesNumber() << " analysis frames");
+
+        if (indexIntervalMs && timingIndex.getDrift().isValid())
+            INFO(captureDevIdStr << ": device clock " << timingIndex.getDrift().getRate() << "Hz, drift "
+                 << timingIndex.getDrift().getDriftPpm() << "ppm, " << timingIndex.getDrift().getRestarts() << " timestamp gap(s)");
+
+        for (size_t i = 0; i < monitorTap.getSinksNumber(); ++i)
+            INFO(captureDevIdStr << ": monitor " << monitorTap.getSink(i)->getName() << ": "
+                 << monitorTap.getSink(i)->getDroppedFrames() + monitorTap.getDroppedFrames() << " frames dropped");
+
+        // Direct output never reads the samples
+        for (u_int ch = 0; ch < (directIo || agc ? 0 : gainLimiter.getChansNumber()); ++ch)
+            INFO(captureDevIdStr << ": channel " << ch << (chansMap.empty() ? "" : " (captured " + std::to_string(chansMap[ch]) + ")")
+                 << ": input peak " << gainLimiter.getPeakDb(ch) << "dBFS, RMS " << gainLimiter.getRmsDb(ch) << "dBFS");
+
+        for (u_int ch = 0; ch < (agc ? autoGain.getChansNumber() : 0); ++ch)
+            INFO(captureDevIdStr << ": channel " << ch << (chansMap.empty() ? "" : " (captured " + std::to_string(chansMap[ch]) + ")")
+                 << ": input peak " << autoGain.getPeakDb(ch) << "dBFS, RMS " << autoGain.getRmsDb(ch) << "dBFS, AGC gain "
+                 << autoGain.getMinAppliedGain(ch) << ".." << autoGain.getMaxAppliedGain(ch) << "dB, limited by up to "
+                 << autoGain.getMaxReduction(ch) << "dB");
+    }
 
-        for (int i = 0; i < itemsCount; ++i)
-            dataBuf[i] *= coeff;
+    if (fifoPriority)
+    {
+        Realtime::unlockMemory(ringBuf.getData(), ringBuf.getSize());
+        Realtime::unlockMemory(selectBuf.data(), selectBuf.size());
+    }
 
-        fwrite(dataBuf, sizeof(short), itemsCount, fdOut);
+    if (daemonSocketStr.empty())
+    {
+        directWriter.stop();
+        ringBuf.destroy();
     }
-    #undef      SIZE_OF_BUF
 
-    fclose(fdTmp);
-    fclose(fdOut);
+    // Ready for the next recording
+    stopFlag = false;
+    rotateFlag = false;
 
-    free((void *)dataBuf);
+    if (!res)
+        return false;
 
-    remove(tmpFileName.c_str());
+    // The writer may fail after the capture is finished, e.g. on the end of the data delayed by the AGC
+    return !captureFailed && !writerFailed;
+}
 
-    return true;
+std::string AudioRecorder::getStatsJson()
+{
+    return stats.toJson(captureDevIdStr, CaptureStats::nowNs(), ringBuf.getFilledSpace(), ringBuf.getHighWaterMark());
 }
 
 bool AudioRecorder::setParameters(const std::string &capDev, u_int chN, float gain, const std::string &outF, u_int sr, u_int time)
@@ -311,252 +564,135 @@ bool AudioRecorder::setParameters(const std::string &capDev, u_int chN, float ga
 
 
 // Private methods
-int AudioRecorder::abufHandleError(int res)
-{
-    switch (res)
-    {
-        case -ESTRPIPE:
-            // Sound device is temporarily unavailable.  Wait until it's online.
-            while ((res = snd_pcm_resume(audioBuf)) == -EAGAIN)
-            {
-                int period_ms = 100;
-                usleep(period_ms * 1000);
-            }
-
-            if (res == 0)
-                return 0;
-            // fallthrough
-
-        case -EPIPE:
-            // Overrun or underrun occurred.  Reset buffer.
-            if ((res = snd_pcm_prepare(audioBuf)) < 0)
-                return res;
-
-            return 0;
-    }
-
-    return res;
-}
-
-bool AudioRecorder::createAudioBuf()
+void AudioRecorder::captureChunk(const CaptureBlock &block)
 {
-    // Attach audio buffer to device
-    if (captureDevIdStr.empty())
-    {
-//        HERE();
-        captureDevIdStr = "plughw:0,0";   // Use default device
-    }
+    framesCount += block.frames;
 
-    if (snd_pcm_open(&audioBuf, captureDevIdStr.c_str(), SND_PCM_STREAM_CAPTURE, 0) != 0)
+    // Pass data to the writer thread. If the ring buffer is full, the chunk is lost,
+    // but the audio buffer is still released so the capture itself never stalls.
+    const char *data = block.data;
+    if (!chansMap.empty())
     {
-        errStr = "Audio buffer opening error (snd_pcm_open())!";
-        ERR(errStr);
-        return false;
+        // Drop unused channels before they are buffered
+        SampleKernels::selectChannels(data, &selectBuf[0], block.frames, chansNumber, &chansMap[0], outChansNumber,
+                                      SampleFormat::getBytes(sampleFormat));
+        data = &selectBuf[0];
     }
 
-    // Get device property-set
-    snd_pcm_hw_params_t *params;
-    snd_pcm_hw_params_alloca(&params);
-    if (snd_pcm_hw_params_any(audioBuf, params) < 0)
+    if (ringBuf.push(data, block.frames * outFrameSize))
     {
-        errStr = "Error of getting device property set!";
-        ERR(errStr);
-        snd_pcm_close(audioBuf);
-        audioBuf = NULL;
-        return false;
-    }
+        stats.addPush(block.frames * outFrameSize, block.captureNs);
 
-    // Specify how we want to access audio data
-    if (snd_pcm_hw_params_set_access(audioBuf, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) != 0)
-    {
-        errStr = "Audio data access specifing error!";
-        ERR(errStr);
-        snd_pcm_close(audioBuf);
-        audioBuf = NULL;
-        return false;
-    }
+        if (indexIntervalMs)
+            timingIndex.addBlock(block.framePos, recordedFrames, block.frames, block.stampPos, block.stampNs);
 
-    // Set sample format
-    if (snd_pcm_hw_params_set_format(audioBuf, params, SND_PCM_FORMAT_S16_LE) != 0)
-    {
-        errStr = "Sample format setting error!";
-        ERR(errStr);
-        snd_pcm_close(audioBuf);
-        audioBuf = NULL;
-        return false;
+        recordedFrames += block.frames;
     }
-
-    // Set channels number
-    if (snd_pcm_hw_params_set_channels_near(audioBuf, params, &chansNumber) != 0)
+    else
     {
-        errStr = "Channels number setting error!";
-        ERR(errStr);
-        snd_pcm_close(audioBuf);
-        audioBuf = NULL;
-        return false;
+        ++ringOverflows;
+        stats.addRingLoss(block.frames);
     }
 
-    // Set sample rate
-    if (snd_pcm_hw_params_set_rate_near(audioBuf, params, &sampleRate, 0) != 0)
-    {
-        errStr = "Sample rate setting error!";
-        ERR(errStr);
-        snd_pcm_close(audioBuf);
-        audioBuf = NULL;
-        return false;
-    }
+    // The same data is shared by the monitors, independently of the writer
+    if (monitorTap.isActive())
+        monitorTap.push(data, block.frames);
 
-    // Set audio buffer length
-    u_int buffer_length_usec = 500 * 1000;
-    if (snd_pcm_hw_params_set_buffer_time_near(audioBuf, params, &buffer_length_usec, NULL) != 0)
+    // The writer is behind by more than the audio buffer length.
+    // Without the ring buffer it would be an overrun.
+    if (ringBuf.getFilledSpace() / outFrameSize > bufSize / frameSize)
     {
-        errStr = "Audio buffer length setting error!";
-        ERR(errStr);
-        snd_pcm_close(audioBuf);
-        audioBuf = NULL;
-        return false;
-    }
+        if (!overrun)
+            ++overrunsAbsorbed;
 
-    // Apply configuration
-    if (snd_pcm_hw_params(audioBuf, params) != 0)
-    {
-        errStr = "Audio buffer apply configuration error!";
-        ERR(errStr);
-        snd_pcm_close(audioBuf);
-        audioBuf = NULL;
-        return false;
+        overrun = true;
     }
-
-    frameSize = (16 / 8) * chansNumber;
-    bufSize = sampleRate * frameSize * buffer_length_usec / 1000000;
-
-    return true;
+    else
+        overrun = false;
 }
 
-bool AudioRecorder::getDeviceName(std::string &deviceName, snd_ctl_t *sndCardHandler, int deviceIndex, bool playback)
+void AudioRecorder::captureStop(bool success)
 {
-    deviceName.clear();
-
-    if (!sndCardHandler || deviceIndex < 0)
-    {
-        errStr = "Wrong handler or device index!";
-        ERR(errStr << "\nsndCardHandler = " << sndCardHandler << ", deviceIndex = " << deviceIndex);
-        return false;
-    }
-
-    snd_pcm_info_t *pcmInfo;
-    snd_pcm_info_alloca(&pcmInfo);
-
-    snd_pcm_info_set_device(pcmInfo, deviceIndex);
-    snd_pcm_info_set_stream(pcmInfo, playback ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE);
-
-    if (snd_ctl_pcm_info(sndCardHandler, pcmInfo) != 0)
-    {
-        errStr = "snd_ctl_pcm_info(sndCardHandler, pcmInfo) error!";
-//        ERR(errStr);
-        return false;
-    }
-
-    deviceName = snd_pcm_info_get_name(pcmInfo);
+    // The device is prepared again, so the next recording only has to start it
+    engine.stop();
 
-//    DBG("Card = " << snd_pcm_info_get_card(pcmInfo));
-//    DBG("Device = " << snd_pcm_info_get_device(pcmInfo));
-//    DBG("Id = \"" << snd_pcm_info_get_id(pcmInfo) << '\"');
+    // The end of the recording is indexed too
+    if (indexIntervalMs)
+        timingIndex.finish(recordedFrames);
 
-    return true;
+    captureFailed = !success;
+    captureDone = true;
 }
 
-bool AudioRecorder::getSoundCardInfo(std::string &soundCardInfo, int soundCardIndex)
+bool AudioRecorder::createAudioBuf()
 {
-    if (soundCardIndex < 0)
+    // Attach audio buffer to device
+    if (captureDevIdStr.empty())
     {
-        return false;
+//        HERE();
+        captureDevIdStr = "plughw:0,0";   // Use default device
     }
 
-    soundCardInfo.clear();
-
-    // Open sound card handler
-    snd_ctl_t *sndCardHandler = NULL;
+    // With own resampling the plugin one is disabled, so the nearest rate is a native one
+    CaptureConfig config;
+    config.device = captureDevIdStr;
+    config.format = sampleFormat;
+    config.chansNumber = chansNumber;
+    config.sampleRate = sampleRate;
+    config.periodSize = periodSize;
+    config.periodsNumber = periodsNumber;
+    config.nativeRate = resample;
+    config.verbose = verbose;
+
+    if (!engine.open(config))
     {
-        std::stringstream ss;
-        ss << "hw:" << soundCardIndex;
-
-        if (snd_ctl_open(&sndCardHandler, ss.str().c_str(), 0) != 0)
-            return false;
-
-        ss.str("");
-        ss << "Card " << soundCardIndex << ": ";
-
-        soundCardInfo += ss.str();
+        errStr = engine.getLastErrorInfo();
+        return false;
     }
 
-    // Get sound card info
-    {
-        snd_ctl_card_info_t *sndCardInfo = NULL;
-
-        if (snd_ctl_card_info_malloc(&sndCardInfo) != 0)
-        {
-            errStr = "Allocation memory for sound card info error!";
-            ERR(errStr);
-            snd_ctl_close(sndCardHandler);
-            return false;
-        }
-
-        if (snd_ctl_card_info(sndCardHandler, sndCardInfo) != 0)
-        {
-            errStr = "Getting sound card info error!";
-            ERR(errStr);
-            snd_ctl_close(sndCardHandler);
-            return false;
-        }
-
-        soundCardInfo += snd_ctl_card_info_get_name(sndCardInfo);
-        soundCardInfo += ":\n";
+    // Negotiated parameters
+    chansNumber = engine.getConfig().chansNumber;
+    captureRate = engine.getConfig().sampleRate;
+    periodSize = engine.getConfig().periodSize;
+    periodsNumber = engine.getConfig().periodsNumber;
 
-//        DBG("Card = " << snd_ctl_card_info_get_card(sndCardInfo));
-//        DBG("Id = \"" << snd_ctl_card_info_get_id(sndCardInfo) << '\"');
-//        DBG("Driver = \"" << snd_ctl_card_info_get_card(sndCardInfo) << '\"');
-//        DBG("Name = \"" << snd_ctl_card_info_get_id(sndCardInfo) << '\"');
-//        DBG("Long name = \"" << snd_ctl_card_info_get_longname(sndCardInfo) << '\"');
-//        DBG("Mixer name = \"" << snd_ctl_card_info_get_mixername(sndCardInfo) << '\"');
-//        DBG("Components = \"" << snd_ctl_card_info_get_components(sndCardInfo) << '\"');
+    frameSize = engine.getFrameSize();
+    bufSize = engine.getBufferFrames() * frameSize;
 
-        snd_ctl_card_info_free(sndCardInfo);
-    }
+    // Recorded channels
+    outChansNumber = chansMap.empty() ? chansNumber : chansMap.size();
+    outFrameSize = SampleFormat::getBytes(sampleFormat) * outChansNumber;
 
-    // Get devices info
-    int devIndex = -1;
-    for (;;)
-    {
-        // Get next device
-        if (snd_ctl_pcm_next_device(sndCardHandler, &devIndex) != 0 || devIndex == -1)
-            break;
+    // Overruns are counted by the engine
+    engine.setStats(&stats);
 
-        std::string deviceId;
-        {
-            std::stringstream ss;
-            ss << "plughw:" << soundCardIndex << ',' << devIndex;
-            deviceId = ss.str();
-        }
+    // Without own resampling the output has the captured rate
+    if (captureRate != sampleRate)
+        INFO(captureDevIdStr << ": the device rate is " << captureRate << "Hz, "
+             << (resample ? "converted to " : "recorded instead of ") << sampleRate << "Hz");
 
-        // Get device info
-        std::string deviceName;
-        if (!getDeviceName(deviceName, sndCardHandler, devIndex, true))
-            continue;
+    if (!resample)
+        sampleRate = captureRate;
 
-        soundCardInfo += '\t' + deviceName + ": " + deviceId + " - playback\n";
+    if (verbose)
+        INFO("Period size " << periodSize << " frames, buffer size " << engine.getBufferFrames() << " frames");
 
-        if (!getDeviceName(deviceName, sndCardHandler, devIndex, false))
-            continue;
+    return true;
+}
 
-        soundCardInfo += '\t' + deviceName + ": " + deviceId + " - capture\n";
-    }
+std::string AudioRecorder::expandFileName()
+{
+    if (outFileStr.find('%') == std::string::npos)
+        return outFileStr;
 
-    snd_ctl_close(sndCardHandler);
+    time_t now = time(0);
+    struct tm tmNow;
+    char buf[PATH_MAX];
 
-    soundCardInfo.erase(soundCardInfo.size() - 1, 1);
+    if (localtime_r(&now, &tmNow) && strftime(buf, sizeof(buf), outFileStr.c_str(), &tmNow) > 0)
+        return buf;
 
-    return true;
+    return outFileStr;
 }
 
 std::string AudioRecorder::getLastErrorInfo()
@@ -568,20 +704,52 @@ void AudioRecorder::init(int argc, char **argv)
 {
     static const struct option cmdLineOptions[] =
     {
+        {"analysis",     required_argument, NULL, 'A'},
+        {"trigger",      required_argument, NULL, 'a'},
+        {"blocks",       required_argument, NULL, 'B'},
+        {"preroll",      required_argument, NULL, 'b'},
         {"capture_dev",  required_argument, NULL, 'C'},
         {"chans_number", optional_argument, NULL, 'c'},
+        {"threshold",    required_argument, NULL, 'd'},
+        {"daemon",       required_argument, NULL, 'D'},
+        {"agc",          required_argument, NULL, 'e'},
+        {"agc_times",    required_argument, NULL, 'E'},
+        {"fifo",         required_argument, NULL, 'F'},
+        {"format",       required_argument, NULL, 'f'},
         {"gain",         required_argument, NULL, 'g'},
+        {"chans_gain",   required_argument, NULL, 'G'},
         {"help",         no_argument,       NULL, 'h'},
+        {"hangover",     required_argument, NULL, 'H'},
+        {"stats",        required_argument, NULL, 'i'},
+        {"index",        required_argument, NULL, 'I'},
+        {"capture_cpus", required_argument, NULL, 'k'},
+        {"writer_cpus",  required_argument, NULL, 'K'},
         {"list",         no_argument,       NULL, 'l'},
+        {"chans_map",    required_argument, NULL, 'm'},
+        {"monitor",      required_argument, NULL, 'M'},
         {"out_file",     required_argument, NULL, 'o'},
+        {"period_size",  required_argument, NULL, 'p'},
+        {"periods",      required_argument, NULL, 'P'},
+        {"ring_time",    required_argument, NULL, 'r'},
+        {"resample",     no_argument,       NULL, 'R'},
         {"sample_rate",  required_argument, NULL, 's'},
+        {"segment_size", required_argument, NULL, 'S'},
+        {"segment_time", required_argument, NULL, 'T'},
         {"time_to_rec",  required_argument, NULL, 't'},
+        {"extract",      required_argument, NULL, 'x'},
+        {"direct_io",    no_argument,       NULL, 'z'},
+        {"stats_socket", required_argument, NULL, 'U'},
+        {"header_time",  required_argument, NULL, 'W'},
+        {"continuous",   no_argument,       NULL, 'u'},
         {"verbose",      no_argument,       NULL, 'v'},
         {0, 0, 0, 0}
     };
 
     inited = false;
 
+    // Full reinitialization of getopt, the command line may be parsed several times
+    optind = 0;
+
     if (argc < 2)
     {
         PRINT(helpStr);
@@ -591,12 +759,38 @@ void AudioRecorder::init(int argc, char **argv)
     for (int res = 0; res != -1; )
     {
         int optionIndex = 0;
-        res = getopt_long(argc, argv, "C:c:g:hlo:s:t:v", cmdLineOptions, &optionIndex);
+        res = getopt_long(argc, argv, "A:a:B:b:C:c:d:D:e:E:F:f:g:G:hH:i:I:k:K:lm:M:o:p:P:r:Rs:S:T:t:U:uvW:x:z", cmdLineOptions, &optionIndex);
 
         if (res == '?')
             continue;
 
-        if (res == 'C')
+        if (res == 'A')
+        {
+            stringToInt(optarg, &analysisFftSize);
+//            DBG("analysisFftSize = " << analysisFftSize);
+        }
+        else if (res == 'a')
+        {
+            if (!TriggerGate::modeFromName(optarg, triggerMode))
+            {
+                errStr = "Wrong trigger mode! Must be level or vad!";
+                ERR(errStr);
+                return;
+            }
+
+            trigger = true;
+        }
+        else if (res == 'B')
+        {
+            stringToInt(optarg, &blockIndexFrames);
+//            DBG("blockIndexFrames = " << blockIndexFrames);
+        }
+        else if (res == 'b')
+        {
+            stringToInt(optarg, &preRollMs);
+//            DBG("preRollMs = " << preRollMs);
+        }
+        else if (res == 'C')
         {
             captureDevIdStr = optarg;
 //            DBG("captureDevIdStr = \"" << captureDevIdStr << '\"');
@@ -608,68 +802,527 @@ void AudioRecorder::init(int argc, char **argv)
                 stringToInt(optarg, &chansNumber);
 //                DBG("chansNumber = " << chansNumber);
 
-                if (chansNumber < 1 || chansNumber > 2)
+                if (chansNumber < 1)
                 {
-                    errStr = "Missing value for channels number. Must be 1 or 2!";
+                    errStr = "Missing value for channels number. Must be at least 1!";
                     ERR(errStr);
                     return;
                 }
             }
         }
-        else if (res == 'g')
+        else if (res == 'd')
         {
             std::stringstream ss;
             ss << optarg;
-            ss >> gainFactor;
-
-//            DBG("gainValue = " << gainValue);
+            ss >> triggerThresholdDb;
 
-            if (gainFactor < -40.0 || gainFactor > 40.0)
+            if (triggerThresholdDb < -120.0 || triggerThresholdDb > 0.0)
             {
-                errStr = "Missing value for gain factor! Must be >= -40.0 and <= 40.0!";
+                errStr = "Wrong trigger threshold! Must be >= -120.0 and <= 0.0 dBFS!";
                 ERR(errStr);
                 return;
             }
         }
-        else if (res == 'h')
+        else if (res == 'D')
         {
-            PRINT(helpStr);
-            return;
+            daemonSocketStr = optarg;
+//            DBG("daemonSocketStr = \"" << daemonSocketStr << '\"');
         }
-        else if (res == 'l')
+        else if (res == 'e')
         {
-            std::vector<std::string> hwInfo = getAudioDevsList();
-            for (std::vector<std::string>::iterator it = hwInfo.begin(); it != hwInfo.end(); ++it)
-                PRINT(*it);
+            std::stringstream ss;
+            ss << optarg;
+            ss >> agcTargetDb;
 
-            return;
+            if (agcTargetDb < -60.0 || agcTargetDb > 0.0)
+            {
+                errStr = "Wrong AGC target level! Must be >= -60.0 and <= 0.0 dBFS!";
+                ERR(errStr);
+                return;
+            }
+
+            agc = true;
         }
-        else if (res == 'o')
+        else if (res == 'E')
         {
-            outFileStr = optarg;
-//            DBG("outFileStr = \"" << outFileStr << '\"');
+            if (!stringToFloatList(optarg, agcTimesMs) || agcTimesMs.size() > 3)
+            {
+                errStr = "Wrong AGC times! Must be <attack>,<release>[,<look-ahead>] in ms, e.g. 20,500,5";
+                ERR(errStr);
+                return;
+            }
+
+            for (size_t i = 0; i < agcTimesMs.size(); ++i)
+            {
+                if (agcTimesMs[i] < 0.0 || agcTimesMs[i] > (i == 2 ? 100.0 : 60000.0))
+                {
+                    errStr = "Wrong AGC times! Must be <attack>,<release>[,<look-ahead>] in ms, e.g. 20,500,5";
+                    ERR(errStr);
+                    return;
+                }
+            }
         }
-        else if (res == 's')
+        else if (res == 'F')
         {
-            stringToInt(optarg, &sampleRate);
-//            DBG("sampleRate = " << sampleRate);
+            stringToInt(optarg, &fifoPriority);
+//            DBG("fifoPriority = " << fifoPriority);
         }
-        else if (res == 't')
+        else if (res == 'f')
         {
-            stringToInt(optarg, &timeToRec);
+            if (!SampleFormat::fromName(optarg, sampleFormat))
+            {
+                errStr = "Wrong sample format! Must be S16_LE, S24_3LE, S32_LE or FLOAT_LE!";
+                ERR(errStr);
+                return;
+            }
+        }
+        else if (res == 'g')
+        {
+            std::stringstream ss;
+            ss << optarg;
+            ss >> gainFactor;
+
+//            DBG("gainValue = " << gainValue);
+
+            if (gainFactor < -40.0 || gainFactor > 40.0)
+            {
+                errStr = "Missing value for gain factor! Must be >= -40.0 and <= 40.0!";
+                ERR(errStr);
+                return;
+            }
+        }
+        else if (res == 'G')
+        {
+            if (!stringToFloatList(optarg, chansGain))
+            {
+                errStr = "Wrong per-channel gain factors! Must be a comma-separated list of values from -40.0 to 40.0!";
+                ERR(errStr);
+                return;
+            }
+
+            for (size_t i = 0; i < chansGain.size(); ++i)
+            {
+                if (chansGain[i] < -40.0 || chansGain[i] > 40.0)
+                {
+                    errStr = "Wrong per-channel gain factors! Must be a comma-separated list of values from -40.0 to 40.0!";
+                    ERR(errStr);
+                    return;
+                }
+            }
+        }
+        else if (res == 'h')
+        {
+            PRINT(helpStr);
+            return;
+        }
+        else if (res == 'H')
+        {
+            stringToInt(optarg, &hangoverMs);
+//            DBG("hangoverMs = " << hangoverMs);
+        }
+        else if (res == 'i')
+        {
+            stringToInt(optarg, &statsInterval);
+//            DBG("statsInterval = " << statsInterval);
+        }
+        else if (res == 'I')
+        {
+            stringToInt(optarg, &indexIntervalMs);
+//            DBG("indexIntervalMs = " << indexIntervalMs);
+        }
+        else if (res == 'k' || res == 'K')
+        {
+            if (!stringToIntList(optarg, res == 'k' ? captureCpus : writerCpus))
+            {
+                errStr = "Wrong CPU list! Must be a comma-separated list of CPU indexes, e.g. 2,3";
+                ERR(errStr);
+                return;
+            }
+        }
+        else if (res == 'l')
+        {
+            std::vector<std::string> hwInfo = getAudioDevsList();
+            for (std::vector<std::string>::iterator it = hwInfo.begin(); it != hwInfo.end(); ++it)
+                PRINT(*it);
+
+            return;
+        }
+        else if (res == 'm')
+        {
+            if (!stringToIntList(optarg, chansMap))
+            {
+                errStr = "Wrong channels map! Must be a comma-separated list of channel indexes, e.g. 0,2,5";
+                ERR(errStr);
+                return;
+            }
+        }
+        else if (res == 'M')
+        {
+            if (!monitorTap.addSink(optarg))
+            {
+                errStr = monitorTap.getLastErrorInfo();
+                ERR(errStr);
+                return;
+            }
+        }
+        else if (res == 'o')
+        {
+            outFileStr = optarg;
+//            DBG("outFileStr = \"" << outFileStr << '\"');
+        }
+        else if (res == 'p')
+        {
+            u_int value = 0;
+            stringToInt(optarg, &value);
+            periodSize = value;
+//            DBG("periodSize = " << periodSize);
+        }
+        else if (res == 'P')
+        {
+            stringToInt(optarg, &periodsNumber);
+//            DBG("periodsNumber = " << periodsNumber);
+        }
+        else if (res == 'r')
+        {
+            stringToInt(optarg, &ringTimeMs);
+//            DBG("ringTimeMs = " << ringTimeMs);
+        }
+        else if (res == 'R')
+            resample = true;
+        else if (res == 's')
+        {
+            stringToInt(optarg, &sampleRate);
+//            DBG("sampleRate = " << sampleRate);
+        }
+        else if (res == 'S')
+        {
+            stringToInt(optarg, &segmentSizeMb);
+//            DBG("segmentSizeMb = " << segmentSizeMb);
+        }
+        else if (res == 'T')
+        {
+            stringToInt(optarg, &segmentTime);
+//            DBG("segmentTime = " << segmentTime);
+        }
+        else if (res == 't')
+        {
+            stringToInt(optarg, &timeToRec);
 //            DBG("timeToRec = " << timeToRec);
         }
+        else if (res == 'U')
+        {
+            statsSocketStr = optarg;
+//            DBG("statsSocketStr = \"" << statsSocketStr << '\"');
+        }
+        else if (res == 'u')
+            continuous = true;
         else if (res == 'v')
             verbose = true;
+        else if (res == 'W')
+        {
+            stringToInt(optarg, &headerInterval);
+//            DBG("headerInterval = " << headerInterval);
+        }
+        else if (res == 'x')
+            extractRangeStr = optarg;
+        else if (res == 'z')
+            directIo = true;
+    }
+
+    // A range of an existing recording is copied, nothing is captured
+    if (!extractRangeStr.empty())
+    {
+        if (optind + 1 != argc || outFileStr.empty())
+        {
+            errStr = "Recording to extract from not specified!\nUse: -x,--extract <start>:<duration> -o,--out_file <path> <recording>";
+            ERR(errStr);
+            return;
+        }
+
+        RangeExtractor extractor;
+        if (!extractor.extract(argv[optind], outFileStr, extractRangeStr))
+        {
+            errStr = extractor.getLastErrorInfo();
+            ERR(errStr);
+        }
+        else if (verbose)
+            INFO(argv[optind] << ": " << extractor.getFramesNumber() << " frames extracted to \"" << outFileStr << '\"');
+
+        return;
     }
 
     if (!validateParams())
         return;
 
+    // Wall clock of the blocks is taken from the timing index
+    if (blockIndexFrames && !indexIntervalMs)
+        indexIntervalMs = 1000;
+
+    // The analyzer takes the captured data from the tap, like the monitors
+    if (analysisFftSize)
+    {
+        spectrumAnalyzer = new SpectrumAnalyzer(analysisFftSize);
+        monitorTap.addSink(spectrumAnalyzer);
+    }
+
 //    HERE();
     inited = createAudioBuf();
 }
 
+bool AudioRecorder::isFlacFile()
+{
+    size_t pos1, pos2,
+           strSize = outFileStr.size();
+
+    pos1 = outFileStr.rfind(".flac");
+    pos2 = outFileStr.rfind(".FLAC");
+
+    return (pos1 != std::string::npos && strSize - pos1 == 5) || (pos2 != std::string::npos && strSize - pos2 == 5);
+}
+
+bool AudioRecorder::isWavFile()
+{
+    size_t pos1, pos2,
+           strSize = outFileStr.size();
+
+    pos1 = outFileStr.rfind(".wav");
+    pos2 = outFileStr.rfind(".WAV");
+
+    return (pos1 != std::string::npos && strSize - pos1 == 4) || (pos2 != std::string::npos && strSize - pos2 == 4);
+}
+
+size_t AudioRecorder::processGain(const char *in, char *out, size_t framesNumber)
+{
+    if (agc)
+        return autoGain.process(in, out, framesNumber);
+
+    gainLimiter.process(in, out, framesNumber);
+
+    return framesNumber;
+}
+
+void AudioRecorder::releaseStatsSocket()
+{
+    for (std::map<std::string, AudioRecorder *>::iterator it = statsSockets.begin(); it != statsSockets.end(); )
+    {
+        if (it->second == this)
+            it = statsSockets.erase(it);
+        else
+            ++it;
+    }
+}
+
+void AudioRecorder::reportStats()
+{
+    uint64_t now = CaptureStats::nowNs();
+    std::string line = getStatsJson();
+
+    if (statsServer.isOpened())
+        statsServer.publish(line);
+    else
+        INFO(line);
+
+    statsNextNs = now + statsInterval * 1000000000ULL;
+}
+
+bool AudioRecorder::segmentClose()
+{
+    if (directIo)
+    {
+        if (!directWriter.close())
+        {
+            errStr = directWriter.getLastErrorInfo();
+            return false;
+        }
+
+        ++segmentIndex;
+        return true;
+    }
+
+    // Patch wav-header with the actual data size. It is not possible for pipes,
+    // there it is only tried if the size differs from the expected one
+    if (wavOut && (outFile.isSeekable() || dataSize != segmentExpectedSize - wavHeader.getSize()))
+    {
+        wavHeader.setDataSize(dataSize);
+        if (!outFile.writeAt(0, wavHeader.getData(), wavHeader.getSize()))
+            ERR("Can not update wav-header: " << outFile.getLastErrorInfo());
+    }
+
+    // Encode the rest of data and patch STREAMINFO. Without them the segment is incomplete,
+    // it is still closed
+    bool res = true;
+    if (flacOut && !flacEncoder.close())
+    {
+        errStr = flacEncoder.getLastErrorInfo();
+        ERR(captureDevIdStr << ": " << errStr);
+        res = false;
+    }
+
+    if (!blockIndex.close())
+        ERR(captureDevIdStr << ": " << blockIndex.getLastErrorInfo());
+
+    if (!outFile.close())
+    {
+        errStr = outFile.getLastErrorInfo();
+        return false;
+    }
+
+    ++segmentIndex;
+
+    return res;
+}
+
+std::string AudioRecorder::segmentFileName()
+{
+    // Expand date and time of the segment start
+    std::string fileName = expandFileName();
+
+    // The name is the same as the previous one, add the segment index before the extension
+    if (segmentIndex > 0 && fileName == segmentBaseStr)
+    {
+        std::stringstream ss;
+        ss << '_' << segmentIndex;
+
+        size_t pos = fileName.rfind('.');
+        if (pos == std::string::npos || fileName.find('/', pos) != std::string::npos)
+            pos = fileName.size();
+
+        return fileName.insert(pos, ss.str());
+    }
+
+    segmentBaseStr = fileName;
+
+    return fileName;
+}
+
+bool AudioRecorder::segmentOpen()
+{
+    segmentFileStr = segmentFileName();
+    segmentFrames = 0;
+    dataSize = 0;
+
+    if (directIo)
+    {
+        if (!directWriter.open(segmentFileStr))
+        {
+            errStr = directWriter.getLastErrorInfo();
+            return false;
+        }
+
+        if (verbose && segmentIndex > 0)
+            INFO(captureDevIdStr << ": new segment \"" << segmentFileStr << '\"');
+
+        return true;
+    }
+
+    // If the segment length is known, the file is preallocated and mapped if possible.
+    // The size of compressed data and of triggered events is never known in advance.
+    uint64_t expectedDataSize = 0;
+    if (segmentFramesMax != UINT64_MAX && !flacOut && !trigger)
+        expectedDataSize = segmentFramesMax * outFrameSize;
+
+    // The header has space for RF64 sizes unless the segment surely fits 4GB
+    if (wavOut)
+        wavHeader.setExpectedDataSize(expectedDataSize);
+
+    segmentExpectedSize = expectedDataSize ? expectedDataSize + (wavOut ? wavHeader.getSize() : 0) : 0;
+
+    if (!outFile.open(segmentFileStr, segmentExpectedSize, bufSize))
+    {
+        errStr = outFile.getLastErrorInfo();
+        return false;
+    }
+
+    // Write wav-header if it is needed. Its sizes are patched when the segment is closed,
+    // until then they describe the expected size (it matters if the output is not seekable).
+    // The header of a regular file is updated while recording, so it starts with no data.
+    if (flacOut && !flacEncoder.open(&outFile, sampleFormat, outChansNumber, sampleRate))
+    {
+        errStr = flacEncoder.getLastErrorInfo();
+        outFile.close();
+        return false;
+    }
+
+    if (wavOut)
+    {
+        if (outFile.isSeekable() && headerInterval)
+            wavHeader.setDataSize(0);
+        else
+            wavHeader.setDataSize(segmentExpectedSize ? segmentExpectedSize - wavHeader.getSize() : UINT64_MAX);
+
+        // Without the header the data would start at the wrong offset
+        if (!outFile.write(wavHeader.getData(), wavHeader.getSize()))
+        {
+            errStr = outFile.getLastErrorInfo();
+            outFile.close();
+            return false;
+        }
+
+        headerNextNs = CaptureStats::nowNs() + headerInterval * 1000000000ULL;
+    }
+
+    // The segment is recorded without its block index if it can't be written
+    uint64_t dataOffset = flacOut ? BlockIndex::NO_OFFSET : outFile.getSize();
+    if (blockIndexFrames && !blockIndex.open(segmentFileStr + ".bix", sampleFormat, outChansNumber, sampleRate, blockIndexFrames, dataOffset))
+        ERR(captureDevIdStr << ": " << blockIndex.getLastErrorInfo());
+
+    if (verbose && segmentIndex > 0)
+        INFO(captureDevIdStr << ": new segment \"" << segmentFileStr << '\"');
+
+    return true;
+}
+
+void AudioRecorder::segmentUpdateHeader()
+{
+    headerNextNs = CaptureStats::nowNs() + headerInterval * 1000000000ULL;
+
+    // Only the data written so far is described, the file is valid whenever the process dies
+    if (!outFile.isSeekable())
+        return;
+
+    wavHeader.setDataSize(dataSize);
+    if (!outFile.writeAt(0, wavHeader.getData(), wavHeader.getSize()))
+        ERR("Can not update wav-header: " << outFile.getLastErrorInfo());
+}
+
+bool AudioRecorder::stringToFloatList(const char *str, std::vector<float> &values)
+{
+    std::stringstream ss(str);
+    std::string item;
+
+    values.clear();
+    while (std::getline(ss, item, ','))
+    {
+        std::stringstream itemSs(item);
+        float value;
+        if (!(itemSs >> value))
+            return false;
+
+        values.push_back(value);
+    }
+
+    return !values.empty();
+}
+
+bool AudioRecorder::stringToIntList(const char *str, std::vector<u_int> &values)
+{
+    std::stringstream ss(str);
+    std::string item;
+
+    values.clear();
+    while (std::getline(ss, item, ','))
+    {
+        std::stringstream itemSs(item);
+        u_int value;
+        if (item.find('-') != std::string::npos || !(itemSs >> value))
+            return false;
+
+        values.push_back(value);
+    }
+
+    return !values.empty();
+}
+
 void AudioRecorder::stringToInt(char *str, unsigned int *pIntValue)
 {
     std::stringstream ss;
@@ -700,23 +1353,525 @@ bool AudioRecorder::validateParams()
         return false;
     }
 
-    if (timeToRec == 0)
+    if (periodsNumber < 2)
+    {
+        errStr = "Wrong periods number!\nUse: -P,--periods <number, at least 2>";
+        ERR(errStr);
+        return false;
+    }
+
+    if (ringTimeMs < 1000)
+    {
+        errStr = "Ring buffer length is too small!\nUse: -r,--ring_time <length in ms, at least 1000>";
+        ERR(errStr);
+        return false;
+    }
+
+    if (trigger && (uint64_t)preRollMs >= ringTimeMs)
+    {
+        errStr = "Pre-roll is too long!\nUse: -b,--preroll <length in ms, less than --ring_time>";
+        ERR(errStr);
+        return false;
+    }
+
+    // A daemon records until the stop command
+    if (timeToRec == 0 && !continuous && daemonSocketStr.empty())
+    {
+        errStr = "Recording duration not specified!\nUse: -t,--time_to_rec <duration in seconds>, -u,--continuous or -D,--daemon";
+        ERR(errStr);
+        return false;
+    }
+
+    for (size_t i = 0; i < chansMap.size(); ++i)
+    {
+        if (chansMap[i] >= chansNumber)
+        {
+            errStr = "Wrong channels map! Channel indexes must be less than the channels number";
+            ERR(errStr);
+            return false;
+        }
+    }
+
+    if (isFlacFile() && !FlacEncoder::isFormatSupported(sampleFormat, chansMap.empty() ? chansNumber : chansMap.size()))
+    {
+        errStr = "FLAC output supports S16_LE and S24_3LE with 1 to 8 channels!\nUse: -f,--format and -m,--chans_map";
+        ERR(errStr);
+        return false;
+    }
+
+    if (directIo)
+    {
+        bool unityGain = gainFactor == 0;
+        for (size_t i = 0; i < chansGain.size(); ++i)
+            unityGain &= chansGain[i] == 0;
+
+        if (isWavFile() || isFlacFile() || outFileStr == "-" || trigger || resample || !unityGain || agc)
+        {
+            errStr = "Direct I/O needs a raw output file, 0dB gain, no AGC, no trigger and no resampling!\nUse: -g,--gain 0 and -o,--out_file <path>";
+            ERR(errStr);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < monitorTap.getSinksNumber(); ++i)
+    {
+        if (monitorTap.getSink(i)->getName() == "-" && outFileStr == "-")
+        {
+            errStr = "The standard output can't be both the output file and a monitor!";
+            ERR(errStr);
+            return false;
+        }
+    }
+
+    if (indexIntervalMs && outFileStr == "-")
+    {
+        errStr = "The timing index is written next to the output file, it can't be the standard output!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Binding the socket would unlink the one of the other recorder
+    if (!statsSocketStr.empty())
+    {
+        std::map<std::string, AudioRecorder *>::iterator it = statsSockets.find(statsSocketStr);
+        if (it != statsSockets.end() && it->second != this)
+        {
+            errStr = "The stats socket is used by another device: \"" + statsSocketStr + "\"!\nUse: -U,--stats_socket <path> after every -C";
+            ERR(errStr);
+            return false;
+        }
+
+        // The path of a previous validation is released
+        releaseStatsSocket();
+        statsSockets[statsSocketStr] = this;
+    }
+
+    if (fifoPriority && !Realtime::isPriorityValid(fifoPriority))
+    {
+        errStr = "Wrong real-time priority! Must be from 1 to 99";
+        ERR(errStr);
+        return false;
+    }
+
+    std::vector<u_int> cpus(captureCpus);
+    cpus.insert(cpus.end(), writerCpus.begin(), writerCpus.end());
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        if (!Realtime::isCpuValid(cpus[i]))
+        {
+            errStr = "Wrong CPU list! CPU indexes must be less than the number of CPUs";
+            ERR(errStr);
+            return false;
+        }
+    }
+
+    if (blockIndexFrames && (!BlockIndex::isBlockFramesValid(blockIndexFrames) || outFileStr == "-" || trigger || directIo))
+    {
+        errStr = "Wrong block index parameters! A block must be at least 16 frames, the index is written\n"
+                 "next to the output file, it can't be the standard output, with --trigger or --direct_io";
+        ERR(errStr);
+        return false;
+    }
+
+    if (analysisFftSize && (!SpectrumAnalyzer::isFftSizeValid(analysisFftSize) || outFileStr == "-"))
     {
-        errStr = "Recording duration not specified!\nUse: -t,--time_to_rec <duration in seconds>";
+        errStr = "Wrong spectral analysis parameters! The FFT size must be a power of 2 from 64 to 65536,\n"
+                 "the features are written next to the output file, it can't be the standard output";
         ERR(errStr);
         return false;
     }
 
+    if (chansGain.size() > (chansMap.empty() ? chansNumber : chansMap.size()))
+    {
+        errStr = "Too many per-channel gain factors! Must be at most one per recorded channel";
+        ERR(errStr);
+        return false;
+    }
+
+    return true;
+}
+
+void AudioRecorder::writeLoop()
+{
+    std::string rtErrStr;
+    if (!writerCpus.empty() && !Realtime::pinThread(writerCpus, rtErrStr))
+        ERR(captureDevIdStr << ": writer thread: " << rtErrStr);
+
+    if (directIo)
+    {
+        writeLoopDirect();
+        return;
+    }
+
+    for (;;)
+    {
+        // Check the flag before reading, so data pushed before the end of capture is not lost
+        bool done = captureDone;
+
+        if (statsInterval && CaptureStats::nowNs() >= statsNextNs)
+            reportStats();
+
+        // Index entries are written as they come, so a crash keeps them. The recording goes on without the index
+        if (timingIndex.isOpened() && !timingIndex.flush())
+        {
+            ERR(captureDevIdStr << ": " << timingIndex.getLastErrorInfo());
+            timingIndex.close();
+        }
+
+        // Start a new segment on request, the next data opens it
+        if (rotateFlag.exchange(false) && outFile.isOpened() && !segmentClose())
+        {
+            writerFailed = true;
+            break;
+        }
+
+        // Keep the wav-header current, so a crash does not lose the recording
+        if (wavOut && headerInterval && outFile.isOpened() && CaptureStats::nowNs() >= headerNextNs)
+            segmentUpdateHeader();
+
+        const char *data;
+        size_t size = ringBuf.peek(&data);
+        if (size == 0)
+        {
+            // The data delayed by the AGC ends the recording
+            if (done)
+            {
+                if (!writeDrain())
+                    writerFailed = true;
+
+                break;
+            }
+
+            // Ring buffer is empty. Wait 10ms until some new data is available
+            usleep(10 * 1000);
+            continue;
+        }
+
+        size_t frames = size / outFrameSize;
+        if (frames > bufSize / frameSize)
+            frames = bufSize / frameSize;
+
+        size = frames * outFrameSize;
+
+        uint64_t startNs = CaptureStats::nowNs();
+
+        // Wall clock of the chunk by the timing index, for the block index.
+        // The AGC output starts with its delayed frames
+        if (blockIndexFrames)
+        {
+            uint64_t delayedFrames = agc ? (uint64_t)autoGain.getPendingFrames() * captureRate / sampleRate : 0;
+            chunkWallNs = timingIndex.getWallNs(writtenFrames > delayedFrames ? writtenFrames - delayedFrames : 0);
+        }
+        writtenFrames += frames;
+
+        // The rest of processing is done at the output rate
+        const char *outData = data;
+        size_t outFrames = frames;
+        if (resampler.isActive())
+        {
+            outFrames = resampler.process(data, frames, &resampleBuf[0]);
+            outData = &resampleBuf[0];
+        }
+
+        bool res = trigger ? writeTriggered(outData, outFrames) : writeData(outData, outFrames);
+
+        ringBuf.pop(size);
+        stats.addWrite(CaptureStats::nowNs() - startNs, size);
+
+        if (!res)
+        {
+            writerFailed = true;
+            break;
+        }
+    }
+}
+
+bool AudioRecorder::writeData(const char *data, size_t framesNumber)
+{
+    while (framesNumber > 0)
+    {
+        // Open the next segment only when there is data for it
+        if (!outFile.isOpened() && !segmentOpen())
+            return false;
+
+        // Staging buffers hold one audio buffer
+        size_t frames = framesNumber;
+        if (frames > bufSize / frameSize)
+            frames = bufSize / frameSize;
+
+        // Split the chunk exactly at the segment boundary, so rotation is gap-free
+        if (frames > segmentFramesMax - segmentFrames)
+            frames = segmentFramesMax - segmentFrames;
+
+        size_t size = frames * outFrameSize;
+
+        // The AGC outputs fewer frames while its delay fills, never more than it gets
+        size_t outFrames = 0;
+
+        // The block index summarizes the data as it is written, after gain
+        const char *indexData = NULL;
+        uint64_t indexOffset = BlockIndex::NO_OFFSET;
+
+        if (flacOut)
+        {
+            // Apply gain into the staging buffer and compress it
+            outFrames = processGain(data, &flacBuf[0], frames);
+
+            // A job which is not written would be overwritten by the next ones, the stream can't go on
+            if (outFrames && !flacEncoder.write(&flacBuf[0], outFrames))
+            {
+                errStr = flacEncoder.getLastErrorInfo();
+                ERR(captureDevIdStr << ": " << errStr);
+                return false;
+            }
+
+            dataSize += outFrames * outFrameSize;
+            indexData = &flacBuf[0];
+        }
+        else
+        {
+            // Apply gain straight into the output file
+            uint64_t offset = outFile.getSize();
+            char *outData = outFile.reserve(size);
+            if (outData == NULL)
+            {
+                errStr = outFile.getLastErrorInfo();
+                ERR(captureDevIdStr << ": " << errStr);
+                return false;
+            }
+
+            outFrames = processGain(data, outData, frames);
+            if (!outFile.commit(outFrames * outFrameSize))
+            {
+                errStr = outFile.getLastErrorInfo();
+                ERR(captureDevIdStr << ": " << errStr);
+                return false;
+            }
+
+            dataSize += outFrames * outFrameSize;
+            indexData = outData;
+            indexOffset = offset;
+        }
+
+        if (indexData && outFrames && blockIndex.isOpened() && !blockIndex.add(indexData, outFrames, indexOffset, chunkWallNs))
+        {
+            ERR(captureDevIdStr << ": " << blockIndex.getLastErrorInfo());
+            blockIndex.close();
+        }
+
+        if (chunkWallNs)
+            chunkWallNs += outFrames * 1000000000ULL / sampleRate;
+
+        // No data is the silence which flushes the AGC
+        if (data)
+            data += size;
+        framesNumber -= frames;
+
+        // Rotate output segment
+        if ((segmentFrames += outFrames) == segmentFramesMax && !segmentClose())
+            return false;
+    }
+
+    return true;
+}
+
+bool AudioRecorder::writeDrain()
+{
+    // The frames delayed by the AGC are pushed out by its latency of silence
+    if (!agc || autoGain.getPendingFrames() == 0)
+        return true;
+
+    return writeData(NULL, autoGain.getLatencyFrames());
+}
+
+bool AudioRecorder::writeTriggered(const char *data, size_t framesNumber)
+{
+    // The gate decides per analysis window
+    while (framesNumber > 0)
+    {
+        size_t frames = framesNumber < triggerGate.getWindowFrames() ? framesNumber : triggerGate.getWindowFrames();
+
+        switch (triggerGate.process(data, frames))
+        {
+            case TriggerGate::GATE_SKIP:
+                break;
+
+            case TriggerGate::GATE_START:
+            {
+                if (verbose)
+                    INFO(captureDevIdStr << ": triggered event " << triggerGate.getEventsNumber());
+
+                const char *preRoll1, *preRoll2;
+                size_t preRollFrames1, preRollFrames2;
+                triggerGate.getPreRoll(&preRoll1, &preRollFrames1, &preRoll2, &preRollFrames2);
+
+                if (!writeData(preRoll1, preRollFrames1) || !writeData(preRoll2, preRollFrames2) || !writeData(data, frames))
+                    return false;
+
+                break;
+            }
+
+            case TriggerGate::GATE_WRITE:
+                if (!writeData(data, frames))
+                    return false;
+
+                break;
+
+            case TriggerGate::GATE_STOP:
+                // Every event is a separate file
+                if (!writeData(data, frames) || !writeDrain() || (outFile.isOpened() && !segmentClose()))
+                    return false;
+
+                break;
+        }
+
+        data += frames * outFrameSize;
+        framesNumber -= frames;
+    }
+
     return true;
 }
 
-void AudioRecorder::wavHeaderInit()
+void AudioRecorder::writeLoopDirect()
 {
-    strncpy(wavHeader.fields.chunkId, "RIFF", 4);
-    strncpy(wavHeader.fields.format, "WAVE", 4);
-    strncpy(wavHeader.fields.subchunk1Id, "fmt ", 4);
-    wavHeader.fields.subchunk1Size = 16;
-    wavHeader.fields.audioFormat = 1;
-    wavHeader.fields.bitsPerSample = 16;
-    strncpy(wavHeader.fields.subchunk2Id, "data", 4);
+    // The data stays in the ring buffer until its write is completed.
+    // All writes but the last one are aligned: the ring buffer and the segments
+    // are multiples of the direct block size, and the rest of data is never
+    // submitted until the capture is finished.
+    uint64_t segmentBytesMax = segmentFramesMax == UINT64_MAX ? UINT64_MAX : segmentFramesMax * outFrameSize;
+    uint64_t segmentLimit = segmentBytesMax;
+    uint64_t segmentBytes = 0;
+    size_t inFlightBytes = 0;
+
+    size_t maxWriteSize = bufSize / DirectWriter::ALIGNMENT * DirectWriter::ALIGNMENT;
+    if (maxWriteSize == 0)
+        maxWriteSize = DirectWriter::ALIGNMENT;
+
+    for (;;)
+    {
+        // Check the flag before reading, so data pushed before the end of capture is not lost
+        bool done = captureDone;
+
+        if (statsInterval && CaptureStats::nowNs() >= statsNextNs)
+            reportStats();
+
+        // Index entries are written as they come, so a crash keeps them. The recording goes on without the index
+        if (timingIndex.isOpened() && !timingIndex.flush())
+        {
+            ERR(captureDevIdStr << ": " << timingIndex.getLastErrorInfo());
+            timingIndex.close();
+        }
+
+        // Rotation on request is done at the next aligned boundary
+        if (rotateFlag.exchange(false) && segmentBytes > 0)
+            segmentLimit = (segmentBytes + directBlockSize - 1) / directBlockSize * directBlockSize;
+
+        // Completed writes release their data. After a failed one the data stays in the ring buffer
+        uint64_t latencyNs = 0;
+        size_t written;
+        bool reaped = directWriter.reap(false, &written, &latencyNs);
+        if (written)
+        {
+            ringBuf.pop(written);
+            inFlightBytes -= written;
+            stats.addWrite(latencyNs, written);
+        }
+
+        if (!reaped)
+        {
+            errStr = directWriter.getLastErrorInfo();
+            writerFailed = true;
+            break;
+        }
+
+        // Rotate output segment when all its writes are completed
+        if (segmentBytes == segmentLimit && directWriter.getInFlight() == 0)
+        {
+            if (directWriter.isOpened() && !segmentClose())
+            {
+                writerFailed = true;
+                break;
+            }
+
+            segmentBytes = 0;
+            segmentLimit = segmentBytesMax;
+            continue;
+        }
+
+        const char *data;
+        size_t size = ringBuf.peek(&data, inFlightBytes);
+        if (size > segmentLimit - segmentBytes)
+            size = segmentLimit - segmentBytes;
+
+        size_t alignedSize = size / DirectWriter::ALIGNMENT * DirectWriter::ALIGNMENT;
+        if (alignedSize > maxWriteSize)
+            alignedSize = maxWriteSize;
+
+        if (alignedSize > 0 && directWriter.getInFlight() < DirectWriter::QUEUE_DEPTH)
+        {
+            // Open the next segment only when there is data for it
+            if (!directWriter.isOpened() && !segmentOpen())
+            {
+                writerFailed = true;
+                break;
+            }
+
+            if (!directWriter.submit(data, alignedSize))
+            {
+                errStr = directWriter.getLastErrorInfo();
+                writerFailed = true;
+                break;
+            }
+
+            inFlightBytes += alignedSize;
+            segmentBytes += alignedSize;
+            continue;
+        }
+
+        if (directWriter.getInFlight())
+        {
+            reaped = directWriter.reap(true, &written, &latencyNs);
+            ringBuf.pop(written);
+            inFlightBytes -= written;
+            stats.addWrite(latencyNs, written);
+
+            if (!reaped)
+            {
+                errStr = directWriter.getLastErrorInfo();
+                writerFailed = true;
+                break;
+            }
+
+            continue;
+        }
+
+        if (!done)
+        {
+            // Less than an aligned block is buffered. Wait 10ms until some new data is available
+            usleep(10 * 1000);
+            continue;
+        }
+
+        if (size == 0)
+            break;
+
+        // The end of the recording, the rest is not aligned
+        if (!directWriter.isOpened() && !segmentOpen())
+        {
+            writerFailed = true;
+            break;
+        }
+
+        uint64_t startNs = CaptureStats::nowNs();
+        if (!directWriter.writeTail(data, size))
+        {
+            errStr = directWriter.getLastErrorInfo();
+            writerFailed = true;
+            break;
+        }
+
+        ringBuf.pop(size);
+        stats.addWrite(CaptureStats::nowNs() - startNs, size);
+        segmentBytes += size;
+    }
 }
@@ -0,0 +1,336 @@
+#include "autogain.h"
+
+#include <string.h>
+
+// Public members
+AutoGain::AutoGain() :
+    format(SampleFormat::S16_LE),
+    chansNumber(0),
+    sampleRate(48000),
+    frameSize(0),
+    targetDb(0),
+    attackCoeff(1),
+    releaseCoeff(1),
+    lineFrames(0),
+    linePos(0),
+    pending(0),
+    blockFill(0),
+    windowBlocks(1),
+    blocksNumber(0),
+    framesTotal(0)
+{
+}
+
+
+// Public methods
+float AutoGain::getPeakDb(u_int ch)
+{
+    return 20 * log10f(peakMax[ch]);
+}
+
+float AutoGain::getRmsDb(u_int ch)
+{
+    if (framesTotal == 0)
+        return -INFINITY;
+
+    return 10 * log10(sumSquares[ch] / framesTotal);
+}
+
+void AutoGain::setup(SampleFormat::Id format, u_int chansNumber, u_int sampleRate, float targetDb,
+                     float attackMs, float releaseMs, float lookaheadMs)
+{
+    this->format = format;
+    this->chansNumber = chansNumber;
+    this->sampleRate = sampleRate;
+    frameSize = SampleFormat::getBytes(format) * chansNumber;
+    this->targetDb = targetDb;
+
+    // One-pole smoothing per control block, 0 is an immediate response
+    attackCoeff = attackMs > 0 ? 1 - expf(-(float)CONTROL_FRAMES * 1000 / (attackMs * sampleRate)) : 1;
+    releaseCoeff = releaseMs > 0 ? 1 - expf(-(float)CONTROL_FRAMES * 1000 / (releaseMs * sampleRate)) : 1;
+
+    // The block leaving the delay line sees the blocks of the look-ahead time after it
+    size_t lookaheadFrames = (size_t)(lookaheadMs * sampleRate / 1000);
+    windowBlocks = (lookaheadFrames + CONTROL_FRAMES - 1) / CONTROL_FRAMES + 1;
+    lineFrames = windowBlocks * CONTROL_FRAMES;
+
+    line.resize(lineFrames * frameSize);
+    scratch.resize(CONTROL_FRAMES * frameSize);
+
+    minValues.resize(chansNumber);
+    maxValues.resize(chansNumber);
+    blockSumSquares.resize(chansNumber);
+    blockPeaks.resize(chansNumber);
+
+    maxCoeff.resize(chansNumber, 1.0f);
+    envelope.resize(chansNumber);
+    agcHistory.resize(windowBlocks * chansNumber);
+    reductionHistory.resize(windowBlocks * chansNumber);
+    minHistory.resize(windowBlocks * chansNumber);
+    outCoeff.resize(chansNumber);
+
+    peakMax.resize(chansNumber);
+    sumSquares.resize(chansNumber);
+    minApplied.resize(chansNumber);
+    maxApplied.resize(chansNumber);
+    minReduction.resize(chansNumber);
+
+    reset();
+}
+
+void AutoGain::setMaxGain(float gainDb, const std::vector<float> &gainsDb)
+{
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        maxCoeff[ch] = powf(10.0, (ch < gainsDb.size() ? gainsDb[ch] : gainDb) / 20.0);
+
+    reset();
+}
+
+void AutoGain::reset()
+{
+    memset(&line[0], 0, line.size());
+    linePos = 0;
+    pending = 0;
+    blockFill = 0;
+    blocksNumber = 0;
+    framesTotal = 0;
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        minValues[ch] = 0x7FFF;
+        maxValues[ch] = -0x8000;
+        blockSumSquares[ch] = 0;
+        blockPeaks[ch] = 0;
+
+        // The gain starts at 0dB
+        envelope[ch] = targetDb;
+        outCoeff[ch] = 1.0f;
+
+        peakMax[ch] = 0;
+        sumSquares[ch] = 0;
+        minApplied[ch] = maxCoeff[ch];
+        maxApplied[ch] = MIN_COEFF;
+        minReduction[ch] = 1.0f;
+    }
+
+    for (size_t i = 0; i < reductionHistory.size(); ++i)
+    {
+        agcHistory[i] = 1.0f;
+        reductionHistory[i] = 1.0f;
+        minHistory[i] = 1.0f;
+    }
+
+    SampleKernels::makeGain(fixedGain, &outCoeff[0], chansNumber);
+}
+
+size_t AutoGain::process(const void *in, void *out, size_t framesNumber)
+{
+    const char *src = (const char *)in;
+    char *dst = (char *)out;
+    size_t outFramesNumber = 0;
+
+    // Slices never cross a control block, nor the end of the delay line
+    while (framesNumber > 0)
+    {
+        size_t frames = CONTROL_FRAMES - blockFill;
+        if (frames > framesNumber)
+            frames = framesNumber;
+
+        size_t size = frames * frameSize;
+
+        // Only the newest pending frames of the line are data, the older ones are not output
+        size_t skip = lineFrames - pending;
+        size_t outFrames = frames > skip ? frames - skip : 0;
+        char *slot = &line[linePos * frameSize];
+
+        // The input may be overwritten by the output, it is saved first
+        if (src)
+            memcpy(&scratch[0], src, size);
+        else
+            memset(&scratch[0], 0, size);
+
+        analyze(&scratch[0], frames);
+
+        if (outFrames)
+            applyGain(slot + (frames - outFrames) * frameSize, dst, outFrames);
+
+        memcpy(slot, &scratch[0], size);
+
+        pending = src ? pending + frames - outFrames : pending - outFrames;
+        linePos = (linePos + frames) % lineFrames;
+        outFramesNumber += outFrames;
+        dst += outFrames * frameSize;
+        if (src)
+            src += size;
+        framesNumber -= frames;
+
+        if ((blockFill += frames) == CONTROL_FRAMES)
+            finishBlock();
+    }
+
+    return outFramesNumber;
+}
+
+
+// Private methods
+void AutoGain::analyze(const char *in, size_t framesNumber)
+{
+    switch (format)
+    {
+        case SampleFormat::S16_LE:
+            SampleKernels::findPeaks((const short *)in, framesNumber, chansNumber, &minValues[0], &maxValues[0], &blockSumSquares[0]);
+            break;
+
+        case SampleFormat::S24_3LE:
+            analyzeGeneric<SampleS24>(in, framesNumber);
+            break;
+
+        case SampleFormat::S32_LE:
+            analyzeGeneric<SampleS32>(in, framesNumber);
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            analyzeGeneric<SampleFloat>(in, framesNumber);
+            break;
+    }
+}
+
+template <class Sample>
+void AutoGain::analyzeGeneric(const char *in, size_t framesNumber)
+{
+    for (size_t i = 0; i < framesNumber; ++i)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch, in += Sample::SIZE)
+        {
+            float level = Sample::level(Sample::load(in));
+
+            blockPeaks[ch] = blockPeaks[ch] > level ? blockPeaks[ch] : level;
+            blockSumSquares[ch] += level * level;
+        }
+    }
+}
+
+void AutoGain::applyGain(const char *in, char *out, size_t framesNumber)
+{
+    switch (format)
+    {
+        case SampleFormat::S16_LE:
+            SampleKernels::applyGain((const short *)in, (short *)out, framesNumber, chansNumber, fixedGain);
+            break;
+
+        case SampleFormat::S24_3LE:
+            applyGainGeneric<SampleS24>(in, out, framesNumber);
+            break;
+
+        case SampleFormat::S32_LE:
+            applyGainGeneric<SampleS32>(in, out, framesNumber);
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            applyGainGeneric<SampleFloat>(in, out, framesNumber);
+            break;
+    }
+}
+
+template <class Sample>
+void AutoGain::applyGainGeneric(const char *in, char *out, size_t framesNumber)
+{
+    for (size_t i = 0; i < framesNumber; ++i)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch, in += Sample::SIZE, out += Sample::SIZE)
+            Sample::store(out, Sample::scale(Sample::load(in), outCoeff[ch]));
+    }
+}
+
+void AutoGain::finishBlock()
+{
+    // Block levels of S16 are taken from the kernel results
+    if (format == SampleFormat::S16_LE)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+        {
+            int peak = -minValues[ch] > maxValues[ch] ? -minValues[ch] : maxValues[ch];
+            blockPeaks[ch] = peak / 32768.0f;
+            blockSumSquares[ch] /= 32768.0f * 32768.0f;
+        }
+    }
+
+    // Input block m: its AGC gain and the limiter reduction needed on top of it
+    size_t slot = blocksNumber % windowBlocks;
+    float *agc = &agcHistory[slot * chansNumber];
+    float *reduction = &reductionHistory[slot * chansNumber];
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        // The envelope follows the level in dB, so a short transient moves it a little
+        // and the limiter takes care of it
+        float power = blockSumSquares[ch] / CONTROL_FRAMES;
+        float powerDb = 10 * log10f(power > MIN_POWER ? power : MIN_POWER);
+        envelope[ch] += (powerDb > envelope[ch] ? attackCoeff : releaseCoeff) * (powerDb - envelope[ch]);
+
+        float coeff = powf(10.0, (targetDb - envelope[ch]) / 20.0);
+        coeff = coeff > maxCoeff[ch] ? maxCoeff[ch] : coeff;
+        agc[ch] = coeff > MIN_COEFF ? coeff : MIN_COEFF;
+
+        float level = blockPeaks[ch] * agc[ch];
+        reduction[ch] = level > MAX_LEVEL ? MAX_LEVEL / level : 1.0f;
+
+        if (peakMax[ch] < blockPeaks[ch])
+            peakMax[ch] = blockPeaks[ch];
+        sumSquares[ch] += blockSumSquares[ch];
+    }
+
+    framesTotal += CONTROL_FRAMES;
+
+    // Block m - n leaves the delay line next. The minimum reduction over its window m - n..m
+    // is averaged with the minimums of the blocks before it, every one of them is not
+    // above the reduction of block m - n, as all their windows contain it
+    float *minimum = &minHistory[slot * chansNumber];
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        minimum[ch] = 1.0f;
+
+    for (u_int i = 0; i < windowBlocks; ++i)
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+            minimum[ch] = minimum[ch] < reductionHistory[i * chansNumber + ch] ? minimum[ch] : reductionHistory[i * chansNumber + ch];
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        outCoeff[ch] = 0;
+
+    for (u_int i = 0; i < windowBlocks; ++i)
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+            outCoeff[ch] += minHistory[i * chansNumber + ch];
+
+    // The oldest slot still has block m - n. Its own reduction bounds the average
+    // while the history is shorter than the window
+    size_t outSlot = (blocksNumber + 1) % windowBlocks;
+    const float *outAgc = &agcHistory[outSlot * chansNumber];
+    const float *outReduction = &reductionHistory[outSlot * chansNumber];
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        float limit = outCoeff[ch] / windowBlocks;
+        limit = limit < outReduction[ch] ? limit : outReduction[ch];
+        outCoeff[ch] = outAgc[ch] * limit;
+
+        // Block m - n is data once the delay line is full
+        if (blocksNumber + 1 >= windowBlocks)
+        {
+            minApplied[ch] = minApplied[ch] < outCoeff[ch] ? minApplied[ch] : outCoeff[ch];
+            maxApplied[ch] = maxApplied[ch] > outCoeff[ch] ? maxApplied[ch] : outCoeff[ch];
+            minReduction[ch] = minReduction[ch] < limit ? minReduction[ch] : limit;
+        }
+    }
+
+    SampleKernels::makeGain(fixedGain, &outCoeff[0], chansNumber);
+
+    ++blocksNumber;
+    blockFill = 0;
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        minValues[ch] = 0x7FFF;
+        maxValues[ch] = -0x8000;
+        blockSumSquares[ch] = 0;
+        blockPeaks[ch] = 0;
+    }
+}
@@ -0,0 +1,618 @@
+#include "blockindex.h"
+#include "samplekernels.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// BlockIndex
+// Public members
+BlockIndex::BlockIndex() :
+    format(SampleFormat::S16_LE),
+    chansNumber(1),
+    recordSize(0),
+    blockFilled(0),
+    batchBlocks(0),
+    blocksNumber(0),
+    framesNumber(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+
+// Public methods
+bool BlockIndex::open(const std::string &fileName, SampleFormat::Id format, u_int chansNumber, u_int sampleRate,
+                      u_int blockFrames, uint64_t dataOffset)
+{
+    this->format = format;
+    this->chansNumber = chansNumber;
+    recordSize = sizeof(bix_block_t) + chansNumber * sizeof(bix_summary_t);
+
+    // All buffers of level 0 are allocated here
+    block.resize(chansNumber);
+    resetAccumulators(block);
+    minValues.resize(chansNumber);
+    maxValues.resize(chansNumber);
+    sumSquares.resize(chansNumber);
+    batch.resize(BATCH_BLOCKS * recordSize);
+    blockFilled = 0;
+    batchBlocks = 0;
+    blocksNumber = 0;
+    framesNumber = 0;
+    upper.clear();
+
+    if (!outFile.open(fileName))
+    {
+        errStr = outFile.getLastErrorInfo();
+        return false;
+    }
+
+    memcpy(header.magic, "ARBIX001", sizeof(header.magic));
+    header.headerSize = sizeof(header);
+    header.sampleRate = sampleRate;
+    header.chansNumber = chansNumber;
+    header.format = format;
+    header.frameSize = SampleFormat::getBytes(format) * chansNumber;
+    header.blockFrames = blockFrames;
+    header.levelFactor = LEVEL_FACTOR;
+    header.dataOffset = dataOffset;
+    header.framesNumber = 0;
+    header.levelsOffset = 0;
+
+    if (!outFile.write(&header, sizeof(header)))
+    {
+        errStr = outFile.getLastErrorInfo();
+        outFile.close();
+        return false;
+    }
+
+    errStr.clear();
+
+    return true;
+}
+
+bool BlockIndex::close()
+{
+    if (!outFile.isOpened())
+        return true;
+
+    // The last blocks of all levels are partial
+    if (blockFilled > 0)
+        finishBlock();
+
+    bool res = flushBatch();
+
+    // Upper levels are kept while the level below has more than one block
+    uint64_t belowBlocks = blocksNumber;
+    size_t levelsNumber = 0;
+    while (levelsNumber < upper.size() && belowBlocks > 1)
+    {
+        if (upper[levelsNumber].blocks > 0)
+            emitUpper(levelsNumber + 1);
+
+        belowBlocks = upper[levelsNumber].summaries.size() / chansNumber;
+        ++levelsNumber;
+    }
+
+    upper.resize(levelsNumber);
+
+    // Upper levels and the table of levels after level 0
+    bix_levels_t table;
+    table.levelsNumber = levelsNumber + 1;
+
+    std::vector<bix_level_t> levels(levelsNumber + 1);
+    levels[0].offset = header.headerSize;
+    levels[0].blocksNumber = blocksNumber;
+
+    for (size_t i = 0; res && i < levelsNumber; ++i)
+    {
+        levels[i + 1].offset = outFile.getSize();
+        levels[i + 1].blocksNumber = upper[i].summaries.size() / chansNumber;
+        res = upper[i].summaries.empty() || outFile.write(&upper[i].summaries[0], upper[i].summaries.size() * sizeof(bix_summary_t));
+    }
+
+    header.framesNumber = framesNumber;
+    header.levelsOffset = outFile.getSize();
+
+    res = res && outFile.write(&table, sizeof(table)) && outFile.write(&levels[0], levels.size() * sizeof(bix_level_t));
+
+    // The header is patched the last, so an incomplete table is never referred to
+    res = res && outFile.writeAt(0, &header, sizeof(header));
+
+    if (!res)
+        errStr = outFile.getLastErrorInfo();
+
+    if (!outFile.close() && res)
+    {
+        errStr = outFile.getLastErrorInfo();
+        res = false;
+    }
+
+    upper.clear();
+
+    return res;
+}
+
+bool BlockIndex::add(const char *data, size_t framesNumber, uint64_t byteOffset, uint64_t wallNs)
+{
+    while (framesNumber > 0)
+    {
+        // The position of the block is the one of its first frame
+        if (blockFilled == 0)
+        {
+            bix_block_t position;
+            position.byteOffset = byteOffset;
+            position.wallNs = wallNs;
+            memcpy(&batch[batchBlocks * recordSize], &position, sizeof(position));
+        }
+
+        size_t frames = header.blockFrames - blockFilled;
+        if (frames > framesNumber)
+            frames = framesNumber;
+
+        accumulate(data, frames);
+
+        data += frames * header.frameSize;
+        framesNumber -= frames;
+        blockFilled += frames;
+        this->framesNumber += frames;
+
+        if (byteOffset != NO_OFFSET)
+            byteOffset += frames * header.frameSize;
+        if (wallNs != 0)
+            wallNs += frames * 1000000000ULL / header.sampleRate;
+
+        if (blockFilled < header.blockFrames)
+            break;
+
+        finishBlock();
+        if (batchBlocks == BATCH_BLOCKS && !flushBatch())
+            return false;
+    }
+
+    return true;
+}
+
+
+// Private methods
+void BlockIndex::accumulate(const char *data, size_t framesNumber)
+{
+    switch (format)
+    {
+        case SampleFormat::S16_LE:
+        {
+            // Peaks and energies of all channels in one vectorized pass
+            for (u_int ch = 0; ch < chansNumber; ++ch)
+            {
+                minValues[ch] = 0x7FFF;
+                maxValues[ch] = -0x8000;
+                sumSquares[ch] = 0;
+            }
+
+            SampleKernels::findPeaks((const short *)data, framesNumber, chansNumber, &minValues[0], &maxValues[0], &sumSquares[0]);
+
+            for (u_int ch = 0; ch < chansNumber; ++ch)
+            {
+                Accumulator &acc = block[ch];
+                acc.min = fminf(acc.min, minValues[ch] / 32768.0f);
+                acc.max = fmaxf(acc.max, maxValues[ch] / 32768.0f);
+                acc.sumSquares += sumSquares[ch] / (32768.0 * 32768.0);
+            }
+
+            break;
+        }
+
+        case SampleFormat::S24_3LE:
+            accumulateGeneric<SampleS24>(data, framesNumber);
+            break;
+
+        case SampleFormat::S32_LE:
+            accumulateGeneric<SampleS32>(data, framesNumber);
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            accumulateGeneric<SampleFloat>(data, framesNumber);
+            break;
+    }
+}
+
+template <class Sample>
+void BlockIndex::accumulateGeneric(const char *data, size_t framesNumber)
+{
+    for (size_t i = 0; i < framesNumber; ++i)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch, data += Sample::SIZE)
+        {
+            float value = Sample::toFloat(Sample::load(data));
+            Accumulator &acc = block[ch];
+
+            acc.min = value < acc.min ? value : acc.min;
+            acc.max = value > acc.max ? value : acc.max;
+            acc.sumSquares += value * value;
+        }
+    }
+}
+
+void BlockIndex::finishBlock()
+{
+    char *record = &batch[batchBlocks * recordSize];
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        bix_summary_t summary = toSummary(block[ch], blockFilled);
+        memcpy(record + sizeof(bix_block_t) + ch * sizeof(bix_summary_t), &summary, sizeof(summary));
+    }
+
+    ++batchBlocks;
+    ++blocksNumber;
+
+    propagate(1, block, blockFilled);
+
+    resetAccumulators(block);
+    blockFilled = 0;
+}
+
+bool BlockIndex::flushBatch()
+{
+    if (batchBlocks == 0)
+        return true;
+
+    bool res = outFile.write(&batch[0], batchBlocks * recordSize);
+    if (!res)
+        errStr = outFile.getLastErrorInfo();
+
+    batchBlocks = 0;
+
+    return res;
+}
+
+void BlockIndex::propagate(u_int level, const std::vector<Accumulator> &acc, uint64_t frames)
+{
+    if (upper.size() < level)
+    {
+        upper.resize(level);
+        upper[level - 1].acc.resize(chansNumber);
+        resetAccumulators(upper[level - 1].acc);
+        upper[level - 1].frames = 0;
+        upper[level - 1].blocks = 0;
+    }
+
+    UpperLevel &state = upper[level - 1];
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        state.acc[ch].min = fminf(state.acc[ch].min, acc[ch].min);
+        state.acc[ch].max = fmaxf(state.acc[ch].max, acc[ch].max);
+        state.acc[ch].sumSquares += acc[ch].sumSquares;
+    }
+
+    state.frames += frames;
+    if (++state.blocks == LEVEL_FACTOR)
+        emitUpper(level);
+}
+
+void BlockIndex::emitUpper(u_int level)
+{
+    UpperLevel &state = upper[level - 1];
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        state.summaries.push_back(toSummary(state.acc[ch], state.frames));
+
+    // The vector of levels may grow, the state is copied
+    std::vector<Accumulator> acc(state.acc);
+    uint64_t frames = state.frames;
+
+    resetAccumulators(state.acc);
+    state.frames = 0;
+    state.blocks = 0;
+
+    propagate(level + 1, acc, frames);
+}
+
+void BlockIndex::resetAccumulators(std::vector<Accumulator> &acc)
+{
+    for (size_t i = 0; i < acc.size(); ++i)
+    {
+        acc[i].min = 1.0f;
+        acc[i].max = -1.0f;
+        acc[i].sumSquares = 0;
+    }
+}
+
+BlockIndex::bix_summary_t BlockIndex::toSummary(const Accumulator &acc, uint64_t frames)
+{
+    bix_summary_t summary;
+    summary.min = lrintf(fmaxf(acc.min, -1.0f) * 32767);
+    summary.max = lrintf(fminf(acc.max, 1.0f) * 32767);
+
+    double rms = frames ? sqrt(acc.sumSquares / frames) : 0;
+    summary.rms = lrint((rms < 1 ? rms : 1) * 32767);
+
+    return summary;
+}
+
+
+// BlockIndexReader
+// Public members
+BlockIndexReader::BlockIndexReader() :
+    mapAddr(NULL),
+    mapSize(0),
+    recordSize(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+BlockIndexReader::~BlockIndexReader()
+{
+    close();
+}
+
+
+// Public methods
+bool BlockIndexReader::load(const std::string &fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        errStr = "Can not open block index: \"" + fileName + "\"!";
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header))
+    {
+        ::close(fd);
+        errStr = "Not a block index: \"" + fileName + "\"!";
+        return false;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (addr == MAP_FAILED)
+    {
+        errStr = "Block index mapping error: \"" + fileName + "\"!";
+        return false;
+    }
+
+    mapAddr = (const char *)addr;
+    mapSize = st.st_size;
+
+    memcpy(&header, mapAddr, sizeof(header));
+    recordSize = sizeof(BlockIndex::bix_block_t) + header.chansNumber * sizeof(BlockIndex::bix_summary_t);
+
+    if (memcmp(header.magic, "ARBIX001", sizeof(header.magic)) != 0 || header.headerSize < sizeof(header) ||
+        header.headerSize > mapSize || header.chansNumber == 0 || header.sampleRate == 0 || header.blockFrames == 0 ||
+        header.levelFactor < 2)
+    {
+        close();
+        errStr = "Wrong block index header: \"" + fileName + "\"!";
+        return false;
+    }
+
+    // The table of levels of a completed file
+    if (header.levelsOffset != 0 && header.levelsOffset + sizeof(BlockIndex::bix_levels_t) <= mapSize)
+    {
+        BlockIndex::bix_levels_t table;
+        memcpy(&table, mapAddr + header.levelsOffset, sizeof(table));
+
+        const char *p = mapAddr + header.levelsOffset + sizeof(table);
+        if (table.levelsNumber > 0 && p + table.levelsNumber * sizeof(BlockIndex::bix_level_t) <= mapAddr + mapSize)
+        {
+            levels.resize(table.levelsNumber);
+            memcpy(&levels[0], p, levels.size() * sizeof(BlockIndex::bix_level_t));
+        }
+
+        for (size_t i = 1; i < levels.size(); ++i)
+            if (levels[i].offset + levels[i].blocksNumber * header.chansNumber * sizeof(BlockIndex::bix_summary_t) > mapSize)
+                levels.clear();
+    }
+
+    // An interrupted recording has level 0 only
+    if (levels.empty())
+    {
+        header.framesNumber = 0;
+        header.levelsOffset = 0;
+
+        BlockIndex::bix_level_t level0;
+        level0.offset = header.headerSize;
+        level0.blocksNumber = (mapSize - header.headerSize) / recordSize;
+        levels.push_back(level0);
+
+        rebuildLevels();
+    }
+
+    return true;
+}
+
+void BlockIndexReader::close()
+{
+    if (mapAddr)
+        munmap((void *)mapAddr, mapSize);
+
+    mapAddr = NULL;
+    mapSize = 0;
+    levels.clear();
+    rebuilt.clear();
+}
+
+uint64_t BlockIndexReader::getFramesNumber()
+{
+    return header.levelsOffset ? header.framesNumber : levels[0].blocksNumber * header.blockFrames;
+}
+
+uint64_t BlockIndexReader::getLevelFrames(u_int level)
+{
+    uint64_t frames = header.blockFrames;
+    for (u_int i = 0; i < level; ++i)
+        frames *= header.levelFactor;
+
+    return frames;
+}
+
+uint64_t BlockIndexReader::getByteOffset(uint64_t framePos)
+{
+    if (levels[0].blocksNumber == 0 || framePos > getFramesNumber())
+        return BlockIndex::NO_OFFSET;
+
+    // The end of the file is in the last block
+    uint64_t i = framePos / header.blockFrames;
+    if (i >= levels[0].blocksNumber)
+        i = levels[0].blocksNumber - 1;
+
+    uint64_t offset = getBlock(i)->byteOffset;
+    if (offset == BlockIndex::NO_OFFSET)
+        return offset;
+
+    return offset + (framePos - i * header.blockFrames) * header.frameSize;
+}
+
+bool BlockIndexReader::findFrame(uint64_t wallNs, uint64_t *framePos)
+{
+    uint64_t blocksNumber = levels[0].blocksNumber;
+    if (blocksNumber == 0 || getBlock(0)->wallNs == 0 || wallNs < getBlock(0)->wallNs)
+        return false;
+
+    // The last block which does not start after the time
+    uint64_t low = 0, high = blocksNumber;
+    while (high - low > 1)
+    {
+        uint64_t mid = (low + high) / 2;
+        if (getBlock(mid)->wallNs <= wallNs)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    // Data lost before the next block leaves a time gap, it is mapped to the next block
+    uint64_t pos = low * header.blockFrames + (wallNs - getBlock(low)->wallNs) * header.sampleRate / 1000000000;
+    uint64_t end = low + 1 < blocksNumber ? (low + 1) * header.blockFrames : getFramesNumber();
+    if (pos > end)
+    {
+        if (low + 1 == blocksNumber)
+            return false;
+
+        pos = end;
+    }
+
+    *framePos = pos;
+
+    return true;
+}
+
+uint64_t BlockIndexReader::getWallNs(uint64_t framePos)
+{
+    if (levels[0].blocksNumber == 0)
+        return 0;
+
+    uint64_t i = framePos / header.blockFrames;
+    if (i >= levels[0].blocksNumber)
+        i = levels[0].blocksNumber - 1;
+
+    uint64_t wallNs = getBlock(i)->wallNs;
+    if (wallNs == 0)
+        return 0;
+
+    return wallNs + (framePos - i * header.blockFrames) * 1000000000 / header.sampleRate;
+}
+
+bool BlockIndexReader::getOverview(size_t columnsNumber, std::vector<Level> &overview)
+{
+    overview.clear();
+    if (columnsNumber == 0 || levels[0].blocksNumber == 0)
+        return false;
+
+    u_int level = levels.size() - 1;
+    while (level > 0 && levels[level].blocksNumber < columnsNumber)
+        --level;
+
+    uint64_t blocksNumber = levels[level].blocksNumber;
+    overview.resize(columnsNumber);
+
+    for (size_t c = 0; c < columnsNumber; ++c)
+    {
+        // Columns have one block at least, a short file repeats the blocks
+        uint64_t first = c * blocksNumber / columnsNumber;
+        uint64_t last = (c + 1) * blocksNumber / columnsNumber;
+        if (last <= first)
+            last = first + 1;
+
+        Level &column = overview[c];
+        column.min = 1.0f;
+        column.max = -1.0f;
+        double sumSquares = 0;
+
+        for (uint64_t i = first; i < last; ++i)
+        {
+            const BlockIndex::bix_summary_t *summary = getSummary(level, i);
+            for (u_int ch = 0; ch < header.chansNumber; ++ch)
+            {
+                column.min = fminf(column.min, summary[ch].min / 32767.0f);
+                column.max = fmaxf(column.max, summary[ch].max / 32767.0f);
+                sumSquares += (double)summary[ch].rms * summary[ch].rms;
+            }
+        }
+
+        column.rms = sqrt(sumSquares / ((last - first) * header.chansNumber)) / 32767;
+    }
+
+    return true;
+}
+
+
+// Private methods
+const BlockIndex::bix_summary_t *BlockIndexReader::getSummary(u_int level, uint64_t i)
+{
+    if (level == 0)
+        return (const BlockIndex::bix_summary_t *)((const char *)getBlock(i) + sizeof(BlockIndex::bix_block_t));
+
+    if (!rebuilt.empty())
+        return &rebuilt[level - 1][i * header.chansNumber];
+
+    return (const BlockIndex::bix_summary_t *)(mapAddr + levels[level].offset) + i * header.chansNumber;
+}
+
+void BlockIndexReader::rebuildLevels()
+{
+    u_int chansNumber = header.chansNumber;
+
+    for (u_int level = 1; levels[level - 1].blocksNumber > 1; ++level)
+    {
+        uint64_t belowBlocks = levels[level - 1].blocksNumber;
+        uint64_t blocksNumber = (belowBlocks + header.levelFactor - 1) / header.levelFactor;
+
+        rebuilt.push_back(std::vector<BlockIndex::bix_summary_t>(blocksNumber * chansNumber));
+
+        for (uint64_t i = 0; i < blocksNumber; ++i)
+        {
+            uint64_t first = i * header.levelFactor;
+            uint64_t last = first + header.levelFactor < belowBlocks ? first + header.levelFactor : belowBlocks;
+
+            for (u_int ch = 0; ch < chansNumber; ++ch)
+            {
+                int16_t minValue = 32767, maxValue = -32767;
+                double sumSquares = 0;
+
+                for (uint64_t j = first; j < last; ++j)
+                {
+                    const BlockIndex::bix_summary_t &summary = getSummary(level - 1, j)[ch];
+                    minValue = summary.min < minValue ? summary.min : minValue;
+                    maxValue = summary.max > maxValue ? summary.max : maxValue;
+                    sumSquares += (double)summary.rms * summary.rms;
+                }
+
+                BlockIndex::bix_summary_t &summary = rebuilt.back()[i * chansNumber + ch];
+                summary.min = minValue;
+                summary.max = maxValue;
+                summary.rms = lrint(sqrt(sumSquares / (last - first)));
+            }
+        }
+
+        BlockIndex::bix_level_t rebuiltLevel;
+        rebuiltLevel.offset = 0;
+        rebuiltLevel.blocksNumber = blocksNumber;
+        levels.push_back(rebuiltLevel);
+    }
+}
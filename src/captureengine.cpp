@@ -0,0 +1,538 @@
+#include "captureengine.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// Public members
+PcmHandle PcmHandle::open(const std::string &device, snd_pcm_stream_t stream, int mode, int *err)
+{
+    snd_pcm_t *pcm = NULL;
+    int res = snd_pcm_open(&pcm, device.c_str(), stream, mode);
+    if (err)
+        *err = res;
+
+    return PcmHandle(res == 0 ? pcm : NULL);
+}
+
+
+// Public members
+CaptureEngine::CaptureEngine() :
+    frameSize(0),
+    bufferFrames(0),
+    stampClock(CLOCK_REALTIME),
+    stats(NULL),
+    captureErr(0),
+    framePos(0),
+    stopFlag(false),
+    running(false),
+    pullOffset(0)
+{
+}
+
+CaptureEngine::~CaptureEngine()
+{
+    close();
+}
+
+
+// Public methods
+bool CaptureEngine::open(const CaptureConfig &config)
+{
+    close();
+
+    this->config = config;
+
+    // Attach audio buffer to device. The handle closes it on any error below
+    PcmHandle handle = PcmHandle::open(config.device, SND_PCM_STREAM_CAPTURE);
+    if (!handle)
+    {
+        errStr = "Audio buffer opening error (snd_pcm_open())!";
+        ERR(errStr);
+        return false;
+    }
+
+    snd_pcm_t *audioBuf = handle.get();
+
+    // Get device property-set
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_alloca(&params);
+    if (snd_pcm_hw_params_any(audioBuf, params) < 0)
+    {
+        errStr = "Error of getting device property set!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Specify how we want to access audio data
+    if (snd_pcm_hw_params_set_access(audioBuf, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) != 0)
+    {
+        errStr = "Audio data access specifing error!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Set sample format
+    snd_pcm_format_t alsaFormat = SND_PCM_FORMAT_S16_LE;
+    switch (config.format)
+    {
+        case SampleFormat::S16_LE:
+            alsaFormat = SND_PCM_FORMAT_S16_LE;
+            break;
+
+        case SampleFormat::S24_3LE:
+            alsaFormat = SND_PCM_FORMAT_S24_3LE;
+            break;
+
+        case SampleFormat::S32_LE:
+            alsaFormat = SND_PCM_FORMAT_S32_LE;
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            alsaFormat = SND_PCM_FORMAT_FLOAT_LE;
+            break;
+    }
+
+    if (snd_pcm_hw_params_set_format(audioBuf, params, alsaFormat) != 0)
+    {
+        errStr = std::string("Sample format ") + SampleFormat::getName(config.format) + " setting error!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Set channels number
+    if (snd_pcm_hw_params_set_channels_near(audioBuf, params, &this->config.chansNumber) != 0)
+    {
+        errStr = "Channels number setting error!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Set sample rate. Without the plugin resampling the nearest rate is a native one
+    if (config.nativeRate && snd_pcm_hw_params_set_rate_resample(audioBuf, params, 0) != 0)
+    {
+        errStr = "ALSA resampling disabling error!";
+        ERR(errStr);
+        return false;
+    }
+
+    if (snd_pcm_hw_params_set_rate_near(audioBuf, params, &this->config.sampleRate, 0) != 0)
+    {
+        errStr = "Sample rate setting error!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Set audio buffer length. The period is the wake-up unit of the capture loop
+    if (config.periodSize == 0)
+    {
+        // Period size is not specified, use 500ms buffer
+        u_int buffer_length_usec = 500 * 1000;
+        if (snd_pcm_hw_params_set_buffer_time_near(audioBuf, params, &buffer_length_usec, NULL) != 0)
+        {
+            errStr = "Audio buffer length setting error!";
+            ERR(errStr);
+            return false;
+        }
+    }
+    else if (snd_pcm_hw_params_set_period_size_near(audioBuf, params, &this->config.periodSize, NULL) != 0)
+    {
+        errStr = "Period size setting error!";
+        ERR(errStr);
+        return false;
+    }
+
+    if (snd_pcm_hw_params_set_periods_near(audioBuf, params, &this->config.periodsNumber, NULL) != 0)
+    {
+        errStr = "Periods number setting error!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Apply configuration
+    if (snd_pcm_hw_params(audioBuf, params) != 0)
+    {
+        errStr = "Audio buffer apply configuration error!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Get actual buffer geometry
+    snd_pcm_hw_params_get_period_size(params, &this->config.periodSize, NULL);
+    snd_pcm_hw_params_get_buffer_size(params, &bufferFrames);
+
+    frameSize = SampleFormat::getBytes(config.format) * this->config.chansNumber;
+
+    // Wake up the capture loop once per period
+    snd_pcm_sw_params_t *swParams;
+    snd_pcm_sw_params_alloca(&swParams);
+    if (snd_pcm_sw_params_current(audioBuf, swParams) != 0 ||
+        snd_pcm_sw_params_set_avail_min(audioBuf, swParams, this->config.periodSize) != 0 ||
+        snd_pcm_sw_params(audioBuf, swParams) != 0)
+    {
+        errStr = "Audio buffer software parameters setting error!";
+        ERR(errStr);
+        return false;
+    }
+
+    // Timestamps of the hardware position are taken at the period interrupts. The raw
+    // monotonic clock is not slewed by NTP, so it shows the drift of the device clock.
+    // Without support of the types the default one is the wall clock
+    stampClock = CLOCK_REALTIME;
+    if (snd_pcm_sw_params_set_tstamp_mode(audioBuf, swParams, SND_PCM_TSTAMP_ENABLE) == 0)
+    {
+        if (snd_pcm_sw_params_set_tstamp_type(audioBuf, swParams, SND_PCM_TSTAMP_TYPE_MONOTONIC_RAW) == 0)
+            stampClock = CLOCK_MONOTONIC_RAW;
+        else if (snd_pcm_sw_params_set_tstamp_type(audioBuf, swParams, SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0)
+            stampClock = CLOCK_MONOTONIC;
+
+        if (snd_pcm_sw_params(audioBuf, swParams) != 0)
+            stampClock = CLOCK_REALTIME;
+    }
+
+    // Get descriptors to poll for new periods
+    int pollFdsCount = snd_pcm_poll_descriptors_count(audioBuf);
+    if (pollFdsCount <= 0)
+    {
+        errStr = "Audio buffer poll descriptors getting error!";
+        ERR(errStr);
+        return false;
+    }
+
+    pollFds.resize(pollFdsCount);
+    snd_pcm_poll_descriptors(audioBuf, &pollFds[0], pollFdsCount);
+
+    pcm = std::move(handle);
+    errStr.clear();
+
+    return true;
+}
+
+void CaptureEngine::close()
+{
+    if (!pcm)
+        return;
+
+    stop();
+    pcm.reset();
+    pollFds.clear();
+}
+
+bool CaptureEngine::start()
+{
+    if (!pcm)
+        return false;
+
+    captureErr = 0;
+    framePos = 0;
+    stopFlag = false;
+
+    // Start streaming
+    if (snd_pcm_start(pcm.get()) != 0)
+    {
+        errStr = "snd_pcm_start(audioBuf) error!";
+        ERR(errStr);
+        return false;
+    }
+
+    return true;
+}
+
+bool CaptureEngine::start(const Callback &callback)
+{
+    if (thread.joinable() || !start())
+        return false;
+
+    running = true;
+    thread = std::thread(&CaptureEngine::threadLoop, this, callback);
+
+    return true;
+}
+
+void CaptureEngine::stop()
+{
+    stopFlag = true;
+    if (thread.joinable())
+        thread.join();
+
+    if (!pcm)
+        return;
+
+    // Prepare the device again, so the next capture only has to start it
+    snd_pcm_drop(pcm.get());
+    snd_pcm_prepare(pcm.get());
+}
+
+bool CaptureEngine::pull(CaptureBlock &block, int timeoutMs)
+{
+    for (bool waited = false;; waited = true)
+    {
+        int res = begin(block, pullOffset, UINT64_MAX);
+        if (res != 0)
+            return res > 0;
+
+        if (stopFlag || waited)
+            return false;
+
+        // A failure is recovered from by the next attempt
+        res = snd_pcm_wait(pcm.get(), timeoutMs);
+        if (res < 0)
+            captureErr = res;
+    }
+}
+
+void CaptureEngine::release(const CaptureBlock &block)
+{
+    commit(pullOffset, block.frames);
+}
+
+u_int CaptureEngine::getPollFds(struct pollfd *fds)
+{
+    for (size_t i = 0; i < pollFds.size(); ++i)
+        fds[i] = pollFds[i];
+
+    return pollFds.size();
+}
+
+int CaptureEngine::getWaitTimeoutMs()
+{
+    // Wait at most two buffer lengths, then check the state again
+    return 2 * bufferFrames * 1000 / config.sampleRate;
+}
+
+void CaptureEngine::handlePollEvents(struct pollfd *fds)
+{
+    unsigned short revents = 0;
+    int res = snd_pcm_poll_descriptors_revents(pcm.get(), fds, pollFds.size(), &revents);
+    if (res < 0)
+    {
+        captureErr = res;
+        return;
+    }
+
+    if (!(revents & POLLERR))
+        return;
+
+    switch (snd_pcm_state(pcm.get()))
+    {
+        case SND_PCM_STATE_XRUN:
+            captureErr = -EPIPE;
+            break;
+
+        case SND_PCM_STATE_SUSPENDED:
+            captureErr = -ESTRPIPE;
+            break;
+
+        default:
+            captureErr = -EIO;
+    }
+}
+
+CaptureEngine::Status CaptureEngine::process(const Callback &callback, uint64_t framesMax)
+{
+    // Pass all available chunks to the callback, straight from the audio buffer
+    for (;;)
+    {
+        if (framePos >= framesMax)
+            return STATUS_DONE;
+
+        CaptureBlock block;
+        snd_pcm_uframes_t offset;
+        int res = begin(block, offset, framesMax);
+        if (res < 0)
+            return STATUS_ERROR;
+
+        if (res == 0)
+            // Everything available is taken, stop if it is requested
+            return stopFlag ? STATUS_DONE : STATUS_WAIT;
+
+        callback(block);
+
+        commit(offset, block.frames);
+    }
+}
+
+
+// Private methods
+int CaptureEngine::begin(CaptureBlock &block, snd_pcm_uframes_t &offset, uint64_t framesMax)
+{
+    for (;;)
+    {
+        if (captureErr < 0)
+        {
+            if (!handleError())
+                return -1;
+
+            captureErr = 0;
+
+            // Start streaming if necessary
+            if (snd_pcm_state(pcm.get()) != SND_PCM_STATE_RUNNING)
+                if (snd_pcm_start(pcm.get()) != 0)
+                {
+                    errStr = "Streaming restart error!";
+                    ERR(errStr);
+                    return -1;
+                }
+        }
+
+        // Refresh audio buffer state
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm.get());
+        if (avail < 0)
+        {
+            captureErr = avail;
+            continue;
+        }
+
+        if (stats)
+            stats->addAvail(avail);
+
+        // Less than a period is available. Sleep until the next period is completed
+        if ((snd_pcm_uframes_t)avail < config.periodSize && (snd_pcm_uframes_t)avail < framesMax - framePos)
+            return 0;
+
+        // Get audio data region available for reading
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t frames = bufferFrames;
+        int res = snd_pcm_mmap_begin(pcm.get(), &areas, &offset, &frames);
+        if (res != 0)
+        {
+            captureErr = res;
+            continue;
+        }
+
+        // Buffer is empty. Wait until some new data is available
+        if (frames == 0)
+            return 0;
+
+        // Don't take more than requested
+        if (frames > framesMax - framePos)
+            frames = framesMax - framePos;
+
+        if (stats)
+            stats->addChunk(frames);
+
+        block.data = (const char *)areas[0].addr + offset * areas[0].step / 8;
+        block.frames = frames;
+        block.frameSize = frameSize;
+        block.framePos = framePos;
+
+        // The last frame of the chunk was captured (avail - frames) frames ago
+        block.captureNs = CaptureStats::nowNs();
+        if ((snd_pcm_uframes_t)avail > frames)
+            block.captureNs -= (avail - frames) * 1000000000ULL / config.sampleRate;
+
+        // Without a timestamp of the driver the hardware position is stamped now
+        snd_pcm_uframes_t stampAvail;
+        snd_htimestamp_t stamp;
+        if (snd_pcm_htimestamp(pcm.get(), &stampAvail, &stamp) != 0 || (stamp.tv_sec == 0 && stamp.tv_nsec == 0))
+        {
+            stampAvail = avail;
+            clock_gettime(stampClock, &stamp);
+        }
+
+        block.stampPos = framePos + stampAvail;
+        block.stampNs = (uint64_t)stamp.tv_sec * 1000000000 + stamp.tv_nsec;
+
+        framePos += frames;
+
+        return 1;
+    }
+}
+
+bool CaptureEngine::commit(snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
+{
+    // Mark the data chunk as read
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm.get(), offset, frames);
+    if (committed < 0)
+        captureErr = committed;
+    else if ((snd_pcm_uframes_t)committed != frames)
+        // Not all frames are processed
+        captureErr = -EPIPE;
+
+    return captureErr == 0;
+}
+
+bool CaptureEngine::handleError()
+{
+    int res = captureErr;
+
+    // Count the failure before the buffer state is reset
+    if (res == -EPIPE || res == -ESTRPIPE)
+    {
+        uint64_t lost = lostFrames();
+
+        if (stats && res == -EPIPE)
+            stats->addXrun(lost);
+        else if (stats)
+            stats->addSuspend(lost);
+
+        if (config.verbose)
+            INFO(config.device << ": " << (res == -EPIPE ? "overrun" : "suspend") << ", about " << lost << " frames lost");
+    }
+
+    switch (res)
+    {
+        case -ESTRPIPE:
+            // Sound device is temporarily unavailable.  Wait until it's online.
+            while ((res = snd_pcm_resume(pcm.get())) == -EAGAIN)
+                usleep(config.periodSize * 1000000ULL / config.sampleRate);
+
+            if (res == 0)
+                return true;
+            // fallthrough
+
+        case -EPIPE:
+            // Overrun or underrun occurred.  Reset buffer.
+            if ((res = snd_pcm_prepare(pcm.get())) < 0)
+                break;
+
+            return true;
+    }
+
+    errStr = std::string("Audio buffer error recovery failed: ") + snd_strerror(res);
+    ERR(errStr);
+
+    return false;
+}
+
+uint64_t CaptureEngine::lostFrames()
+{
+    // Capture stops at the trigger time, the frames left in the buffer are dropped on recovery
+    snd_pcm_status_t *status;
+    snd_pcm_status_alloca(&status);
+    if (snd_pcm_status(pcm.get(), status) != 0)
+        return 0;
+
+    snd_htimestamp_t triggerTs, nowTs;
+    snd_pcm_status_get_trigger_htstamp(status, &triggerTs);
+    snd_pcm_status_get_htstamp(status, &nowTs);
+
+    int64_t stoppedNs = (int64_t)(nowTs.tv_sec - triggerTs.tv_sec) * 1000000000 + (nowTs.tv_nsec - triggerTs.tv_nsec);
+    if (stoppedNs < 0 || triggerTs.tv_sec == 0)
+        stoppedNs = 0;
+
+    return snd_pcm_status_get_avail(status) + (uint64_t)stoppedNs * config.sampleRate / 1000000000;
+}
+
+void CaptureEngine::threadLoop(Callback callback)
+{
+    // The descriptors are polled by this thread only
+    std::vector<struct pollfd> fds(pollFds);
+
+    while (process(callback) == STATUS_WAIT)
+    {
+        int res = poll(&fds[0], fds.size(), getWaitTimeoutMs());
+        if (res < 0 && errno != EINTR)
+        {
+            errStr = std::string("poll() error: ") + strerror(errno);
+            ERR(errStr);
+            break;
+        }
+
+        if (res > 0)
+            handlePollEvents(&fds[0]);
+    }
+
+    running = false;
+}
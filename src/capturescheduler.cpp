@@ -0,0 +1,153 @@
+#include "capturescheduler.h"
+#include "debug.h"
+#include "realtime.h"
+
+#include <errno.h>
+
+#include <thread>
+
+// Public members
+CaptureScheduler::CaptureScheduler()
+{
+}
+
+
+// Public methods
+void CaptureScheduler::addRecorder(AudioRecorder *recorder)
+{
+    recorders.push_back(recorder);
+}
+
+bool CaptureScheduler::run()
+{
+    if (recorders.empty())
+        return false;
+
+    // Prepare outputs, streaming is started by the capture thread
+    for (size_t i = 0; i < recorders.size(); ++i)
+    {
+        if (recorders[i]->recordStart())
+            continue;
+
+        // Finish already prepared recorders
+        for (size_t j = 0; j < i; ++j)
+            recorders[j]->recordFinish();
+
+        return false;
+    }
+
+    std::thread capturer(&CaptureScheduler::captureLoop, this);
+    capturer.join();
+
+    bool res = true;
+    for (size_t i = 0; i < recorders.size(); ++i)
+        if (!recorders[i]->recordFinish())
+            res = false;
+
+    return res;
+}
+
+
+// Private methods
+void CaptureScheduler::captureLoop()
+{
+    // All buffers are allocated before the loop
+    std::vector<AudioRecorder *> active(recorders);
+    std::vector<size_t> fdsOffsets(recorders.size());
+    std::vector<struct pollfd> fds;
+    {
+        size_t fdsCount = 0;
+        for (size_t i = 0; i < recorders.size(); ++i)
+            fdsCount += recorders[i]->getPollFdsCount();
+
+        fds.resize(fdsCount);
+    }
+
+    // One thread captures all devices, it gets the highest priority and all CPUs asked for
+    u_int priority = 0;
+    std::vector<u_int> cpus;
+    bool verbose = false;
+    for (size_t i = 0; i < recorders.size(); ++i)
+    {
+        if (priority < recorders[i]->getFifoPriority())
+            priority = recorders[i]->getFifoPriority();
+
+        const std::vector<u_int> &recorderCpus = recorders[i]->getCaptureCpus();
+        cpus.insert(cpus.end(), recorderCpus.begin(), recorderCpus.end());
+        verbose |= recorders[i]->isVerbose();
+    }
+
+    std::string errStr;
+    if (!cpus.empty() && !Realtime::pinThread(cpus, errStr))
+        ERR("Capture thread: " << errStr);
+
+    if (priority)
+    {
+        if (!Realtime::setFifo(priority, errStr))
+            ERR("Capture thread: " << errStr);
+
+        if (!Realtime::lockStack(errStr))
+            ERR("Capture thread: " << errStr);
+    }
+
+    // The thread is set up, all devices start streaming now. If one of them fails, the recording
+    // is finished, the started devices are stopped by recordFinish()
+    for (size_t i = 0; i < recorders.size(); ++i)
+    {
+        if (!recorders[i]->captureStart())
+            return;
+    }
+
+    // Nothing is allocated by the loop, unless a device fails
+    uint64_t allocations = Realtime::getThreadAllocations();
+
+    while (!active.empty())
+    {
+        // Take all available data and collect descriptors of devices waiting for the next period
+        size_t fdsCount = 0;
+        int timeoutMs = -1;
+
+        for (size_t i = 0; i < active.size(); )
+        {
+            if (active[i]->captureProcess() != AudioRecorder::CAPTURE_WAIT)
+            {
+                active.erase(active.begin() + i);
+                continue;
+            }
+
+            fdsOffsets[i] = fdsCount;
+            fdsCount += active[i]->getPollFds(&fds[fdsCount]);
+
+            int deviceTimeoutMs = active[i]->getWaitTimeoutMs();
+            if (timeoutMs < 0 || timeoutMs > deviceTimeoutMs)
+                timeoutMs = deviceTimeoutMs;
+
+            ++i;
+        }
+
+        if (active.empty())
+            break;
+
+        int res = poll(&fds[0], fdsCount, timeoutMs);
+        if (res < 0 && errno != EINTR)
+        {
+            ERR("poll() error: " << errno);
+            break;
+        }
+
+        if (res <= 0)
+            continue;
+
+        for (size_t i = 0; i < active.size(); ++i)
+            active[i]->handlePollEvents(&fds[fdsOffsets[i]]);
+    }
+
+    allocations = Realtime::getThreadAllocations() - allocations;
+    if (!Realtime::isAllocationCounted())
+        return;
+
+    if (priority && allocations)
+        ERR("Capture thread: " << allocations << " heap allocation(s) after the start!");
+    else if (priority && verbose)
+        INFO("Capture thread: SCHED_FIFO priority " << priority << ", no heap allocations after the start");
+}
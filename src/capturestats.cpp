@@ -0,0 +1,187 @@
+#include "capturestats.h"
+
+#include <time.h>
+
+#include <sstream>
+
+// Histogram
+// Public methods
+void Histogram::add(uint64_t value)
+{
+    u_int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    if (bucket >= BUCKETS_NUMBER)
+        bucket = BUCKETS_NUMBER - 1;
+
+    buckets[bucket].store(buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+
+    if (max.load(std::memory_order_relaxed) < value)
+        max.store(value, std::memory_order_relaxed);
+}
+
+void Histogram::reset()
+{
+    for (u_int i = 0; i < BUCKETS_NUMBER; ++i)
+        buckets[i].store(0, std::memory_order_relaxed);
+
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::getPercentile(double fraction)
+{
+    uint64_t total = getCount();
+    if (total == 0)
+        return 0;
+
+    uint64_t accumulated = 0;
+    for (u_int i = 0; i < BUCKETS_NUMBER; ++i)
+    {
+        accumulated += buckets[i].load(std::memory_order_relaxed);
+        if (accumulated >= fraction * total)
+        {
+            uint64_t bound = i == 0 ? 0 : (1ULL << i) - 1;
+            return bound < getMax() ? bound : getMax();
+        }
+    }
+
+    return getMax();
+}
+
+void Histogram::toJson(std::string &json)
+{
+    uint64_t total = getCount();
+
+    std::stringstream ss;
+    ss << "{\"count\":" << total
+       << ",\"mean\":" << (total ? sum.load(std::memory_order_relaxed) / total : 0)
+       << ",\"p50\":" << getPercentile(0.5)
+       << ",\"p99\":" << getPercentile(0.99)
+       << ",\"max\":" << getMax()
+       << ",\"buckets\":[";
+
+    // Trailing empty buckets are omitted
+    u_int last = BUCKETS_NUMBER;
+    while (last > 0 && buckets[last - 1].load(std::memory_order_relaxed) == 0)
+        --last;
+
+    for (u_int i = 0; i < last; ++i)
+        ss << (i ? "," : "") << buckets[i].load(std::memory_order_relaxed);
+
+    ss << "]}";
+    json += ss.str();
+}
+
+
+// CaptureStats
+// Public members
+CaptureStats::CaptureStats()
+{
+    reset(0);
+}
+
+
+// Public methods
+void CaptureStats::reset(uint64_t startNs)
+{
+    this->startNs = startNs;
+
+    capturedFrames.store(0, std::memory_order_relaxed);
+    xruns.store(0, std::memory_order_relaxed);
+    suspends.store(0, std::memory_order_relaxed);
+    xrunFramesLost.store(0, std::memory_order_relaxed);
+    ringFramesLost.store(0, std::memory_order_relaxed);
+    availFrames.reset();
+    chunkFrames.reset();
+
+    pushedPos = 0;
+    marksHead.store(0, std::memory_order_relaxed);
+    marksTail.store(0, std::memory_order_relaxed);
+
+    writtenPos = 0;
+    writtenBytes.store(0, std::memory_order_relaxed);
+    writeLatencyUs.reset();
+    captureToDiskUs.reset();
+}
+
+void CaptureStats::addPush(uint64_t bytesNumber, uint64_t captureNs)
+{
+    pushedPos += bytesNumber;
+
+    uint64_t head = marksHead.load(std::memory_order_relaxed);
+    if (head - marksTail.load(std::memory_order_acquire) == MARKS_NUMBER)
+        return;
+
+    marks[head % MARKS_NUMBER].endPos = pushedPos;
+    marks[head % MARKS_NUMBER].captureNs = captureNs;
+    marksHead.store(head + 1, std::memory_order_release);
+}
+
+void CaptureStats::addWrite(uint64_t latencyNs, uint64_t bytesNumber)
+{
+    writeLatencyUs.add(latencyNs / 1000);
+    writtenPos += bytesNumber;
+    inc(writtenBytes, bytesNumber);
+
+    // Chunks which are completely written
+    uint64_t now = 0;
+    uint64_t tail = marksTail.load(std::memory_order_relaxed);
+    uint64_t head = marksHead.load(std::memory_order_acquire);
+    for (; tail != head && marks[tail % MARKS_NUMBER].endPos <= writtenPos; ++tail)
+    {
+        if (now == 0)
+            now = nowNs();
+
+        uint64_t captureNs = marks[tail % MARKS_NUMBER].captureNs;
+        captureToDiskUs.add(now > captureNs ? (now - captureNs) / 1000 : 0);
+    }
+
+    marksTail.store(tail, std::memory_order_release);
+}
+
+std::string CaptureStats::toJson(const std::string &deviceId, uint64_t nowNs, uint64_t ringFill, uint64_t ringHighWaterMark)
+{
+    std::string json = "{\"device\":\"";
+
+    for (size_t i = 0; i < deviceId.size(); ++i)
+    {
+        if (deviceId[i] == '"' || deviceId[i] == '\\')
+            json += '\\';
+
+        json += deviceId[i];
+    }
+
+    std::stringstream ss;
+    ss << "\",\"time_ms\":" << (nowNs > startNs ? (nowNs - startNs) / 1000000 : 0)
+       << ",\"frames\":" << capturedFrames.load(std::memory_order_relaxed)
+       << ",\"xruns\":" << xruns.load(std::memory_order_relaxed)
+       << ",\"suspends\":" << suspends.load(std::memory_order_relaxed)
+       << ",\"xrun_frames_lost\":" << xrunFramesLost.load(std::memory_order_relaxed)
+       << ",\"ring_frames_lost\":" << ringFramesLost.load(std::memory_order_relaxed)
+       << ",\"ring_fill\":" << ringFill
+       << ",\"ring_hwm\":" << ringHighWaterMark
+       << ",\"written_bytes\":" << writtenBytes.load(std::memory_order_relaxed);
+    json += ss.str();
+
+    json += ",\"avail_frames\":";
+    availFrames.toJson(json);
+    json += ",\"chunk_frames\":";
+    chunkFrames.toJson(json);
+    json += ",\"write_us\":";
+    writeLatencyUs.toJson(json);
+    json += ",\"capture_to_disk_us\":";
+    captureToDiskUs.toJson(json);
+    json += '}';
+
+    return json;
+}
+
+uint64_t CaptureStats::nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,373 @@
+#include "deviceenumerator.h"
+#include "debug.h"
+
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <sstream>
+
+namespace
+{
+    const struct
+    {
+        SampleFormat::Id format;
+        snd_pcm_format_t alsaFormat;
+    } supportedFormats[] =
+    {
+        {SampleFormat::S16_LE,   SND_PCM_FORMAT_S16_LE},
+        {SampleFormat::S24_3LE,  SND_PCM_FORMAT_S24_3LE},
+        {SampleFormat::S32_LE,   SND_PCM_FORMAT_S32_LE},
+        {SampleFormat::FLOAT_LE, SND_PCM_FORMAT_FLOAT_LE}
+    };
+
+    void appendJsonString(std::string &json, const std::string &str)
+    {
+        json += '"';
+        for (size_t i = 0; i < str.size(); ++i)
+        {
+            if (str[i] == '"' || str[i] == '\\')
+                json += '\\';
+
+            json += str[i];
+        }
+        json += '"';
+    }
+}
+
+// Public members
+DeviceEnumerator::DeviceEnumerator() :
+    cached(false),
+    generation(0),
+    inotifyFd(-1)
+{
+    stopPipe[0] = stopPipe[1] = -1;
+}
+
+DeviceEnumerator::~DeviceEnumerator()
+{
+    stopMonitor();
+}
+
+
+// Public methods
+std::vector<AudioDeviceInfo> DeviceEnumerator::getDevices()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cached)
+            return devices;
+    }
+
+    refresh();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return devices;
+}
+
+void DeviceEnumerator::refresh()
+{
+    std::vector<int> cards;
+    for (int card = -1; snd_card_next(&card) == 0 && card >= 0; )
+        cards.push_back(card);
+
+    // Every card is probed by its own thread into its own list
+    std::vector<std::vector<AudioDeviceInfo> > cardDevices(cards.size());
+    std::vector<std::thread> probers;
+
+    for (size_t i = 0; i < cards.size(); ++i)
+        probers.push_back(std::thread(probeCard, cards[i], &cardDevices[i]));
+
+    for (size_t i = 0; i < probers.size(); ++i)
+        probers[i].join();
+
+    std::vector<AudioDeviceInfo> result;
+    for (size_t i = 0; i < cardDevices.size(); ++i)
+        result.insert(result.end(), cardDevices[i].begin(), cardDevices[i].end());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    devices.swap(result);
+    cached = true;
+    ++generation;
+}
+
+bool DeviceEnumerator::startMonitor()
+{
+    if (monitorThread.joinable())
+        return true;
+
+    // Device nodes are created and removed by the kernel (and udev) on hotplug
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0 || inotify_add_watch(inotifyFd, "/dev/snd", IN_CREATE | IN_DELETE | IN_ATTRIB) < 0)
+    {
+        ERR("Can not watch /dev/snd, audio devices list is not updated on hotplug!");
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+
+        inotifyFd = -1;
+        return false;
+    }
+
+    if (pipe2(stopPipe, O_CLOEXEC) != 0)
+    {
+        close(inotifyFd);
+        inotifyFd = -1;
+        return false;
+    }
+
+    monitorThread = std::thread(&DeviceEnumerator::monitorLoop, this);
+
+    return true;
+}
+
+void DeviceEnumerator::stopMonitor()
+{
+    if (!monitorThread.joinable())
+        return;
+
+    char c = 0;
+    if (write(stopPipe[1], &c, 1) != 1)
+        ERR("Can not stop devices monitor!");
+
+    monitorThread.join();
+
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    close(inotifyFd);
+    stopPipe[0] = stopPipe[1] = inotifyFd = -1;
+}
+
+std::vector<std::string> DeviceEnumerator::toText(const std::vector<AudioDeviceInfo> &devices)
+{
+    std::vector<std::string> lines;
+
+    for (size_t i = 0; i < devices.size(); ++i)
+    {
+        const AudioDeviceInfo &dev = devices[i];
+
+        if (i == 0 || devices[i - 1].card != dev.card)
+        {
+            std::stringstream ss;
+            ss << "Card " << dev.card << ": " << dev.cardName << ':';
+            lines.push_back(ss.str());
+        }
+
+        for (int stream = 0; stream < 2; ++stream)
+        {
+            const AudioStreamCaps &caps = stream ? dev.capture : dev.playback;
+            if (!caps.present)
+                continue;
+
+            std::stringstream ss;
+            ss << '\t' << dev.name << ": " << dev.id << " - " << (stream ? "capture" : "playback");
+
+            if (!caps.probed)
+                ss << ", busy";
+            else
+            {
+                ss << ", " << caps.minChans << '-' << caps.maxChans << " channels, "
+                   << caps.minRate << '-' << caps.maxRate << " Hz,";
+
+                for (size_t f = 0; f < caps.formats.size(); ++f)
+                    ss << ' ' << SampleFormat::getName(caps.formats[f]);
+            }
+
+            lines.push_back(ss.str());
+        }
+    }
+
+    return lines;
+}
+
+std::string DeviceEnumerator::toJson(const AudioDeviceInfo &device)
+{
+    std::stringstream ss;
+    ss << "{\"card\":" << device.card << ",\"device\":" << device.device;
+
+    std::string json = ss.str();
+    json += ",\"card_name\":";
+    appendJsonString(json, device.cardName);
+    json += ",\"name\":";
+    appendJsonString(json, device.name);
+    json += ",\"id\":";
+    appendJsonString(json, device.id);
+    json += ",\"playback\":";
+    capsToJson(device.playback, json);
+    json += ",\"capture\":";
+    capsToJson(device.capture, json);
+    json += '}';
+
+    return json;
+}
+
+
+// Private methods
+void DeviceEnumerator::probeCard(int card, std::vector<AudioDeviceInfo> *cardDevices)
+{
+    std::stringstream ss;
+    ss << "hw:" << card;
+
+    snd_ctl_t *ctl = NULL;
+    if (snd_ctl_open(&ctl, ss.str().c_str(), 0) != 0)
+        return;
+
+    std::string cardName;
+    snd_ctl_card_info_t *cardInfo = NULL;
+    if (snd_ctl_card_info_malloc(&cardInfo) == 0)
+    {
+        if (snd_ctl_card_info(ctl, cardInfo) == 0)
+            cardName = snd_ctl_card_info_get_name(cardInfo);
+
+        snd_ctl_card_info_free(cardInfo);
+    }
+
+    snd_pcm_info_t *pcmInfo;
+    snd_pcm_info_alloca(&pcmInfo);
+
+    for (int device = -1; snd_ctl_pcm_next_device(ctl, &device) == 0 && device >= 0; )
+    {
+        AudioDeviceInfo dev;
+        dev.card = card;
+        dev.device = device;
+        dev.cardName = cardName;
+
+        std::stringstream idSs;
+        idSs << card << ',' << device;
+        dev.id = "plughw:" + idSs.str();
+
+        for (int stream = 0; stream < 2; ++stream)
+        {
+            AudioStreamCaps &caps = stream ? dev.capture : dev.playback;
+            caps.present = false;
+            caps.probed = false;
+            caps.minRate = caps.maxRate = caps.minChans = caps.maxChans = 0;
+
+            snd_pcm_info_set_device(pcmInfo, device);
+            snd_pcm_info_set_subdevice(pcmInfo, 0);
+            snd_pcm_info_set_stream(pcmInfo, stream ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK);
+
+            if (snd_ctl_pcm_info(ctl, pcmInfo) != 0)
+                continue;
+
+            caps.present = true;
+            dev.name = snd_pcm_info_get_name(pcmInfo);
+
+            // The hardware device shows what the card itself supports
+            probeStream("hw:" + idSs.str(), !stream, caps);
+        }
+
+        if (dev.playback.present || dev.capture.present)
+            cardDevices->push_back(dev);
+    }
+
+    snd_ctl_close(ctl);
+}
+
+void DeviceEnumerator::probeStream(const std::string &hwId, bool playback, AudioStreamCaps &caps)
+{
+    // A device used by somebody else is not waited for
+    snd_pcm_t *pcm = NULL;
+    if (snd_pcm_open(&pcm, hwId.c_str(), playback ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK) != 0)
+        return;
+
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_alloca(&params);
+
+    if (snd_pcm_hw_params_any(pcm, params) >= 0)
+    {
+        int dir = 0;
+        snd_pcm_hw_params_get_rate_min(params, &caps.minRate, &dir);
+        snd_pcm_hw_params_get_rate_max(params, &caps.maxRate, &dir);
+        snd_pcm_hw_params_get_channels_min(params, &caps.minChans);
+        snd_pcm_hw_params_get_channels_max(params, &caps.maxChans);
+
+        for (size_t i = 0; i < sizeof(supportedFormats) / sizeof(supportedFormats[0]); ++i)
+            if (snd_pcm_hw_params_test_format(pcm, params, supportedFormats[i].alsaFormat) == 0)
+                caps.formats.push_back(supportedFormats[i].format);
+
+        caps.probed = true;
+    }
+
+    snd_pcm_close(pcm);
+}
+
+void DeviceEnumerator::capsToJson(const AudioStreamCaps &caps, std::string &json)
+{
+    if (!caps.present)
+    {
+        json += "null";
+        return;
+    }
+
+    std::stringstream ss;
+    ss << "{\"probed\":" << (caps.probed ? "true" : "false");
+
+    if (caps.probed)
+    {
+        ss << ",\"rates\":[" << caps.minRate << ',' << caps.maxRate << ']'
+           << ",\"channels\":[" << caps.minChans << ',' << caps.maxChans << ']'
+           << ",\"formats\":[";
+
+        for (size_t i = 0; i < caps.formats.size(); ++i)
+            ss << (i ? "," : "") << '"' << SampleFormat::getName(caps.formats[i]) << '"';
+
+        ss << ']';
+    }
+
+    ss << '}';
+    json += ss.str();
+}
+
+void DeviceEnumerator::monitorLoop()
+{
+    struct pollfd fds[2];
+    fds[0].fd = inotifyFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopPipe[0];
+    fds[1].events = POLLIN;
+
+    bool changed = false;
+
+    for (;;)
+    {
+        // After a change, wait until the nodes settle, then enumerate once
+        int res = poll(fds, 2, changed ? MONITOR_SETTLE_MS : -1);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            ERR("Devices monitor poll() error: " << errno);
+            return;
+        }
+
+        if (fds[1].revents)
+            return;
+
+        if (res == 0)
+        {
+            changed = false;
+            refresh();
+            continue;
+        }
+
+        // Only control and PCM nodes matter, e.g. not timers or sequencers
+        alignas(struct inotify_event) char buf[4096];
+        ssize_t size;
+        while ((size = read(inotifyFd, buf, sizeof(buf))) > 0)
+        {
+            for (char *p = buf; p < buf + size; )
+            {
+                struct inotify_event *event = (struct inotify_event *)p;
+                if (event->len && (strncmp(event->name, "controlC", 8) == 0 || strncmp(event->name, "pcmC", 4) == 0))
+                    changed = true;
+
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+}
@@ -0,0 +1,369 @@
+#include "directwriter.h"
+#include "capturestats.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef AUDIORECORDING_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+// Public members
+DirectWriter::DirectWriter() :
+    fd(-1),
+    direct(false),
+    pos(0),
+    submitted(0),
+    completed(0),
+    ringFd(-1),
+    fixedBuf(false),
+    buf(NULL),
+    bufSize(0),
+    sqMap(NULL),
+    sqMapSize(0),
+    cqMap(NULL),
+    cqMapSize(0),
+    sqesMap(NULL),
+    sqesMapSize(0)
+{
+}
+
+DirectWriter::~DirectWriter()
+{
+    close();
+    stop();
+}
+
+
+// Public methods
+void DirectWriter::start(const char *buf, size_t bufSize)
+{
+    if (isUring() && this->buf == buf && this->bufSize == bufSize)
+        return;
+
+    stop();
+
+    this->buf = buf;
+    this->bufSize = bufSize;
+
+    if (!setupUring())
+        closeUring();
+}
+
+void DirectWriter::stop()
+{
+    closeUring();
+    buf = NULL;
+    bufSize = 0;
+}
+
+bool DirectWriter::open(const std::string &fileName)
+{
+    close();
+
+    // Some file systems (e.g. tmpfs) do not support O_DIRECT, they are written through the page cache
+    direct = true;
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == EINVAL)
+    {
+        direct = false;
+        fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+
+    if (fd < 0)
+    {
+        errStr = "Can not open output file: \"" + fileName + "\"!";
+        ERR(errStr);
+        return false;
+    }
+
+    pos = 0;
+    submitted = completed = 0;
+    errStr.clear();
+
+    return true;
+}
+
+bool DirectWriter::submit(const char *data, size_t size)
+{
+    if (getInFlight() == QUEUE_DEPTH)
+        return false;
+
+    Slot &slot = slots[submitted % QUEUE_DEPTH];
+    slot.data = data;
+    slot.offset = pos;
+    slot.size = size;
+    slot.startNs = CaptureStats::nowNs();
+    slot.done = false;
+
+#ifdef AUDIORECORDING_IO_URING
+    if (isUring())
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        struct io_uring_sqe *sqe = (struct io_uring_sqe *)sqes + index;
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = fixedBuf ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)data;
+        sqe->len = size;
+        sqe->off = pos;
+        sqe->buf_index = 0;
+        sqe->user_data = submitted;
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        if (syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, NULL, 0) != 1)
+        {
+            errStr = "io_uring write submission error!";
+            ERR(errStr << ' ' << errno);
+            return false;
+        }
+
+        pos += size;
+        ++submitted;
+        return true;
+    }
+#endif
+
+    // Synchronous fallback, the write is completed at once
+    slot.res = pwriteAll(data, size, pos) ? size : -EIO;
+    slot.done = true;
+    pos += size;
+    ++submitted;
+
+    return slot.res >= 0;
+}
+
+bool DirectWriter::reap(bool wait, size_t *size, uint64_t *latencyNs)
+{
+#ifdef AUDIORECORDING_IO_URING
+    if (isUring() && getInFlight())
+    {
+        if (wait && __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) == *cqHead)
+            syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        unsigned head = *cqHead;
+        for (unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE); head != tail; ++head)
+        {
+            struct io_uring_cqe *cqe = (struct io_uring_cqe *)cqes + (head & *cqMask);
+            complete(cqe->user_data, cqe->res);
+        }
+
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+#else
+    (void)wait;
+#endif
+
+    // Only the writes completed in order release their data
+    *size = 0;
+    uint64_t now = 0;
+
+    for (; completed < submitted && slots[completed % QUEUE_DEPTH].done; ++completed)
+    {
+        Slot &slot = slots[completed % QUEUE_DEPTH];
+
+        // The failed write is finished, but its data is not released
+        if (slot.res < 0 || (size_t)slot.res != slot.size)
+        {
+            errStr = slot.res < 0 ? std::string("Output file writing error: ") + strerror(-slot.res) : "Output file short write!";
+            ERR(errStr);
+            ++completed;
+            return false;
+        }
+
+        if (latencyNs)
+        {
+            if (now == 0)
+                now = CaptureStats::nowNs();
+
+            if (*latencyNs < now - slot.startNs)
+                *latencyNs = now - slot.startNs;
+        }
+
+        *size += slot.size;
+    }
+
+    return true;
+}
+
+bool DirectWriter::writeTail(const char *data, size_t size)
+{
+    if (size == 0)
+        return true;
+
+    // The size is not aligned, the rest of the file is written through the page cache
+    if (direct)
+    {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) != 0)
+        {
+            errStr = "Can not switch off O_DIRECT!";
+            ERR(errStr);
+            return false;
+        }
+
+        direct = false;
+    }
+
+    if (!pwriteAll(data, size, pos))
+        return false;
+
+    pos += size;
+
+    return true;
+}
+
+bool DirectWriter::close()
+{
+    if (fd < 0)
+        return true;
+
+    // Every write is waited for, the failed ones too
+    size_t size;
+    while (getInFlight())
+        reap(true, &size);
+
+    bool res = errStr.empty();
+
+    ::close(fd);
+    fd = -1;
+
+    return res;
+}
+
+
+// Private methods
+bool DirectWriter::setupUring()
+{
+#ifdef AUDIORECORDING_IO_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params);
+    if (ringFd < 0)
+        return false;
+
+    sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels map both rings at once
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqMapSize = cqMapSize = sqMapSize > cqMapSize ? sqMapSize : cqMapSize;
+
+    sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED)
+    {
+        sqMap = NULL;
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cqMap = sqMap;
+    else
+    {
+        cqMap = mmap(NULL, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED)
+        {
+            cqMap = NULL;
+            return false;
+        }
+    }
+
+    sqesMapSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqesMap = mmap(NULL, sqesMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqesMap == MAP_FAILED)
+    {
+        sqesMap = NULL;
+        return false;
+    }
+
+    char *sq = (char *)sqMap;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + params.sq_off.array);
+    sqes = sqesMap;
+
+    char *cq = (char *)cqMap;
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    // The registered buffer is pinned once, instead of on every write.
+    // It may fail because of RLIMIT_MEMLOCK, then the buffer is passed with every write.
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = bufSize;
+    fixedBuf = buf && syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void DirectWriter::closeUring()
+{
+    if (sqesMap)
+        munmap(sqesMap, sqesMapSize);
+
+    if (cqMap && cqMap != sqMap)
+        munmap(cqMap, cqMapSize);
+
+    if (sqMap)
+        munmap(sqMap, sqMapSize);
+
+    sqesMap = cqMap = sqMap = NULL;
+
+    if (ringFd >= 0)
+        ::close(ringFd);
+
+    ringFd = -1;
+    fixedBuf = false;
+}
+
+bool DirectWriter::pwriteAll(const char *data, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t res = pwrite(fd, data, size, offset);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            errStr = std::string("Output file writing error: ") + strerror(errno);
+            ERR(errStr);
+            return false;
+        }
+
+        data += res;
+        size -= res;
+        offset += res;
+    }
+
+    return true;
+}
+
+void DirectWriter::complete(uint64_t index, int res)
+{
+    Slot &slot = slots[index % QUEUE_DEPTH];
+
+    // A short write is finished synchronously, it is rare for regular files
+    if (res >= 0 && (size_t)res < slot.size)
+        res = pwriteAll(slot.data + res, slot.size - res, slot.offset + res) ? slot.size : -EIO;
+
+    slot.res = res;
+    slot.done = true;
+}
@@ -0,0 +1,287 @@
+#include "flacencoder.h"
+#include "debug.h"
+
+#include <string.h>
+
+// Public members
+FlacEncoder::FlacEncoder() :
+    file(NULL),
+    format(SampleFormat::S16_LE),
+    chansNumber(0),
+    sampleRate(0),
+    bits(0),
+    fillFrames(0),
+    submitted(0),
+    taken(0),
+    written(0),
+    stopping(false),
+    totalFrames(0),
+    minFrameSize(0),
+    maxFrameSize(0)
+{
+}
+
+FlacEncoder::~FlacEncoder()
+{
+    stopWorkers();
+}
+
+
+// Public methods
+bool FlacEncoder::isFormatSupported(SampleFormat::Id format, u_int chansNumber)
+{
+    // The format allows up to 8 channels. 32-bit and float samples are not supported,
+    // integer 32-bit residuals and side channels may not fit into 32 bits.
+    return (format == SampleFormat::S16_LE || format == SampleFormat::S24_3LE) && chansNumber >= 1 && chansNumber <= 8;
+}
+
+bool FlacEncoder::open(OutputFile *file, SampleFormat::Id format, u_int chansNumber, u_int sampleRate)
+{
+    if (!isFormatSupported(format, chansNumber))
+    {
+        errStr = "FLAC output supports S16_LE and S24_3LE with 1 to 8 channels!";
+        ERR(errStr);
+        return false;
+    }
+
+    this->file = file;
+    this->format = format;
+    this->chansNumber = chansNumber;
+    this->sampleRate = sampleRate;
+    bits = SampleFormat::getBits(format);
+
+    fillFrames = 0;
+    totalFrames = 0;
+    minFrameSize = 0;
+    maxFrameSize = 0;
+
+    startWorkers();
+
+    // All blocks are allocated here, so encoding does not allocate
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        jobs[i].samples.resize(BLOCK_SIZE * chansNumber);
+        jobs[i].out.reserve(BLOCK_SIZE * chansNumber * SampleFormat::getBytes(format) + 1024);
+    }
+
+    uint8_t header[STREAM_HEADER_SIZE];
+    makeStreamHeader(header);
+
+    if (!file->write(header, sizeof(header)))
+    {
+        errStr = file->getLastErrorInfo();
+        return false;
+    }
+
+    return true;
+}
+
+bool FlacEncoder::write(const void *data, size_t framesNumber)
+{
+    const char *in = (const char *)data;
+    size_t frameSize = SampleFormat::getBytes(format) * chansNumber;
+
+    while (framesNumber > 0)
+    {
+        size_t frames = BLOCK_SIZE - fillFrames;
+        if (frames > framesNumber)
+            frames = framesNumber;
+
+        if (format == SampleFormat::S16_LE)
+            deinterleave<SampleS16>(in, fillFrames, frames);
+        else
+            deinterleave<SampleS24>(in, fillFrames, frames);
+
+        in += frames * frameSize;
+        framesNumber -= frames;
+        fillFrames += frames;
+
+        if (fillFrames == BLOCK_SIZE)
+        {
+            submitJob();
+
+            // The next job must be written before it is filled again
+            if (!writeJobs(submitted >= jobs.size() ? submitted - jobs.size() + 1 : 0))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool FlacEncoder::close()
+{
+    if (fillFrames > 0)
+        submitJob();
+
+    if (!writeJobs(submitted))
+        return false;
+
+    // Patch STREAMINFO with the stream length and frame sizes
+    uint8_t header[STREAM_HEADER_SIZE];
+    makeStreamHeader(header);
+
+    if (!file->writeAt(0, header, sizeof(header)))
+    {
+        errStr = "Can not update FLAC STREAMINFO: " + file->getLastErrorInfo();
+        return false;
+    }
+
+    return true;
+}
+
+
+// Private methods
+template <class Sample>
+void FlacEncoder::deinterleave(const char *in, size_t offset, size_t framesNumber)
+{
+    int32_t *samples = &jobs[submitted % jobs.size()].samples[0];
+
+    for (size_t i = 0; i < framesNumber; ++i)
+        for (u_int ch = 0; ch < chansNumber; ++ch, in += Sample::SIZE)
+            samples[ch * BLOCK_SIZE + offset + i] = Sample::load(in);
+}
+
+void FlacEncoder::makeStreamHeader(uint8_t *header)
+{
+    BitWriter out;
+
+    out.writeBits(0x664C6143, 32);          // "fLaC"
+    out.writeBits(0x80, 8);                 // The last metadata block, STREAMINFO
+    out.writeBits(34, 24);
+    out.writeBits(BLOCK_SIZE, 16);          // Minimum and maximum block sizes
+    out.writeBits(BLOCK_SIZE, 16);
+    out.writeBits(minFrameSize, 24);
+    out.writeBits(maxFrameSize, 24);
+    out.writeBits(sampleRate, 20);
+    out.writeBits(chansNumber - 1, 3);
+    out.writeBits(bits - 1, 5);
+    out.writeBits(totalFrames >> 32, 4);
+    out.writeBits(totalFrames, 32);
+
+    // MD5 of the samples is not calculated, zero means "unknown"
+    for (int i = 0; i < 4; ++i)
+        out.writeBits(0, 32);
+
+    memcpy(header, out.getData(), STREAM_HEADER_SIZE);
+}
+
+void FlacEncoder::startWorkers()
+{
+    if (!workers.empty())
+        return;
+
+    u_int workersNumber = std::thread::hardware_concurrency();
+    if (workersNumber < 1)
+        workersNumber = 1;
+
+    jobs.resize(workersNumber * JOBS_PER_WORKER);
+    submitted = taken = written = 0;
+    stopping = false;
+
+    for (u_int i = 0; i < workersNumber; ++i)
+        workers.push_back(std::thread(&FlacEncoder::workerLoop, this));
+}
+
+void FlacEncoder::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    workCond.notify_all();
+
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    workers.clear();
+}
+
+void FlacEncoder::submitJob()
+{
+    Job &job = jobs[submitted % jobs.size()];
+
+    // The last block is shorter, its channels are packed together
+    if (fillFrames < BLOCK_SIZE)
+        for (u_int ch = 1; ch < chansNumber; ++ch)
+            memmove(&job.samples[ch * fillFrames], &job.samples[ch * BLOCK_SIZE], fillFrames * sizeof(int32_t));
+
+    // All blocks but the last one are full, so the frame number is known from the length
+    job.framesNumber = fillFrames;
+    job.frameIndex = totalFrames / BLOCK_SIZE;
+    job.done = false;
+    totalFrames += fillFrames;
+    fillFrames = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++submitted;
+    }
+
+    workCond.notify_one();
+}
+
+void FlacEncoder::workerLoop()
+{
+    // Every worker has its own scratch buffers
+    FlacFrameEncoder encoder;
+
+    for (;;)
+    {
+        Job *job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workCond.wait(lock, [this]() { return stopping || taken < submitted; });
+
+            if (taken == submitted)
+                return;
+
+            job = &jobs[taken++ % jobs.size()];
+        }
+
+        encoder.encode(&job->samples[0], job->framesNumber, chansNumber, bits, sampleRate, job->frameIndex, job->out);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job->done = true;
+        }
+
+        doneCond.notify_all();
+    }
+}
+
+bool FlacEncoder::writeJobs(uint64_t minWritten)
+{
+    while (written < submitted)
+    {
+        Job &job = jobs[written % jobs.size()];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!job.done)
+            {
+                if (written >= minWritten)
+                    break;
+
+                doneCond.wait(lock, [&job]() { return job.done; });
+            }
+        }
+
+        size_t size = job.out.getSize();
+        if (!file->write(job.out.getData(), size))
+        {
+            errStr = file->getLastErrorInfo();
+            return false;
+        }
+
+        if (minFrameSize == 0 || minFrameSize > size)
+            minFrameSize = size;
+
+        if (maxFrameSize < size)
+            maxFrameSize = size;
+
+        ++written;
+    }
+
+    return true;
+}
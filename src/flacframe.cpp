@@ -0,0 +1,607 @@
+#include "flacframe.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace
+{
+    // CRC-8, polynomial x^8 + x^2 + x + 1, used by the frame header
+    uint8_t crc8(const uint8_t *data, size_t size)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; ++bit)
+                crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+
+        return crc;
+    }
+
+    // CRC-16, polynomial x^16 + x^15 + x^2 + 1, used by the whole frame
+    struct Crc16Table
+    {
+        uint16_t values[256];
+
+        Crc16Table()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                uint16_t crc = i << 8;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = crc & 0x8000 ? (crc << 1) ^ 0x8005 : crc << 1;
+
+                values[i] = crc;
+            }
+        }
+    };
+
+    uint16_t crc16(const uint8_t *data, size_t size)
+    {
+        static const Crc16Table table;
+
+        uint16_t crc = 0;
+        for (size_t i = 0; i < size; ++i)
+            crc = (crc << 8) ^ table.values[(crc >> 8) ^ data[i]];
+
+        return crc;
+    }
+
+    inline uint32_t zigzag(int32_t value)
+    {
+        return (uint32_t)value << 1 ^ (uint32_t)(value >> 31);
+    }
+
+    // Frame header codes, 0 means "see STREAMINFO"
+    u_int sampleRateCode(u_int sampleRate)
+    {
+        switch (sampleRate)
+        {
+            case 88200:  return 1;
+            case 176400: return 2;
+            case 192000: return 3;
+            case 8000:   return 4;
+            case 16000:  return 5;
+            case 22050:  return 6;
+            case 24000:  return 7;
+            case 32000:  return 8;
+            case 44100:  return 9;
+            case 48000:  return 10;
+            case 96000:  return 11;
+            default:     return 0;
+        }
+    }
+
+    u_int sampleSizeCode(u_int bits)
+    {
+        switch (bits)
+        {
+            case 8:  return 1;
+            case 12: return 2;
+            case 16: return 4;
+            case 20: return 5;
+            case 24: return 6;
+            case 32: return 7;
+            default: return 0;
+        }
+    }
+
+    // Channel assignment of stereo frames
+    const u_int CHANS_LEFT_SIDE = 8;
+    const u_int CHANS_RIGHT_SIDE = 9;
+    const u_int CHANS_MID_SIDE = 10;
+}
+
+
+// BitWriter
+void BitWriter::alignToByte()
+{
+    if (accBits > 0)
+        writeBits(0, 8 - accBits);
+}
+
+void BitWriter::writeBits(uint32_t value, u_int bits)
+{
+    if (bits == 0)
+        return;
+
+    acc = acc << bits | (value & (bits < 32 ? (1u << bits) - 1 : 0xFFFFFFFF));
+    accBits += bits;
+    bitsNumber += bits;
+
+    while (accBits >= 8)
+    {
+        accBits -= 8;
+        buf.push_back(acc >> accBits);
+    }
+}
+
+void BitWriter::writeRice(int32_t value, u_int param)
+{
+    uint32_t u = zigzag(value);
+    uint32_t quotient = u >> param;
+
+    // Unary quotient, stop bit and the low bits in one write if they fit
+    if (quotient + 1 + param <= 32)
+    {
+        writeBits((1u << param) | (u & ((1u << param) - 1)), quotient + 1 + param);
+        return;
+    }
+
+    for (; quotient >= 32; quotient -= 32)
+        writeBits(0, 32);
+
+    writeBits(0, quotient);
+    writeBits(1, 1);
+    writeBits(u, param);
+}
+
+void BitWriter::writeUtf8(uint64_t value)
+{
+    if (value < 0x80)
+    {
+        writeBits(value, 8);
+        return;
+    }
+
+    // Number of continuation bytes
+    int extra = value < 0x800 ? 1 : value < 0x10000 ? 2 : value < 0x200000 ? 3 :
+                value < 0x4000000 ? 4 : value < 0x80000000 ? 5 : 6;
+
+    writeBits((0xFF00 >> (extra + 1) & 0xFF) | (uint32_t)(value >> (6 * extra)), 8);
+    for (int i = extra - 1; i >= 0; --i)
+        writeBits(0x80 | (value >> (6 * i) & 0x3F), 8);
+}
+
+
+// FlacFrameEncoder
+// Public members
+FlacFrameEncoder::FlacFrameEncoder()
+{
+    midSide[0].resize(MAX_BLOCK_SIZE);
+    midSide[1].resize(MAX_BLOCK_SIZE);
+
+    for (int i = 0; i < 4; ++i)
+        subframes[i].residual.resize(MAX_BLOCK_SIZE);
+
+    candidate.residual.resize(MAX_BLOCK_SIZE);
+    windowed.resize(MAX_BLOCK_SIZE);
+    partitionSums.resize(1 << MAX_PARTITION_ORDER);
+}
+
+
+// Public methods
+void FlacFrameEncoder::encode(const int32_t *samples, size_t framesNumber, u_int chansNumber, u_int bits,
+                              u_int sampleRate, uint64_t frameIndex, BitWriter &out)
+{
+    out.clear();
+
+    // Stereo: try all decorrelations, the side channel needs one more bit
+    if (chansNumber == 2 && bits < 32)
+    {
+        const int32_t *left = samples;
+        const int32_t *right = samples + framesNumber;
+        int32_t *mid = &midSide[0][0];
+        int32_t *side = &midSide[1][0];
+
+        for (size_t i = 0; i < framesNumber; ++i)
+        {
+            mid[i] = (left[i] + right[i]) >> 1;
+            side[i] = left[i] - right[i];
+        }
+
+        analyzeSubframe(left, framesNumber, bits, subframes[0]);
+        analyzeSubframe(right, framesNumber, bits, subframes[1]);
+        analyzeSubframe(mid, framesNumber, bits, subframes[2]);
+        analyzeSubframe(side, framesNumber, bits + 1, subframes[3]);
+
+        uint64_t leftRight = subframes[0].bitsNumber + subframes[1].bitsNumber;
+        uint64_t leftSide = subframes[0].bitsNumber + subframes[3].bitsNumber;
+        uint64_t rightSide = subframes[1].bitsNumber + subframes[3].bitsNumber;
+        uint64_t midSideBits = subframes[2].bitsNumber + subframes[3].bitsNumber;
+        uint64_t best = std::min(std::min(leftRight, leftSide), std::min(rightSide, midSideBits));
+
+        if (best == leftRight)
+        {
+            writeFrameHeader(framesNumber, 1, bits, sampleRate, frameIndex, out);
+            writeSubframe(left, framesNumber, bits, subframes[0], out);
+            writeSubframe(right, framesNumber, bits, subframes[1], out);
+        }
+        else if (best == leftSide)
+        {
+            writeFrameHeader(framesNumber, CHANS_LEFT_SIDE, bits, sampleRate, frameIndex, out);
+            writeSubframe(left, framesNumber, bits, subframes[0], out);
+            writeSubframe(side, framesNumber, bits + 1, subframes[3], out);
+        }
+        else if (best == rightSide)
+        {
+            writeFrameHeader(framesNumber, CHANS_RIGHT_SIDE, bits, sampleRate, frameIndex, out);
+            writeSubframe(side, framesNumber, bits + 1, subframes[3], out);
+            writeSubframe(right, framesNumber, bits, subframes[1], out);
+        }
+        else
+        {
+            writeFrameHeader(framesNumber, CHANS_MID_SIDE, bits, sampleRate, frameIndex, out);
+            writeSubframe(mid, framesNumber, bits, subframes[2], out);
+            writeSubframe(side, framesNumber, bits + 1, subframes[3], out);
+        }
+    }
+    else
+    {
+        // Independent channels
+        writeFrameHeader(framesNumber, chansNumber - 1, bits, sampleRate, frameIndex, out);
+
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+        {
+            const int32_t *chanSamples = samples + ch * framesNumber;
+
+            analyzeSubframe(chanSamples, framesNumber, bits, subframes[0]);
+            writeSubframe(chanSamples, framesNumber, bits, subframes[0], out);
+        }
+    }
+
+    // Frame footer
+    out.alignToByte();
+    out.writeBits(crc16(out.getData(), out.getSize()), 16);
+}
+
+
+// Private methods
+void FlacFrameEncoder::analyzeSubframe(const int32_t *samples, size_t framesNumber, u_int bits, Subframe &sf)
+{
+    // Header of every subframe is 8 bits
+    bool constant = true;
+    for (size_t i = 1; i < framesNumber && constant; ++i)
+        constant = samples[i] == samples[0];
+
+    if (constant)
+    {
+        sf.type = SUBFRAME_CONSTANT;
+        sf.bitsNumber = 8 + bits;
+        return;
+    }
+
+    sf.type = SUBFRAME_VERBATIM;
+    sf.bitsNumber = 8 + (uint64_t)framesNumber * bits;
+
+    // Fixed polynomial predictors
+    for (u_int order = 0; order <= MAX_FIXED_ORDER && order < framesNumber; ++order)
+    {
+        int32_t *res = &candidate.residual[0];
+        const int32_t *x = samples;
+
+        switch (order)
+        {
+            case 0:
+                memcpy(res, x, framesNumber * sizeof(int32_t));
+                break;
+
+            case 1:
+                for (size_t i = 1; i < framesNumber; ++i)
+                    res[i] = x[i] - x[i - 1];
+                break;
+
+            case 2:
+                for (size_t i = 2; i < framesNumber; ++i)
+                    res[i] = x[i] - 2 * (int64_t)x[i - 1] + x[i - 2];
+                break;
+
+            case 3:
+                for (size_t i = 3; i < framesNumber; ++i)
+                    res[i] = x[i] - 3 * (int64_t)x[i - 1] + 3 * (int64_t)x[i - 2] - x[i - 3];
+                break;
+
+            case 4:
+                for (size_t i = 4; i < framesNumber; ++i)
+                    res[i] = x[i] - 4 * (int64_t)x[i - 1] + 6 * (int64_t)x[i - 2] - 4 * (int64_t)x[i - 3] + x[i - 4];
+                break;
+        }
+
+        candidate.type = SUBFRAME_FIXED;
+        candidate.order = order;
+        candidate.bitsNumber = 8 + (uint64_t)order * bits +
+                               computeRice(res, framesNumber, order, bits, candidate.partitionOrder, candidate.riceParams);
+
+        if (candidate.bitsNumber < sf.bitsNumber)
+            std::swap(candidate, sf);
+    }
+
+    // Linear prediction
+    if (tryLpc(samples, framesNumber, bits, candidate) && candidate.bitsNumber < sf.bitsNumber)
+        std::swap(candidate, sf);
+}
+
+uint64_t FlacFrameEncoder::computeRice(const int32_t *residual, size_t framesNumber, u_int order, u_int bits,
+                                       u_int &partitionOrder, u_int *riceParams)
+{
+    // 4-bit parameters are enough for 16-bit samples, wider samples use 5-bit ones
+    u_int paramBits = bits <= 16 ? 4 : 5;
+    u_int maxParam = (1u << paramBits) - 2;
+
+    // The highest partition order: every partition is longer than the warm-up
+    u_int maxOrder = 0;
+    while (maxOrder < MAX_PARTITION_ORDER && framesNumber % (2u << maxOrder) == 0 && (framesNumber >> (maxOrder + 1)) > order)
+        ++maxOrder;
+
+    // Sums of the mapped residual in every partition of the highest order
+    size_t partitionsNumber = 1u << maxOrder;
+    size_t partitionSize = framesNumber >> maxOrder;
+    for (size_t p = 0; p < partitionsNumber; ++p)
+    {
+        uint64_t sum = 0;
+        for (size_t i = p == 0 ? order : p * partitionSize; i < (p + 1) * partitionSize; ++i)
+            sum += zigzag(residual[i]);
+
+        partitionSums[p] = sum;
+    }
+
+    // Lower orders are found by merging neighbouring partitions
+    uint64_t bestBits = UINT64_MAX;
+    u_int params[1 << MAX_PARTITION_ORDER];
+    for (int po = maxOrder; po >= 0; --po)
+    {
+        partitionsNumber = 1u << po;
+        partitionSize = framesNumber >> po;
+
+        uint64_t totalBits = 6;
+        for (size_t p = 0; p < partitionsNumber; ++p)
+        {
+            uint64_t sum = partitionSums[p];
+            uint64_t count = partitionSize - (p == 0 ? order : 0);
+
+            // Parameter close to log2 of the mean, then the best of its neighbours.
+            // (sum >> k) estimates the sum of quotients
+            u_int k = 0;
+            while (k < maxParam && (count << (k + 1)) < sum)
+                ++k;
+
+            uint64_t kBits = count * (k + 1) + (sum >> k);
+            if (k > 0 && count * k + (sum >> (k - 1)) < kBits)
+            {
+                --k;
+                kBits = count * (k + 1) + (sum >> k);
+            }
+
+            params[p] = k;
+            totalBits += paramBits + kBits;
+        }
+
+        if (totalBits < bestBits)
+        {
+            bestBits = totalBits;
+            partitionOrder = po;
+            memcpy(riceParams, params, partitionsNumber * sizeof(u_int));
+        }
+
+        for (size_t p = 0; p < partitionsNumber / 2; ++p)
+            partitionSums[p] = partitionSums[2 * p] + partitionSums[2 * p + 1];
+    }
+
+    return bestBits;
+}
+
+bool FlacFrameEncoder::tryLpc(const int32_t *samples, size_t framesNumber, u_int bits, Subframe &sf)
+{
+    u_int maxOrder = framesNumber > MAX_LPC_ORDER ? MAX_LPC_ORDER : framesNumber - 1;
+    if (framesNumber < 32 || maxOrder < 1)
+        return false;
+
+    // Tukey(0.5) window, recalculated only when the block size changes
+    if (window.size() != framesNumber)
+    {
+        window.resize(framesNumber);
+
+        size_t taper = framesNumber / 4;
+        for (size_t i = 0; i < framesNumber; ++i)
+        {
+            if (i < taper)
+                window[i] = 0.5 - 0.5 * cos(M_PI * i / taper);
+            else if (i >= framesNumber - taper)
+                window[i] = 0.5 - 0.5 * cos(M_PI * (framesNumber - 1 - i) / taper);
+            else
+                window[i] = 1.0;
+        }
+    }
+
+    for (size_t i = 0; i < framesNumber; ++i)
+        windowed[i] = samples[i] * window[i];
+
+    double autoc[MAX_LPC_ORDER + 1];
+    for (u_int lag = 0; lag <= maxOrder; ++lag)
+    {
+        double sum = 0;
+        for (size_t i = lag; i < framesNumber; ++i)
+            sum += windowed[i] * windowed[i - lag];
+
+        autoc[lag] = sum;
+    }
+
+    if (autoc[0] <= 0)
+        return false;
+
+    // Levinson-Durbin recursion, lpc[order - 1] predicts with the given order:
+    // x[i] ~ sum(lpc[order - 1][j] * x[i - 1 - j])
+    double lpc[MAX_LPC_ORDER][MAX_LPC_ORDER];
+    double err[MAX_LPC_ORDER];
+    double a[MAX_LPC_ORDER] = {0};
+    double e = autoc[0];
+    u_int ordersNumber = 0;
+
+    for (u_int i = 0; i < maxOrder; ++i)
+    {
+        double r = autoc[i + 1];
+        for (u_int j = 0; j < i; ++j)
+            r -= a[j] * autoc[i - j];
+
+        double k = r / e;
+
+        double prev[MAX_LPC_ORDER];
+        memcpy(prev, a, sizeof(a));
+        a[i] = k;
+        for (u_int j = 0; j < i; ++j)
+            a[j] = prev[j] - k * prev[i - 1 - j];
+
+        e *= 1 - k * k;
+        memcpy(lpc[i], a, sizeof(a));
+        err[i] = e;
+        ++ordersNumber;
+
+        if (e <= 0)
+            break;
+    }
+
+    // Coefficient precision, bits
+    u_int precision = bits <= 16 ? 13 : 15;
+
+    // Order with the smallest estimated size
+    u_int order = 1;
+    double bestEstimate = INFINITY;
+    for (u_int i = 0; i < ordersNumber; ++i)
+    {
+        double bitsPerSample = err[i] > 0 ? 0.5 * log2(err[i] / framesNumber) : 0;
+        double estimate = (bitsPerSample > 0 ? bitsPerSample : 0) * (framesNumber - i - 1) + (i + 1) * (precision + bits);
+
+        if (estimate < bestEstimate)
+        {
+            bestEstimate = estimate;
+            order = i + 1;
+        }
+    }
+
+    // Quantize the coefficients, the rounding error is carried to the next one
+    const double *coeffs = lpc[order - 1];
+    double cmax = 0;
+    for (u_int j = 0; j < order; ++j)
+        cmax = fabs(coeffs[j]) > cmax ? fabs(coeffs[j]) : cmax;
+
+    if (cmax <= 0 || !isfinite(cmax))
+        return false;
+
+    int log2cmax;
+    frexp(cmax, &log2cmax);
+    int shift = (int)precision - log2cmax - 1;
+    if (shift > 15)
+        shift = 15;
+
+    // Negative shifts are not allowed by the format
+    if (shift < 0)
+        return false;
+
+    int32_t qmax = (1 << (precision - 1)) - 1;
+    int32_t qmin = -(1 << (precision - 1));
+    double error = 0;
+    for (u_int j = 0; j < order; ++j)
+    {
+        error += coeffs[j] * (1 << shift);
+        long q = lround(error);
+        q = q > qmax ? qmax : q < qmin ? qmin : q;
+        error -= q;
+        sf.coeffs[j] = q;
+    }
+
+    // Residual, it must fit into 32 bits
+    int32_t *res = &sf.residual[0];
+    for (size_t i = order; i < framesNumber; ++i)
+    {
+        int64_t sum = 0;
+        for (u_int j = 0; j < order; ++j)
+            sum += (int64_t)sf.coeffs[j] * samples[i - 1 - j];
+
+        int64_t r = samples[i] - (sum >> shift);
+        if (r > INT32_MAX || r < INT32_MIN)
+            return false;
+
+        res[i] = r;
+    }
+
+    sf.type = SUBFRAME_LPC;
+    sf.order = order;
+    sf.precision = precision;
+    sf.shift = shift;
+    sf.bitsNumber = 8 + (uint64_t)order * bits + 4 + 5 + order * precision +
+                    computeRice(res, framesNumber, order, bits, sf.partitionOrder, sf.riceParams);
+
+    return true;
+}
+
+void FlacFrameEncoder::writeFrameHeader(size_t framesNumber, u_int chanAssignment, u_int bits, u_int sampleRate,
+                                        uint64_t frameIndex, BitWriter &out)
+{
+    // Block size code: 256 * 2^n, or an explicit 8 or 16-bit value at the end of the header
+    u_int blockSizeCode = framesNumber <= 256 ? 6 : 7;
+    for (u_int n = 0; n < 8; ++n)
+        if (framesNumber == 256u << n)
+            blockSizeCode = 8 + n;
+
+    // Sync code, fixed block size
+    out.writeBits(0xFFF8, 16);
+    out.writeBits(blockSizeCode, 4);
+    out.writeBits(sampleRateCode(sampleRate), 4);
+    out.writeBits(chanAssignment, 4);
+    out.writeBits(sampleSizeCode(bits), 3);
+    out.writeBits(0, 1);
+    out.writeUtf8(frameIndex);
+
+    if (blockSizeCode == 6)
+        out.writeBits(framesNumber - 1, 8);
+    else if (blockSizeCode == 7)
+        out.writeBits(framesNumber - 1, 16);
+
+    out.writeBits(crc8(out.getData(), out.getSize()), 8);
+}
+
+void FlacFrameEncoder::writeSubframe(const int32_t *samples, size_t framesNumber, u_int bits, const Subframe &sf, BitWriter &out)
+{
+    switch (sf.type)
+    {
+        case SUBFRAME_CONSTANT:
+            out.writeBits(0x00, 8);
+            out.writeSigned(samples[0], bits);
+            return;
+
+        case SUBFRAME_VERBATIM:
+            out.writeBits(0x02, 8);
+            for (size_t i = 0; i < framesNumber; ++i)
+                out.writeSigned(samples[i], bits);
+            return;
+
+        case SUBFRAME_FIXED:
+            out.writeBits((0x08 | sf.order) << 1, 8);
+            break;
+
+        case SUBFRAME_LPC:
+            out.writeBits((0x20 | (sf.order - 1)) << 1, 8);
+            break;
+    }
+
+    // Warm-up samples
+    for (u_int i = 0; i < sf.order; ++i)
+        out.writeSigned(samples[i], bits);
+
+    if (sf.type == SUBFRAME_LPC)
+    {
+        out.writeBits(sf.precision - 1, 4);
+        out.writeSigned(sf.shift, 5);
+
+        for (u_int j = 0; j < sf.order; ++j)
+            out.writeSigned(sf.coeffs[j], sf.precision);
+    }
+
+    // Partitioned Rice coded residual
+    u_int paramBits = bits <= 16 ? 4 : 5;
+    out.writeBits(paramBits == 4 ? 0 : 1, 2);
+    out.writeBits(sf.partitionOrder, 4);
+
+    size_t partitionSize = framesNumber >> sf.partitionOrder;
+    for (size_t p = 0; p < (1u << sf.partitionOrder); ++p)
+    {
+        u_int param = sf.riceParams[p];
+        out.writeBits(param, paramBits);
+
+        for (size_t i = p == 0 ? sf.order : p * partitionSize; i < (p + 1) * partitionSize; ++i)
+            out.writeRice(sf.residual[i], param);
+    }
+}
@@ -0,0 +1,259 @@
+#include "gainlimiter.h"
+
+#include <math.h>
+
+// Public members
+GainLimiter::GainLimiter(float gainDb, u_int sampleRate, u_int chansNumber, SampleFormat::Id format) :
+    gainDb(gainDb), releaseDbPerSec(10.0)
+{
+    setStreamFormat(sampleRate, chansNumber, format);
+    setGain(gainDb);
+}
+
+
+// Public methods
+float GainLimiter::getMinAppliedGain(u_int ch)
+{
+    return 20 * log10f(minCoeff[ch]);
+}
+
+float GainLimiter::getPeakDb(u_int ch)
+{
+    return 20 * log10f(peakMax[ch]);
+}
+
+float GainLimiter::getRmsDb(u_int ch)
+{
+    if (framesTotal == 0)
+        return -INFINITY;
+
+    return 10 * log10(sumSquares[ch] / framesTotal);
+}
+
+bool GainLimiter::isLimited()
+{
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        if (isLimited(ch))
+            return true;
+
+    return false;
+}
+
+void GainLimiter::process(const void *in, void *out, size_t framesNumber)
+{
+    if (framesNumber == 0)
+        return;
+
+    // The format is checked once per block, every format has its own loop
+    switch (format)
+    {
+        case SampleFormat::S16_LE:
+            processS16((const short *)in, (short *)out, framesNumber);
+            break;
+
+        case SampleFormat::S24_3LE:
+            processGeneric<SampleS24>((const char *)in, (char *)out, framesNumber);
+            break;
+
+        case SampleFormat::S32_LE:
+            processGeneric<SampleS32>((const char *)in, (char *)out, framesNumber);
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            processGeneric<SampleFloat>((const char *)in, (char *)out, framesNumber);
+            break;
+    }
+
+    framesTotal += framesNumber;
+}
+
+void GainLimiter::reset()
+{
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        curCoeff[ch] = targetCoeff[ch];
+        minCoeff[ch] = targetCoeff[ch];
+        peakMax[ch] = 0;
+        sumSquares[ch] = 0;
+    }
+
+    framesTotal = 0;
+}
+
+void GainLimiter::setChannelGains(const std::vector<float> &gainsDb)
+{
+    this->gainsDb = gainsDb;
+    updateTargets();
+
+    reset();
+}
+
+void GainLimiter::setGain(float gainDb)
+{
+    this->gainDb = gainDb;
+    updateTargets();
+
+    reset();
+}
+
+void GainLimiter::setStreamFormat(u_int sampleRate, u_int chansNumber, SampleFormat::Id format)
+{
+    this->sampleRate = sampleRate;
+    this->chansNumber = chansNumber;
+    this->format = format;
+
+    // All per-channel buffers are allocated here, so processing does not allocate
+    targetCoeff.resize(chansNumber);
+    curCoeff.resize(chansNumber);
+    minCoeff.resize(chansNumber);
+    nextCoeff.resize(chansNumber);
+    stepCoeff.resize(chansNumber);
+    minValues.resize(chansNumber);
+    maxValues.resize(chansNumber);
+    blockSumSquares.resize(chansNumber);
+    peakLevels.resize(chansNumber);
+    peakMax.resize(chansNumber);
+    sumSquares.resize(chansNumber);
+
+    updateTargets();
+    reset();
+}
+
+
+// Private methods
+float GainLimiter::nextCoefficient(u_int ch, float peakLevel, size_t framesNumber)
+{
+    // Determine the maximum permissible gain for this block
+    float coeffMax = peakLevel > 0 ? MAX_LEVEL / peakLevel : targetCoeff[ch];
+
+    // Release the gain back to the requested value
+    float coeff = curCoeff[ch] * powf(10.0, releaseDbPerSec * framesNumber / (20.0 * sampleRate));
+    if (coeff > targetCoeff[ch])
+        coeff = targetCoeff[ch];
+
+    if (coeff > coeffMax)
+        coeff = coeffMax;
+
+    return coeff;
+}
+
+void GainLimiter::updateTargets()
+{
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        targetCoeff[ch] = powf(10.0, (ch < gainsDb.size() ? gainsDb[ch] : gainDb) / 20.0);
+}
+
+void GainLimiter::processS16(const short *in, short *out, size_t framesNumber)
+{
+    // Determine the block peaks and energies in one pass
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        minValues[ch] = 0x7FFF;
+        maxValues[ch] = -0x8000;
+        blockSumSquares[ch] = 0;
+    }
+
+    SampleKernels::findPeaks(in, framesNumber, chansNumber, &minValues[0], &maxValues[0], &blockSumSquares[0]);
+
+    bool release = false;
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        int peak = -minValues[ch] > maxValues[ch] ? -minValues[ch] : maxValues[ch];
+        float peakLevel = peak / 32768.0;
+
+        if (peakMax[ch] < peakLevel)
+            peakMax[ch] = peakLevel;
+        sumSquares[ch] += blockSumSquares[ch] / (32768.0 * 32768.0);
+
+        nextCoeff[ch] = nextCoefficient(ch, peakLevel, framesNumber);
+        release |= curCoeff[ch] < nextCoeff[ch];
+    }
+
+    // Attack is applied to the whole block at once. Release is ramped over the block
+    // in steps. All steps are not greater than the maximum permissible gain, so there
+    // is no clipping.
+    size_t stepsNumber = release ? (framesNumber + RAMP_STEP_FRAMES - 1) / RAMP_STEP_FRAMES : 1;
+    for (size_t step = 0; step < stepsNumber; ++step)
+    {
+        size_t offset = step * RAMP_STEP_FRAMES * chansNumber;
+        size_t frames = step + 1 < stepsNumber ? RAMP_STEP_FRAMES : framesNumber - step * RAMP_STEP_FRAMES;
+
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+            stepCoeff[ch] = curCoeff[ch] >= nextCoeff[ch] ? nextCoeff[ch] :
+                            curCoeff[ch] + (nextCoeff[ch] - curCoeff[ch]) * (step + 1) / stepsNumber;
+
+        SampleKernels::makeGain(fixedGain, &stepCoeff[0], chansNumber);
+        SampleKernels::applyGain(in + offset, out + offset, frames, chansNumber, fixedGain);
+    }
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        curCoeff[ch] = nextCoeff[ch];
+        if (minCoeff[ch] > curCoeff[ch])
+            minCoeff[ch] = curCoeff[ch];
+    }
+}
+
+template <class Sample>
+void GainLimiter::processGeneric(const char *in, char *out, size_t framesNumber)
+{
+    size_t frameSize = chansNumber * Sample::SIZE;
+
+    // Determine the block peaks and energies in one pass
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        peakLevels[ch] = 0;
+        blockSumSquares[ch] = 0;
+    }
+
+    const char *p = in;
+    for (size_t i = 0; i < framesNumber; ++i)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch, p += Sample::SIZE)
+        {
+            float level = Sample::level(Sample::load(p));
+
+            peakLevels[ch] = peakLevels[ch] > level ? peakLevels[ch] : level;
+            blockSumSquares[ch] += level * level;
+        }
+    }
+
+    bool release = false;
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        if (peakMax[ch] < peakLevels[ch])
+            peakMax[ch] = peakLevels[ch];
+        sumSquares[ch] += blockSumSquares[ch];
+
+        nextCoeff[ch] = nextCoefficient(ch, peakLevels[ch], framesNumber);
+        release |= curCoeff[ch] < nextCoeff[ch];
+    }
+
+    // Attack is applied to the whole block at once, release is ramped over it in steps
+    size_t stepsNumber = release ? (framesNumber + RAMP_STEP_FRAMES - 1) / RAMP_STEP_FRAMES : 1;
+    for (size_t step = 0; step < stepsNumber; ++step)
+    {
+        size_t begin = step * RAMP_STEP_FRAMES;
+        size_t end = step + 1 < stepsNumber ? begin + RAMP_STEP_FRAMES : framesNumber;
+
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+            stepCoeff[ch] = curCoeff[ch] >= nextCoeff[ch] ? nextCoeff[ch] :
+                            curCoeff[ch] + (nextCoeff[ch] - curCoeff[ch]) * (step + 1) / stepsNumber;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            const char *src = in + i * frameSize;
+            char *dst = out + i * frameSize;
+
+            for (u_int ch = 0; ch < chansNumber; ++ch)
+                Sample::store(dst + ch * Sample::SIZE, Sample::scale(Sample::load(src + ch * Sample::SIZE), stepCoeff[ch]));
+        }
+    }
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        curCoeff[ch] = nextCoeff[ch];
+        if (minCoeff[ch] > curCoeff[ch])
+            minCoeff[ch] = curCoeff[ch];
+    }
+}
@@ -1,16 +1,45 @@
 #ifndef __AUDIORECORDER_H__
 #define __AUDIORECORDER_H__
 
+#include <atomic>
+#include <map>
+#include <thread>
 #include <vector>
 #include <string>
 
 #include <alsa/asoundlib.h>
 
+#include "autogain.h"
+#include "blockindex.h"
+#include "captureengine.h"
+#include "capturestats.h"
+#include "deviceenumerator.h"
+#include "directwriter.h"
+#include "flacencoder.h"
+#include "gainlimiter.h"
+#include "monitortap.h"
+#include "outputfile.h"
+#include "resampler.h"
+#include "ringbuffer.h"
+#include "sampleformat.h"
+#include "spectrumanalyzer.h"
+#include "statsserver.h"
+#include "timingindex.h"
+#include "triggergate.h"
+#include "wavheader.h"
+
 class AudioRecorder
 {
 public:
     static const char *helpStr;
 
+    enum CaptureState
+    {
+        CAPTURE_WAIT,   // Waiting for the next period
+        CAPTURE_DONE,   // Requested duration is captured
+        CAPTURE_ERROR
+    };
+
     AudioRecorder();
     AudioRecorder(int argc, char **argv);
     ~AudioRecorder();
@@ -18,14 +47,44 @@ public:
     std::vector<std::string> getAudioDevsList();
 
     std::string getCaptureDevId() { return captureDevIdStr; }
+    std::string getDaemonSocket() { return daemonSocketStr; }
     u_int getChannelsNumber() { return chansNumber; }
     float getGainFactor() { return gainFactor; }
+    SampleFormat::Id getSampleFormat() { return sampleFormat; }
     std::string getOutFile() { return outFileStr; }
     u_int getSampleRate() { return sampleRate; }
+    // Negotiated device rate, differs from the sample rate when resampling
+    u_int getCaptureRate() { return captureRate; }
     u_int getTimeToRec() { return timeToRec; }
+    // Real-time setup of the capture thread, 0 and empty if it is not requested
+    u_int getFifoPriority() { return fifoPriority; }
+    const std::vector<u_int> &getCaptureCpus() { return captureCpus; }
+    bool isVerbose() { return verbose; }
+
+    // Finish all recordings, safe to call from a signal handler
+    static void requestStop() { stopRequested = true; }
+    static bool isStopRequested() { return stopRequested; }
+
+    // Requests from other threads to the current recording
+    void stop() { stopFlag = true; }
+    void rotate() { rotateFlag = true; }
+    // Stats of the current or the last recording, one-line JSON
+    std::string getStatsJson();
 
     bool isInited() { return inited; }
     bool record();
+
+    // Recording steps. They are driven by CaptureScheduler, which can serve several recorders at once.
+    // recordStart() prepares everything but streaming, captureStart() starts it from the capture thread
+    bool recordStart();
+    bool captureStart();
+    CaptureState captureProcess();
+    u_int getPollFds(struct pollfd *fds);
+    u_int getPollFdsCount() { return engine.getPollFdsCount(); }
+    int getWaitTimeoutMs();
+    void handlePollEvents(struct pollfd *fds);
+    bool recordFinish();
+
     bool setParameters(const std::string &capDev = "plughw:0,0", 
                         u_int chN = 1,
                         float gain = 10.5,
@@ -34,102 +93,146 @@ public:
                         u_int time = 1);
 
 private:
-    typedef union WAV_HEADER
-    {
-        struct {
-            // WAV-формат начинается с RIFF-заголовка:
-
-            // Содержит символы "RIFF" в ASCII кодировке
-            // (0x52494646 в big-endian представлении)
-            char chunkId[4];
-
-            // 36 + subchunk2Size, или более точно:
-            // 4 + (8 + subchunk1Size) + (8 + subchunk2Size)
-            // Это оставшийся размер цепочки, начиная с этой позиции.
-            // Иначе говоря, это размер файла - 8, то есть,
-            // исключены поля chunkId и chunkSize.
-            unsigned int chunkSize;
-
-            // Содержит символы "WAVE"
-            // (0x57415645 в big-endian представлении)
-            char format[4];
-
-            // Формат "WAVE" состоит из двух подцепочек: "fmt " и "data":
-            // Подцепочка "fmt " описывает формат звуковых данных:
-
-            // Содержит символы "fmt "
-            // (0x666d7420 в big-endian представлении)
-            char subchunk1Id[4];
-
-            // 16 для формата PCM.
-            // Это оставшийся размер подцепочки, начиная с этой позиции.
-            unsigned int subchunk1Size;
-
-            // Аудио формат, полный список можно получить здесь http://audiocoding.ru/wav_formats.txt
-            // Для PCM = 1 (то есть, Линейное квантование).
-            // Значения, отличающиеся от 1, обозначают некоторый формат сжатия.
-            unsigned short audioFormat;
-
-            // Количество каналов. Моно = 1, Стерео = 2 и т.д.
-            unsigned short numChannels;
-
-            // Частота дискретизации. 8000 Гц, 44100 Гц и т.д.
-            unsigned int sampleRate;
-
-            // sampleRate * numChannels * bitsPerSample/8
-            unsigned int byteRate;
-
-            // numChannels * bitsPerSample/8
-            // Количество байт для одного сэмпла, включая все каналы.
-            unsigned short blockAlign;
-
-            // Так называемая "глубиная" или точность звучания. 8 бит, 16 бит и т.д.
-            unsigned short bitsPerSample;
-
-            // Подцепочка "data" содержит аудио-данные и их размер.
-
-            // Содержит символы "data"
-            // (0x64617461 в big-endian представлении)
-            char subchunk2Id[4];
-
-            // numSamples * numChannels * bitsPerSample/8
-            // Количество байт в области данных.
-            unsigned int subchunk2Size;
-
-            // Далее следуют непосредственно Wav данные.
-        } fields;
-
-        char data[sizeof(fields)];
-    } wav_header_t;
-
+    static std::atomic<bool> stopRequested;
+    // Stats sockets of the recorders of the process, a path can't be shared.
+    // Recorders are created and destroyed by the main thread only
+    static std::map<std::string, AudioRecorder *> statsSockets;
 
     // Capture parameters
+    bool agc;
+    float agcTargetDb;
+    std::vector<float> agcTimesMs;
+    u_int analysisFftSize;
+    u_int blockIndexFrames;
     std::string captureDevIdStr;
+    std::vector<u_int> captureCpus;
+    std::vector<float> chansGain;
+    std::string daemonSocketStr;
+    std::vector<u_int> chansMap;
     u_int chansNumber;
+    bool continuous;
+    bool directIo;
+    std::string extractRangeStr;
+    u_int fifoPriority;
     float gainFactor;
+    u_int hangoverMs;
+    u_int headerInterval;
+    u_int indexIntervalMs;
     std::string outFileStr;
+    snd_pcm_uframes_t periodSize;
+    u_int periodsNumber;
+    u_int preRollMs;
+    bool resample;
+    u_int ringTimeMs;
+    SampleFormat::Id sampleFormat;
     u_int sampleRate;
+    u_int captureRate;
+    u_int segmentSizeMb;
+    u_int segmentTime;
+    u_int statsInterval;
+    std::string statsSocketStr;
     u_int timeToRec;
+    std::vector<u_int> writerCpus;
+    bool trigger;
+    TriggerGate::Mode triggerMode;
+    float triggerThresholdDb;
     // Audio buffer
-    snd_pcm_t *audioBuf;
+    CaptureEngine engine;
     u_int bufSize;
     u_int frameSize;
+    // Output frames, after the channels selection
+    u_int outChansNumber;
+    u_int outFrameSize;
+    std::vector<char> selectBuf;
+    // Capture state
+    bool captureFailed;
+    uint64_t framesCount;
+    uint64_t framesCountMax;
+    // Frames passed to the writer, the lost ones are not counted
+    uint64_t recordedFrames;
+    bool overrun;
+    // Ring buffer between capture and writer threads
+    RingBuffer ringBuf;
+    std::atomic<bool> captureDone;
+    // The writer stopped on an error, the capture stops too
+    std::atomic<bool> writerFailed;
+    std::atomic<u_int> overrunsAbsorbed;
+    std::atomic<u_int> ringOverflows;
+    std::atomic<bool> stopFlag;
+    std::atomic<bool> rotateFlag;
+    // Writer
+    std::thread writerThread;
+    OutputFile outFile;
+    GainLimiter gainLimiter;
+    // Adaptive gain instead of the fixed one, its output is delayed by the look-ahead
+    AutoGain autoGain;
+    bool wavOut;
+    bool flacOut;
+    FlacEncoder flacEncoder;
+    std::vector<char> flacBuf;
+    // Sample rate conversion from the device rate, before any other processing
+    Resampler resampler;
+    std::vector<char> resampleBuf;
+    // Direct output, data is written from the ring buffer in blocks aligned to the frame size and to the file system
+    DirectWriter directWriter;
+    size_t directBlockSize;
+    uint64_t dataSize;
+    // Output segments
+    std::string segmentBaseStr;
+    std::string segmentFileStr;
+    u_int segmentIndex;
+    uint64_t segmentExpectedSize;
+    uint64_t segmentFrames;
+    uint64_t segmentFramesMax;
+    uint64_t headerNextNs;
+    // Triggered recording
+    TriggerGate triggerGate;
+    // Live monitoring of the captured data
+    MonitorTap monitorTap;
+    // Spectral features sidecar, the analyzer is a sink of the tap
+    SpectrumAnalyzer *spectrumAnalyzer;
+    // Device timestamps and wall clock of the recorded frames, with the clock drift
+    TimingIndex timingIndex;
+    // Seekable block index of every segment with its level pyramid, the wall clock of
+    // the data is taken from the timing index by the writer
+    BlockIndex blockIndex;
+    uint64_t writtenFrames;
+    uint64_t chunkWallNs;
+    // Instrumentation
+    CaptureStats stats;
+    StatsServer statsServer;
+    uint64_t statsNextNs;
 
     bool inited;
     std::string errStr;
-    wav_header_t wavHeader;
+    WavHeader wavHeader;
     bool verbose;
 
-    int  abufHandleError(int res);
+    void captureChunk(const CaptureBlock &block);
+    void captureStop(bool success);
     bool createAudioBuf();
-    bool getDeviceName(std::string &deviceName, snd_ctl_t *sndCardHandler = NULL, int deviceIndex = -1, bool playback = true);
-    bool getSoundCardInfo(std::string &soundCardInfo, int soundCardIndex = -1);
 
     std::string getLastErrorInfo();
+    std::string expandFileName();
     void init(int argc, char **argv);
+    bool isFlacFile();
+    bool isWavFile();
+    size_t processGain(const char *in, char *out, size_t framesNumber);
+    void releaseStatsSocket();
+    void reportStats();
+    bool segmentClose();
+    std::string segmentFileName();
+    bool segmentOpen();
+    void segmentUpdateHeader();
+    bool stringToFloatList(const char *str, std::vector<float> &values);
+    bool stringToIntList(const char *str, std::vector<u_int> &values);
     void stringToInt(char *str, unsigned int *pIntValue);
     bool validateParams();
-    void wavHeaderInit();
+    bool writeData(const char *data, size_t framesNumber);
+    bool writeDrain();
+    void writeLoop();
+    void writeLoopDirect();
+    bool writeTriggered(const char *data, size_t framesNumber);
 };
 
 #endif  // __AUDIORECORDER_H__
@@ -0,0 +1,120 @@
+#ifndef __AUTOGAIN_H__
+#define __AUTOGAIN_H__
+
+#include <sys/types.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "sampleformat.h"
+#include "samplekernels.h"
+
+// Streaming automatic gain control with a look-ahead limiter, the alternative to the
+// fixed gain of GainLimiter. Every channel has an envelope follower of its RMS level, dB,
+// with its own attack and release times, the gain brings the envelope to the target level and stays
+// within [MIN_GAIN_DB, maximum gain]. The limiter keeps the peaks below the full scale:
+// the data is delayed by the look-ahead time, the needed gain reduction is the minimum over
+// the look-ahead window, averaged over the same window, so the gain ramps down before
+// a peak and the peak never clips.
+// The gains are updated once per control block of CONTROL_FRAMES frames, the levels of
+// all channels are measured in one pass (S16 by the vectorized SampleKernels) and the
+// per-channel state is updated in loops over contiguous arrays.
+// The latency is the look-ahead rounded up to control blocks plus one block. The output
+// starts that much later than the input, the rest is pushed out by silence at the end.
+class AutoGain
+{
+public:
+    static const size_t CONTROL_FRAMES = 32;
+    static constexpr float MIN_GAIN_DB = -40.0;
+
+    AutoGain();
+
+    u_int getChansNumber() { return chansNumber; }
+    size_t getLatencyFrames() { return lineFrames; }
+    // Input frames which are delayed and not output yet
+    size_t getPendingFrames() { return pending; }
+
+    // Metering of the input and of the applied gains
+    float getPeakDb(u_int ch);
+    float getRmsDb(u_int ch);
+    float getMinAppliedGain(u_int ch) { return 20 * log10f(minApplied[ch]); }
+    float getMaxAppliedGain(u_int ch) { return 20 * log10f(maxApplied[ch]); }
+    // Largest reduction by the limiter, dB, 0 if it never acted
+    float getMaxReduction(u_int ch) { return -20 * log10f(minReduction[ch]); }
+
+    // All buffers are allocated here, so processing does not allocate
+    void setup(SampleFormat::Id format, u_int chansNumber, u_int sampleRate, float targetDb,
+               float attackMs, float releaseMs, float lookaheadMs);
+    // Largest gain per channel, dB. Channels without a value use the common one
+    void setMaxGain(float gainDb, const std::vector<float> &gainsDb);
+    void reset();
+
+    // Interleaved frames in the stream format, in and out may point to the same buffer.
+    // Returns the number of output frames, less than framesNumber while the delay fills.
+    // A NULL input is silence which pushes out the pending frames: all of them are output
+    // after getLatencyFrames() frames
+    size_t process(const void *in, void *out, size_t framesNumber);
+
+private:
+    // Highest permissible output level, relative to the full scale
+    static constexpr float MAX_LEVEL = 32767.0 / 32768.0;
+    // MIN_GAIN_DB
+    static constexpr float MIN_COEFF = 0.01;
+    // Level of silence, -100dBFS
+    static constexpr float MIN_POWER = 1e-10;
+
+    SampleFormat::Id format;
+    u_int chansNumber;
+    u_int sampleRate;
+    size_t frameSize;
+    float targetDb;
+    float attackCoeff;
+    float releaseCoeff;
+    std::vector<float> maxCoeff;
+
+    // Delay line of whole control blocks, the oldest frame is at linePos
+    std::vector<char> line;
+    std::vector<char> scratch;
+    size_t lineFrames;
+    size_t linePos;
+    size_t pending;
+
+    // Levels of the current input block
+    size_t blockFill;
+    std::vector<short> minValues;
+    std::vector<short> maxValues;
+    std::vector<float> blockSumSquares;
+    std::vector<float> blockPeaks;
+
+    // Per-channel state. Histories are rings of windowBlocks blocks, [slot * chansNumber + ch]
+    u_int windowBlocks;
+    uint64_t blocksNumber;
+    std::vector<float> envelope;
+    std::vector<float> agcHistory;
+    std::vector<float> reductionHistory;
+    std::vector<float> minHistory;
+    // Gains of the block leaving the delay line
+    std::vector<float> outCoeff;
+    SampleKernels::FixedGain fixedGain;
+
+    // Metering
+    std::vector<float> peakMax;
+    std::vector<double> sumSquares;
+    uint64_t framesTotal;
+    std::vector<float> minApplied;
+    std::vector<float> maxApplied;
+    std::vector<float> minReduction;
+
+    void analyze(const char *in, size_t framesNumber);
+    template <class Sample>
+    void analyzeGeneric(const char *in, size_t framesNumber);
+    void applyGain(const char *in, char *out, size_t framesNumber);
+    template <class Sample>
+    void applyGainGeneric(const char *in, char *out, size_t framesNumber);
+    // Updates the envelopes and the limiter by the complete input block
+    void finishBlock();
+};
+
+#endif  // __AUTOGAIN_H__
@@ -0,0 +1,206 @@
+#ifndef __BLOCKINDEX_H__
+#define __BLOCKINDEX_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "outputfile.h"
+#include "sampleformat.h"
+
+// Block index of an output file, written next to it by the writer thread.
+// The written data is split into blocks of blockFrames frames. Every block of
+// level 0 has its byte offset in the file and the wall clock of its first frame,
+// so a range of the recording is found without reading the audio data. Every block
+// of every level has the per-channel minimum, maximum and RMS of its samples, a
+// block of level k summarizes LEVEL_FACTOR blocks of level k - 1, the levels are
+// the zoom steps of a waveform overview.
+//
+// File layout, little-endian: bix_header_t, level 0 blocks (bix_block_t followed by
+// chansNumber bix_summary_t each), then the upper levels (bix_summary_t only) and
+// the table of levels. Level 0 is written while recording, the upper levels are
+// kept in memory and appended when the file is closed, then the header is patched.
+// An interrupted recording leaves level 0 only, the upper levels are rebuilt from it.
+class BlockIndex
+{
+public:
+    static const u_int LEVEL_FACTOR = 4;
+    static const u_int MIN_BLOCK_FRAMES = 16;
+    // Byte offset of compressed data, which is not known per block
+    static const uint64_t NO_OFFSET = UINT64_MAX;
+
+    typedef struct BIX_HEADER
+    {
+        // "ARBIX001"
+        char magic[8];
+        // Offset of the first level 0 block
+        uint32_t headerSize;
+        uint32_t sampleRate;
+        uint16_t chansNumber;
+        // SampleFormat::Id
+        uint16_t format;
+        uint32_t frameSize;
+        uint32_t blockFrames;
+        uint32_t levelFactor;
+        // Offset of the first frame in the audio file
+        uint64_t dataOffset;
+        // Frames and offset of bix_levels_t, 0 until the file is closed
+        uint64_t framesNumber;
+        uint64_t levelsOffset;
+    } __attribute__((packed)) bix_header_t;
+
+    typedef struct BIX_BLOCK
+    {
+        uint64_t byteOffset;
+        // CLOCK_REALTIME, 0 if it is unknown
+        uint64_t wallNs;
+    } __attribute__((packed)) bix_block_t;
+
+    // Sample values scaled to 16 bits
+    typedef struct BIX_SUMMARY
+    {
+        int16_t min;
+        int16_t max;
+        uint16_t rms;
+    } __attribute__((packed)) bix_summary_t;
+
+    // Followed by levelsNumber bix_level_t, level 0 is the first one
+    typedef struct BIX_LEVELS
+    {
+        uint32_t levelsNumber;
+    } __attribute__((packed)) bix_levels_t;
+
+    typedef struct BIX_LEVEL
+    {
+        uint64_t offset;
+        uint64_t blocksNumber;
+    } __attribute__((packed)) bix_level_t;
+
+    BlockIndex();
+
+    std::string getLastErrorInfo() { return errStr; }
+    bool isOpened() { return outFile.isOpened(); }
+
+    static bool isBlockFramesValid(u_int blockFrames) { return blockFrames >= MIN_BLOCK_FRAMES; }
+
+    bool open(const std::string &fileName, SampleFormat::Id format, u_int chansNumber, u_int sampleRate,
+              u_int blockFrames, uint64_t dataOffset);
+    // Summarizes the last block and writes the upper levels
+    bool close();
+
+    // Written frames starting at byteOffset of the audio file (NO_OFFSET if it is compressed),
+    // the first one was captured at wallNs
+    bool add(const char *data, size_t framesNumber, uint64_t byteOffset, uint64_t wallNs);
+
+private:
+    // Level 0 blocks are written in batches
+    static const size_t BATCH_BLOCKS = 64;
+
+    // Summary while it is accumulated, in the [-1, 1] range
+    struct Accumulator
+    {
+        float min;
+        float max;
+        double sumSquares;
+    };
+
+    // Upper level: its summaries and the current block
+    struct UpperLevel
+    {
+        std::vector<bix_summary_t> summaries;
+        std::vector<Accumulator> acc;
+        uint64_t frames;
+        u_int blocks;
+    };
+
+    OutputFile outFile;
+    std::string errStr;
+    bix_header_t header;
+    SampleFormat::Id format;
+    u_int chansNumber;
+    size_t recordSize;
+
+    // Current level 0 block
+    u_int blockFilled;
+    std::vector<Accumulator> block;
+    std::vector<short> minValues;
+    std::vector<short> maxValues;
+    std::vector<float> sumSquares;
+    std::vector<char> batch;
+    size_t batchBlocks;
+    uint64_t blocksNumber;
+    uint64_t framesNumber;
+
+    // Level k is upper[k - 1]
+    std::vector<UpperLevel> upper;
+
+    void accumulate(const char *data, size_t framesNumber);
+    template <class Sample>
+    void accumulateGeneric(const char *data, size_t framesNumber);
+    void finishBlock();
+    bool flushBatch();
+    // Adds a block of the level below to the current block of the level
+    void propagate(u_int level, const std::vector<Accumulator> &acc, uint64_t frames);
+    void emitUpper(u_int level);
+    void resetAccumulators(std::vector<Accumulator> &acc);
+    static bix_summary_t toSummary(const Accumulator &acc, uint64_t frames);
+};
+
+// Reader of a block index. The file is memory-mapped, only the blocks asked for are touched
+class BlockIndexReader
+{
+public:
+    // Summary of a range in the [-1, 1] range
+    struct Level
+    {
+        float min;
+        float max;
+        float rms;
+    };
+
+    BlockIndexReader();
+    ~BlockIndexReader();
+
+    std::string getLastErrorInfo() { return errStr; }
+
+    bool load(const std::string &fileName);
+    void close();
+
+    const BlockIndex::bix_header_t &getHeader() { return header; }
+    // All frames, or the frames of the complete level 0 blocks of an interrupted recording
+    uint64_t getFramesNumber();
+    u_int getLevelsNumber() { return levels.size(); }
+    uint64_t getBlocksNumber(u_int level) { return levels[level].blocksNumber; }
+    // Frames of a block of the level
+    uint64_t getLevelFrames(u_int level);
+
+    bool isSeekable() { return header.dataOffset != BlockIndex::NO_OFFSET; }
+    // Byte offset of the frame in the audio file, NO_OFFSET if the data is compressed
+    uint64_t getByteOffset(uint64_t framePos);
+    // Frame captured at the wall clock time, O(log n) in the blocks number. False if the time is outside the file
+    bool findFrame(uint64_t wallNs, uint64_t *framePos);
+    uint64_t getWallNs(uint64_t framePos);
+
+    // Overview of columnsNumber equal parts of the file, taken from the coarsest level
+    // which has at least one block per column
+    bool getOverview(size_t columnsNumber, std::vector<Level> &overview);
+
+private:
+    BlockIndex::bix_header_t header;
+    std::string errStr;
+    const char *mapAddr;
+    size_t mapSize;
+    size_t recordSize;
+    std::vector<BlockIndex::bix_level_t> levels;
+    // Upper levels rebuilt from level 0 of an interrupted recording
+    std::vector<std::vector<BlockIndex::bix_summary_t> > rebuilt;
+
+    const BlockIndex::bix_block_t *getBlock(uint64_t i) { return (const BlockIndex::bix_block_t *)(mapAddr + header.headerSize + i * recordSize); }
+    const BlockIndex::bix_summary_t *getSummary(u_int level, uint64_t i);
+    void rebuildLevels();
+};
+
+#endif  // __BLOCKINDEX_H__
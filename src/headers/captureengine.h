@@ -0,0 +1,210 @@
+#ifndef __CAPTUREENGINE_H__
+#define __CAPTUREENGINE_H__
+
+#include <sys/types.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <alsa/asoundlib.h>
+
+#include "capturestats.h"
+#include "sampleformat.h"
+
+// Move-only owner of an ALSA PCM handle, the device is closed with the last owner
+class PcmHandle
+{
+public:
+    PcmHandle() : pcm(NULL) {}
+    explicit PcmHandle(snd_pcm_t *pcm) : pcm(pcm) {}
+    PcmHandle(PcmHandle &&other) : pcm(other.pcm) { other.pcm = NULL; }
+    ~PcmHandle() { reset(); }
+
+    PcmHandle(const PcmHandle &) = delete;
+    PcmHandle &operator=(const PcmHandle &) = delete;
+
+    PcmHandle &operator=(PcmHandle &&other)
+    {
+        if (this != &other)
+            reset(other.release());
+
+        return *this;
+    }
+
+    // Returns an empty handle on error, the ALSA error code is stored into err
+    static PcmHandle open(const std::string &device, snd_pcm_stream_t stream, int mode = 0, int *err = NULL);
+
+    snd_pcm_t *get() const { return pcm; }
+    explicit operator bool() const { return pcm != NULL; }
+
+    snd_pcm_t *release()
+    {
+        snd_pcm_t *res = pcm;
+        pcm = NULL;
+        return res;
+    }
+
+    void reset(snd_pcm_t *newPcm = NULL)
+    {
+        if (pcm)
+            snd_pcm_close(pcm);
+
+        pcm = newPcm;
+    }
+
+private:
+    snd_pcm_t *pcm;
+};
+
+// View of captured interleaved frames in the mmap area of the device, in the manner
+// of std::span: nothing is copied, the data is valid until the block is released
+struct CaptureBlock
+{
+    const char *data;
+    size_t frames;
+    size_t frameSize;
+    // Index of the first frame since the start of streaming
+    uint64_t framePos;
+    // Capture time of the last frame, CLOCK_MONOTONIC
+    uint64_t captureNs;
+    // Device timestamp: the frame stampPos (not taken yet, it is at the hardware position)
+    // was captured at stampNs by the engine's timestamp clock
+    uint64_t stampPos;
+    uint64_t stampNs;
+
+    const char *begin() const { return data; }
+    const char *end() const { return data + size(); }
+    size_t size() const { return frames * frameSize; }
+    bool empty() const { return frames == 0; }
+};
+
+// Requested capture parameters. After CaptureEngine::open() the engine keeps the negotiated ones
+struct CaptureConfig
+{
+    std::string device;
+    SampleFormat::Id format;
+    u_int chansNumber;
+    u_int sampleRate;
+    // 0 is a 500ms buffer
+    snd_pcm_uframes_t periodSize;
+    u_int periodsNumber;
+    // Disable the plugin resampling, the nearest rate is a native one
+    bool nativeRate;
+    // Report overruns
+    bool verbose;
+
+    CaptureConfig() :
+        device("plughw:0,0"),
+        format(SampleFormat::S16_LE),
+        chansNumber(1),
+        sampleRate(48000),
+        periodSize(0),
+        periodsNumber(4),
+        nativeRate(false),
+        verbose(false)
+    {
+    }
+};
+
+// Capture from one ALSA device with mmap access, without any processing or file I/O.
+// The data can be taken in three ways:
+//  - callback: start(callback) runs the capture in the engine's own thread;
+//  - pull: start(), then pull() and release() from the caller's thread;
+//  - steps: start(), then the caller polls getPollFds() (together with other devices)
+//    and calls handlePollEvents() and process(), like CaptureScheduler does.
+// Overruns and suspends are recovered from, the lost frames are counted in the stats.
+class CaptureEngine
+{
+public:
+    enum Status
+    {
+        STATUS_WAIT,    // Less than a period is available
+        STATUS_DONE,    // Requested frames are captured or stop is requested
+        STATUS_ERROR
+    };
+
+    typedef std::function<void(const CaptureBlock &)> Callback;
+
+    CaptureEngine();
+    ~CaptureEngine();
+
+    CaptureEngine(const CaptureEngine &) = delete;
+    CaptureEngine &operator=(const CaptureEngine &) = delete;
+
+    std::string getLastErrorInfo() { return errStr; }
+    bool isOpened() { return (bool)pcm; }
+    snd_pcm_t *getPcm() { return pcm.get(); }
+
+    // Negotiated parameters
+    const CaptureConfig &getConfig() { return config; }
+    size_t getFrameSize() { return frameSize; }
+    snd_pcm_uframes_t getBufferFrames() { return bufferFrames; }
+    uint64_t getFramePos() { return framePos; }
+    // Clock of the block timestamps: CLOCK_MONOTONIC_RAW, or CLOCK_MONOTONIC / CLOCK_REALTIME
+    // if the driver does not support it
+    clockid_t getStampClock() { return stampClock; }
+    // The callback thread is delivering data, it finishes on stop or on an unrecoverable error
+    bool isRunning() { return running; }
+
+    // Overruns, suspends and chunk sizes are counted here if it is set
+    void setStats(CaptureStats *stats) { this->stats = stats; }
+
+    bool open(const CaptureConfig &config);
+    void close();
+
+    // Start streaming. With a callback the data is delivered from the engine's thread
+    bool start();
+    bool start(const Callback &callback);
+    // May be called from any thread, the capture finishes with the data available now
+    void requestStop() { stopFlag = true; }
+    // Stop streaming, the device is prepared for the next start
+    void stop();
+
+    // Pull interface. Waits up to timeoutMs for a period of data, returns false on
+    // timeout, stop or error. The block must be released before the next pull
+    bool pull(CaptureBlock &block, int timeoutMs);
+    void release(const CaptureBlock &block);
+
+    // Step interface. process() passes all available data to the callback,
+    // up to framesMax frames since the start
+    u_int getPollFds(struct pollfd *fds);
+    u_int getPollFdsCount() { return pollFds.size(); }
+    int getWaitTimeoutMs();
+    void handlePollEvents(struct pollfd *fds);
+    Status process(const Callback &callback, uint64_t framesMax = UINT64_MAX);
+
+private:
+    CaptureConfig config;
+    PcmHandle pcm;
+    size_t frameSize;
+    snd_pcm_uframes_t bufferFrames;
+    std::vector<struct pollfd> pollFds;
+    clockid_t stampClock;
+    std::string errStr;
+    CaptureStats *stats;
+
+    // Capture state
+    int captureErr;
+    uint64_t framePos;
+    std::atomic<bool> stopFlag;
+    std::atomic<bool> running;
+    std::thread thread;
+    // Region taken by pull()
+    snd_pcm_uframes_t pullOffset;
+
+    // Takes the next chunk: 1 if it is taken, 0 if less than a period is available, -1 on error
+    int begin(CaptureBlock &block, snd_pcm_uframes_t &offset, uint64_t framesMax);
+    bool commit(snd_pcm_uframes_t offset, snd_pcm_uframes_t frames);
+    bool handleError();
+    uint64_t lostFrames();
+    void threadLoop(Callback callback);
+};
+
+#endif  // __CAPTUREENGINE_H__
@@ -0,0 +1,27 @@
+#ifndef __CAPTURESCHEDULER_H__
+#define __CAPTURESCHEDULER_H__
+
+#include <poll.h>
+
+#include <vector>
+
+#include "audiorecorder.h"
+
+// Drives capture of one or several recorders from a single thread.
+// The poll descriptors of all devices are waited for together, every recorder
+// keeps its own writer thread, output file and parameters.
+class CaptureScheduler
+{
+public:
+    CaptureScheduler();
+
+    void addRecorder(AudioRecorder *recorder);
+    bool run();
+
+private:
+    std::vector<AudioRecorder *> recorders;
+
+    void captureLoop();
+};
+
+#endif  // __CAPTURESCHEDULER_H__
@@ -0,0 +1,106 @@
+#ifndef __CAPTURESTATS_H__
+#define __CAPTURESTATS_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+// Histogram with power-of-two buckets: bucket 0 counts zeros, bucket i counts
+// values from 2^(i-1) to 2^i - 1. Every instance has a single writer thread, so
+// the counters are updated with relaxed loads and stores, without locked instructions.
+class Histogram
+{
+public:
+    static const u_int BUCKETS_NUMBER = 40;
+
+    Histogram() { reset(); }
+
+    void add(uint64_t value);
+    void reset();
+
+    uint64_t getCount() { return count.load(std::memory_order_relaxed); }
+    uint64_t getMax() { return max.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket containing the given fraction of values
+    uint64_t getPercentile(double fraction);
+
+    void toJson(std::string &json);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS_NUMBER];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+// Instrumentation of one recorder. The capture thread and the writer thread
+// update their own counters, any thread may read them and build a stats line.
+class CaptureStats
+{
+public:
+    CaptureStats();
+
+    void reset(uint64_t startNs);
+
+    // Capture thread
+    void addAvail(uint64_t frames) { availFrames.add(frames); }
+    void addChunk(uint64_t frames) { chunkFrames.add(frames); inc(capturedFrames, frames); }
+    void addRingLoss(uint64_t frames) { inc(ringFramesLost, frames); }
+    void addSuspend(uint64_t framesLost) { inc(suspends, 1); inc(xrunFramesLost, framesLost); }
+    void addXrun(uint64_t framesLost) { inc(xruns, 1); inc(xrunFramesLost, framesLost); }
+    // A chunk captured at captureNs is pushed to the ring buffer
+    void addPush(uint64_t bytesNumber, uint64_t captureNs);
+
+    // Writer thread. bytesNumber is the size of the chunk taken from the ring buffer
+    void addWrite(uint64_t latencyNs, uint64_t bytesNumber);
+
+    uint64_t getXruns() { return xruns.load(std::memory_order_relaxed); }
+    uint64_t getXrunFramesLost() { return xrunFramesLost.load(std::memory_order_relaxed); }
+
+    // One-line JSON object with all counters
+    std::string toJson(const std::string &deviceId, uint64_t nowNs, uint64_t ringFill, uint64_t ringHighWaterMark);
+
+    static uint64_t nowNs();
+
+private:
+    // Capture marks waiting for the writer, a single-producer/single-consumer queue.
+    // If the queue is full, chunks are not marked, so the delay is sampled.
+    static const size_t MARKS_NUMBER = 256;
+
+    struct Mark
+    {
+        uint64_t endPos;
+        uint64_t captureNs;
+    };
+
+    uint64_t startNs;
+
+    // Capture thread
+    std::atomic<uint64_t> capturedFrames;
+    std::atomic<uint64_t> xruns;
+    std::atomic<uint64_t> suspends;
+    std::atomic<uint64_t> xrunFramesLost;
+    std::atomic<uint64_t> ringFramesLost;
+    Histogram availFrames;
+    Histogram chunkFrames;
+
+    uint64_t pushedPos;
+    Mark marks[MARKS_NUMBER];
+    alignas(64) std::atomic<uint64_t> marksHead;
+    alignas(64) std::atomic<uint64_t> marksTail;
+
+    // Writer thread
+    uint64_t writtenPos;
+    std::atomic<uint64_t> writtenBytes;
+    Histogram writeLatencyUs;
+    Histogram captureToDiskUs;
+
+    static void inc(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+#endif  // __CAPTURESTATS_H__
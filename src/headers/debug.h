@@ -12,6 +12,7 @@
 #define HERE()          std::cout << GREEN_CLR << __FILE__ << ", " << __LINE__ << RES_CLR << std::endl
 #define DBG(x)          std::cout << YELLOW_CLR << __FILE__ << ", " << __LINE__ << ": " << x << RES_CLR << std::endl
 #define PRINT(x)        std::cout << x << std::endl;
-#define ERR(x)          std::cout << RED_CLR << __FILE__ << ", " << __LINE__ << ": " << x << RES_CLR << std::endl
+#define INFO(x)         std::cerr << x << std::endl;
+#define ERR(x)          std::cerr << RED_CLR << __FILE__ << ", " << __LINE__ << ": " << x << RES_CLR << std::endl
 
 #endif  // __DEBUG_H__
@@ -0,0 +1,83 @@
+#ifndef __DEVICEENUMERATOR_H__
+#define __DEVICEENUMERATOR_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sampleformat.h"
+
+// Capabilities of one stream direction of a PCM device, from its hw_params space
+struct AudioStreamCaps
+{
+    bool present;           // The device has this stream
+    bool probed;            // The ranges are known, false if the device was busy
+    u_int minRate;
+    u_int maxRate;
+    u_int minChans;
+    u_int maxChans;
+    std::vector<SampleFormat::Id> formats;
+};
+
+struct AudioDeviceInfo
+{
+    int card;
+    int device;
+    std::string cardName;
+    std::string name;
+    std::string id;        // "plughw:<card>,<device>"
+    AudioStreamCaps playback;
+    AudioStreamCaps capture;
+};
+
+// Cache of the audio devices.
+// Cards are probed in parallel, one thread per card, as a slow card (e.g. behind a
+// USB hub) should not delay the others. With the monitor started, the cache is
+// refreshed when device nodes appear or disappear in /dev/snd.
+class DeviceEnumerator
+{
+public:
+    DeviceEnumerator();
+    ~DeviceEnumerator();
+
+    // Cached devices, they are enumerated on the first call
+    std::vector<AudioDeviceInfo> getDevices();
+    // Number of enumerations done, grows when the monitor notices a change
+    uint64_t getGeneration() { return generation; }
+
+    void refresh();
+
+    bool startMonitor();
+    void stopMonitor();
+
+    // Human-readable lines grouped by card, as printed by --list
+    static std::vector<std::string> toText(const std::vector<AudioDeviceInfo> &devices);
+    // One-line JSON object
+    static std::string toJson(const AudioDeviceInfo &device);
+
+private:
+    // Coalesce bursts of device node events, ms
+    static const int MONITOR_SETTLE_MS = 200;
+
+    std::mutex mutex;
+    std::vector<AudioDeviceInfo> devices;
+    bool cached;
+    std::atomic<uint64_t> generation;
+
+    std::thread monitorThread;
+    int inotifyFd;
+    int stopPipe[2];
+
+    static void probeCard(int card, std::vector<AudioDeviceInfo> *cardDevices);
+    static void probeStream(const std::string &hwId, bool playback, AudioStreamCaps &caps);
+    static void capsToJson(const AudioStreamCaps &caps, std::string &json);
+
+    void monitorLoop();
+};
+
+#endif  // __DEVICEENUMERATOR_H__
@@ -0,0 +1,96 @@
+#ifndef __DIRECTWRITER_H__
+#define __DIRECTWRITER_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// Zero-copy file writer for raw data.
+// Data is written straight from the caller's buffer, which must stay untouched
+// until the write completes: the file is opened with O_DIRECT (bypassing the page
+// cache), and the writes are queued to io_uring with the buffer registered as a
+// fixed buffer. Where io_uring is unavailable, the writes are plain synchronous pwrite().
+// O_DIRECT requires aligned memory, offsets and sizes, only the last part of the
+// file may be unaligned, it is written without O_DIRECT.
+class DirectWriter
+{
+public:
+    static const size_t ALIGNMENT = 4096;
+    // Writes in flight
+    static const u_int QUEUE_DEPTH = 8;
+
+    DirectWriter();
+    ~DirectWriter();
+
+    std::string getLastErrorInfo() { return errStr; }
+    bool isDirect() { return direct; }
+    bool isOpened() { return fd >= 0; }
+    bool isUring() { return ringFd >= 0; }
+    uint64_t getSize() { return pos; }
+    u_int getInFlight() { return submitted - completed; }
+
+    // Set up the queue for data from the given buffer, falls back to pwrite() if it fails
+    void start(const char *buf, size_t bufSize);
+    void stop();
+
+    bool open(const std::string &fileName);
+    // Append aligned data. Returns false if the queue is full or on error
+    bool submit(const char *data, size_t size);
+    // Completed writes, in the submission order: bytes number and the longest latency.
+    // Waits for one write at least if wait is true and there are writes in flight.
+    // Returns false on a failed or short write, it is not counted and nothing after it is reaped
+    bool reap(bool wait, size_t *size, uint64_t *latencyNs = NULL);
+    // Write the unaligned end of the file synchronously. All writes must be completed
+    bool writeTail(const char *data, size_t size);
+    bool close();
+
+private:
+    struct Slot
+    {
+        const char *data;
+        uint64_t offset;
+        size_t size;
+        uint64_t startNs;
+        bool done;
+        int res;
+    };
+
+    int fd;
+    bool direct;
+    uint64_t pos;
+    std::string errStr;
+
+    Slot slots[QUEUE_DEPTH];
+    uint64_t submitted;
+    uint64_t completed;
+
+    // io_uring
+    int ringFd;
+    bool fixedBuf;
+    const char *buf;
+    size_t bufSize;
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;
+    size_t cqMapSize;
+    void *sqesMap;
+    size_t sqesMapSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    void *cqes;
+    void *sqes;
+
+    bool setupUring();
+    void closeUring();
+    bool pwriteAll(const char *data, size_t size, uint64_t offset);
+    void complete(uint64_t index, int res);
+};
+
+#endif  // __DIRECTWRITER_H__
@@ -0,0 +1,100 @@
+#ifndef __FLACENCODER_H__
+#define __FLACENCODER_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flacframe.h"
+#include "outputfile.h"
+#include "sampleformat.h"
+
+// Lossless FLAC stream encoder.
+// Interleaved samples are split into fixed-size blocks, and every block is an
+// independent FLAC frame. The frames are encoded in parallel by a pool of worker
+// threads, then written to the output file in their order. STREAMINFO is patched
+// with the final sizes when the stream is closed, as the wav-header is.
+class FlacEncoder
+{
+public:
+    // Frames per block
+    static const size_t BLOCK_SIZE = FlacFrameEncoder::MAX_BLOCK_SIZE;
+
+    FlacEncoder();
+    ~FlacEncoder();
+
+    static bool isFormatSupported(SampleFormat::Id format, u_int chansNumber);
+
+    std::string getLastErrorInfo() { return errStr; }
+    uint64_t getFramesNumber() { return totalFrames; }
+    u_int getWorkersNumber() { return workers.size(); }
+
+    // Write the stream header to an opened file
+    bool open(OutputFile *file, SampleFormat::Id format, u_int chansNumber, u_int sampleRate);
+    // Encode and write interleaved frames in the stream format
+    bool write(const void *data, size_t framesNumber);
+    // Write the rest of data and patch STREAMINFO. The file is not closed
+    bool close();
+
+private:
+    // Blocks being filled, encoded or waiting to be written, per worker
+    static const size_t JOBS_PER_WORKER = 2;
+
+    // "fLaC" marker, metadata block header and STREAMINFO
+    static const size_t STREAM_HEADER_SIZE = 4 + 4 + 34;
+
+    struct Job
+    {
+        // Per-channel blocks
+        std::vector<int32_t> samples;
+        size_t framesNumber;
+        uint64_t frameIndex;
+        BitWriter out;
+        bool done;
+    };
+
+    OutputFile *file;
+    SampleFormat::Id format;
+    u_int chansNumber;
+    u_int sampleRate;
+    u_int bits;
+    std::string errStr;
+
+    // Jobs are used in a circle: submitted ones are taken by workers in order,
+    // and written in the same order.
+    std::vector<Job> jobs;
+    size_t fillFrames;
+    uint64_t submitted;
+    uint64_t taken;
+    uint64_t written;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workCond;
+    std::condition_variable doneCond;
+    bool stopping;
+
+    // Stream statistics for STREAMINFO
+    uint64_t totalFrames;
+    size_t minFrameSize;
+    size_t maxFrameSize;
+
+    template <class Sample>
+    void deinterleave(const char *in, size_t offset, size_t framesNumber);
+
+    void makeStreamHeader(uint8_t *header);
+    void startWorkers();
+    void stopWorkers();
+    void submitJob();
+    void workerLoop();
+    // Write encoded jobs in order. Waits for the jobs before minWritten, writes later ones only if they are ready
+    bool writeJobs(uint64_t minWritten);
+};
+
+#endif  // __FLACENCODER_H__
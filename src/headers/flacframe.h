@@ -0,0 +1,99 @@
+#ifndef __FLACFRAME_H__
+#define __FLACFRAME_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Big-endian bit writer for FLAC frames. The buffer grows only until it reaches
+// the largest frame size, then it is reused.
+class BitWriter
+{
+public:
+    BitWriter() : bitsNumber(0), acc(0), accBits(0) {}
+
+    void clear() { buf.clear(); bitsNumber = 0; acc = 0; accBits = 0; }
+    void reserve(size_t bytesNumber) { buf.reserve(bytesNumber); }
+
+    // Data is complete only after alignToByte()
+    const uint8_t *getData() { return buf.data(); }
+    size_t getSize() { return buf.size(); }
+    uint64_t getBitsNumber() { return bitsNumber; }
+
+    void alignToByte();
+    void writeBits(uint32_t value, u_int bits);
+    void writeSigned(int32_t value, u_int bits) { writeBits((uint32_t)value & (bits < 32 ? (1u << bits) - 1 : 0xFFFFFFFF), bits); }
+    void writeRice(int32_t value, u_int param);
+    void writeUtf8(uint64_t value);
+
+private:
+    std::vector<uint8_t> buf;
+    uint64_t bitsNumber;
+    uint64_t acc;
+    u_int accBits;
+};
+
+// Encoder of one FLAC frame: a block of samples of every channel.
+// Every subframe is coded with the smallest of constant, verbatim, fixed and LPC
+// predictors, the residual is Rice coded with the best partition order.
+// Stereo is decorrelated with left/side, right/side or mid/side if it is smaller.
+// Every worker thread has its own instance, all scratch buffers are reused between blocks.
+class FlacFrameEncoder
+{
+public:
+    // Longest block and highest LPC order supported
+    static const size_t MAX_BLOCK_SIZE = 4096;
+    static const u_int MAX_LPC_ORDER = 8;
+
+    FlacFrameEncoder();
+
+    // samples are per-channel blocks of framesNumber values each, frameIndex is the frame number in the stream
+    void encode(const int32_t *samples, size_t framesNumber, u_int chansNumber, u_int bits,
+                u_int sampleRate, uint64_t frameIndex, BitWriter &out);
+
+private:
+    static const u_int MAX_FIXED_ORDER = 4;
+    static const u_int MAX_PARTITION_ORDER = 8;
+
+    enum SubframeType
+    {
+        SUBFRAME_CONSTANT,
+        SUBFRAME_VERBATIM,
+        SUBFRAME_FIXED,
+        SUBFRAME_LPC
+    };
+
+    // Chosen coding of one subframe
+    struct Subframe
+    {
+        SubframeType type;
+        u_int order;
+        u_int precision;
+        int shift;
+        int32_t coeffs[MAX_LPC_ORDER];
+        u_int partitionOrder;
+        u_int riceParams[1 << MAX_PARTITION_ORDER];
+        uint64_t bitsNumber;
+        std::vector<int32_t> residual;
+    };
+
+    // Per-channel buffers, mid and side channels are the last two
+    std::vector<int32_t> midSide[2];
+    Subframe subframes[4];
+    Subframe candidate;
+    std::vector<double> window;
+    std::vector<double> windowed;
+    std::vector<uint64_t> partitionSums;
+
+    void analyzeSubframe(const int32_t *samples, size_t framesNumber, u_int bits, Subframe &sf);
+    uint64_t computeRice(const int32_t *residual, size_t framesNumber, u_int order, u_int bits,
+                         u_int &partitionOrder, u_int *riceParams);
+    bool tryLpc(const int32_t *samples, size_t framesNumber, u_int bits, Subframe &sf);
+    void writeFrameHeader(size_t framesNumber, u_int chanAssignment, u_int bits, u_int sampleRate,
+                          uint64_t frameIndex, BitWriter &out);
+    void writeSubframe(const int32_t *samples, size_t framesNumber, u_int bits, const Subframe &sf, BitWriter &out);
+};
+
+#endif  // __FLACFRAME_H__
@@ -0,0 +1,82 @@
+#ifndef __GAINLIMITER_H__
+#define __GAINLIMITER_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "sampleformat.h"
+#include "samplekernels.h"
+
+// Streaming gain stage. Applies the requested gain while the data is captured
+// and limits it by a running peak tracker, so no global pass over the whole
+// recording is required. Every processed block is its own look-ahead window:
+// if the block peak does not fit into the full scale of the sample format with
+// the current gain, the gain is reduced before the block is written. Afterwards the gain is released back
+// to the requested value with a fixed rate.
+// Every channel has its own gain and limiter state, and its input peak and RMS
+// levels are metered in the same pass that finds the block peaks.
+// S16 uses the vectorized SampleKernels, other formats use loops specialized by templates.
+class GainLimiter
+{
+public:
+    GainLimiter(float gainDb = 0.0, u_int sampleRate = 48000, u_int chansNumber = 1, SampleFormat::Id format = SampleFormat::S16_LE);
+
+    float getGain() { return gainDb; }
+    float getMinAppliedGain(u_int ch);
+    float getPeakDb(u_int ch);
+    float getRmsDb(u_int ch);
+    u_int getChansNumber() { return chansNumber; }
+    bool isLimited(u_int ch) { return minCoeff[ch] < targetCoeff[ch]; }
+    bool isLimited();
+
+    // Interleaved frames in the stream format. in and out may point to the same buffer
+    void process(const void *in, void *out, size_t framesNumber);
+    void reset();
+    void setGain(float gainDb);
+    // Per-channel gains, dB. Channels without a value keep the common gain
+    void setChannelGains(const std::vector<float> &gainsDb);
+    void setReleaseRate(float dbPerSec) { releaseDbPerSec = dbPerSec; }
+    void setStreamFormat(u_int sampleRate, u_int chansNumber, SampleFormat::Id format = SampleFormat::S16_LE);
+
+private:
+    // Release ramp granularity, frames
+    static const size_t RAMP_STEP_FRAMES = 128;
+
+    // Highest permissible output level, relative to the full scale
+    static constexpr float MAX_LEVEL = 32767.0 / 32768.0;
+
+    float gainDb;
+    std::vector<float> gainsDb;
+    std::vector<float> targetCoeff;
+    std::vector<float> curCoeff;
+    std::vector<float> minCoeff;
+    std::vector<float> nextCoeff;
+    std::vector<float> stepCoeff;
+    float releaseDbPerSec;
+    u_int sampleRate;
+    u_int chansNumber;
+    SampleFormat::Id format;
+
+    SampleKernels::FixedGain fixedGain;
+    std::vector<short> minValues;
+    std::vector<short> maxValues;
+    std::vector<float> blockSumSquares;
+    std::vector<float> peakLevels;
+
+    // Metering of the input stream
+    std::vector<float> peakMax;
+    std::vector<double> sumSquares;
+    uint64_t framesTotal;
+
+    float nextCoefficient(u_int ch, float peakLevel, size_t framesNumber);
+    void updateTargets();
+    void processS16(const short *in, short *out, size_t framesNumber);
+
+    template <class Sample>
+    void processGeneric(const char *in, char *out, size_t framesNumber);
+};
+
+#endif  // __GAINLIMITER_H__
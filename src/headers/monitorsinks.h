@@ -0,0 +1,84 @@
+#ifndef __MONITORSINKS_H__
+#define __MONITORSINKS_H__
+
+#include <alsa/asoundlib.h>
+
+#include <vector>
+
+#include "monitortap.h"
+
+// Live playback on an ALSA device. The device latency is kept low,
+// an underrun is recovered from and the playback continues.
+class AlsaMonitorSink : public MonitorSink
+{
+public:
+    // Playback latency, us
+    static const u_int LATENCY_US = 50000;
+
+    AlsaMonitorSink(const std::string &name, const std::string &device);
+    ~AlsaMonitorSink();
+
+protected:
+    bool open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate);
+    bool write(const MonitorBlock *block);
+    void close();
+
+private:
+    std::string device;
+    snd_pcm_t *pcm;
+    size_t frameSize;
+};
+
+// RTP stream over UDP (RFC 3550), L16 or L24 payload (RFC 3551, RFC 3190) with the
+// dynamic payload type 96. Timestamps follow the captured frames, so the gaps of
+// dropped data are visible to the receiver. A packet which can't be sent at once is dropped.
+class RtpMonitorSink : public MonitorSink
+{
+public:
+    static const u_int PAYLOAD_TYPE = 96;
+    // Payload size limit, the packets are not fragmented on usual networks
+    static const size_t MAX_PAYLOAD_SIZE = 1200;
+
+    RtpMonitorSink(const std::string &name, const std::string &host, const std::string &port);
+    ~RtpMonitorSink();
+
+protected:
+    bool open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate);
+    bool write(const MonitorBlock *block);
+    void close();
+
+private:
+    static const size_t HEADER_SIZE = 12;
+
+    std::string host;
+    std::string port;
+    int fd;
+    size_t sampleSize;
+    size_t frameSize;
+    uint16_t seq;
+    uint32_t ssrc;
+    std::vector<char> packet;
+};
+
+// Raw interleaved data to a pipe, a FIFO or a file. A FIFO must have a reader when
+// the recording starts. If the reader is slow, the data is dropped, if it goes away, the sink stops.
+class PipeMonitorSink : public MonitorSink
+{
+public:
+    PipeMonitorSink(const std::string &name, const std::string &path);
+    ~PipeMonitorSink();
+
+protected:
+    bool open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate);
+    bool write(const MonitorBlock *block);
+    void close();
+
+private:
+    std::string path;
+    int fd;
+    // Flags of the standard output, which is shared with the rest of the process
+    int savedFlags;
+    size_t frameSize;
+};
+
+#endif  // __MONITORSINKS_H__
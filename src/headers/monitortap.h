@@ -0,0 +1,122 @@
+#ifndef __MONITORTAP_H__
+#define __MONITORTAP_H__
+
+#include <sys/types.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sampleformat.h"
+
+// Captured data shared by all monitor sinks. It is freed when the last sink releases it
+struct MonitorBlock
+{
+    std::atomic<u_int> refs;
+    char *data;
+    size_t frames;
+    // Index of the first frame since the start of capture
+    uint64_t framePos;
+
+    void release() { refs.fetch_sub(1, std::memory_order_release); }
+};
+
+// Consumer of the monitored data, running in its own thread.
+// Blocks are passed through a lock-free queue, so the capture thread never waits:
+// if the queue is full, the block is dropped for this sink only.
+class MonitorSink
+{
+public:
+    // Blocks waiting for the sink
+    static const size_t QUEUE_SIZE = 64;
+
+    // "alsa:<device>", "rtp:<host>:<port>", "pipe:<path>" or "-" for the standard output
+    static MonitorSink *create(const std::string &spec);
+
+    MonitorSink(const std::string &name);
+    virtual ~MonitorSink();
+
+    std::string getName() { return name; }
+    std::string getLastErrorInfo() { return errStr; }
+    uint64_t getDroppedFrames() { return droppedFrames; }
+
+    bool start(SampleFormat::Id format, u_int chansNumber, u_int sampleRate);
+    void stop();
+
+    // Capture thread side. Returns false if the block is dropped
+    bool enqueue(MonitorBlock *block);
+
+protected:
+    std::string errStr;
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> droppedFrames;
+    // The queued blocks are written on stop instead of being dropped
+    bool lossless;
+
+    virtual bool open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate) = 0;
+    // Returns false on a permanent error, then the rest of data is dropped
+    virtual bool write(const MonitorBlock *block) = 0;
+    virtual void close() = 0;
+
+private:
+    std::string name;
+    std::thread thread;
+    sem_t sem;
+    MonitorBlock *queue[QUEUE_SIZE];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    // After a permanent error the data is still taken from the queue, so the blocks are released
+    bool failed;
+
+    // Passes the queued blocks to the sink, or drops them if it has failed
+    void drain();
+    void loop();
+};
+
+// Fan-out of the captured data to monitor sinks.
+// Every chunk is copied once into a shared block from a preallocated pool, the sinks
+// hold references to it. If all blocks are held by slow sinks, the chunk is not monitored.
+class MonitorTap
+{
+public:
+    MonitorTap();
+    ~MonitorTap();
+
+    std::string getLastErrorInfo() { return errStr; }
+    bool isActive() { return !sinks.empty(); }
+    size_t getSinksNumber() { return sinks.size(); }
+    MonitorSink *getSink(size_t index) { return sinks[index].get(); }
+    uint64_t getDroppedFrames() { return droppedFrames; }
+
+    bool addSink(const std::string &spec);
+    // The tap takes the ownership
+    void addSink(MonitorSink *sink);
+
+    // Blocks are blockFrames long, a chunk is split into several ones if needed
+    bool start(SampleFormat::Id format, u_int chansNumber, u_int sampleRate, size_t blockFrames, size_t blocksNumber);
+    void stop();
+
+    // Capture thread side, never blocks and never allocates
+    void push(const char *data, size_t frames);
+
+private:
+    std::vector<std::unique_ptr<MonitorSink> > sinks;
+    std::unique_ptr<MonitorBlock[]> blocks;
+    std::vector<char> blocksData;
+    size_t blocksNumber;
+    size_t blockFrames;
+    size_t frameSize;
+    size_t nextBlock;
+    uint64_t framePos;
+    uint64_t droppedFrames;
+    std::string errStr;
+
+    MonitorBlock *acquire();
+};
+
+#endif  // __MONITORTAP_H__
@@ -0,0 +1,55 @@
+#ifndef __OUTPUTFILE_H__
+#define __OUTPUTFILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// Output file backend.
+// If the expected size is known and the output is a regular file, the file is
+// preallocated and memory-mapped, so the data is produced directly into the page cache.
+// Otherwise (pipe, unknown size, mmap failure) data is written with write().
+// Data is produced with reserve()/commit() pairs: the caller fills the reserved region in place.
+class OutputFile
+{
+public:
+    OutputFile();
+    ~OutputFile();
+
+    bool open(const std::string &fileName, uint64_t expectedSize = 0, size_t maxChunkSize = 0);
+    bool close();
+
+    std::string getLastErrorInfo() { return errStr; }
+    uint64_t getSize() { return pos; }
+    bool isMapped() { return mapAddr != NULL; }
+    bool isOpened() { return fd >= 0; }
+    // Regular file, headers can be patched while it is written
+    bool isSeekable() { return seekable; }
+
+    char *reserve(size_t size);
+    bool commit(size_t size);
+    bool write(const void *data, size_t size);
+
+    // Overwrite already written data, used to patch headers
+    bool writeAt(uint64_t offset, const void *data, size_t size);
+
+private:
+    int fd;
+    uint64_t pos;
+    bool seekable;
+    std::string errStr;
+
+    // Mapped file
+    char *mapAddr;
+    uint64_t mapSize;
+
+    // Staging buffer for write()
+    char *stageBuf;
+    size_t stageSize;
+
+    bool switchToWrite();
+    bool writeAll(const char *data, size_t size);
+};
+
+#endif  // __OUTPUTFILE_H__
@@ -0,0 +1,40 @@
+#ifndef __RANGEEXTRACTOR_H__
+#define __RANGEEXTRACTOR_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "blockindex.h"
+
+// Extraction of a time range of a recording by its block index (<recording>.bix).
+// The byte range is looked up in the index, the audio data is neither scanned nor
+// decoded: it is copied in the kernel with copy_file_range() (shared extents on file
+// systems which support them), or with pread() and write() where it is not possible.
+// A ".wav" output gets its own header, any other output is raw data.
+class RangeExtractor
+{
+public:
+    RangeExtractor();
+
+    std::string getLastErrorInfo() { return errStr; }
+    uint64_t getFramesNumber() { return framesNumber; }
+
+    // The range is "<start>:<duration>" in seconds, the start is counted from the beginning of
+    // the recording, or is a wall clock time after '@' (see TimingIndexReader::parseWallTime)
+    bool extract(const std::string &inFileName, const std::string &outFileName, const std::string &rangeStr);
+
+private:
+    static const size_t COPY_BUF_SIZE = 1024 * 1024;
+
+    std::string errStr;
+    uint64_t framesNumber;
+
+    bool parseRange(BlockIndexReader &index, const std::string &rangeStr, uint64_t *startPos, uint64_t *endPos);
+    bool copyRange(int inFd, uint64_t offset, uint64_t size, int outFd);
+    static bool isWavFile(const std::string &fileName);
+};
+
+#endif  // __RANGEEXTRACTOR_H__
@@ -0,0 +1,44 @@
+#ifndef __REALFFT_H__
+#define __REALFFT_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+
+#include <vector>
+
+// FFT of real data. A block of N samples is transformed as N/2 complex values
+// (even samples are real parts, odd ones are imaginary parts) by an iterative
+// radix-2 FFT with vectorized butterflies, then the spectrum of the real signal
+// is separated from it. Tables are built once by setup(), transforms don't allocate.
+class RealFft
+{
+public:
+    static const size_t MIN_SIZE = 16;
+    static const size_t MAX_SIZE = 65536;
+
+    RealFft();
+
+    size_t getSize() { return size; }
+    static bool isSizeValid(size_t size);
+
+    bool setup(size_t size);
+
+    // Bins 0..N/2 of the spectrum of N samples, the arrays hold N/2 + 1 values
+    void transform(const float *in, float *re, float *im);
+
+private:
+    size_t size;
+    // Bit-reversed index of every complex value
+    std::vector<u_int> reversed;
+    // Twiddle factors of all stages, the stage with butterflies of half elements starts at half - 1
+    std::vector<float> twRe;
+    std::vector<float> twIm;
+    // Factors separating the real spectrum, exp(-2*pi*i*k/N)
+    std::vector<float> splitRe;
+    std::vector<float> splitIm;
+    // Complex data
+    std::vector<float> workRe;
+    std::vector<float> workIm;
+};
+
+#endif  // __REALFFT_H__
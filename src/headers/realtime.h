@@ -0,0 +1,47 @@
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// operator new calls of the current thread, defined by allocationcounter.cpp. It replaces
+// the global operator new, so it is linked into programs and not into the library.
+// Weak, the address is NULL when the program does not count allocations
+uint64_t realtimeThreadAllocations() __attribute__((weak));
+
+// Real-time setup of the capture path: SCHED_FIFO priority, memory locking, CPU affinity
+// and prefaulting. Errors are returned in errStr, callers usually go on without the setting,
+// it needs CAP_SYS_NICE / CAP_IPC_LOCK or the rtprio / memlock limits.
+// Only the memory of the capture path is locked, the output files and the buffers of
+// the writer stay pageable.
+// Programs linked with allocationcounter.cpp count every operator new per thread, so a loop
+// can check that it does not allocate. Allocations of C code (malloc() in libraries) are not counted.
+class Realtime
+{
+public:
+    // Stack used by the capture thread, it is touched before the loop
+    static const size_t STACK_PREFAULT_SIZE = 64 * 1024;
+
+    static bool isPriorityValid(u_int priority);
+    static bool isCpuValid(u_int cpu);
+
+    // Current thread
+    static bool setFifo(u_int priority, std::string &errStr);
+    static bool pinThread(const std::vector<u_int> &cpus, std::string &errStr);
+    // STACK_PREFAULT_SIZE of the stack below the caller is faulted in and locked
+    static bool lockStack(std::string &errStr);
+
+    // The pages of the buffer are faulted in and stay in memory until it is unlocked
+    static bool lockMemory(const void *addr, size_t size, std::string &errStr);
+    static void unlockMemory(const void *addr, size_t size);
+
+    // operator new calls of the current thread since it started, 0 if they are not counted
+    static uint64_t getThreadAllocations();
+    static bool isAllocationCounted();
+};
+
+#endif  // __REALTIME_H__
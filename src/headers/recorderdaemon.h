@@ -0,0 +1,76 @@
+#ifndef __RECORDERDAEMON_H__
+#define __RECORDERDAEMON_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audiorecorder.h"
+#include "deviceenumerator.h"
+
+// Long-running recording service.
+// The recorders are created once, so their devices stay open and prepared
+// between recordings. Commands come over a Unix domain socket, one per line,
+// every reply ends with an "OK" or "ERROR: <reason>" line:
+//   start [device]     start recording on the device or on all idle devices
+//   stop [device]      finish the recording
+//   rotate [device]    continue the recording in a new output segment
+//   status [device]    one JSON line per device
+//   list [refresh]     one JSON line per audio device, from the cache which is
+//                      updated on hotplug
+//   quit               finish all recordings and exit
+class RecorderDaemon
+{
+public:
+    RecorderDaemon();
+    ~RecorderDaemon();
+
+    std::string getLastErrorInfo() { return errStr; }
+
+    void addRecorder(AudioRecorder *recorder);
+    // Serve commands until "quit" or SIGINT/SIGTERM
+    bool run(const std::string &socketPath);
+
+private:
+    // Maximum length of a command line
+    static const size_t MAX_LINE_SIZE = 4096;
+
+    // A recorder and its recording thread
+    struct Slot
+    {
+        AudioRecorder *recorder;
+        std::thread thread;
+        std::atomic<bool> recording;
+    };
+
+    struct Client
+    {
+        int fd;
+        std::string inBuf;
+    };
+
+    std::vector<std::unique_ptr<Slot> > slots;
+    std::vector<Client> clients;
+    DeviceEnumerator devsEnumerator;
+    int listenFd;
+    std::string path;
+    bool quit;
+    std::string errStr;
+
+    bool openSocket(const std::string &socketPath);
+    void closeSocket();
+
+    void acceptClients();
+    bool readClient(Client &client);
+    void execCommand(const std::string &line, std::string &reply);
+
+    // Slots matching the device, all if it is empty. False if there are none
+    bool findSlots(const std::string &device, std::vector<Slot *> &found);
+    bool startRecording(Slot *slot, std::string &reply);
+    void finishRecording(Slot *slot, bool wait);
+    static void recordingLoop(Slot *slot);
+};
+
+#endif  // __RECORDERDAEMON_H__
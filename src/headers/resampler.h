@@ -0,0 +1,105 @@
+#ifndef __RESAMPLER_H__
+#define __RESAMPLER_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sampleformat.h"
+
+// Polyphase sample rate converter for a rational ratio outRate/inRate = L/M.
+// The prototype filter is a Kaiser-windowed sinc with its cutoff below the lower
+// Nyquist frequency, split into L phases. Every output sample is a dot product of
+// one phase with the latest input samples, done by the vectorized kernel.
+// The channels are independent, with many of them they are shared between worker threads.
+class Resampler
+{
+public:
+    // Filter taps per phase when upsampling, downsampling uses proportionally more
+    static const u_int BASE_TAPS = 32;
+    static const u_int MAX_TAPS = 256;
+    static const u_int MAX_PHASES = 4096;
+
+    Resampler();
+    ~Resampler();
+
+    std::string getLastErrorInfo() { return errStr; }
+    bool isActive() { return inRate != outRate; }
+    u_int getTapsNumber() { return tapsNumber; }
+    u_int getWorkersNumber() { return workers.size() + 1; }
+
+    // Buffers are allocated here for blocks of up to maxInFrames, processing does not allocate
+    bool setup(SampleFormat::Id format, u_int chansNumber, u_int inRate, u_int outRate, size_t maxInFrames);
+    void reset();
+
+    // Output frames for an input block, not more than for maxInFrames
+    size_t getMaxOutFrames(size_t inFrames);
+
+    // Interleaved frames in, interleaved frames out. Returns the number of output frames
+    size_t process(const char *in, size_t inFrames, char *out);
+
+private:
+    // Channels per worker thread, fewer are not worth the synchronization
+    static const u_int MIN_CHANS_PER_WORKER = 4;
+    static const double KAISER_BETA;
+    static const double ROLLOFF;
+
+    SampleFormat::Id format;
+    u_int chansNumber;
+    u_int inRate;
+    u_int outRate;
+    u_int upFactor;
+    u_int downFactor;
+    u_int tapsNumber;
+    std::string errStr;
+
+    // Phases one after another, taps reversed
+    std::vector<float> coeffs;
+
+    // Per-channel history: the last (taps - 1) input samples, then the new block
+    std::vector<float> history;
+    size_t historyStride;
+    // Per-channel output of the block
+    std::vector<float> planarOut;
+    size_t outStride;
+
+    // Filter position: the newest input sample of the next output and its phase
+    size_t pos;
+    u_int phase;
+    // Positions and phases of the outputs of the current block, the same for all channels
+    std::vector<u_int> outPos;
+    std::vector<u_int> outPhase;
+
+    // Current block
+    const char *blockIn;
+    size_t blockInFrames;
+    size_t blockOutFrames;
+
+    // Workers take channel groups 1..N, the calling thread takes group 0
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workCond;
+    std::condition_variable doneCond;
+    uint64_t generation;
+    u_int doneNumber;
+    bool stopping;
+
+    void makeFilter();
+    void startWorkers(u_int workersNumber);
+    void stopWorkers();
+    void workerLoop(u_int group);
+    void processGroup(u_int group);
+
+    template <class Sample>
+    void processChannels(u_int firstCh, u_int lastCh);
+    template <class Sample>
+    void interleave(char *out);
+};
+
+#endif  // __RESAMPLER_H__
@@ -0,0 +1,50 @@
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer byte ring.
+// The memory is allocated once by create(), push() and peek()/pop() never allocate
+// and never block, so the producer side is safe to call from a real-time thread.
+class RingBuffer
+{
+public:
+    // Alignment of the buffer memory
+    static const size_t ALIGNMENT = 4096;
+
+    RingBuffer();
+    ~RingBuffer();
+
+    bool create(size_t size);
+    void destroy();
+    void reset();
+
+    size_t getSize() { return size; }
+    size_t getFilledSpace();
+    size_t getFreeSpace() { return size - getFilledSpace(); }
+    size_t getHighWaterMark() { return highWaterMark.load(std::memory_order_relaxed); }
+
+    // Producer side
+    bool push(const void *data, size_t dataSize);
+
+    // Consumer side. peek() returns the size of the contiguous region available for reading,
+    // starting offset bytes after the read position (the consumer may hold data which is not popped yet)
+    size_t peek(const char **data, size_t offset = 0);
+    const char *getData() { return buf; }
+    void pop(size_t dataSize);
+
+private:
+    char *buf;
+    size_t size;
+
+    // Positions grow monotonically, index in the buffer is position % size.
+    // They are kept on separate cache lines to avoid false sharing between threads.
+    alignas(64) std::atomic<uint64_t> writePos;
+    alignas(64) std::atomic<uint64_t> readPos;
+    alignas(64) std::atomic<size_t> highWaterMark;
+};
+
+#endif  // __RINGBUFFER_H__
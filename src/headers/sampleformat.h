@@ -0,0 +1,134 @@
+#ifndef __SAMPLEFORMAT_H__
+#define __SAMPLEFORMAT_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <string>
+
+// Supported capture sample formats
+class SampleFormat
+{
+public:
+    enum Id
+    {
+        S16_LE,
+        S24_3LE,
+        S32_LE,
+        FLOAT_LE
+    };
+
+    static u_int getBits(Id format);
+    static size_t getBytes(Id format) { return getBits(format) / 8; }
+    static const char *getName(Id format);
+    static bool isFloat(Id format) { return format == FLOAT_LE; }
+    static bool fromName(const std::string &name, Id &format);
+};
+
+// Sample traits. The hot loops are templates on these types, so every format
+// gets its own specialized loop without per-sample branching.
+// value_t is the type used for arithmetic, level() is the absolute level in [0, 1],
+// toFloat() and fromFloat() convert to and from the [-1, 1] range with saturation.
+struct SampleS16
+{
+    typedef int16_t value_t;
+    static const size_t SIZE = 2;
+
+    static value_t load(const char *p) { value_t v; memcpy(&v, p, SIZE); return v; }
+    static void store(char *p, value_t v) { memcpy(p, &v, SIZE); }
+    static float level(value_t v) { return (v < 0 ? -(float)v : (float)v) / 32768.0f; }
+    static float toFloat(value_t v) { return v / 32768.0f; }
+
+    static value_t fromFloat(float v)
+    {
+        long res = lrintf(v * 32768.0f);
+        return res > 32767 ? 32767 : res < -32768 ? -32768 : res;
+    }
+
+    static value_t scale(value_t v, float coeff)
+    {
+        long res = lrintf(v * coeff);
+        return res > 32767 ? 32767 : res < -32768 ? -32768 : res;
+    }
+};
+
+struct SampleS24
+{
+    typedef int32_t value_t;
+    static const size_t SIZE = 3;
+
+    static value_t load(const char *p)
+    {
+        const unsigned char *b = (const unsigned char *)p;
+        return (int32_t)((uint32_t)b[0] << 8 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 24) >> 8;
+    }
+
+    static void store(char *p, value_t v)
+    {
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+    }
+
+    static float level(value_t v) { return (v < 0 ? -(float)v : (float)v) / 8388608.0f; }
+    static float toFloat(value_t v) { return v / 8388608.0f; }
+
+    static value_t fromFloat(float v)
+    {
+        long res = lrintf(v * 8388608.0f);
+        return res > 0x7FFFFF ? 0x7FFFFF : res < -0x800000 ? -0x800000 : res;
+    }
+
+    static value_t scale(value_t v, float coeff)
+    {
+        long res = lrintf(v * coeff);
+        return res > 0x7FFFFF ? 0x7FFFFF : res < -0x800000 ? -0x800000 : res;
+    }
+};
+
+struct SampleS32
+{
+    typedef int32_t value_t;
+    static const size_t SIZE = 4;
+
+    static value_t load(const char *p) { value_t v; memcpy(&v, p, SIZE); return v; }
+    static void store(char *p, value_t v) { memcpy(p, &v, SIZE); }
+    static float level(value_t v) { return (v < 0 ? -(double)v : (double)v) / 2147483648.0; }
+    static float toFloat(value_t v) { return v / 2147483648.0; }
+
+    static value_t fromFloat(float v)
+    {
+        double res = rint((double)v * 2147483648.0);
+        return res > 2147483647.0 ? 2147483647 : res < -2147483648.0 ? (-2147483647 - 1) : (value_t)res;
+    }
+
+    static value_t scale(value_t v, float coeff)
+    {
+        // Single precision is not enough for 32-bit samples
+        double res = rint((double)v * coeff);
+        return res > 2147483647.0 ? 2147483647 : res < -2147483648.0 ? (-2147483647 - 1) : (value_t)res;
+    }
+};
+
+struct SampleFloat
+{
+    typedef float value_t;
+    static const size_t SIZE = 4;
+
+    static value_t load(const char *p) { value_t v; memcpy(&v, p, SIZE); return v; }
+    static void store(char *p, value_t v) { memcpy(p, &v, SIZE); }
+    static float level(value_t v) { return fabsf(v); }
+    static float toFloat(value_t v) { return v; }
+    static value_t fromFloat(float v) { return v > 1.0f ? 1.0f : v < -1.0f ? -1.0f : v; }
+
+    static value_t scale(value_t v, float coeff)
+    {
+        float res = v * coeff;
+        return res > 1.0f ? 1.0f : res < -1.0f ? -1.0f : res;
+    }
+};
+
+#endif  // __SAMPLEFORMAT_H__
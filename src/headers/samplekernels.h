@@ -0,0 +1,84 @@
+#ifndef __SAMPLEKERNELS_H__
+#define __SAMPLEKERNELS_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+
+#include <vector>
+
+// Hot loops over interleaved S16 samples and float filter data.
+// Every kernel has a portable scalar version and SSE2/AVX2 versions on x86.
+// The fastest one supported by the CPU is selected at runtime.
+class SampleKernels
+{
+public:
+    enum Impl
+    {
+        IMPL_SCALAR,
+        IMPL_SSE2,
+        IMPL_AVX2
+    };
+
+    // Fixed-point gain: out = saturate((in * mult + round) >> shift).
+    // Multipliers are stored for every sample position of a repeating pattern,
+    // its length is a multiple of both the channels number and the widest vector.
+    struct FixedGain
+    {
+        std::vector<short> pattern;
+        int shift;
+    };
+
+    static Impl getImpl();
+    static const char *getImplName(Impl impl);
+    static bool isImplSupported(Impl impl);
+    static bool setImpl(Impl impl);
+
+    // Prepare a fixed-point gain from per-channel coefficients.
+    // Does not reallocate memory if the channels number is not changed.
+    static void makeGain(FixedGain &gain, const float *coeffs, u_int chansNumber);
+    static void makeGain(FixedGain &gain, float coeff, u_int chansNumber);
+
+    // Apply gain with saturation. in and out may point to the same buffer
+    static void applyGain(const short *in, short *out, size_t framesNumber, u_int chansNumber, const FixedGain &gain);
+
+    // Update per-channel minimum and maximum values and, if sumSquares is not NULL, sums of squares,
+    // all in one pass over the interleaved buffer. The arrays must be initialized by the caller
+    static void findPeaks(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares = NULL);
+
+    // Copy selected channels of interleaved frames, map[i] is the input channel of the output channel i
+    static void selectChannels(const char *in, char *out, size_t framesNumber, u_int inChansNumber,
+                               const u_int *map, u_int outChansNumber, size_t sampleSize);
+
+    // Sum of products of two float arrays, e.g. filter taps and samples
+    static float dotProduct(const float *a, const float *b, size_t length);
+
+    // One radix-2 decimation-in-time stage of a complex FFT over split real and imaginary arrays.
+    // Butterflies span half elements, tw holds their half twiddle factors
+    static void fftStage(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half);
+
+private:
+    // Longest interleaved pattern handled by the vector peak kernels, samples
+    static const size_t MAX_PEAK_PATTERN = 512;
+
+    static size_t patternLength(u_int chansNumber, size_t vectorWidth);
+
+    template <size_t SIZE>
+    static void selectChannelsImpl(const char *in, char *out, size_t framesNumber, u_int inChansNumber, const u_int *map, u_int outChansNumber);
+
+    static void applyGainScalar(const short *in, short *out, size_t samplesNumber, const FixedGain &gain, size_t patternPos);
+    static void findPeaksScalar(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares);
+    static float dotProductScalar(const float *a, const float *b, size_t length);
+    static void fftStageScalar(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half);
+
+    static void applyGainSse2(const short *in, short *out, size_t samplesNumber, const FixedGain &gain);
+    static void findPeaksSse2(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares);
+    static float dotProductSse2(const float *a, const float *b, size_t length);
+    static void fftStageSse2(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half);
+
+    static void applyGainAvx2(const short *in, short *out, size_t samplesNumber, const FixedGain &gain);
+    static void findPeaksAvx2(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares);
+    static float dotProductAvx2(const float *a, const float *b, size_t length);
+    static void fftStageAvx2(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half);
+};
+
+#endif  // __SAMPLEKERNELS_H__
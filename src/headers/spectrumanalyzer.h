@@ -0,0 +1,102 @@
+#ifndef __SPECTRUMANALYZER_H__
+#define __SPECTRUMANALYZER_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "monitortap.h"
+#include "outputfile.h"
+#include "realfft.h"
+
+// Spectral features of the captured audio, computed in the sink thread while recording and
+// written to a sidecar file. The recorded channels are mixed down to mono, analysis frames
+// are Hann-windowed and overlap by half. Every frame gives the peak and RMS levels, the
+// spectral centroid and the energies of log-spaced bands. Data dropped by the tap restarts
+// the framing, the frame positions in the file show the gap.
+//
+// File layout, little-endian: spec_header_t, bandsNumber + 1 band edges in Hz (float),
+// then spec_frame_t records. Levels are in 0.01dBFS units, -32768 is silence.
+class SpectrumAnalyzer : public MonitorSink
+{
+public:
+    static const u_int BANDS_NUMBER = 24;
+    // Lower edge of the first band, Hz
+    static const u_int MIN_BAND_FREQ = 20;
+    // Every band needs at least one bin
+    static const u_int MIN_FFT_SIZE = 64;
+
+    typedef struct SPEC_HEADER
+    {
+        // "ARSPEC01"
+        char magic[8];
+        // Header with the band edges, offset of the first frame
+        uint32_t headerSize;
+        uint32_t frameSize;
+        uint32_t sampleRate;
+        uint32_t fftSize;
+        uint32_t hopSize;
+        uint32_t bandsNumber;
+        // Start of the recording, CLOCK_REALTIME
+        uint64_t startTimeNs;
+    } __attribute__((packed)) spec_header_t;
+
+    typedef struct SPEC_FRAME
+    {
+        // First captured frame of the analysis frame
+        uint64_t framePos;
+        int16_t peak;
+        int16_t rms;
+        uint16_t centroidHz;
+        int16_t bands[BANDS_NUMBER];
+    } __attribute__((packed)) spec_frame_t;
+
+    explicit SpectrumAnalyzer(u_int fftSize);
+    ~SpectrumAnalyzer();
+
+    static bool isFftSizeValid(u_int fftSize) { return fftSize >= MIN_FFT_SIZE && RealFft::isSizeValid(fftSize); }
+
+    // Set before the start, the file is created when the recording starts
+    void setFileName(const std::string &fileName) { this->fileName = fileName; }
+    uint64_t getFramesNumber() { return framesNumber; }
+
+protected:
+    bool open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate);
+    bool write(const MonitorBlock *block);
+    void close();
+
+private:
+    u_int fftSize;
+    u_int hopSize;
+    std::string fileName;
+    OutputFile outFile;
+    RealFft fft;
+    SampleFormat::Id format;
+    u_int chansNumber;
+    u_int sampleRate;
+    // Bins of the bands, band b is [bandBins[b], bandBins[b + 1])
+    std::vector<u_int> bandBins;
+    std::vector<float> window;
+    // Window power normalization of the band energies
+    float bandScale;
+    // Mono samples of the current analysis frame
+    std::vector<float> frame;
+    size_t filled;
+    uint64_t framePos;
+    uint64_t nextPos;
+    std::vector<float> windowed;
+    std::vector<float> re;
+    std::vector<float> im;
+    uint64_t framesNumber;
+
+    // Computes the features of the full frame and writes them
+    bool analyze();
+    template <class Sample>
+    void mixDown(const char *data, size_t frames, float *out);
+    static int16_t toLevel(double meanSquare);
+};
+
+#endif  // __SPECTRUMANALYZER_H__
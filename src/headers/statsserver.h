@@ -0,0 +1,34 @@
+#ifndef __STATSSERVER_H__
+#define __STATSSERVER_H__
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+// Unix domain socket publishing stats lines.
+// Any number of clients may connect (e.g. "nc -U <path>"), every line is sent to
+// all of them. Nothing ever blocks: clients are accepted and served with
+// non-blocking calls, a client which can not take a line is disconnected.
+class StatsServer
+{
+public:
+    StatsServer();
+    ~StatsServer();
+
+    std::string getLastErrorInfo() { return errStr; }
+    bool isOpened() { return listenFd >= 0; }
+
+    bool open(const std::string &path);
+    void close();
+    // The line is sent with a trailing new line
+    void publish(const std::string &line);
+
+private:
+    int listenFd;
+    std::string path;
+    std::vector<int> clientFds;
+    std::string errStr;
+};
+
+#endif  // __STATSSERVER_H__
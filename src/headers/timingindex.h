@@ -0,0 +1,170 @@
+#ifndef __TIMINGINDEX_H__
+#define __TIMINGINDEX_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "outputfile.h"
+
+// Online linear fit of the device timestamps against the frame positions, the slope
+// is the actual period of the device clock measured by the timestamp clock.
+// A timestamp far from the line of the nominal rate (overrun, suspend) starts a new fit.
+class DriftEstimator
+{
+public:
+    // Largest deviation of a timestamp from the nominal rate which is not a gap
+    static const uint64_t MAX_JUMP_NS = 5000000;
+
+    DriftEstimator() { reset(48000); }
+
+    void reset(u_int nominalRate);
+    // Frame pos was captured at ns
+    void add(uint64_t pos, uint64_t ns);
+
+    // At least a second of timestamps is fitted
+    bool isValid() { return pointsNumber >= 2 && lastNs - ns0 >= 1000000000ULL; }
+    // Measured rate, Hz, and its deviation from the nominal one, ppm, positive if the device is fast
+    double getRate();
+    double getDriftPpm() { return isValid() ? (getRate() / nominalRate - 1) * 1e6 : 0; }
+    u_int getRestarts() { return restarts; }
+
+private:
+    u_int nominalRate;
+    u_int restarts;
+    uint64_t pointsNumber;
+    uint64_t pos0;
+    uint64_t ns0;
+    uint64_t lastPos;
+    uint64_t lastNs;
+    // Means and co-moments of the positions and times relative to the first point
+    double meanX;
+    double meanY;
+    double cxx;
+    double cxy;
+};
+
+// Timing index of a recording, written next to the output while capturing.
+// Every interval and after every gap in the data (overrun, ring buffer loss) the capture
+// thread maps the recorded frame position to its capture time by the device clock (ALSA
+// timestamps, CLOCK_MONOTONIC_RAW where supported) and by the wall clock, with the current
+// drift estimate. The entries are passed to the writer thread by a single-producer/
+// single-consumer queue, if it is full the entry is taken from a later block.
+//
+// File layout, little-endian: idx_header_t, then idx_entry_t records in time order.
+// Positions count the frames passed to the writer at the capture rate, so frames
+// lost by the ring buffer are not counted. In a single-file recording without
+// resampling they are frame offsets in the output data.
+class TimingIndex
+{
+public:
+    typedef struct IDX_HEADER
+    {
+        // "ARIDX001"
+        char magic[8];
+        // Offset of the first entry
+        uint32_t headerSize;
+        uint32_t entrySize;
+        uint32_t captureRate;
+        // Output rate, differs from the capture rate when resampling
+        uint32_t sampleRate;
+        uint32_t intervalMs;
+        // clockid_t of the device timestamps
+        uint32_t deviceClock;
+        // Start of the recording, CLOCK_REALTIME
+        uint64_t startWallNs;
+    } __attribute__((packed)) idx_header_t;
+
+    typedef struct IDX_ENTRY
+    {
+        uint64_t framePos;
+        // Capture time of the frame by the device timestamp clock and by CLOCK_REALTIME
+        uint64_t deviceNs;
+        uint64_t wallNs;
+        // Device clock drift estimate at this time, ppb, 0 while it is unknown
+        int32_t driftPpb;
+    } __attribute__((packed)) idx_entry_t;
+
+    TimingIndex();
+
+    std::string getLastErrorInfo() { return errStr; }
+    bool isOpened() { return outFile.isOpened(); }
+    DriftEstimator &getDrift() { return drift; }
+
+    bool open(const std::string &fileName, u_int captureRate, u_int sampleRate, u_int intervalMs, clockid_t deviceClock);
+    // Writes the queued entries
+    bool close();
+
+    // Capture thread. The block of frames starting at device frame blockPos is recorded
+    // from filePos, the device frame stampPos was captured at stampNs
+    void addBlock(uint64_t blockPos, uint64_t filePos, uint64_t frames, uint64_t stampPos, uint64_t stampNs);
+    // The recording ends before filePos, its end time is taken from the last block
+    void finish(uint64_t filePos);
+
+    // Writer thread. The written entries are kept, so the writer can map its data to the wall clock
+    bool flush();
+    // Wall clock of the recorded frame by the written entries, 0 if there are none yet
+    uint64_t getWallNs(uint64_t framePos);
+
+private:
+    static const size_t QUEUE_SIZE = 256;
+
+    OutputFile outFile;
+    std::string errStr;
+    u_int captureRate;
+    u_int intervalFrames;
+    clockid_t deviceClock;
+    DriftEstimator drift;
+
+    // Capture thread
+    uint64_t nextFilePos;
+    uint64_t lastStampPos;
+    uint64_t lastStampNs;
+    uint64_t lastBlockPos;
+    uint64_t lastFilePos;
+    uint64_t lastBlockFrames;
+    u_int lastRestarts;
+
+    idx_entry_t queue[QUEUE_SIZE];
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+
+    // Writer thread
+    std::vector<idx_entry_t> written;
+
+    void addEntry(uint64_t filePos, uint64_t blockPos);
+};
+
+// Reader of a timing index, the whole index is loaded
+class TimingIndexReader
+{
+public:
+    TimingIndexReader();
+
+    std::string getLastErrorInfo() { return errStr; }
+
+    bool load(const std::string &fileName);
+
+    const TimingIndex::idx_header_t &getHeader() { return header; }
+    size_t getEntriesNumber() { return entries.size(); }
+    const TimingIndex::idx_entry_t &getEntry(size_t i) { return entries[i]; }
+
+    // Recorded frame captured at the wall clock time, O(log n) in the entries number.
+    // False if the time is outside the recording
+    bool findFrame(uint64_t wallNs, uint64_t *framePos);
+
+    // Seconds since the epoch or local "YYYY-MM-DD HH:MM:SS", both with optional fractions
+    static bool parseWallTime(const char *str, uint64_t *wallNs);
+
+private:
+    TimingIndex::idx_header_t header;
+    std::vector<TimingIndex::idx_entry_t> entries;
+    std::string errStr;
+};
+
+#endif  // __TIMINGINDEX_H__
@@ -0,0 +1,96 @@
+#ifndef __TRIGGERGATE_H__
+#define __TRIGGERGATE_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "sampleformat.h"
+
+// Gate of the triggered recording.
+// The input is analyzed in short windows. While the gate is closed, the windows
+// are kept in a circular pre-roll buffer instead of being written. The gate opens
+// when the level exceeds the threshold: the peak of any channel in the level mode,
+// or the RMS of any channel together with a low zero-crossing rate in the voice
+// activity mode. The gate closes after the trigger has been silent for the hangover time.
+class TriggerGate
+{
+public:
+    enum Mode
+    {
+        MODE_LEVEL,
+        MODE_VAD
+    };
+
+    // What to do with a processed window
+    enum Action
+    {
+        GATE_SKIP,          // Window is kept in the pre-roll buffer
+        GATE_START,         // Write the pre-roll buffer, then the window
+        GATE_WRITE,         // Write the window
+        GATE_STOP           // Write the window, then finish the recording event
+    };
+
+    // Analysis window, ms
+    static const u_int WINDOW_MS = 10;
+
+    TriggerGate();
+
+    static bool modeFromName(const std::string &name, Mode &mode);
+
+    size_t getWindowFrames() { return windowFrames; }
+    uint64_t getEventsNumber() { return eventsNumber; }
+    bool isOpened() { return opened; }
+
+    void setup(Mode mode, float thresholdDb, u_int preRollMs, u_int hangoverMs,
+               u_int sampleRate, u_int chansNumber, SampleFormat::Id format);
+    void reset();
+
+    // Interleaved frames, not more than one window
+    Action process(const char *data, size_t framesNumber);
+
+    // Pre-roll data from the oldest frame, in two parts as the buffer is circular
+    void getPreRoll(const char **data1, size_t *frames1, const char **data2, size_t *frames2);
+
+private:
+    // The highest zero-crossing rate of voice, crossings per second. Noise and hiss cross more often
+    static const u_int VAD_MAX_ZCR = 3000;
+
+    Mode mode;
+    float thresholdLevel;
+    u_int sampleRate;
+    u_int chansNumber;
+    SampleFormat::Id format;
+    size_t frameSize;
+    size_t windowFrames;
+    uint64_t hangoverFrames;
+
+    bool opened;
+    uint64_t silentFrames;
+    uint64_t eventsNumber;
+
+    // Circular pre-roll buffer
+    std::vector<char> preRollBuf;
+    size_t preRollFrames;
+    size_t preRollPos;
+    size_t preRollFilled;
+
+    // Per-channel analysis buffers
+    std::vector<short> minValues;
+    std::vector<short> maxValues;
+    std::vector<float> peakLevels;
+    std::vector<float> sumSquares;
+    std::vector<u_int> crossings;
+    std::vector<char> negative;
+
+    bool isTriggered(const char *data, size_t framesNumber);
+    void storePreRoll(const char *data, size_t framesNumber);
+
+    template <class Sample>
+    void analyzeGeneric(const char *data, size_t framesNumber);
+};
+
+#endif  // __TRIGGERGATE_H__
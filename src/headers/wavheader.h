@@ -0,0 +1,142 @@
+#ifndef __WAVHEADER_H__
+#define __WAVHEADER_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampleformat.h"
+
+// WAV file header.
+// 16-bit PCM with 1 or 2 channels uses the canonical 44-byte header,
+// other formats use WAVE_FORMAT_EXTENSIBLE (68 bytes).
+// Files which may exceed 4GB reserve 36 bytes for the ds64 chunk of RF64 (EBU Tech 3306).
+// It is written as "JUNK", which readers skip, and becomes "ds64" once the sizes
+// do not fit 32 bits, then the file starts with "RF64" instead of "RIFF".
+class WavHeader
+{
+public:
+    WavHeader();
+
+    const char *getData() { return raw; }
+    size_t getSize() { return size; }
+    bool isRf64() { return rf64; }
+
+    void setFormat(SampleFormat::Id format, u_int chansNumber, u_int sampleRate);
+    // The ds64 chunk is reserved if the data may exceed 4GB, 0 is an unknown size
+    void setExpectedDataSize(uint64_t dataSize);
+    // UINT64_MAX is an unknown size, the largest RIFF sizes are written then
+    void setDataSize(uint64_t dataSize);
+
+private:
+    typedef union WAV_HEADER
+    {
+        struct {
+            // WAV-формат начинается с RIFF-заголовка:
+
+            // Содержит символы "RIFF" в ASCII кодировке
+            // (0x52494646 в big-endian представлении)
+            char chunkId[4];
+
+            // 36 + subchunk2Size, или более точно:
+            // 4 + (8 + subchunk1Size) + (8 + subchunk2Size)
+            // Это оставшийся размер цепочки, начиная с этой позиции.
+            // Иначе говоря, это размер файла - 8, то есть,
+            // исключены поля chunkId и chunkSize.
+            unsigned int chunkSize;
+
+            // Содержит символы "WAVE"
+            // (0x57415645 в big-endian представлении)
+            char format[4];
+
+            // Формат "WAVE" состоит из двух подцепочек: "fmt " и "data":
+            // Подцепочка "fmt " описывает формат звуковых данных:
+
+            // Содержит символы "fmt "
+            // (0x666d7420 в big-endian представлении)
+            char subchunk1Id[4];
+
+            // 16 для формата PCM, 40 для WAVE_FORMAT_EXTENSIBLE.
+            // Это оставшийся размер подцепочки, начиная с этой позиции.
+            unsigned int subchunk1Size;
+
+            // Аудио формат, полный список можно получить здесь http://audiocoding.ru/wav_formats.txt
+            // Для PCM = 1 (то есть, Линейное квантование), для IEEE float = 3,
+            // для WAVE_FORMAT_EXTENSIBLE = 0xFFFE (формат задаётся полем subFormat).
+            // Остальные значения обозначают некоторый формат сжатия.
+            unsigned short audioFormat;
+
+            // Количество каналов. Моно = 1, Стерео = 2 и т.д.
+            unsigned short numChannels;
+
+            // Частота дискретизации. 8000 Гц, 44100 Гц и т.д.
+            unsigned int sampleRate;
+
+            // sampleRate * numChannels * bitsPerSample/8
+            unsigned int byteRate;
+
+            // numChannels * bitsPerSample/8
+            // Количество байт для одного сэмпла, включая все каналы.
+            unsigned short blockAlign;
+
+            // Так называемая "глубиная" или точность звучания. 8 бит, 16 бит и т.д.
+            unsigned short bitsPerSample;
+
+            // Расширение WAVE_FORMAT_EXTENSIBLE. Записывается только если
+            // subchunk1Size = 40, иначе сразу следует подцепочка "data".
+
+            // Размер расширения, 22
+            unsigned short cbSize;
+
+            // Количество значащих бит в сэмпле
+            unsigned short validBitsPerSample;
+
+            // Маска расположения каналов (динамиков), 0 - не задано
+            unsigned int channelMask;
+
+            // GUID формата данных: KSDATAFORMAT_SUBTYPE_PCM или KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+            unsigned char subFormat[16];
+
+            // Подцепочка "data" содержит аудио-данные и их размер.
+
+            // Содержит символы "data"
+            // (0x64617461 в big-endian представлении)
+            char subchunk2Id[4];
+
+            // numSamples * numChannels * bitsPerSample/8
+            // Количество байт в области данных.
+            unsigned int subchunk2Size;
+
+            // Далее следуют непосредственно Wav данные.
+        } __attribute__((packed)) fields;
+
+        char data[sizeof(fields)];
+    } wav_header_t;
+
+    // RF64 sizes, placed after the "WAVE" id
+    typedef struct DS64_CHUNK
+    {
+        // "ds64", or "JUNK" while the sizes fit the RIFF header
+        char chunkId[4];
+        // 28, the table is not used
+        unsigned int chunkSize;
+        uint64_t riffSize;
+        uint64_t dataSize;
+        uint64_t sampleCount;
+        unsigned int tableLength;
+    } __attribute__((packed)) ds64_chunk_t;
+
+    wav_header_t header;
+    ds64_chunk_t ds64;
+    bool extensible;
+    bool rf64Reserved;
+    bool rf64;
+
+    // Header as it is written to the file
+    char raw[sizeof(wav_header_t) + sizeof(ds64_chunk_t)];
+    size_t size;
+
+    void build();
+};
+
+#endif  // __WAVHEADER_H__
@@ -1,12 +1,135 @@
 #include "audiorecorder.h"
+#include "capturescheduler.h"
+#include "recorderdaemon.h"
 #include <debug.h>
 
+#include <signal.h>
+#include <string.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace
+{
+    void stopSignalHandler(int)
+    {
+        AudioRecorder::requestStop();
+    }
+
+    // SIGINT and SIGTERM finish recording gracefully, so output files are completed
+    void setStopSignalHandlers()
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stopSignalHandler;
+        sigemptyset(&sa.sa_mask);
+
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        // A monitor pipe may lose its reader, it must not kill the recording
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    bool isCaptureDevOption(const char *arg)
+    {
+        return strncmp(arg, "-C", 2) == 0 || strcmp(arg, "--capture_dev") == 0 || strncmp(arg, "--capture_dev=", 14) == 0;
+    }
+
+    bool isStatsSocketOption(const char *arg)
+    {
+        return strncmp(arg, "-U", 2) == 0 || strcmp(arg, "--stats_socket") == 0 || strncmp(arg, "--stats_socket=", 15) == 0;
+    }
+
+    // Every device needs its own stats socket, the device index is appended to the common path.
+    // The new arguments are kept in strings
+    void setStatsSocketIndex(std::vector<char *> &args, size_t index, std::deque<std::string> &strings)
+    {
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (!isStatsSocketOption(args[i]))
+                continue;
+
+            // The path is the next argument or the rest of this one
+            if ((strcmp(args[i], "-U") == 0 || strcmp(args[i], "--stats_socket") == 0) && ++i == args.size())
+                break;
+
+            strings.push_back(std::string(args[i]) + '.' + std::to_string(index));
+            args[i] = &strings.back()[0];
+        }
+    }
+
+    // Split command line into per-device groups. Every -C starts a new device,
+    // options before the first -C are common and are applied to all devices.
+    std::vector<std::vector<char *> > splitCmdLine(int argc, char **argv, std::deque<std::string> &strings)
+    {
+        std::vector<char *> common(1, argv[0]);
+        std::vector<std::vector<char *> > groups;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            if (isCaptureDevOption(argv[i]))
+            {
+                groups.push_back(common);
+                setStatsSocketIndex(groups.back(), groups.size() - 1, strings);
+            }
+
+            if (groups.empty())
+                common.push_back(argv[i]);
+            else
+                groups.back().push_back(argv[i]);
+        }
+
+        for (size_t i = 0; i < groups.size(); ++i)
+            groups[i].push_back(NULL);
+
+        return groups;
+    }
+}
+
 int main(int argc, char **argv)
 {
-    AudioRecorder ar(argc, argv);
+    std::deque<std::string> argStrings;
+    std::vector<std::vector<char *> > groups = splitCmdLine(argc, argv, argStrings);
+
+    setStopSignalHandlers();
+
+    if (groups.size() < 2)
+    {
+        AudioRecorder ar(argc, argv);
+
+        if (!ar.isInited())
+            return 0;
+
+        if (ar.getDaemonSocket().empty())
+            return ar.record() ? 0 : 1;
+
+        RecorderDaemon daemon;
+        daemon.addRecorder(&ar);
+
+        return daemon.run(ar.getDaemonSocket()) ? 0 : 1;
+    }
+
+    // Several devices are recorded by one process
+    std::vector<std::unique_ptr<AudioRecorder> > recorders;
+    CaptureScheduler scheduler;
+    RecorderDaemon daemon;
+
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        recorders.push_back(std::unique_ptr<AudioRecorder>(new AudioRecorder(groups[i].size() - 1, &groups[i][0])));
+
+        if (!recorders.back()->isInited())
+            return 1;
+
+        scheduler.addRecorder(recorders.back().get());
+        daemon.addRecorder(recorders.back().get());
+    }
 
-    if (ar.isInited())
-        ar.record();
+    // The daemon socket is normally a common option, the first device has it
+    if (!recorders[0]->getDaemonSocket().empty())
+        return daemon.run(recorders[0]->getDaemonSocket()) ? 0 : 1;
 
-    return 0;
+    return scheduler.run() ? 0 : 1;
 }
@@ -0,0 +1,334 @@
+#include "monitorsinks.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+    // Waits are split into short ones, so a stopping sink does not hang
+    const int WAIT_MS = 100;
+}
+
+// Public members
+AlsaMonitorSink::AlsaMonitorSink(const std::string &name, const std::string &device) :
+    MonitorSink(name),
+    device(device),
+    pcm(NULL),
+    frameSize(0)
+{
+}
+
+AlsaMonitorSink::~AlsaMonitorSink()
+{
+    stop();
+}
+
+
+// Private methods
+bool AlsaMonitorSink::open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate)
+{
+    snd_pcm_format_t alsaFormat = SND_PCM_FORMAT_S16_LE;
+    switch (format)
+    {
+        case SampleFormat::S16_LE:
+            alsaFormat = SND_PCM_FORMAT_S16_LE;
+            break;
+
+        case SampleFormat::S24_3LE:
+            alsaFormat = SND_PCM_FORMAT_S24_3LE;
+            break;
+
+        case SampleFormat::S32_LE:
+            alsaFormat = SND_PCM_FORMAT_S32_LE;
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            alsaFormat = SND_PCM_FORMAT_FLOAT_LE;
+            break;
+    }
+
+    int res = snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if (res != 0)
+    {
+        pcm = NULL;
+        errStr = "Playback device opening error: " + std::string(snd_strerror(res));
+        return false;
+    }
+
+    // The ALSA plugins convert the format if the device needs it
+    res = snd_pcm_set_params(pcm, alsaFormat, SND_PCM_ACCESS_RW_INTERLEAVED, chansNumber, sampleRate, 1, LATENCY_US);
+    if (res != 0)
+    {
+        errStr = "Playback parameters setting error: " + std::string(snd_strerror(res));
+        close();
+        return false;
+    }
+
+    frameSize = SampleFormat::getBytes(format) * chansNumber;
+    errStr.clear();
+
+    return true;
+}
+
+bool AlsaMonitorSink::write(const MonitorBlock *block)
+{
+    const char *data = block->data;
+    size_t frames = block->frames;
+
+    while (frames > 0 && !stopping)
+    {
+        snd_pcm_sframes_t res = snd_pcm_writei(pcm, data, frames);
+        if (res == -EAGAIN)
+        {
+            snd_pcm_wait(pcm, WAIT_MS);
+            continue;
+        }
+
+        if (res < 0)
+        {
+            // An underrun is expected after the data was dropped, the playback is restarted
+            res = snd_pcm_recover(pcm, res, 1);
+            if (res < 0)
+            {
+                errStr = "Playback error: " + std::string(snd_strerror(res));
+                return false;
+            }
+
+            continue;
+        }
+
+        data += res * frameSize;
+        frames -= res;
+    }
+
+    return true;
+}
+
+void AlsaMonitorSink::close()
+{
+    if (!pcm)
+        return;
+
+    snd_pcm_drop(pcm);
+    snd_pcm_close(pcm);
+    pcm = NULL;
+}
+
+
+// Public members
+RtpMonitorSink::RtpMonitorSink(const std::string &name, const std::string &host, const std::string &port) :
+    MonitorSink(name),
+    host(host),
+    port(port),
+    fd(-1),
+    sampleSize(0),
+    frameSize(0),
+    seq(0),
+    ssrc(0)
+{
+}
+
+RtpMonitorSink::~RtpMonitorSink()
+{
+    stop();
+}
+
+
+// Private methods
+bool RtpMonitorSink::open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate)
+{
+    (void)sampleRate;
+
+    if (format != SampleFormat::S16_LE && format != SampleFormat::S24_3LE)
+    {
+        errStr = "RTP monitor supports S16_LE and S24_3LE only!";
+        return false;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    struct addrinfo *addrs = NULL;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0 || addrs == NULL)
+    {
+        errStr = "Can not resolve \"" + host + "\"!";
+        return false;
+    }
+
+    // Sending never blocks, a full socket buffer drops the packet
+    fd = socket(addrs->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, addrs->ai_addr, addrs->ai_addrlen) != 0)
+    {
+        freeaddrinfo(addrs);
+        errStr = "Can not create RTP socket!";
+        close();
+        return false;
+    }
+
+    freeaddrinfo(addrs);
+
+    sampleSize = SampleFormat::getBytes(format);
+    frameSize = sampleSize * chansNumber;
+    packet.resize(HEADER_SIZE + (MAX_PAYLOAD_SIZE > frameSize ? MAX_PAYLOAD_SIZE / frameSize * frameSize : frameSize));
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ssrc = ts.tv_nsec ^ getpid();
+    seq = ts.tv_nsec >> 8;
+    errStr.clear();
+
+    return true;
+}
+
+bool RtpMonitorSink::write(const MonitorBlock *block)
+{
+    size_t framesPerPacket = (packet.size() - HEADER_SIZE) / frameSize;
+
+    for (size_t pos = 0; pos < block->frames; pos += framesPerPacket)
+    {
+        size_t frames = block->frames - pos < framesPerPacket ? block->frames - pos : framesPerPacket;
+        uint32_t timestamp = block->framePos + pos;
+        char *p = &packet[0];
+
+        // Version 2, no padding, extension and CSRC, no marker
+        p[0] = (char)0x80;
+        p[1] = PAYLOAD_TYPE;
+        p[2] = seq >> 8;
+        p[3] = seq;
+        for (int i = 0; i < 4; ++i)
+        {
+            p[4 + i] = timestamp >> (24 - 8 * i);
+            p[8 + i] = ssrc >> (24 - 8 * i);
+        }
+
+        // Network byte order
+        const char *in = block->data + pos * frameSize;
+        char *out = p + HEADER_SIZE;
+        size_t size = frames * frameSize;
+
+        for (size_t i = 0; i < size; i += sampleSize)
+            for (size_t b = 0; b < sampleSize; ++b)
+                out[i + b] = in[i + sampleSize - 1 - b];
+
+        ++seq;
+
+        if (send(fd, p, HEADER_SIZE + size, MSG_NOSIGNAL) < 0)
+        {
+            // The receiver is not listening yet (ECONNREFUSED on localhost) or the socket buffer is full
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != ECONNREFUSED)
+            {
+                errStr = std::string("RTP sending error: ") + strerror(errno);
+                return false;
+            }
+
+            droppedFrames += frames;
+        }
+    }
+
+    return true;
+}
+
+void RtpMonitorSink::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+
+    fd = -1;
+}
+
+
+// Public members
+PipeMonitorSink::PipeMonitorSink(const std::string &name, const std::string &path) :
+    MonitorSink(name),
+    path(path),
+    fd(-1),
+    savedFlags(-1),
+    frameSize(0)
+{
+}
+
+PipeMonitorSink::~PipeMonitorSink()
+{
+    stop();
+}
+
+
+// Private methods
+bool PipeMonitorSink::open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate)
+{
+    (void)sampleRate;
+
+    if (path == "-")
+        fd = dup(STDOUT_FILENO);
+    else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+    {
+        errStr = "Can not open \"" + path + "\"" + (errno == ENXIO ? ", the FIFO has no reader!" : "!");
+        return false;
+    }
+
+    // Writes wait in the sink thread only, and not longer than it is stopping
+    savedFlags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, savedFlags | O_NONBLOCK);
+
+    frameSize = SampleFormat::getBytes(format) * chansNumber;
+    errStr.clear();
+
+    return true;
+}
+
+bool PipeMonitorSink::write(const MonitorBlock *block)
+{
+    const char *data = block->data;
+    size_t size = block->frames * frameSize;
+
+    while (size > 0 && !stopping)
+    {
+        ssize_t res = ::write(fd, data, size);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN)
+            {
+                errStr = std::string("Writing error: ") + strerror(errno);
+                return false;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, WAIT_MS);
+            continue;
+        }
+
+        data += res;
+        size -= res;
+    }
+
+    return true;
+}
+
+void PipeMonitorSink::close()
+{
+    if (fd < 0)
+        return;
+
+    if (savedFlags >= 0)
+        fcntl(fd, F_SETFL, savedFlags);
+
+    ::close(fd);
+    fd = -1;
+    savedFlags = -1;
+}
@@ -0,0 +1,266 @@
+#include "monitortap.h"
+#include "monitorsinks.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Public members
+MonitorSink *MonitorSink::create(const std::string &spec)
+{
+    if (spec == "-")
+        return new PipeMonitorSink(spec, "-");
+
+    size_t pos = spec.find(':');
+    if (pos == std::string::npos || pos + 1 == spec.size())
+        return NULL;
+
+    std::string type = spec.substr(0, pos);
+    std::string target = spec.substr(pos + 1);
+
+    if (type == "alsa")
+        return new AlsaMonitorSink(spec, target);
+
+    if (type == "pipe")
+        return new PipeMonitorSink(spec, target);
+
+    if (type == "rtp")
+    {
+        pos = target.rfind(':');
+        if (pos == std::string::npos || pos == 0 || atoi(target.c_str() + pos + 1) <= 0)
+            return NULL;
+
+        return new RtpMonitorSink(spec, target.substr(0, pos), target.substr(pos + 1));
+    }
+
+    return NULL;
+}
+
+MonitorSink::MonitorSink(const std::string &name) :
+    stopping(false),
+    droppedFrames(0),
+    lossless(false),
+    name(name),
+    head(0),
+    tail(0),
+    failed(false)
+{
+    sem_init(&sem, 0, 0);
+}
+
+MonitorSink::~MonitorSink()
+{
+    sem_destroy(&sem);
+}
+
+
+// Public methods
+bool MonitorSink::start(SampleFormat::Id format, u_int chansNumber, u_int sampleRate)
+{
+    droppedFrames = 0;
+    stopping = false;
+    failed = false;
+    head = tail = 0;
+
+    if (!open(format, chansNumber, sampleRate))
+        return false;
+
+    thread = std::thread(&MonitorSink::loop, this);
+
+    return true;
+}
+
+void MonitorSink::stop()
+{
+    if (!thread.joinable())
+        return;
+
+    stopping = true;
+    sem_post(&sem);
+    thread.join();
+
+    // Blocks left in the queue are released, so the pool is free for the next recording
+    drain();
+    close();
+}
+
+bool MonitorSink::enqueue(MonitorBlock *block)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == QUEUE_SIZE)
+    {
+        droppedFrames += block->frames;
+        return false;
+    }
+
+    queue[t % QUEUE_SIZE] = block;
+    tail.store(t + 1, std::memory_order_release);
+
+    // Never blocks
+    sem_post(&sem);
+
+    return true;
+}
+
+
+// Private methods
+void MonitorSink::drain()
+{
+    size_t t = tail.load(std::memory_order_acquire);
+
+    for (size_t h = head.load(std::memory_order_relaxed); h != t; ++h)
+    {
+        MonitorBlock *block = queue[h % QUEUE_SIZE];
+
+        if (failed || (stopping && !lossless))
+            droppedFrames += block->frames;
+        else if (!write(block))
+        {
+            ERR(name << ": monitor failed: " << errStr);
+            failed = true;
+            droppedFrames += block->frames;
+        }
+
+        block->release();
+        head.store(h + 1, std::memory_order_release);
+    }
+}
+
+void MonitorSink::loop()
+{
+    while (!stopping)
+    {
+        if (sem_wait(&sem) != 0 && errno != EINTR)
+            break;
+
+        drain();
+    }
+}
+
+
+// Public members
+MonitorTap::MonitorTap() :
+    blocksNumber(0),
+    blockFrames(0),
+    frameSize(0),
+    nextBlock(0),
+    framePos(0),
+    droppedFrames(0)
+{
+}
+
+MonitorTap::~MonitorTap()
+{
+    stop();
+}
+
+
+// Public methods
+bool MonitorTap::addSink(const std::string &spec)
+{
+    MonitorSink *sink = MonitorSink::create(spec);
+    if (sink == NULL)
+    {
+        errStr = "Wrong monitor \"" + spec + "\"! Must be alsa:<device>, rtp:<host>:<port>, pipe:<path> or -";
+        return false;
+    }
+
+    addSink(sink);
+
+    return true;
+}
+
+void MonitorTap::addSink(MonitorSink *sink)
+{
+    sinks.push_back(std::unique_ptr<MonitorSink>(sink));
+}
+
+bool MonitorTap::start(SampleFormat::Id format, u_int chansNumber, u_int sampleRate, size_t blockFrames, size_t blocksNumber)
+{
+    frameSize = SampleFormat::getBytes(format) * chansNumber;
+
+    // The pool is kept between recordings of the same geometry
+    if (this->blockFrames != blockFrames || this->blocksNumber != blocksNumber || blocksData.size() != blockFrames * blocksNumber * frameSize)
+    {
+        blocks.reset(new MonitorBlock[blocksNumber]);
+        blocksData.resize(blockFrames * blocksNumber * frameSize);
+
+        for (size_t i = 0; i < blocksNumber; ++i)
+        {
+            blocks[i].refs = 0;
+            blocks[i].data = &blocksData[i * blockFrames * frameSize];
+        }
+
+        this->blockFrames = blockFrames;
+        this->blocksNumber = blocksNumber;
+    }
+
+    nextBlock = 0;
+    framePos = 0;
+    droppedFrames = 0;
+
+    for (size_t i = 0; i < sinks.size(); ++i)
+    {
+        if (!sinks[i]->start(format, chansNumber, sampleRate))
+        {
+            errStr = sinks[i]->getName() + ": " + sinks[i]->getLastErrorInfo();
+            ERR(errStr);
+            stop();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MonitorTap::stop()
+{
+    for (size_t i = 0; i < sinks.size(); ++i)
+        sinks[i]->stop();
+}
+
+void MonitorTap::push(const char *data, size_t frames)
+{
+    while (frames > 0)
+    {
+        size_t n = frames < blockFrames ? frames : blockFrames;
+
+        MonitorBlock *block = acquire();
+        if (block == NULL)
+            droppedFrames += n;
+        else
+        {
+            memcpy(block->data, data, n * frameSize);
+            block->frames = n;
+            block->framePos = framePos;
+
+            // References are taken for all sinks before the block is visible to any of them
+            block->refs.store(sinks.size(), std::memory_order_relaxed);
+            for (size_t i = 0; i < sinks.size(); ++i)
+                if (!sinks[i]->enqueue(block))
+                    block->release();
+        }
+
+        data += n * frameSize;
+        frames -= n;
+        framePos += n;
+    }
+}
+
+
+// Private methods
+MonitorBlock *MonitorTap::acquire()
+{
+    for (size_t i = 0; i < blocksNumber; ++i)
+    {
+        size_t index = (nextBlock + i) % blocksNumber;
+        if (blocks[index].refs.load(std::memory_order_acquire) == 0)
+        {
+            nextBlock = index + 1;
+            return &blocks[index];
+        }
+    }
+
+    return NULL;
+}
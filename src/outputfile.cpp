@@ -0,0 +1,243 @@
+#include "outputfile.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Public members
+OutputFile::OutputFile() :
+    fd(-1),
+    pos(0),
+    seekable(false),
+    mapAddr(NULL),
+    mapSize(0),
+    stageBuf(NULL),
+    stageSize(0)
+{
+}
+
+OutputFile::~OutputFile()
+{
+    close();
+}
+
+
+// Public methods
+bool OutputFile::open(const std::string &fileName, uint64_t expectedSize, size_t maxChunkSize)
+{
+    close();
+
+    // "-" is the standard output
+    if (fileName == "-")
+        fd = dup(STDOUT_FILENO);
+    else
+        fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        errStr = "Can not open output file: \"" + fileName + "\"!";
+        ERR(errStr);
+        return false;
+    }
+
+    pos = 0;
+
+    // Staging buffer is used if the file is not mapped or the mapping is exhausted
+    if (maxChunkSize)
+    {
+        stageBuf = (char *)malloc(maxChunkSize);
+        if (stageBuf == NULL)
+        {
+            errStr = "Can not allocate memory space for output buffer!";
+            ERR(errStr);
+            close();
+            return false;
+        }
+
+        stageSize = maxChunkSize;
+    }
+
+    struct stat st;
+    seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (expectedSize == 0 || !seekable)
+        return true;
+
+    // Preallocate the whole file and map it
+    if (posix_fallocate(fd, 0, expectedSize) != 0)
+        return true;
+
+    void *addr = mmap(NULL, expectedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        // The preallocated space would be left before the written data
+        if (ftruncate(fd, 0) != 0)
+        {
+            errStr = "Output file truncating error!";
+            ERR(errStr);
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    madvise(addr, expectedSize, MADV_SEQUENTIAL);
+
+    mapAddr = (char *)addr;
+    mapSize = expectedSize;
+
+    return true;
+}
+
+bool OutputFile::close()
+{
+    if (fd < 0)
+        return true;
+
+    bool res = true;
+
+    if (mapAddr)
+    {
+        munmap(mapAddr, mapSize);
+        mapAddr = NULL;
+
+        // Cut off the preallocated space which was not used
+        if (pos < mapSize && ftruncate(fd, pos) != 0)
+        {
+            errStr = "Output file truncating error!";
+            ERR(errStr);
+            res = false;
+        }
+    }
+
+    ::close(fd);
+    fd = -1;
+
+    free((void *)stageBuf);
+    stageBuf = NULL;
+    stageSize = 0;
+
+    return res;
+}
+
+char *OutputFile::reserve(size_t size)
+{
+    if (mapAddr)
+    {
+        if (pos + size <= mapSize)
+            return mapAddr + pos;
+
+        // More data than expected, continue with write()
+        if (!switchToWrite())
+            return NULL;
+    }
+
+    if (size > stageSize)
+    {
+        char *buf = (char *)realloc(stageBuf, size);
+        if (buf == NULL)
+        {
+            errStr = "Can not allocate memory space for output buffer!";
+            ERR(errStr);
+            return NULL;
+        }
+
+        stageBuf = buf;
+        stageSize = size;
+    }
+
+    return stageBuf;
+}
+
+bool OutputFile::commit(size_t size)
+{
+    if (!mapAddr && !writeAll(stageBuf, size))
+        return false;
+
+    pos += size;
+
+    return true;
+}
+
+bool OutputFile::write(const void *data, size_t size)
+{
+    if (mapAddr && pos + size <= mapSize)
+    {
+        memcpy(mapAddr + pos, data, size);
+        pos += size;
+
+        return true;
+    }
+
+    if (mapAddr && !switchToWrite())
+        return false;
+
+    if (!writeAll((const char *)data, size))
+        return false;
+
+    pos += size;
+
+    return true;
+}
+
+bool OutputFile::writeAt(uint64_t offset, const void *data, size_t size)
+{
+    if (mapAddr && offset + size <= mapSize)
+    {
+        memcpy(mapAddr + offset, data, size);
+        return true;
+    }
+
+    // Not possible for pipes
+    if (pwrite(fd, data, size, offset) != (ssize_t)size)
+    {
+        errStr = "Output file rewriting error!";
+        return false;
+    }
+
+    return true;
+}
+
+
+// Private methods
+bool OutputFile::switchToWrite()
+{
+    munmap(mapAddr, mapSize);
+    mapAddr = NULL;
+
+    if (ftruncate(fd, pos) != 0 || lseek(fd, pos, SEEK_SET) != (off_t)pos)
+    {
+        errStr = "Output file switching to write() error!";
+        ERR(errStr);
+        return false;
+    }
+
+    return true;
+}
+
+bool OutputFile::writeAll(const char *data, size_t size)
+{
+    while (size)
+    {
+        ssize_t res = ::write(fd, data, size);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            errStr = "Output file writing error!";
+            ERR(errStr);
+            return false;
+        }
+
+        data += res;
+        size -= res;
+    }
+
+    return true;
+}
@@ -0,0 +1,223 @@
+#include "rangeextractor.h"
+#include "timingindex.h"
+#include "wavheader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+// Public members
+RangeExtractor::RangeExtractor() :
+    framesNumber(0)
+{
+}
+
+
+// Public methods
+bool RangeExtractor::extract(const std::string &inFileName, const std::string &outFileName, const std::string &rangeStr)
+{
+    framesNumber = 0;
+
+    BlockIndexReader index;
+    if (!index.load(inFileName + ".bix"))
+    {
+        errStr = index.getLastErrorInfo();
+        return false;
+    }
+
+    if (!index.isSeekable())
+    {
+        errStr = "The recording is compressed, its ranges can't be copied: \"" + inFileName + "\"!";
+        return false;
+    }
+
+    uint64_t startPos, endPos;
+    if (!parseRange(index, rangeStr, &startPos, &endPos))
+        return false;
+
+    const BlockIndex::bix_header_t &header = index.getHeader();
+    uint64_t offset = index.getByteOffset(startPos);
+    uint64_t size = (endPos - startPos) * header.frameSize;
+
+    // The range must not cross a lost part of the data, the offsets are contiguous then
+    if (offset == BlockIndex::NO_OFFSET || index.getByteOffset(endPos) != offset + size)
+    {
+        errStr = "The range is not contiguous in the recording: \"" + rangeStr + "\"!";
+        return false;
+    }
+
+    int inFd = ::open(inFileName.c_str(), O_RDONLY);
+    if (inFd < 0)
+    {
+        errStr = "Can not open the recording: \"" + inFileName + "\"!";
+        return false;
+    }
+
+    int outFd = outFileName == "-" ? STDOUT_FILENO : ::open(outFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0)
+    {
+        ::close(inFd);
+        errStr = "Can not open the output file: \"" + outFileName + "\"!";
+        return false;
+    }
+
+    bool res = true;
+    if (isWavFile(outFileName))
+    {
+        WavHeader wavHeader;
+        wavHeader.setFormat((SampleFormat::Id)header.format, header.chansNumber, header.sampleRate);
+        wavHeader.setExpectedDataSize(size);
+        wavHeader.setDataSize(size);
+
+        res = write(outFd, wavHeader.getData(), wavHeader.getSize()) == (ssize_t)wavHeader.getSize();
+        if (!res)
+            errStr = "Output file writing error!";
+    }
+
+    res = res && copyRange(inFd, offset, size, outFd);
+
+    ::close(inFd);
+    if (outFd != STDOUT_FILENO && ::close(outFd) != 0 && res)
+    {
+        errStr = "Output file closing error!";
+        res = false;
+    }
+
+    if (res)
+        framesNumber = endPos - startPos;
+
+    return res;
+}
+
+
+// Private methods
+bool RangeExtractor::parseRange(BlockIndexReader &index, const std::string &rangeStr, uint64_t *startPos, uint64_t *endPos)
+{
+    const BlockIndex::bix_header_t &header = index.getHeader();
+
+    // The wall clock time has ':' in it, the duration is after the last one
+    size_t pos = rangeStr.rfind(':');
+    if (pos == std::string::npos || pos == 0 || pos + 1 == rangeStr.size())
+    {
+        errStr = "Wrong range: \"" + rangeStr + "\"! Must be <start>:<duration>";
+        return false;
+    }
+
+    std::string startStr = rangeStr.substr(0, pos);
+    std::string durationStr = rangeStr.substr(pos + 1);
+
+    char *end;
+    double duration = strtod(durationStr.c_str(), &end);
+    if (*end != '\0' || duration <= 0)
+    {
+        errStr = "Wrong range duration: \"" + durationStr + "\"!";
+        return false;
+    }
+
+    if (startStr[0] == '@')
+    {
+        uint64_t wallNs;
+        if (!TimingIndexReader::parseWallTime(startStr.c_str() + 1, &wallNs))
+        {
+            errStr = "Wrong range start time: \"" + startStr + "\"!";
+            return false;
+        }
+
+        if (!index.findFrame(wallNs, startPos))
+        {
+            errStr = "The range start is outside the recording: \"" + startStr + "\"!";
+            return false;
+        }
+    }
+    else
+    {
+        double start = strtod(startStr.c_str(), &end);
+        if (*end != '\0' || start < 0)
+        {
+            errStr = "Wrong range start: \"" + startStr + "\"!";
+            return false;
+        }
+
+        *startPos = (uint64_t)(start * header.sampleRate);
+    }
+
+    // The range ends at the end of the recording at the latest
+    uint64_t framesNumber = index.getFramesNumber();
+    if (*startPos >= framesNumber)
+    {
+        errStr = "The range start is outside the recording: \"" + startStr + "\"!";
+        return false;
+    }
+
+    *endPos = *startPos + (uint64_t)(duration * header.sampleRate);
+    if (*endPos > framesNumber)
+        *endPos = framesNumber;
+
+    return true;
+}
+
+bool RangeExtractor::copyRange(int inFd, uint64_t offset, uint64_t size, int outFd)
+{
+    // Data is copied in the kernel. It fails for pipes, between file systems on older kernels
+    // and where the call is missing, the rest is copied by user space then
+    loff_t inOffset = offset;
+    while (size > 0)
+    {
+        ssize_t res = copy_file_range(inFd, &inOffset, outFd, NULL, size, 0);
+        if (res <= 0)
+            break;
+
+        size -= res;
+    }
+
+    if (size == 0)
+        return true;
+
+    std::vector<char> buf(COPY_BUF_SIZE);
+    offset = inOffset;
+
+    while (size > 0)
+    {
+        ssize_t res = pread(inFd, &buf[0], size < buf.size() ? size : buf.size(), offset);
+        if (res < 0 && errno == EINTR)
+            continue;
+
+        if (res <= 0)
+        {
+            errStr = res == 0 ? "The recording is shorter than its block index!" : "Recording reading error!";
+            return false;
+        }
+
+        for (ssize_t written = 0; written < res; )
+        {
+            ssize_t n = write(outFd, &buf[written], res - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0)
+            {
+                errStr = "Output file writing error!";
+                return false;
+            }
+
+            written += n;
+        }
+
+        offset += res;
+        size -= res;
+    }
+
+    return true;
+}
+
+bool RangeExtractor::isWavFile(const std::string &fileName)
+{
+    size_t pos1 = fileName.rfind(".wav"),
+           pos2 = fileName.rfind(".WAV");
+
+    return (pos1 != std::string::npos && fileName.size() - pos1 == 4) || (pos2 != std::string::npos && fileName.size() - pos2 == 4);
+}
@@ -0,0 +1,105 @@
+#include "realfft.h"
+#include "samplekernels.h"
+
+#include <math.h>
+
+// Public members
+RealFft::RealFft() :
+    size(0)
+{
+}
+
+
+// Public methods
+bool RealFft::isSizeValid(size_t size)
+{
+    return size >= MIN_SIZE && size <= MAX_SIZE && (size & (size - 1)) == 0;
+}
+
+bool RealFft::setup(size_t size)
+{
+    if (!isSizeValid(size))
+        return false;
+
+    if (this->size == size)
+        return true;
+
+    this->size = size;
+    size_t n = size / 2;
+
+    u_int bits = 0;
+    while (((size_t)1 << bits) < n)
+        ++bits;
+
+    reversed.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        u_int r = 0;
+        for (u_int b = 0; b < bits; ++b)
+            if (i & ((size_t)1 << b))
+                r |= 1 << (bits - 1 - b);
+
+        reversed[i] = r;
+    }
+
+    twRe.resize(n > 1 ? n - 1 : 1);
+    twIm.resize(twRe.size());
+    for (size_t half = 1; half < n; half *= 2)
+    {
+        for (size_t k = 0; k < half; ++k)
+        {
+            double angle = -M_PI * k / half;
+            twRe[half - 1 + k] = cos(angle);
+            twIm[half - 1 + k] = sin(angle);
+        }
+    }
+
+    splitRe.resize(n);
+    splitIm.resize(n);
+    for (size_t k = 0; k < n; ++k)
+    {
+        double angle = -2 * M_PI * k / size;
+        splitRe[k] = cos(angle);
+        splitIm[k] = sin(angle);
+    }
+
+    workRe.resize(n);
+    workIm.resize(n);
+
+    return true;
+}
+
+void RealFft::transform(const float *in, float *re, float *im)
+{
+    size_t n = size / 2;
+    float *zr = &workRe[0];
+    float *zi = &workIm[0];
+
+    // Pack the samples as complex values in bit-reversed order
+    for (size_t i = 0; i < n; ++i)
+    {
+        zr[reversed[i]] = in[2 * i];
+        zi[reversed[i]] = in[2 * i + 1];
+    }
+
+    for (size_t half = 1; half < n; half *= 2)
+        SampleKernels::fftStage(zr, zi, &twRe[half - 1], &twIm[half - 1], n, half);
+
+    // Z[k] = E[k] + i*O[k], where E and O are the spectra of the even and the odd samples,
+    // then X[k] = E[k] + exp(-2*pi*i*k/N) * O[k]
+    re[0] = zr[0] + zi[0];
+    im[0] = 0;
+    re[n] = zr[0] - zi[0];
+    im[n] = 0;
+
+    for (size_t k = 1; k < n; ++k)
+    {
+        float er = 0.5f * (zr[k] + zr[n - k]);
+        float ei = 0.5f * (zi[k] - zi[n - k]);
+        float or_ = 0.5f * (zi[k] + zi[n - k]);
+        float oi = -0.5f * (zr[k] - zr[n - k]);
+
+        re[k] = er + splitRe[k] * or_ - splitIm[k] * oi;
+        im[k] = ei + splitRe[k] * oi + splitIm[k] * or_;
+    }
+}
@@ -0,0 +1,90 @@
+#include "realtime.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Static public methods
+bool Realtime::isPriorityValid(u_int priority)
+{
+    return (int)priority >= sched_get_priority_min(SCHED_FIFO) && (int)priority <= sched_get_priority_max(SCHED_FIFO);
+}
+
+bool Realtime::isCpuValid(u_int cpu)
+{
+    return cpu < CPU_SETSIZE && (long)cpu < sysconf(_SC_NPROCESSORS_CONF);
+}
+
+bool Realtime::setFifo(u_int priority, std::string &errStr)
+{
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0)
+    {
+        errStr = std::string("Can not set SCHED_FIFO priority ") + std::to_string(priority) + ": " + strerror(err);
+        return false;
+    }
+
+    return true;
+}
+
+bool Realtime::pinThread(const std::vector<u_int> &cpus, std::string &errStr)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); ++i)
+        CPU_SET(cpus[i], &set);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        errStr = std::string("Can not set CPU affinity: ") + strerror(err);
+        return false;
+    }
+
+    return true;
+}
+
+bool Realtime::lockStack(std::string &errStr)
+{
+    // Stack growth faults are taken now instead of in the loop. The pages stay
+    // locked after the return, they belong to the thread until it exits
+    volatile char stack[STACK_PREFAULT_SIZE];
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+
+    return lockMemory((const void *)stack, sizeof(stack), errStr);
+}
+
+bool Realtime::lockMemory(const void *addr, size_t size, std::string &errStr)
+{
+    if (size && mlock(addr, size) != 0)
+    {
+        errStr = std::string("Can not lock memory: ") + strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+void Realtime::unlockMemory(const void *addr, size_t size)
+{
+    if (size)
+        munlock(addr, size);
+}
+
+uint64_t Realtime::getThreadAllocations()
+{
+    return isAllocationCounted() ? realtimeThreadAllocations() : 0;
+}
+
+bool Realtime::isAllocationCounted()
+{
+    return realtimeThreadAllocations != NULL;
+}
@@ -0,0 +1,314 @@
+#include "recorderdaemon.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sstream>
+
+// Public members
+RecorderDaemon::RecorderDaemon() :
+    listenFd(-1),
+    quit(false)
+{
+}
+
+RecorderDaemon::~RecorderDaemon()
+{
+    for (size_t i = 0; i < slots.size(); ++i)
+        finishRecording(slots[i].get(), true);
+
+    closeSocket();
+}
+
+
+// Public methods
+void RecorderDaemon::addRecorder(AudioRecorder *recorder)
+{
+    slots.push_back(std::unique_ptr<Slot>(new Slot));
+    slots.back()->recorder = recorder;
+    slots.back()->recording = false;
+}
+
+bool RecorderDaemon::run(const std::string &socketPath)
+{
+    if (slots.empty() || !openSocket(socketPath))
+        return false;
+
+    INFO("Waiting for commands on \"" << socketPath << '\"');
+
+    // The devices list is kept current in background
+    devsEnumerator.startMonitor();
+
+    std::vector<struct pollfd> fds;
+    quit = false;
+
+    while (!quit && !AudioRecorder::isStopRequested())
+    {
+        fds.resize(clients.size() + 1);
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        // Wake up from time to time to notice the stop signal
+        int res = poll(&fds[0], fds.size(), 200);
+        if (res < 0 && errno != EINTR)
+        {
+            errStr = "poll() error on control socket!";
+            ERR(errStr << ' ' << errno);
+            break;
+        }
+
+        if (res <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN)
+            acceptClients();
+
+        // New clients are after the polled ones
+        for (size_t i = fds.size() - 1; i > 0; --i)
+        {
+            if (!fds[i].revents || readClient(clients[i - 1]))
+                continue;
+
+            close(clients[i - 1].fd);
+            clients.erase(clients.begin() + i - 1);
+        }
+    }
+
+    for (size_t i = 0; i < slots.size(); ++i)
+        finishRecording(slots[i].get(), true);
+
+    devsEnumerator.stopMonitor();
+    closeSocket();
+
+    return errStr.empty();
+}
+
+
+// Private methods
+bool RecorderDaemon::openSocket(const std::string &socketPath)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (socketPath.size() >= sizeof(addr.sun_path))
+    {
+        errStr = "Control socket path is too long: \"" + socketPath + "\"!";
+        ERR(errStr);
+        return false;
+    }
+
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+    {
+        errStr = "Can not create control socket!";
+        ERR(errStr);
+        return false;
+    }
+
+    // A socket file left by a previous run is replaced
+    unlink(socketPath.c_str());
+
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 8) != 0)
+    {
+        errStr = "Can not listen on control socket: \"" + socketPath + "\"!";
+        ERR(errStr);
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    path = socketPath;
+
+    return true;
+}
+
+void RecorderDaemon::closeSocket()
+{
+    if (listenFd < 0)
+        return;
+
+    for (size_t i = 0; i < clients.size(); ++i)
+        close(clients[i].fd);
+
+    clients.clear();
+
+    close(listenFd);
+    listenFd = -1;
+    unlink(path.c_str());
+}
+
+void RecorderDaemon::acceptClients()
+{
+    for (;;)
+    {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            break;
+
+        Client client;
+        client.fd = fd;
+        clients.push_back(client);
+    }
+}
+
+bool RecorderDaemon::readClient(Client &client)
+{
+    char buf[1024];
+    ssize_t res = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (res < 0)
+        return errno == EAGAIN || errno == EINTR;
+
+    // The client has disconnected
+    if (res == 0)
+        return false;
+
+    client.inBuf.append(buf, res);
+
+    for (size_t pos; (pos = client.inBuf.find('\n')) != std::string::npos; )
+    {
+        std::string line = client.inBuf.substr(0, pos);
+        client.inBuf.erase(0, pos + 1);
+
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+
+        std::string reply;
+        execCommand(line, reply);
+
+        // Replies are short, they are sent at once
+        if (send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t)reply.size())
+            return false;
+    }
+
+    return client.inBuf.size() <= MAX_LINE_SIZE;
+}
+
+void RecorderDaemon::execCommand(const std::string &line, std::string &reply)
+{
+    std::stringstream ss(line);
+    std::string command, arg;
+    ss >> command >> arg;
+
+    reply.clear();
+
+    if (command.empty())
+        return;
+
+    if (command == "list")
+    {
+        if (arg == "refresh")
+            devsEnumerator.refresh();
+
+        std::vector<AudioDeviceInfo> devices = devsEnumerator.getDevices();
+        for (size_t i = 0; i < devices.size(); ++i)
+            reply += DeviceEnumerator::toJson(devices[i]) + '\n';
+
+        reply += "OK\n";
+        return;
+    }
+
+    if (command == "quit")
+    {
+        quit = true;
+        reply = "OK\n";
+        return;
+    }
+
+    std::vector<Slot *> found;
+    if (command != "start" && command != "stop" && command != "rotate" && command != "status")
+    {
+        reply = "ERROR: unknown command \"" + command + "\"\n";
+        return;
+    }
+
+    if (!findSlots(arg, found))
+    {
+        reply = "ERROR: unknown device \"" + arg + "\"\n";
+        return;
+    }
+
+    bool res = true;
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        Slot *slot = found[i];
+
+        if (command == "start")
+        {
+            // Without a device only idle ones are started
+            if (!slot->recording || !arg.empty())
+                res &= startRecording(slot, reply);
+        }
+        else if (command == "stop")
+            finishRecording(slot, false);
+        else if (command == "rotate")
+        {
+            if (slot->recording)
+                slot->recorder->rotate();
+        }
+        else
+            reply += std::string("{\"recording\":") + (slot->recording ? "true" : "false")
+                     + ",\"stats\":" + slot->recorder->getStatsJson() + "}\n";
+    }
+
+    if (res)
+        reply += "OK\n";
+}
+
+bool RecorderDaemon::findSlots(const std::string &device, std::vector<Slot *> &found)
+{
+    for (size_t i = 0; i < slots.size(); ++i)
+        if (device.empty() || slots[i]->recorder->getCaptureDevId() == device)
+            found.push_back(slots[i].get());
+
+    return !found.empty();
+}
+
+bool RecorderDaemon::startRecording(Slot *slot, std::string &reply)
+{
+    if (slot->recording)
+    {
+        reply += "ERROR: " + slot->recorder->getCaptureDevId() + " is already recording\n";
+        return false;
+    }
+
+    // The previous recording has finished by itself
+    if (slot->thread.joinable())
+        slot->thread.join();
+
+    slot->recording = true;
+    slot->thread = std::thread(recordingLoop, slot);
+
+    return true;
+}
+
+void RecorderDaemon::finishRecording(Slot *slot, bool wait)
+{
+    if (slot->recording)
+        slot->recorder->stop();
+
+    // The writer finishes the output file in background, unless it is needed now
+    if (wait && slot->thread.joinable())
+        slot->thread.join();
+}
+
+void RecorderDaemon::recordingLoop(Slot *slot)
+{
+    if (!slot->recorder->record())
+        ERR(slot->recorder->getCaptureDevId() << ": recording failed!");
+
+    slot->recording = false;
+}
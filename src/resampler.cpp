@@ -0,0 +1,327 @@
+#include "resampler.h"
+#include "samplekernels.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace
+{
+    u_int gcd(u_int a, u_int b)
+    {
+        while (b)
+        {
+            u_int t = a % b;
+            a = b;
+            b = t;
+        }
+
+        return a;
+    }
+
+    // Modified Bessel function of the first kind, order 0
+    double besselI0(double x)
+    {
+        double sum = 1, term = 1;
+        for (int k = 1; k < 50 && term > sum * 1e-12; ++k)
+        {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+
+        return sum;
+    }
+}
+
+const double Resampler::KAISER_BETA = 8.0;
+const double Resampler::ROLLOFF = 0.91;
+
+// Public members
+Resampler::Resampler() :
+    format(SampleFormat::S16_LE),
+    chansNumber(0),
+    inRate(0),
+    outRate(0),
+    upFactor(1),
+    downFactor(1),
+    tapsNumber(0),
+    historyStride(0),
+    outStride(0),
+    pos(0),
+    phase(0),
+    blockIn(NULL),
+    blockInFrames(0),
+    blockOutFrames(0),
+    generation(0),
+    doneNumber(0),
+    stopping(false)
+{
+}
+
+Resampler::~Resampler()
+{
+    stopWorkers();
+}
+
+
+// Public methods
+bool Resampler::setup(SampleFormat::Id format, u_int chansNumber, u_int inRate, u_int outRate, size_t maxInFrames)
+{
+    stopWorkers();
+
+    this->format = format;
+    this->chansNumber = chansNumber;
+    this->inRate = inRate;
+    this->outRate = outRate;
+
+    if (!isActive())
+        return true;
+
+    u_int div = gcd(inRate, outRate);
+    upFactor = outRate / div;
+    downFactor = inRate / div;
+
+    if (upFactor > MAX_PHASES)
+    {
+        errStr = "Sample rate ratio is too complex for the resampler!";
+        return false;
+    }
+
+    // The filter is as long in time for downsampling, as its cutoff is lower
+    tapsNumber = BASE_TAPS * downFactor / upFactor;
+    tapsNumber = tapsNumber < BASE_TAPS ? BASE_TAPS : tapsNumber > MAX_TAPS ? MAX_TAPS : (tapsNumber + 7) / 8 * 8;
+
+    makeFilter();
+
+    historyStride = tapsNumber - 1 + maxInFrames;
+    history.assign(historyStride * chansNumber, 0);
+
+    outStride = getMaxOutFrames(maxInFrames);
+    planarOut.resize(outStride * chansNumber);
+    outPos.resize(outStride);
+    outPhase.resize(outStride);
+
+    reset();
+
+    u_int workersNumber = std::thread::hardware_concurrency();
+    if (workersNumber > chansNumber / MIN_CHANS_PER_WORKER)
+        workersNumber = chansNumber / MIN_CHANS_PER_WORKER;
+
+    if (workersNumber > 1)
+        startWorkers(workersNumber - 1);
+
+    return true;
+}
+
+void Resampler::reset()
+{
+    // The history starts with silence
+    pos = tapsNumber ? tapsNumber - 1 : 0;
+    phase = 0;
+    std::fill(history.begin(), history.end(), 0.0f);
+}
+
+size_t Resampler::getMaxOutFrames(size_t inFrames)
+{
+    return ((uint64_t)inFrames * upFactor + downFactor - 1) / downFactor + 1;
+}
+
+size_t Resampler::process(const char *in, size_t inFrames, char *out)
+{
+    // Outputs of the block: the newest input sample of each one is in the block
+    size_t outFrames = 0;
+    for (size_t end = tapsNumber - 1 + inFrames; pos < end; ++outFrames)
+    {
+        outPos[outFrames] = pos;
+        outPhase[outFrames] = phase;
+
+        phase += downFactor;
+        pos += phase / upFactor;
+        phase %= upFactor;
+    }
+
+    pos -= inFrames;
+
+    blockIn = in;
+    blockInFrames = inFrames;
+    blockOutFrames = outFrames;
+
+    if (workers.empty())
+        processGroup(0);
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            doneNumber = 0;
+            ++generation;
+        }
+
+        workCond.notify_all();
+        processGroup(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCond.wait(lock, [this]() { return doneNumber == workers.size(); });
+    }
+
+    switch (format)
+    {
+        case SampleFormat::S16_LE:
+            interleave<SampleS16>(out);
+            break;
+
+        case SampleFormat::S24_3LE:
+            interleave<SampleS24>(out);
+            break;
+
+        case SampleFormat::S32_LE:
+            interleave<SampleS32>(out);
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            interleave<SampleFloat>(out);
+            break;
+    }
+
+    return outFrames;
+}
+
+
+// Private methods
+void Resampler::makeFilter()
+{
+    size_t length = (size_t)upFactor * tapsNumber;
+    double center = (length - 1) / 2.0;
+    // Cutoff at the upsampled rate, cycles per sample
+    double cutoff = ROLLOFF * 0.5 / (upFactor > downFactor ? upFactor : downFactor);
+    double norm = besselI0(KAISER_BETA);
+
+    std::vector<double> proto(length);
+    for (size_t i = 0; i < length; ++i)
+    {
+        double x = i - center;
+        double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        double r = x / (center + 1);
+
+        proto[i] = sinc * besselI0(KAISER_BETA * sqrt(1 - r * r)) / norm;
+    }
+
+    // Every phase is normalized to the unity DC gain
+    coeffs.resize(length);
+    for (u_int p = 0; p < upFactor; ++p)
+    {
+        double sum = 0;
+        for (u_int j = 0; j < tapsNumber; ++j)
+            sum += proto[p + (size_t)j * upFactor];
+
+        for (u_int j = 0; j < tapsNumber; ++j)
+            coeffs[(size_t)p * tapsNumber + tapsNumber - 1 - j] = proto[p + (size_t)j * upFactor] / sum;
+    }
+}
+
+void Resampler::startWorkers(u_int workersNumber)
+{
+    stopping = false;
+    generation = 0;
+
+    for (u_int i = 0; i < workersNumber; ++i)
+        workers.push_back(std::thread(&Resampler::workerLoop, this, i + 1));
+}
+
+void Resampler::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    workCond.notify_all();
+
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    workers.clear();
+}
+
+void Resampler::workerLoop(u_int group)
+{
+    uint64_t seen = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workCond.wait(lock, [this, seen]() { return stopping || generation != seen; });
+
+            if (stopping)
+                return;
+
+            seen = generation;
+        }
+
+        processGroup(group);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++doneNumber;
+        }
+
+        doneCond.notify_one();
+    }
+}
+
+void Resampler::processGroup(u_int group)
+{
+    u_int groupsNumber = workers.size() + 1;
+    u_int firstCh = chansNumber * group / groupsNumber;
+    u_int lastCh = chansNumber * (group + 1) / groupsNumber;
+
+    switch (format)
+    {
+        case SampleFormat::S16_LE:
+            processChannels<SampleS16>(firstCh, lastCh);
+            break;
+
+        case SampleFormat::S24_3LE:
+            processChannels<SampleS24>(firstCh, lastCh);
+            break;
+
+        case SampleFormat::S32_LE:
+            processChannels<SampleS32>(firstCh, lastCh);
+            break;
+
+        case SampleFormat::FLOAT_LE:
+            processChannels<SampleFloat>(firstCh, lastCh);
+            break;
+    }
+}
+
+template <class Sample>
+void Resampler::processChannels(u_int firstCh, u_int lastCh)
+{
+    size_t keep = tapsNumber - 1;
+
+    for (u_int ch = firstCh; ch < lastCh; ++ch)
+    {
+        float *hist = &history[ch * historyStride];
+        float *out = &planarOut[ch * outStride];
+
+        // Append the block to the history
+        const char *in = blockIn + ch * Sample::SIZE;
+        for (size_t i = 0; i < blockInFrames; ++i, in += chansNumber * Sample::SIZE)
+            hist[keep + i] = Sample::toFloat(Sample::load(in));
+
+        for (size_t i = 0; i < blockOutFrames; ++i)
+            out[i] = SampleKernels::dotProduct(&coeffs[(size_t)outPhase[i] * tapsNumber], hist + outPos[i] - keep, tapsNumber);
+
+        memmove(hist, hist + blockInFrames, keep * sizeof(float));
+    }
+}
+
+template <class Sample>
+void Resampler::interleave(char *out)
+{
+    for (size_t i = 0; i < blockOutFrames; ++i)
+        for (u_int ch = 0; ch < chansNumber; ++ch, out += Sample::SIZE)
+            Sample::store(out, Sample::fromFloat(planarOut[ch * outStride + i]));
+}
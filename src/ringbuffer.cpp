@@ -0,0 +1,102 @@
+#include "ringbuffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Public members
+RingBuffer::RingBuffer() :
+    buf(NULL),
+    size(0),
+    writePos(0),
+    readPos(0),
+    highWaterMark(0)
+{
+}
+
+RingBuffer::~RingBuffer()
+{
+    destroy();
+}
+
+
+// Public methods
+bool RingBuffer::create(size_t size)
+{
+    destroy();
+
+    if (size == 0)
+        return false;
+
+    // Page-aligned, so the data can be written to disk with O_DIRECT
+    void *addr = NULL;
+    if (posix_memalign(&addr, ALIGNMENT, size) != 0)
+        return false;
+
+    buf = (char *)addr;
+
+    // Touch all pages now, so page faults don't happen while capturing
+    memset(buf, 0, size);
+    this->size = size;
+    reset();
+
+    return true;
+}
+
+void RingBuffer::destroy()
+{
+    free((void *)buf);
+    buf = NULL;
+    size = 0;
+}
+
+size_t RingBuffer::getFilledSpace()
+{
+    return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire);
+}
+
+void RingBuffer::reset()
+{
+    writePos.store(0, std::memory_order_relaxed);
+    readPos.store(0, std::memory_order_relaxed);
+    highWaterMark.store(0, std::memory_order_relaxed);
+}
+
+bool RingBuffer::push(const void *data, size_t dataSize)
+{
+    uint64_t wPos = writePos.load(std::memory_order_relaxed);
+    size_t filled = wPos - readPos.load(std::memory_order_acquire);
+
+    if (dataSize > size - filled)
+        return false;
+
+    // Copy data, possibly in two parts if it wraps around the buffer end
+    size_t index = wPos % size;
+    size_t firstPart = size - index < dataSize ? size - index : dataSize;
+
+    memcpy(buf + index, data, firstPart);
+    memcpy(buf, (const char *)data + firstPart, dataSize - firstPart);
+
+    writePos.store(wPos + dataSize, std::memory_order_release);
+
+    filled += dataSize;
+    if (filled > highWaterMark.load(std::memory_order_relaxed))
+        highWaterMark.store(filled, std::memory_order_relaxed);
+
+    return true;
+}
+
+size_t RingBuffer::peek(const char **data, size_t offset)
+{
+    uint64_t rPos = readPos.load(std::memory_order_relaxed) + offset;
+    size_t filled = writePos.load(std::memory_order_acquire) - rPos;
+
+    size_t index = rPos % size;
+    *data = buf + index;
+
+    return size - index < filled ? size - index : filled;
+}
+
+void RingBuffer::pop(size_t dataSize)
+{
+    readPos.store(readPos.load(std::memory_order_relaxed) + dataSize, std::memory_order_release);
+}
@@ -0,0 +1,56 @@
+#include "sampleformat.h"
+
+// Public methods
+u_int SampleFormat::getBits(Id format)
+{
+    switch (format)
+    {
+        case S16_LE:
+            return 16;
+
+        case S24_3LE:
+            return 24;
+
+        case S32_LE:
+        case FLOAT_LE:
+            return 32;
+    }
+
+    return 0;
+}
+
+const char *SampleFormat::getName(Id format)
+{
+    switch (format)
+    {
+        case S16_LE:
+            return "S16_LE";
+
+        case S24_3LE:
+            return "S24_3LE";
+
+        case S32_LE:
+            return "S32_LE";
+
+        case FLOAT_LE:
+            return "FLOAT_LE";
+    }
+
+    return "unknown";
+}
+
+bool SampleFormat::fromName(const std::string &name, Id &format)
+{
+    const Id formats[] = {S16_LE, S24_3LE, S32_LE, FLOAT_LE};
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+    {
+        if (name == getName(formats[i]))
+        {
+            format = formats[i];
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,494 @@
+#include "samplekernels.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    SampleKernels::Impl detectImpl()
+    {
+        if (SampleKernels::isImplSupported(SampleKernels::IMPL_AVX2))
+            return SampleKernels::IMPL_AVX2;
+
+        if (SampleKernels::isImplSupported(SampleKernels::IMPL_SSE2))
+            return SampleKernels::IMPL_SSE2;
+
+        return SampleKernels::IMPL_SCALAR;
+    }
+
+    SampleKernels::Impl activeImpl = detectImpl();
+
+    size_t gcd(size_t a, size_t b)
+    {
+        while (b)
+        {
+            size_t t = a % b;
+            a = b;
+            b = t;
+        }
+
+        return a;
+    }
+}
+
+
+// Public methods
+SampleKernels::Impl SampleKernels::getImpl()
+{
+    return activeImpl;
+}
+
+const char *SampleKernels::getImplName(Impl impl)
+{
+    switch (impl)
+    {
+        case IMPL_SCALAR:
+            return "scalar";
+
+        case IMPL_SSE2:
+            return "sse2";
+
+        case IMPL_AVX2:
+            return "avx2";
+    }
+
+    return "unknown";
+}
+
+bool SampleKernels::isImplSupported(Impl impl)
+{
+    switch (impl)
+    {
+        case IMPL_SCALAR:
+            return true;
+
+#if defined(__SSE2__)
+        case IMPL_SSE2:
+            return true;
+#endif
+
+#if defined(AUDIORECORDING_AVX2)
+        case IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+
+        default:
+            return false;
+    }
+}
+
+bool SampleKernels::setImpl(Impl impl)
+{
+    if (!isImplSupported(impl))
+        return false;
+
+    activeImpl = impl;
+    return true;
+}
+
+void SampleKernels::makeGain(FixedGain &gain, const float *coeffs, u_int chansNumber)
+{
+    // Choose the common shift giving the best precision for the largest coefficient
+    float coeffMax = 0;
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        if (coeffMax < coeffs[ch])
+            coeffMax = coeffs[ch];
+
+    gain.shift = 15;
+    while (gain.shift > 0 && coeffMax * (1 << gain.shift) > 32767.0)
+        --gain.shift;
+
+    gain.pattern.resize(patternLength(chansNumber, 16));
+
+    for (size_t i = 0; i < gain.pattern.size(); ++i)
+    {
+        float mult = coeffs[i % chansNumber] * (1 << gain.shift);
+        gain.pattern[i] = mult > 32767.0 ? 32767 : lrintf(mult);
+    }
+}
+
+void SampleKernels::makeGain(FixedGain &gain, float coeff, u_int chansNumber)
+{
+    gain.shift = 15;
+    while (gain.shift > 0 && coeff * (1 << gain.shift) > 32767.0)
+        --gain.shift;
+
+    float mult = coeff * (1 << gain.shift);
+
+    gain.pattern.assign(patternLength(chansNumber, 16), mult > 32767.0 ? 32767 : lrintf(mult));
+}
+
+void SampleKernels::applyGain(const short *in, short *out, size_t framesNumber, u_int chansNumber, const FixedGain &gain)
+{
+    size_t samplesNumber = framesNumber * chansNumber;
+
+    switch (activeImpl)
+    {
+        case IMPL_AVX2:
+            applyGainAvx2(in, out, samplesNumber, gain);
+            break;
+
+        case IMPL_SSE2:
+            applyGainSse2(in, out, samplesNumber, gain);
+            break;
+
+        default:
+            applyGainScalar(in, out, samplesNumber, gain, 0);
+    }
+}
+
+void SampleKernels::findPeaks(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares)
+{
+    switch (activeImpl)
+    {
+        case IMPL_AVX2:
+            findPeaksAvx2(in, framesNumber, chansNumber, minValues, maxValues, sumSquares);
+            break;
+
+        case IMPL_SSE2:
+            findPeaksSse2(in, framesNumber, chansNumber, minValues, maxValues, sumSquares);
+            break;
+
+        default:
+            findPeaksScalar(in, framesNumber, chansNumber, minValues, maxValues, sumSquares);
+    }
+}
+
+void SampleKernels::selectChannels(const char *in, char *out, size_t framesNumber, u_int inChansNumber,
+                                   const u_int *map, u_int outChansNumber, size_t sampleSize)
+{
+    switch (sampleSize)
+    {
+        case 2:
+            selectChannelsImpl<2>(in, out, framesNumber, inChansNumber, map, outChansNumber);
+            break;
+
+        case 3:
+            selectChannelsImpl<3>(in, out, framesNumber, inChansNumber, map, outChansNumber);
+            break;
+
+        case 4:
+            selectChannelsImpl<4>(in, out, framesNumber, inChansNumber, map, outChansNumber);
+            break;
+    }
+}
+
+float SampleKernels::dotProduct(const float *a, const float *b, size_t length)
+{
+    switch (activeImpl)
+    {
+        case IMPL_AVX2:
+            return dotProductAvx2(a, b, length);
+
+        case IMPL_SSE2:
+            return dotProductSse2(a, b, length);
+
+        default:
+            return dotProductScalar(a, b, length);
+    }
+}
+
+void SampleKernels::fftStage(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half)
+{
+    switch (activeImpl)
+    {
+        case IMPL_AVX2:
+            fftStageAvx2(re, im, twRe, twIm, length, half);
+            break;
+
+        case IMPL_SSE2:
+            fftStageSse2(re, im, twRe, twIm, length, half);
+            break;
+
+        default:
+            fftStageScalar(re, im, twRe, twIm, length, half);
+    }
+}
+
+
+// Private methods
+size_t SampleKernels::patternLength(u_int chansNumber, size_t vectorWidth)
+{
+    return chansNumber / gcd(chansNumber, vectorWidth) * vectorWidth;
+}
+
+void SampleKernels::applyGainScalar(const short *in, short *out, size_t samplesNumber, const FixedGain &gain, size_t patternPos)
+{
+    const short *pattern = &gain.pattern[0];
+    size_t patternLen = gain.pattern.size();
+    int round = gain.shift ? 1 << (gain.shift - 1) : 0;
+
+    for (size_t i = 0; i < samplesNumber; ++i)
+    {
+        int value = (in[i] * pattern[patternPos] + round) >> gain.shift;
+
+        out[i] = value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+
+        if (++patternPos == patternLen)
+            patternPos = 0;
+    }
+}
+
+template <size_t SIZE>
+void SampleKernels::selectChannelsImpl(const char *in, char *out, size_t framesNumber, u_int inChansNumber, const u_int *map, u_int outChansNumber)
+{
+    for (size_t i = 0; i < framesNumber; ++i, in += inChansNumber * SIZE)
+        for (u_int ch = 0; ch < outChansNumber; ++ch, out += SIZE)
+            memcpy(out, in + map[ch] * SIZE, SIZE);
+}
+
+void SampleKernels::findPeaksScalar(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares)
+{
+    for (size_t i = 0; i < framesNumber; ++i, in += chansNumber)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+        {
+            short value = in[ch];
+
+            minValues[ch] = minValues[ch] < value ? minValues[ch] : value;
+            maxValues[ch] = maxValues[ch] > value ? maxValues[ch] : value;
+        }
+    }
+
+    if (!sumSquares)
+        return;
+
+    in -= framesNumber * chansNumber;
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        float sum = 0;
+        for (size_t i = 0; i < framesNumber; ++i)
+            sum += (float)in[i * chansNumber + ch] * in[i * chansNumber + ch];
+
+        sumSquares[ch] += sum;
+    }
+}
+
+float SampleKernels::dotProductScalar(const float *a, const float *b, size_t length)
+{
+    float sum = 0;
+    for (size_t i = 0; i < length; ++i)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+void SampleKernels::fftStageScalar(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half)
+{
+    for (size_t group = 0; group < length; group += 2 * half)
+    {
+        float *re0 = re + group, *im0 = im + group;
+        float *re1 = re0 + half, *im1 = im0 + half;
+
+        for (size_t k = 0; k < half; ++k)
+        {
+            float tr = re1[k] * twRe[k] - im1[k] * twIm[k];
+            float ti = re1[k] * twIm[k] + im1[k] * twRe[k];
+
+            re1[k] = re0[k] - tr;
+            im1[k] = im0[k] - ti;
+            re0[k] += tr;
+            im0[k] += ti;
+        }
+    }
+}
+
+#if defined(__SSE2__)
+void SampleKernels::applyGainSse2(const short *in, short *out, size_t samplesNumber, const FixedGain &gain)
+{
+    const short *pattern = &gain.pattern[0];
+    size_t patternLen = gain.pattern.size();
+
+    __m128i shift = _mm_cvtsi32_si128(gain.shift);
+    __m128i round = _mm_set1_epi32(gain.shift ? 1 << (gain.shift - 1) : 0);
+
+    size_t i = 0, patternPos = 0;
+    for (; i + 8 <= samplesNumber; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i m = _mm_loadu_si128((const __m128i *)(pattern + patternPos));
+
+        // 32-bit products
+        __m128i lo = _mm_mullo_epi16(x, m);
+        __m128i hi = _mm_mulhi_epi16(x, m);
+        __m128i p0 = _mm_sra_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), shift);
+        __m128i p1 = _mm_sra_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), shift);
+
+        // Saturating pack back to 16 bits
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(p0, p1));
+
+        if ((patternPos += 8) == patternLen)
+            patternPos = 0;
+    }
+
+    applyGainScalar(in + i, out + i, samplesNumber - i, gain, patternPos);
+}
+
+void SampleKernels::findPeaksSse2(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares)
+{
+    size_t patternLen = patternLength(chansNumber, 8);
+    if (patternLen > MAX_PEAK_PATTERN)
+    {
+        findPeaksScalar(in, framesNumber, chansNumber, minValues, maxValues, sumSquares);
+        return;
+    }
+
+    // One accumulator per vector of the pattern, so every lane always holds the same channel
+    size_t vectorsNumber = patternLen / 8;
+    __m128i accMin[MAX_PEAK_PATTERN / 8];
+    __m128i accMax[MAX_PEAK_PATTERN / 8];
+    __m128 accSq[MAX_PEAK_PATTERN / 4];
+
+    for (size_t k = 0; k < vectorsNumber; ++k)
+    {
+        accMin[k] = _mm_set1_epi16(0x7FFF);
+        accMax[k] = _mm_set1_epi16(-0x8000);
+        accSq[2 * k] = _mm_setzero_ps();
+        accSq[2 * k + 1] = _mm_setzero_ps();
+    }
+
+    size_t samplesNumber = framesNumber * chansNumber;
+    size_t i = 0;
+    if (sumSquares)
+    {
+        for (; i + patternLen <= samplesNumber; i += patternLen)
+        {
+            for (size_t k = 0; k < vectorsNumber; ++k)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i *)(in + i + k * 8));
+
+                accMin[k] = _mm_min_epi16(accMin[k], x);
+                accMax[k] = _mm_max_epi16(accMax[k], x);
+
+                // 32-bit squares of lanes 0-3 and 4-7
+                __m128i lo = _mm_mullo_epi16(x, x);
+                __m128i hi = _mm_mulhi_epi16(x, x);
+                accSq[2 * k] = _mm_add_ps(accSq[2 * k], _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, hi)));
+                accSq[2 * k + 1] = _mm_add_ps(accSq[2 * k + 1], _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, hi)));
+            }
+        }
+    }
+    else
+    {
+        for (; i + patternLen <= samplesNumber; i += patternLen)
+        {
+            for (size_t k = 0; k < vectorsNumber; ++k)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i *)(in + i + k * 8));
+
+                accMin[k] = _mm_min_epi16(accMin[k], x);
+                accMax[k] = _mm_max_epi16(accMax[k], x);
+            }
+        }
+    }
+
+    // Reduce lanes to channels
+    short lanes[MAX_PEAK_PATTERN];
+
+    for (size_t k = 0; k < vectorsNumber; ++k)
+        _mm_storeu_si128((__m128i *)(lanes + k * 8), accMin[k]);
+
+    for (size_t j = 0; j < patternLen; ++j)
+        if (minValues[j % chansNumber] > lanes[j])
+            minValues[j % chansNumber] = lanes[j];
+
+    for (size_t k = 0; k < vectorsNumber; ++k)
+        _mm_storeu_si128((__m128i *)(lanes + k * 8), accMax[k]);
+
+    for (size_t j = 0; j < patternLen; ++j)
+        if (maxValues[j % chansNumber] < lanes[j])
+            maxValues[j % chansNumber] = lanes[j];
+
+    if (sumSquares)
+    {
+        float sqLanes[MAX_PEAK_PATTERN];
+
+        for (size_t k = 0; k < 2 * vectorsNumber; ++k)
+            _mm_storeu_ps(sqLanes + k * 4, accSq[k]);
+
+        for (size_t j = 0; j < patternLen; ++j)
+            sumSquares[j % chansNumber] += sqLanes[j];
+    }
+
+    // The rest of frames
+    findPeaksScalar(in + i, (samplesNumber - i) / chansNumber, chansNumber, minValues, maxValues, sumSquares);
+}
+
+float SampleKernels::dotProductSse2(const float *a, const float *b, size_t length)
+{
+    // Two accumulators hide the latency of additions
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotProductScalar(a + i, b + i, length - i);
+}
+
+void SampleKernels::fftStageSse2(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half)
+{
+    // The first stages have too short butterflies for vectors
+    if (half < 4)
+    {
+        fftStageScalar(re, im, twRe, twIm, length, half);
+        return;
+    }
+
+    for (size_t group = 0; group < length; group += 2 * half)
+    {
+        float *re0 = re + group, *im0 = im + group;
+        float *re1 = re0 + half, *im1 = im0 + half;
+
+        // half is a power of 2, so there is no tail
+        for (size_t k = 0; k < half; k += 4)
+        {
+            __m128 wr = _mm_loadu_ps(twRe + k);
+            __m128 wi = _mm_loadu_ps(twIm + k);
+            __m128 xr = _mm_loadu_ps(re1 + k);
+            __m128 xi = _mm_loadu_ps(im1 + k);
+
+            __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+            __m128 ti = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+            __m128 ar = _mm_loadu_ps(re0 + k);
+            __m128 ai = _mm_loadu_ps(im0 + k);
+
+            _mm_storeu_ps(re1 + k, _mm_sub_ps(ar, tr));
+            _mm_storeu_ps(im1 + k, _mm_sub_ps(ai, ti));
+            _mm_storeu_ps(re0 + k, _mm_add_ps(ar, tr));
+            _mm_storeu_ps(im0 + k, _mm_add_ps(ai, ti));
+        }
+    }
+}
+#else
+void SampleKernels::applyGainSse2(const short *in, short *out, size_t samplesNumber, const FixedGain &gain)
+{
+    applyGainScalar(in, out, samplesNumber, gain, 0);
+}
+
+void SampleKernels::findPeaksSse2(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares)
+{
+    findPeaksScalar(in, framesNumber, chansNumber, minValues, maxValues, sumSquares);
+}
+
+float SampleKernels::dotProductSse2(const float *a, const float *b, size_t length)
+{
+    return dotProductScalar(a, b, length);
+}
+
+void SampleKernels::fftStageSse2(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half)
+{
+    fftStageScalar(re, im, twRe, twIm, length, half);
+}
+#endif
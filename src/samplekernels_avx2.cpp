@@ -0,0 +1,207 @@
+// This file is compiled with -mavx2, its functions are called only if the CPU supports AVX2
+#include "samplekernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+void SampleKernels::applyGainAvx2(const short *in, short *out, size_t samplesNumber, const FixedGain &gain)
+{
+    const short *pattern = &gain.pattern[0];
+    size_t patternLen = gain.pattern.size();
+
+    __m128i shift = _mm_cvtsi32_si128(gain.shift);
+    __m256i round = _mm256_set1_epi32(gain.shift ? 1 << (gain.shift - 1) : 0);
+
+    size_t i = 0, patternPos = 0;
+    for (; i + 16 <= samplesNumber; i += 16)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i m = _mm256_loadu_si256((const __m256i *)(pattern + patternPos));
+
+        // 32-bit products. Unpack and pack work inside 128-bit lanes, so the order is kept
+        __m256i lo = _mm256_mullo_epi16(x, m);
+        __m256i hi = _mm256_mulhi_epi16(x, m);
+        __m256i p0 = _mm256_sra_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), round), shift);
+        __m256i p1 = _mm256_sra_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), round), shift);
+
+        // Saturating pack back to 16 bits
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_packs_epi32(p0, p1));
+
+        if ((patternPos += 16) == patternLen)
+            patternPos = 0;
+    }
+
+    applyGainScalar(in + i, out + i, samplesNumber - i, gain, patternPos);
+}
+
+void SampleKernels::findPeaksAvx2(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares)
+{
+    size_t patternLen = patternLength(chansNumber, 16);
+    if (patternLen > MAX_PEAK_PATTERN)
+    {
+        findPeaksSse2(in, framesNumber, chansNumber, minValues, maxValues, sumSquares);
+        return;
+    }
+
+    // One accumulator per vector of the pattern, so every lane always holds the same channel
+    size_t vectorsNumber = patternLen / 16;
+    __m256i accMin[MAX_PEAK_PATTERN / 16];
+    __m256i accMax[MAX_PEAK_PATTERN / 16];
+    __m256 accSq[MAX_PEAK_PATTERN / 8];
+
+    for (size_t k = 0; k < vectorsNumber; ++k)
+    {
+        accMin[k] = _mm256_set1_epi16(0x7FFF);
+        accMax[k] = _mm256_set1_epi16(-0x8000);
+        accSq[2 * k] = _mm256_setzero_ps();
+        accSq[2 * k + 1] = _mm256_setzero_ps();
+    }
+
+    size_t samplesNumber = framesNumber * chansNumber;
+    size_t i = 0;
+    if (sumSquares)
+    {
+        for (; i + patternLen <= samplesNumber; i += patternLen)
+        {
+            for (size_t k = 0; k < vectorsNumber; ++k)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(in + i + k * 16));
+
+                accMin[k] = _mm256_min_epi16(accMin[k], x);
+                accMax[k] = _mm256_max_epi16(accMax[k], x);
+
+                // 32-bit squares of lanes 0-3, 8-11 and 4-7, 12-15 (unpack works inside 128-bit lanes)
+                __m256i lo = _mm256_mullo_epi16(x, x);
+                __m256i hi = _mm256_mulhi_epi16(x, x);
+                accSq[2 * k] = _mm256_add_ps(accSq[2 * k], _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(lo, hi)));
+                accSq[2 * k + 1] = _mm256_add_ps(accSq[2 * k + 1], _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(lo, hi)));
+            }
+        }
+    }
+    else
+    {
+        for (; i + patternLen <= samplesNumber; i += patternLen)
+        {
+            for (size_t k = 0; k < vectorsNumber; ++k)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(in + i + k * 16));
+
+                accMin[k] = _mm256_min_epi16(accMin[k], x);
+                accMax[k] = _mm256_max_epi16(accMax[k], x);
+            }
+        }
+    }
+
+    // Reduce lanes to channels
+    short lanes[MAX_PEAK_PATTERN];
+
+    for (size_t k = 0; k < vectorsNumber; ++k)
+        _mm256_storeu_si256((__m256i *)(lanes + k * 16), accMin[k]);
+
+    for (size_t j = 0; j < patternLen; ++j)
+        if (minValues[j % chansNumber] > lanes[j])
+            minValues[j % chansNumber] = lanes[j];
+
+    for (size_t k = 0; k < vectorsNumber; ++k)
+        _mm256_storeu_si256((__m256i *)(lanes + k * 16), accMax[k]);
+
+    for (size_t j = 0; j < patternLen; ++j)
+        if (maxValues[j % chansNumber] < lanes[j])
+            maxValues[j % chansNumber] = lanes[j];
+
+    if (sumSquares)
+    {
+        float sqLanes[16];
+
+        for (size_t k = 0; k < vectorsNumber; ++k)
+        {
+            _mm256_storeu_ps(sqLanes, accSq[2 * k]);
+            _mm256_storeu_ps(sqLanes + 8, accSq[2 * k + 1]);
+
+            // Lane order of the stored squares: 0-3, 8-11, 4-7, 12-15
+            for (size_t j = 0; j < 16; ++j)
+            {
+                size_t pos = k * 16 + (j & 3) + ((j >> 2) & 1) * 8 + (j >> 3) * 4;
+                sumSquares[pos % chansNumber] += sqLanes[j];
+            }
+        }
+    }
+
+    // The rest of frames
+    findPeaksSse2(in + i, (samplesNumber - i) / chansNumber, chansNumber, minValues, maxValues, sumSquares);
+}
+
+float SampleKernels::dotProductAvx2(const float *a, const float *b, size_t length)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+
+    __m256 sum = _mm256_add_ps(sum0, sum1);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, half);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotProductSse2(a + i, b + i, length - i);
+}
+
+void SampleKernels::fftStageAvx2(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half)
+{
+    if (half < 8)
+    {
+        fftStageSse2(re, im, twRe, twIm, length, half);
+        return;
+    }
+
+    for (size_t group = 0; group < length; group += 2 * half)
+    {
+        float *re0 = re + group, *im0 = im + group;
+        float *re1 = re0 + half, *im1 = im0 + half;
+
+        for (size_t k = 0; k < half; k += 8)
+        {
+            __m256 wr = _mm256_loadu_ps(twRe + k);
+            __m256 wi = _mm256_loadu_ps(twIm + k);
+            __m256 xr = _mm256_loadu_ps(re1 + k);
+            __m256 xi = _mm256_loadu_ps(im1 + k);
+
+            __m256 tr = _mm256_sub_ps(_mm256_mul_ps(xr, wr), _mm256_mul_ps(xi, wi));
+            __m256 ti = _mm256_add_ps(_mm256_mul_ps(xr, wi), _mm256_mul_ps(xi, wr));
+            __m256 ar = _mm256_loadu_ps(re0 + k);
+            __m256 ai = _mm256_loadu_ps(im0 + k);
+
+            _mm256_storeu_ps(re1 + k, _mm256_sub_ps(ar, tr));
+            _mm256_storeu_ps(im1 + k, _mm256_sub_ps(ai, ti));
+            _mm256_storeu_ps(re0 + k, _mm256_add_ps(ar, tr));
+            _mm256_storeu_ps(im0 + k, _mm256_add_ps(ai, ti));
+        }
+    }
+}
+#else
+void SampleKernels::applyGainAvx2(const short *in, short *out, size_t samplesNumber, const FixedGain &gain)
+{
+    applyGainSse2(in, out, samplesNumber, gain);
+}
+
+void SampleKernels::findPeaksAvx2(const short *in, size_t framesNumber, u_int chansNumber, short *minValues, short *maxValues, float *sumSquares)
+{
+    findPeaksSse2(in, framesNumber, chansNumber, minValues, maxValues, sumSquares);
+}
+
+float SampleKernels::dotProductAvx2(const float *a, const float *b, size_t length)
+{
+    return dotProductSse2(a, b, length);
+}
+
+void SampleKernels::fftStageAvx2(float *re, float *im, const float *twRe, const float *twIm, size_t length, size_t half)
+{
+    fftStageSse2(re, im, twRe, twIm, length, half);
+}
+#endif
@@ -0,0 +1,254 @@
+#include "spectrumanalyzer.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+// Public members
+SpectrumAnalyzer::SpectrumAnalyzer(u_int fftSize) :
+    MonitorSink("analysis"),
+    fftSize(fftSize),
+    hopSize(fftSize / 2),
+    format(SampleFormat::S16_LE),
+    chansNumber(1),
+    sampleRate(0),
+    bandScale(0),
+    filled(0),
+    framePos(0),
+    nextPos(0),
+    framesNumber(0)
+{
+    // The sidecar must describe all recorded audio
+    lossless = true;
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+    stop();
+}
+
+
+// Private methods
+bool SpectrumAnalyzer::open(SampleFormat::Id format, u_int chansNumber, u_int sampleRate)
+{
+    if (!isFftSizeValid(fftSize) || !fft.setup(fftSize))
+    {
+        errStr = "Wrong FFT size! Must be a power of 2 from 64 to 65536";
+        return false;
+    }
+
+    this->format = format;
+    this->chansNumber = chansNumber;
+    this->sampleRate = sampleRate;
+
+    // Hann window, the band energies are mean squares of the signal in the band
+    window.resize(fftSize);
+    double windowPower = 0;
+    for (u_int i = 0; i < fftSize; ++i)
+    {
+        window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / fftSize);
+        windowPower += window[i] * window[i];
+    }
+
+    bandScale = 2.0 / (fftSize * windowPower);
+
+    // Log-spaced bands up to the Nyquist frequency. Every band has at least one bin,
+    // so the low ones are wider than planned with short frames
+    u_int binsNumber = fftSize / 2;
+    double ratio = (double)sampleRate / 2 / MIN_BAND_FREQ;
+    bandBins.resize(BANDS_NUMBER + 1);
+    bandBins[0] = 1;
+    for (u_int b = 1; b <= BANDS_NUMBER; ++b)
+    {
+        double freq = MIN_BAND_FREQ * pow(ratio, (double)b / BANDS_NUMBER);
+        u_int bin = lrint(freq * fftSize / sampleRate);
+        u_int minBin = bandBins[b - 1] + 1;
+
+        bandBins[b] = bin < minBin ? minBin : bin;
+    }
+
+    // The last band ends with the Nyquist bin
+    bandBins[BANDS_NUMBER] = binsNumber + 1;
+    for (u_int b = BANDS_NUMBER; b > 0; --b)
+        if (bandBins[b - 1] >= bandBins[b])
+            bandBins[b - 1] = bandBins[b] - 1;
+
+    frame.assign(fftSize, 0);
+    windowed.resize(fftSize);
+    re.resize(binsNumber + 1);
+    im.resize(binsNumber + 1);
+    filled = 0;
+    framePos = 0;
+    nextPos = 0;
+    framesNumber = 0;
+
+    if (!outFile.open(fileName))
+    {
+        errStr = outFile.getLastErrorInfo();
+        return false;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    spec_header_t header;
+    memcpy(header.magic, "ARSPEC01", sizeof(header.magic));
+    header.headerSize = sizeof(header) + (BANDS_NUMBER + 1) * sizeof(float);
+    header.frameSize = sizeof(spec_frame_t);
+    header.sampleRate = sampleRate;
+    header.fftSize = fftSize;
+    header.hopSize = hopSize;
+    header.bandsNumber = BANDS_NUMBER;
+    header.startTimeNs = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    float edges[BANDS_NUMBER + 1];
+    for (u_int b = 0; b <= BANDS_NUMBER; ++b)
+        edges[b] = (float)bandBins[b] * sampleRate / fftSize;
+
+    if (!outFile.write(&header, sizeof(header)) || !outFile.write(edges, sizeof(edges)))
+    {
+        errStr = outFile.getLastErrorInfo();
+        close();
+        return false;
+    }
+
+    errStr.clear();
+
+    return true;
+}
+
+bool SpectrumAnalyzer::write(const MonitorBlock *block)
+{
+    // Dropped data, the next analysis frame starts after the gap
+    if (block->framePos != nextPos)
+    {
+        filled = 0;
+        framePos = block->framePos;
+    }
+
+    nextPos = block->framePos + block->frames;
+
+    size_t inFrameSize = SampleFormat::getBytes(format) * chansNumber;
+    const char *data = block->data;
+    size_t frames = block->frames;
+
+    while (frames > 0)
+    {
+        size_t n = fftSize - filled < frames ? fftSize - filled : frames;
+
+        switch (format)
+        {
+            case SampleFormat::S16_LE:
+                mixDown<SampleS16>(data, n, &frame[filled]);
+                break;
+
+            case SampleFormat::S24_3LE:
+                mixDown<SampleS24>(data, n, &frame[filled]);
+                break;
+
+            case SampleFormat::S32_LE:
+                mixDown<SampleS32>(data, n, &frame[filled]);
+                break;
+
+            case SampleFormat::FLOAT_LE:
+                mixDown<SampleFloat>(data, n, &frame[filled]);
+                break;
+        }
+
+        data += n * inFrameSize;
+        frames -= n;
+        filled += n;
+
+        if (filled < fftSize)
+            break;
+
+        if (!analyze())
+            return false;
+
+        // Frames overlap by half
+        memmove(&frame[0], &frame[hopSize], (fftSize - hopSize) * sizeof(float));
+        filled -= hopSize;
+        framePos += hopSize;
+    }
+
+    return true;
+}
+
+void SpectrumAnalyzer::close()
+{
+    if (outFile.isOpened())
+        outFile.close();
+}
+
+bool SpectrumAnalyzer::analyze()
+{
+    float peak = 0;
+    double sumSquares = 0;
+    for (u_int i = 0; i < fftSize; ++i)
+    {
+        float level = fabsf(frame[i]);
+        if (level > peak)
+            peak = level;
+
+        sumSquares += frame[i] * frame[i];
+        windowed[i] = frame[i] * window[i];
+    }
+
+    fft.transform(&windowed[0], &re[0], &im[0]);
+
+    spec_frame_t record;
+    record.framePos = framePos;
+    record.peak = toLevel(peak * peak);
+    record.rms = toLevel(sumSquares / fftSize);
+
+    double power = 0, weighted = 0;
+    for (u_int b = 0; b < BANDS_NUMBER; ++b)
+    {
+        double bandPower = 0;
+        for (u_int k = bandBins[b]; k < bandBins[b + 1]; ++k)
+        {
+            double p = re[k] * re[k] + im[k] * im[k];
+            bandPower += p;
+            weighted += p * k;
+        }
+
+        power += bandPower;
+        record.bands[b] = toLevel(bandPower * bandScale);
+    }
+
+    double centroid = power > 0 ? weighted / power * sampleRate / fftSize : 0;
+    record.centroidHz = centroid > 65535 ? 65535 : lrint(centroid);
+
+    if (!outFile.write(&record, sizeof(record)))
+    {
+        errStr = outFile.getLastErrorInfo();
+        return false;
+    }
+
+    ++framesNumber;
+
+    return true;
+}
+
+template <class Sample>
+void SpectrumAnalyzer::mixDown(const char *data, size_t frames, float *out)
+{
+    float scale = 1.0f / chansNumber;
+
+    for (size_t i = 0; i < frames; ++i)
+    {
+        float sum = 0;
+        for (u_int ch = 0; ch < chansNumber; ++ch, data += Sample::SIZE)
+            sum += Sample::toFloat(Sample::load(data));
+
+        out[i] = sum * scale;
+    }
+}
+
+int16_t SpectrumAnalyzer::toLevel(double meanSquare)
+{
+    // 0.01dB units
+    double level = meanSquare > 0 ? 1000 * log10(meanSquare) : -32768;
+
+    return level > 32767 ? 32767 : level < -32768 ? -32768 : lrint(level);
+}
@@ -0,0 +1,111 @@
+#include "statsserver.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Public members
+StatsServer::StatsServer() :
+    listenFd(-1)
+{
+}
+
+StatsServer::~StatsServer()
+{
+    close();
+}
+
+
+// Public methods
+bool StatsServer::open(const std::string &path)
+{
+    close();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        errStr = "Stats socket path is too long: \"" + path + "\"!";
+        ERR(errStr);
+        return false;
+    }
+
+    strcpy(addr.sun_path, path.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+    {
+        errStr = "Can not create stats socket!";
+        ERR(errStr);
+        return false;
+    }
+
+    // A socket file left by a previous run is replaced
+    unlink(path.c_str());
+
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 8) != 0)
+    {
+        errStr = "Can not listen on stats socket: \"" + path + "\"!";
+        ERR(errStr);
+        ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    this->path = path;
+
+    return true;
+}
+
+void StatsServer::close()
+{
+    if (listenFd < 0)
+        return;
+
+    for (size_t i = 0; i < clientFds.size(); ++i)
+        ::close(clientFds[i]);
+
+    clientFds.clear();
+
+    ::close(listenFd);
+    listenFd = -1;
+    unlink(path.c_str());
+}
+
+void StatsServer::publish(const std::string &line)
+{
+    if (listenFd < 0)
+        return;
+
+    // Accept new clients
+    for (;;)
+    {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            break;
+
+        clientFds.push_back(fd);
+    }
+
+    std::string data = line + '\n';
+
+    for (size_t i = 0; i < clientFds.size(); )
+    {
+        ssize_t res = send(clientFds[i], data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (res == (ssize_t)data.size())
+        {
+            ++i;
+            continue;
+        }
+
+        // The client is gone or too slow, a partial line would break the stream
+        ::close(clientFds[i]);
+        clientFds.erase(clientFds.begin() + i);
+    }
+}
@@ -0,0 +1,389 @@
+#include "timingindex.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace
+{
+    uint64_t toNs(const struct timespec &ts)
+    {
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+}
+
+// DriftEstimator
+// Public methods
+void DriftEstimator::reset(u_int nominalRate)
+{
+    this->nominalRate = nominalRate;
+    restarts = 0;
+    pointsNumber = 0;
+    pos0 = ns0 = 0;
+    lastPos = lastNs = 0;
+    meanX = meanY = 0;
+    cxx = cxy = 0;
+}
+
+void DriftEstimator::add(uint64_t pos, uint64_t ns)
+{
+    if (pointsNumber > 0)
+    {
+        // The timestamp is not updated since the previous block
+        if (pos == lastPos && ns == lastNs)
+            return;
+
+        int64_t expectedNs = (int64_t)(pos - lastPos) * 1000000000 / nominalRate;
+        int64_t jumpNs = (int64_t)(ns - lastNs) - expectedNs;
+        if (pos < lastPos || ns < lastNs || jumpNs > (int64_t)MAX_JUMP_NS || jumpNs < -(int64_t)MAX_JUMP_NS)
+        {
+            ++restarts;
+            pointsNumber = 0;
+        }
+    }
+
+    if (pointsNumber == 0)
+    {
+        pos0 = pos;
+        ns0 = ns;
+        meanX = meanY = 0;
+        cxx = cxy = 0;
+    }
+
+    // Welford's update, the sums stay small for recordings of any length
+    double x = pos - pos0;
+    double y = ns - ns0;
+    double dx = x - meanX;
+
+    ++pointsNumber;
+    meanX += dx / pointsNumber;
+    meanY += (y - meanY) / pointsNumber;
+    cxx += dx * (x - meanX);
+    cxy += dx * (y - meanY);
+
+    lastPos = pos;
+    lastNs = ns;
+}
+
+double DriftEstimator::getRate()
+{
+    if (cxx <= 0 || cxy <= 0)
+        return nominalRate;
+
+    // The slope is the period in ns
+    return 1e9 * cxx / cxy;
+}
+
+
+// TimingIndex
+// Public members
+TimingIndex::TimingIndex() :
+    captureRate(48000),
+    intervalFrames(48000),
+    deviceClock(CLOCK_MONOTONIC),
+    nextFilePos(0),
+    lastStampPos(0),
+    lastStampNs(0),
+    lastBlockPos(0),
+    lastFilePos(0),
+    lastBlockFrames(0),
+    lastRestarts(0),
+    head(0),
+    tail(0)
+{
+}
+
+
+// Public methods
+bool TimingIndex::open(const std::string &fileName, u_int captureRate, u_int sampleRate, u_int intervalMs, clockid_t deviceClock)
+{
+    this->captureRate = captureRate;
+    this->deviceClock = deviceClock;
+    intervalFrames = (uint64_t)captureRate * intervalMs / 1000;
+    if (intervalFrames == 0)
+        intervalFrames = 1;
+
+    drift.reset(captureRate);
+    nextFilePos = 0;
+    lastStampPos = lastStampNs = 0;
+    lastBlockPos = lastFilePos = 0;
+    lastBlockFrames = 0;
+    lastRestarts = 0;
+    head = tail = 0;
+    written.clear();
+
+    if (!outFile.open(fileName))
+    {
+        errStr = outFile.getLastErrorInfo();
+        return false;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    idx_header_t header;
+    memcpy(header.magic, "ARIDX001", sizeof(header.magic));
+    header.headerSize = sizeof(header);
+    header.entrySize = sizeof(idx_entry_t);
+    header.captureRate = captureRate;
+    header.sampleRate = sampleRate;
+    header.intervalMs = intervalMs;
+    header.deviceClock = deviceClock;
+    header.startWallNs = toNs(ts);
+
+    if (!outFile.write(&header, sizeof(header)))
+    {
+        errStr = outFile.getLastErrorInfo();
+        outFile.close();
+        return false;
+    }
+
+    errStr.clear();
+
+    return true;
+}
+
+bool TimingIndex::close()
+{
+    if (!outFile.isOpened())
+        return true;
+
+    bool res = flush();
+
+    if (!outFile.close() && res)
+    {
+        errStr = outFile.getLastErrorInfo();
+        res = false;
+    }
+
+    return res;
+}
+
+void TimingIndex::addBlock(uint64_t blockPos, uint64_t filePos, uint64_t frames, uint64_t stampPos, uint64_t stampNs)
+{
+    drift.add(stampPos, stampNs);
+
+    // Data is lost before the block, by the ring buffer or by the device
+    bool gap = lastStampNs != 0 && (blockPos != lastBlockPos + lastBlockFrames || drift.getRestarts() != lastRestarts);
+
+    lastStampPos = stampPos;
+    lastStampNs = stampNs;
+    lastBlockPos = blockPos;
+    lastFilePos = filePos;
+    lastBlockFrames = frames;
+    lastRestarts = drift.getRestarts();
+
+    if (gap || filePos >= nextFilePos)
+        addEntry(filePos, blockPos);
+}
+
+void TimingIndex::finish(uint64_t filePos)
+{
+    // The end is in the last block, which is recorded completely
+    if (lastStampNs != 0 && filePos > lastFilePos)
+        addEntry(filePos, lastBlockPos + (filePos - lastFilePos));
+}
+
+bool TimingIndex::flush()
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+
+    // Contiguous runs of the queue, at most two
+    while (t != h)
+    {
+        size_t n = QUEUE_SIZE - t % QUEUE_SIZE;
+        if (n > h - t)
+            n = h - t;
+
+        if (!outFile.write(&queue[t % QUEUE_SIZE], n * sizeof(idx_entry_t)))
+        {
+            errStr = outFile.getLastErrorInfo();
+            tail.store(h, std::memory_order_release);
+            return false;
+        }
+
+        written.insert(written.end(), &queue[t % QUEUE_SIZE], &queue[t % QUEUE_SIZE] + n);
+
+        t += n;
+        tail.store(t, std::memory_order_release);
+    }
+
+    return true;
+}
+
+uint64_t TimingIndex::getWallNs(uint64_t framePos)
+{
+    if (written.empty())
+        return 0;
+
+    // The data is written in order, the position is at one of the last entries
+    size_t i = written.size() - 1;
+    while (i > 0 && written[i].framePos > framePos)
+        --i;
+
+    const idx_entry_t &entry = written[i];
+    double rate = captureRate * (1 + entry.driftPpb * 1e-9);
+
+    return entry.wallNs + (int64_t)(((double)framePos - entry.framePos) * 1e9 / rate);
+}
+
+
+// Private methods
+void TimingIndex::addEntry(uint64_t filePos, uint64_t blockPos)
+{
+    // Queue is full, a later block is tried
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == QUEUE_SIZE)
+        return;
+
+    // The stamped frame is at most a buffer away, the nominal rate is precise enough there
+    int64_t offsetNs = ((int64_t)lastStampPos - (int64_t)blockPos) * 1000000000 / (int64_t)captureRate;
+
+    // Offset between the clocks now
+    struct timespec wallTs, deviceTs;
+    clock_gettime(CLOCK_REALTIME, &wallTs);
+    clock_gettime(deviceClock, &deviceTs);
+
+    idx_entry_t &entry = queue[h % QUEUE_SIZE];
+    entry.framePos = filePos;
+    entry.deviceNs = lastStampNs - offsetNs;
+    entry.wallNs = entry.deviceNs + (int64_t)(toNs(wallTs) - toNs(deviceTs));
+    entry.driftPpb = lrint(drift.getDriftPpm() * 1000);
+
+    head.store(h + 1, std::memory_order_release);
+
+    nextFilePos = filePos + intervalFrames;
+}
+
+
+// TimingIndexReader
+// Public members
+TimingIndexReader::TimingIndexReader()
+{
+    memset(&header, 0, sizeof(header));
+}
+
+
+// Public methods
+bool TimingIndexReader::load(const std::string &fileName)
+{
+    entries.clear();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        errStr = "Can not open index file: \"" + fileName + "\"!";
+        return false;
+    }
+
+    std::vector<char> data;
+    char buf[64 * 1024];
+    for (ssize_t res; (res = read(fd, buf, sizeof(buf))) != 0; )
+    {
+        if (res < 0)
+        {
+            ::close(fd);
+            errStr = "Index file reading error!";
+            return false;
+        }
+
+        data.insert(data.end(), buf, buf + res);
+    }
+
+    ::close(fd);
+
+    if (data.size() < sizeof(header) || memcmp(&data[0], "ARIDX001", 8) != 0)
+    {
+        errStr = "Not a timing index: \"" + fileName + "\"!";
+        return false;
+    }
+
+    memcpy(&header, &data[0], sizeof(header));
+    if (header.headerSize < sizeof(header) || header.entrySize < sizeof(TimingIndex::idx_entry_t) ||
+        header.headerSize > data.size() || header.captureRate == 0)
+    {
+        errStr = "Wrong timing index header: \"" + fileName + "\"!";
+        return false;
+    }
+
+    // The last entry may be cut by a crash
+    size_t entriesNumber = (data.size() - header.headerSize) / header.entrySize;
+    entries.resize(entriesNumber);
+    for (size_t i = 0; i < entriesNumber; ++i)
+        memcpy(&entries[i], &data[header.headerSize + i * header.entrySize], sizeof(TimingIndex::idx_entry_t));
+
+    return true;
+}
+
+bool TimingIndexReader::parseWallTime(const char *str, uint64_t *wallNs)
+{
+    // Fraction of a second, after the last '.'
+    double fraction = 0;
+    const char *dot = strrchr(str, '.');
+    std::string whole(str, dot ? dot - str : strlen(str));
+    if (dot && dot[1] != '\0')
+    {
+        char *end;
+        fraction = strtod(dot, &end);
+        if (*end != '\0')
+            return false;
+    }
+
+    time_t sec;
+    struct tm tmTime;
+    memset(&tmTime, 0, sizeof(tmTime));
+
+    const char *end = strptime(whole.c_str(), "%Y-%m-%d %H:%M:%S", &tmTime);
+    if (end != NULL && *end == '\0')
+    {
+        tmTime.tm_isdst = -1;
+        sec = mktime(&tmTime);
+    }
+    else
+    {
+        char *numEnd;
+        sec = strtoll(whole.c_str(), &numEnd, 10);
+        if (whole.empty() || *numEnd != '\0')
+            return false;
+    }
+
+    if (sec < 0)
+        return false;
+
+    *wallNs = (uint64_t)sec * 1000000000 + (uint64_t)(fraction * 1e9);
+
+    return true;
+}
+
+bool TimingIndexReader::findFrame(uint64_t wallNs, uint64_t *framePos)
+{
+    if (entries.empty() || wallNs < entries.front().wallNs || wallNs > entries.back().wallNs)
+        return false;
+
+    // The last entry which is not after the time
+    size_t low = 0, high = entries.size();
+    while (high - low > 1)
+    {
+        size_t mid = (low + high) / 2;
+        if (entries[mid].wallNs <= wallNs)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    // Frames after the entry at the measured rate. Data lost before the next entry
+    // leaves a time gap without frames, it is mapped to the next recorded frame
+    const TimingIndex::idx_entry_t &entry = entries[low];
+    double rate = header.captureRate * (1 + entry.driftPpb * 1e-9);
+    uint64_t pos = entry.framePos + (uint64_t)((wallNs - entry.wallNs) * rate / 1e9);
+
+    if (low + 1 < entries.size() && pos > entries[low + 1].framePos)
+        pos = entries[low + 1].framePos;
+
+    *framePos = pos;
+
+    return true;
+}
@@ -0,0 +1,245 @@
+#include "triggergate.h"
+#include "samplekernels.h"
+
+#include <math.h>
+#include <string.h>
+
+// Public members
+TriggerGate::TriggerGate() :
+    mode(MODE_LEVEL),
+    thresholdLevel(0),
+    sampleRate(0),
+    chansNumber(0),
+    format(SampleFormat::S16_LE),
+    frameSize(0),
+    windowFrames(0),
+    hangoverFrames(0),
+    opened(false),
+    silentFrames(0),
+    eventsNumber(0),
+    preRollFrames(0),
+    preRollPos(0),
+    preRollFilled(0)
+{
+}
+
+
+// Public methods
+bool TriggerGate::modeFromName(const std::string &name, Mode &mode)
+{
+    if (name == "level")
+        mode = MODE_LEVEL;
+    else if (name == "vad")
+        mode = MODE_VAD;
+    else
+        return false;
+
+    return true;
+}
+
+void TriggerGate::setup(Mode mode, float thresholdDb, u_int preRollMs, u_int hangoverMs,
+                        u_int sampleRate, u_int chansNumber, SampleFormat::Id format)
+{
+    this->mode = mode;
+    this->sampleRate = sampleRate;
+    this->chansNumber = chansNumber;
+    this->format = format;
+    thresholdLevel = powf(10.0, thresholdDb / 20.0);
+    frameSize = SampleFormat::getBytes(format) * chansNumber;
+
+    windowFrames = (size_t)sampleRate * WINDOW_MS / 1000;
+    if (windowFrames < 1)
+        windowFrames = 1;
+
+    hangoverFrames = (uint64_t)sampleRate * hangoverMs / 1000;
+
+    // The pre-roll buffer is allocated once, windows are copied into it in a circle
+    preRollFrames = (size_t)sampleRate * preRollMs / 1000;
+    preRollBuf.resize(preRollFrames * frameSize);
+
+    minValues.resize(chansNumber);
+    maxValues.resize(chansNumber);
+    peakLevels.resize(chansNumber);
+    sumSquares.resize(chansNumber);
+    crossings.resize(chansNumber);
+    negative.resize(chansNumber);
+
+    reset();
+}
+
+void TriggerGate::reset()
+{
+    opened = false;
+    silentFrames = 0;
+    eventsNumber = 0;
+    preRollPos = 0;
+    preRollFilled = 0;
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+        negative[ch] = 0;
+}
+
+TriggerGate::Action TriggerGate::process(const char *data, size_t framesNumber)
+{
+    bool triggered = isTriggered(data, framesNumber);
+
+    if (!opened)
+    {
+        if (!triggered)
+        {
+            storePreRoll(data, framesNumber);
+            return GATE_SKIP;
+        }
+
+        opened = true;
+        silentFrames = 0;
+        ++eventsNumber;
+        return GATE_START;
+    }
+
+    if (triggered)
+    {
+        silentFrames = 0;
+        return GATE_WRITE;
+    }
+
+    silentFrames += framesNumber;
+    if (silentFrames < hangoverFrames)
+        return GATE_WRITE;
+
+    // The pre-roll of the next event starts from here
+    opened = false;
+    preRollPos = 0;
+    preRollFilled = 0;
+    return GATE_STOP;
+}
+
+void TriggerGate::getPreRoll(const char **data1, size_t *frames1, const char **data2, size_t *frames2)
+{
+    // Until the buffer is filled the first time, the data starts from its beginning
+    size_t start = preRollFilled < preRollFrames ? 0 : preRollPos;
+
+    *data1 = preRollFilled ? &preRollBuf[start * frameSize] : NULL;
+    *frames1 = preRollFilled < preRollFrames ? preRollFilled : preRollFrames - start;
+    *data2 = preRollFilled && start ? &preRollBuf[0] : NULL;
+    *frames2 = preRollFilled < preRollFrames ? 0 : start;
+}
+
+
+// Private methods
+bool TriggerGate::isTriggered(const char *data, size_t framesNumber)
+{
+    if (framesNumber == 0)
+        return false;
+
+    // The level trigger on S16 samples uses the vectorized peak search,
+    // the other cases need the per-sample loop for zero crossings or formats
+    if (mode == MODE_LEVEL && format == SampleFormat::S16_LE)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+        {
+            minValues[ch] = 0x7FFF;
+            maxValues[ch] = -0x8000;
+        }
+
+        SampleKernels::findPeaks((const short *)data, framesNumber, chansNumber, &minValues[0], &maxValues[0]);
+
+        for (u_int ch = 0; ch < chansNumber; ++ch)
+        {
+            int peak = -minValues[ch] > maxValues[ch] ? -minValues[ch] : maxValues[ch];
+            peakLevels[ch] = peak / 32768.0;
+        }
+    }
+    else
+    {
+        switch (format)
+        {
+            case SampleFormat::S16_LE:
+                analyzeGeneric<SampleS16>(data, framesNumber);
+                break;
+
+            case SampleFormat::S24_3LE:
+                analyzeGeneric<SampleS24>(data, framesNumber);
+                break;
+
+            case SampleFormat::S32_LE:
+                analyzeGeneric<SampleS32>(data, framesNumber);
+                break;
+
+            case SampleFormat::FLOAT_LE:
+                analyzeGeneric<SampleFloat>(data, framesNumber);
+                break;
+        }
+    }
+
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        if (mode == MODE_LEVEL)
+        {
+            if (peakLevels[ch] >= thresholdLevel)
+                return true;
+        }
+        else
+        {
+            // Energy above the threshold, and not as many zero crossings as noise has
+            bool energy = sumSquares[ch] >= thresholdLevel * thresholdLevel * framesNumber;
+            bool voiced = (uint64_t)crossings[ch] * sampleRate <= (uint64_t)VAD_MAX_ZCR * framesNumber;
+
+            if (energy && voiced)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void TriggerGate::storePreRoll(const char *data, size_t framesNumber)
+{
+    if (preRollFrames == 0)
+        return;
+
+    // Only the latest frames are kept
+    if (framesNumber > preRollFrames)
+    {
+        data += (framesNumber - preRollFrames) * frameSize;
+        framesNumber = preRollFrames;
+    }
+
+    size_t frames = preRollFrames - preRollPos;
+    if (frames > framesNumber)
+        frames = framesNumber;
+
+    memcpy(&preRollBuf[preRollPos * frameSize], data, frames * frameSize);
+    if (frames < framesNumber)
+        memcpy(&preRollBuf[0], data + frames * frameSize, (framesNumber - frames) * frameSize);
+
+    preRollPos = (preRollPos + framesNumber) % preRollFrames;
+    preRollFilled = preRollFilled + framesNumber < preRollFrames ? preRollFilled + framesNumber : preRollFrames;
+}
+
+template <class Sample>
+void TriggerGate::analyzeGeneric(const char *data, size_t framesNumber)
+{
+    for (u_int ch = 0; ch < chansNumber; ++ch)
+    {
+        peakLevels[ch] = 0;
+        sumSquares[ch] = 0;
+        crossings[ch] = 0;
+    }
+
+    const char *p = data;
+    for (size_t i = 0; i < framesNumber; ++i)
+    {
+        for (u_int ch = 0; ch < chansNumber; ++ch, p += Sample::SIZE)
+        {
+            typename Sample::value_t value = Sample::load(p);
+            float level = Sample::level(value);
+            char sign = value < 0;
+
+            peakLevels[ch] = peakLevels[ch] > level ? peakLevels[ch] : level;
+            sumSquares[ch] += level * level;
+            crossings[ch] += sign != negative[ch];
+            negative[ch] = sign;
+        }
+    }
+}
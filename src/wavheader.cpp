@@ -0,0 +1,140 @@
+#include "wavheader.h"
+
+namespace
+{
+    // KSDATAFORMAT_SUBTYPE_PCM. KSDATAFORMAT_SUBTYPE_IEEE_FLOAT differs in the first byte only
+    const unsigned char subFormatGuid[16] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                                             0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+}
+
+// Public members
+WavHeader::WavHeader() :
+    extensible(false),
+    rf64Reserved(false),
+    rf64(false),
+    size(0)
+{
+    memset(header.data, 0, sizeof(header.data));
+    memset(&ds64, 0, sizeof(ds64));
+    ds64.chunkSize = sizeof(ds64) - sizeof(ds64.chunkId) - sizeof(ds64.chunkSize);
+
+    strncpy(header.fields.chunkId, "RIFF", 4);
+    strncpy(header.fields.format, "WAVE", 4);
+    strncpy(header.fields.subchunk1Id, "fmt ", 4);
+    strncpy(header.fields.subchunk2Id, "data", 4);
+
+    setFormat(SampleFormat::S16_LE, 1, 48000);
+}
+
+
+// Public methods
+void WavHeader::setFormat(SampleFormat::Id format, u_int chansNumber, u_int sampleRate)
+{
+    u_int bits = SampleFormat::getBits(format);
+
+    // The canonical header is enough for 16-bit PCM mono and stereo only
+    extensible = bits > 16 || chansNumber > 2 || SampleFormat::isFloat(format);
+
+    header.fields.numChannels = chansNumber;
+    header.fields.sampleRate = sampleRate;
+    header.fields.byteRate = chansNumber * sampleRate * bits / 8;
+    header.fields.blockAlign = chansNumber * bits / 8;
+    header.fields.bitsPerSample = bits;
+
+    if (extensible)
+    {
+        header.fields.subchunk1Size = 40;
+        header.fields.audioFormat = 0xFFFE;
+        header.fields.cbSize = 22;
+        header.fields.validBitsPerSample = bits;
+        header.fields.channelMask = chansNumber == 1 ? 0x4 : chansNumber == 2 ? 0x3 : 0;
+
+        // The GUID starts with the format tag: 1 for PCM, 3 for IEEE float
+        memcpy(header.fields.subFormat, subFormatGuid, sizeof(subFormatGuid));
+        header.fields.subFormat[0] = SampleFormat::isFloat(format) ? 3 : 1;
+    }
+    else
+    {
+        header.fields.subchunk1Size = 16;
+        header.fields.audioFormat = 1;
+    }
+
+    setDataSize(0);
+}
+
+void WavHeader::setExpectedDataSize(uint64_t dataSize)
+{
+    rf64Reserved = false;
+    setDataSize(0);
+
+    rf64Reserved = dataSize == 0 || dataSize > 0xFFFFFFFF - size;
+    setDataSize(0);
+}
+
+void WavHeader::setDataSize(uint64_t dataSize)
+{
+    size = (extensible ? sizeof(header.data) : sizeof(header.data) - 24) + (rf64Reserved ? sizeof(ds64) : 0);
+
+    uint64_t riffSize = dataSize + size - sizeof(header.fields.chunkId) - sizeof(header.fields.chunkSize);
+    rf64 = rf64Reserved && dataSize != UINT64_MAX && riffSize > 0xFFFFFFFF;
+
+    if (rf64)
+    {
+        // The real sizes are in ds64, the 32-bit ones are -1
+        memcpy(header.fields.chunkId, "RF64", 4);
+        memcpy(ds64.chunkId, "ds64", 4);
+        ds64.riffSize = riffSize;
+        ds64.dataSize = dataSize;
+        ds64.sampleCount = dataSize / header.fields.blockAlign;
+
+        header.fields.chunkSize = 0xFFFFFFFF;
+        header.fields.subchunk2Size = 0xFFFFFFFF;
+    }
+    else
+    {
+        memcpy(header.fields.chunkId, "RIFF", 4);
+        memcpy(ds64.chunkId, "JUNK", 4);
+        ds64.riffSize = ds64.dataSize = ds64.sampleCount = 0;
+
+        // 32-bit sizes can't describe more than 4GB
+        if (dataSize > 0xFFFFFFFF - size)
+            dataSize = 0xFFFFFFFF - size;
+
+        header.fields.chunkSize = dataSize + size - sizeof(header.fields.chunkId) - sizeof(header.fields.chunkSize);
+        header.fields.subchunk2Size = dataSize;
+    }
+
+    build();
+}
+
+
+// Private methods
+void WavHeader::build()
+{
+    // The RIFF header, the ds64 chunk if it is reserved, everything up to bitsPerSample,
+    // then the extension if it is used, then the "data" subchunk header
+    size_t riffSize = offsetof(wav_header_t, fields.subchunk1Id);
+    size_t baseSize = offsetof(wav_header_t, fields.cbSize);
+    size_t extSize = offsetof(wav_header_t, fields.subchunk2Id) - baseSize;
+    char *p = raw;
+
+    memcpy(p, header.data, riffSize);
+    p += riffSize;
+
+    if (rf64Reserved)
+    {
+        memcpy(p, &ds64, sizeof(ds64));
+        p += sizeof(ds64);
+    }
+
+    memcpy(p, header.data + riffSize, baseSize - riffSize);
+    p += baseSize - riffSize;
+
+    if (extensible)
+    {
+        memcpy(p, header.data + baseSize, extSize);
+        p += extSize;
+    }
+
+    memcpy(p, header.data + baseSize + extSize, 8);
+}
@@ -0,0 +1,220 @@
+// Timing index (.idx) or block index (.bix) of a recording: the clocks, the drift
+// of the device clock, the recorded frame at a wall clock time and the waveform overview.
+// The search is a binary one over the index entries, the audio data is not read.
+#include "blockindex.h"
+#include "debug.h"
+#include "timingindex.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace
+{
+    const char *helpStr = "Usage: recindex [options] <file.idx|file.bix>\n"
+                          "Options:\n"
+                          "  -h, --help          Show help\n"
+                          "  -t, --time          Show the recorded frame captured at this wall clock time: seconds since\n"
+                          "                      the epoch or local \"YYYY-MM-DD HH:MM:SS\", both with optional fractions.\n"
+                          "                      A block index also shows its byte offset in the recording\n"
+                          "  -w, --width         Waveform overview of a block index in N columns, one line per column:\n"
+                          "                      start time, minimum, maximum and RMS of all channels";
+
+    const char *clockName(uint32_t clock)
+    {
+        switch (clock)
+        {
+            case CLOCK_MONOTONIC_RAW:
+                return "CLOCK_MONOTONIC_RAW";
+
+            case CLOCK_MONOTONIC:
+                return "CLOCK_MONOTONIC";
+
+            case CLOCK_REALTIME:
+                return "CLOCK_REALTIME";
+        }
+
+        return "unknown";
+    }
+
+    std::string wallTimeStr(uint64_t ns)
+    {
+        time_t sec = ns / 1000000000;
+        struct tm tmTime;
+        char buf[64];
+
+        if (localtime_r(&sec, &tmTime) == NULL || strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tmTime) == 0)
+            return std::to_string(sec);
+
+        std::stringstream ss;
+        ss << buf << '.' << std::setw(3) << std::setfill('0') << ns / 1000000 % 1000;
+
+        return ss.str();
+    }
+
+    bool isBlockIndex(const char *fileName)
+    {
+        char magic[8];
+        int fd = open(fileName, O_RDONLY);
+        bool res = fd >= 0 && read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, "ARBIX001", sizeof(magic)) == 0;
+
+        if (fd >= 0)
+            close(fd);
+
+        return res;
+    }
+
+    int showBlockIndex(const char *fileName, const char *timeStr, size_t width)
+    {
+        BlockIndexReader index;
+        if (!index.load(fileName))
+        {
+            ERR(index.getLastErrorInfo());
+            return 1;
+        }
+
+        const BlockIndex::bix_header_t &header = index.getHeader();
+        uint64_t framesNumber = index.getFramesNumber();
+
+        if (timeStr == NULL && width == 0)
+        {
+            PRINT(SampleFormat::getName((SampleFormat::Id)header.format) << ", " << header.chansNumber << " channel(s), "
+                  << header.sampleRate << "Hz, " << framesNumber << " frames (" << (double)framesNumber / header.sampleRate << "s)"
+                  << (header.levelsOffset ? "" : ", interrupted recording"));
+            PRINT((index.isSeekable() ? "Data from byte " + std::to_string(header.dataOffset) : std::string("Compressed data"))
+                  << ", " << index.getLevelsNumber() << " level(s) of " << header.blockFrames << " to "
+                  << index.getLevelFrames(index.getLevelsNumber() - 1) << " frames per block");
+
+            if (index.getWallNs(0))
+                PRINT("Recorded " << wallTimeStr(index.getWallNs(0)) << " to " << wallTimeStr(index.getWallNs(framesNumber)));
+
+            return 0;
+        }
+
+        if (timeStr != NULL)
+        {
+            uint64_t wallNs, framePos;
+            if (!TimingIndexReader::parseWallTime(timeStr, &wallNs))
+            {
+                ERR("Wrong time: \"" << timeStr << "\"!");
+                return 1;
+            }
+
+            if (!index.findFrame(wallNs, &framePos))
+            {
+                ERR(wallTimeStr(wallNs) << " is outside the recording!");
+                return 1;
+            }
+
+            PRINT("Frame " << framePos << " (" << (double)framePos / header.sampleRate << "s)"
+                  << (index.isSeekable() ? ", byte " + std::to_string(index.getByteOffset(framePos)) : std::string()));
+        }
+
+        std::vector<BlockIndexReader::Level> overview;
+        if (width && index.getOverview(width, overview))
+        {
+            for (size_t c = 0; c < overview.size(); ++c)
+                PRINT(std::fixed << std::setprecision(3) << (double)c * framesNumber / width / header.sampleRate << ' '
+                      << std::setprecision(4) << overview[c].min << ' ' << overview[c].max << ' ' << overview[c].rms);
+        }
+
+        return 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option cmdLineOptions[] =
+    {
+        {"help",         no_argument,       NULL, 'h'},
+        {"time",         required_argument, NULL, 't'},
+        {"width",        required_argument, NULL, 'w'},
+        {0, 0, 0, 0}
+    };
+
+    const char *timeStr = NULL;
+    size_t width = 0;
+
+    for (int res = 0; res != -1; )
+    {
+        int optionIndex = 0;
+        res = getopt_long(argc, argv, "ht:w:", cmdLineOptions, &optionIndex);
+
+        if (res == 't')
+            timeStr = optarg;
+        else if (res == 'w')
+            width = strtoul(optarg, NULL, 10);
+        else if (res == 'h' || res == '?')
+        {
+            PRINT(helpStr);
+            return res == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind + 1 != argc)
+    {
+        PRINT(helpStr);
+        return 1;
+    }
+
+    if (isBlockIndex(argv[optind]))
+        return showBlockIndex(argv[optind], timeStr, width);
+
+    TimingIndexReader index;
+    if (!index.load(argv[optind]))
+    {
+        ERR(index.getLastErrorInfo());
+        return 1;
+    }
+
+    const TimingIndex::idx_header_t &header = index.getHeader();
+
+    if (timeStr == NULL)
+    {
+        PRINT("Capture rate " << header.captureRate << "Hz, output rate " << header.sampleRate << "Hz, entry every "
+              << header.intervalMs << "ms, device clock " << clockName(header.deviceClock));
+        PRINT("Started " << wallTimeStr(header.startWallNs) << ", " << index.getEntriesNumber() << " entries");
+
+        if (index.getEntriesNumber() == 0)
+            return 0;
+
+        const TimingIndex::idx_entry_t &first = index.getEntry(0);
+        const TimingIndex::idx_entry_t &last = index.getEntry(index.getEntriesNumber() - 1);
+
+        PRINT("Frames " << first.framePos << " to " << last.framePos << ", " << wallTimeStr(first.wallNs) << " to " << wallTimeStr(last.wallNs));
+
+        // The drift of the last entry is fitted over the longest time
+        PRINT("Device clock drift " << last.driftPpb / 1000.0 << "ppm, the wall clock moved "
+              << ((int64_t)(last.wallNs - first.wallNs) - (int64_t)(last.deviceNs - first.deviceNs)) / 1000
+              << "us against the device timestamp clock");
+
+        return 0;
+    }
+
+    uint64_t wallNs, framePos;
+    if (!TimingIndexReader::parseWallTime(timeStr, &wallNs))
+    {
+        ERR("Wrong time: \"" << timeStr << "\"!");
+        return 1;
+    }
+
+    if (!index.findFrame(wallNs, &framePos))
+    {
+        ERR(wallTimeStr(wallNs) << " is outside the recording!");
+        return 1;
+    }
+
+    PRINT("Frame " << framePos << " at " << header.captureRate << "Hz (" << (double)framePos / header.captureRate << "s)"
+          << (header.sampleRate != header.captureRate ? ", about frame " + std::to_string(framePos * header.sampleRate / header.captureRate)
+              + " at the output rate" : std::string()));
+
+    return 0;
+}
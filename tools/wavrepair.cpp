@@ -0,0 +1,310 @@
+// Repair of WAV files left by an interrupted recording.
+// The header sizes are set to the data which is actually in the file. The recorder
+// updates the header periodically, so the size in it is a lower bound of the valid data.
+// The data after it is kept up to the last non-zero byte: a preallocated file which
+// was not truncated is zero-filled after the data. Files above 4GB are converted to
+// RF64 if they have space for the ds64 chunk (a "JUNK" chunk of 28 bytes at least).
+#include "debug.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+    const char *helpStr = "Usage: wavrepair [options] <file.wav> ...\n"
+                          "Options:\n"
+                          "  -h, --help          Show help\n"
+                          "  -n, --dry_run       Only show what would be repaired";
+
+    // Chunks before "data" are searched in the beginning of the file only
+    const size_t HEADER_MAX_SIZE = 64 * 1024;
+    const size_t SCAN_BLOCK_SIZE = 1024 * 1024;
+    const size_t DS64_SIZE = 28;
+
+    uint32_t getLe32(const char *p)
+    {
+        const unsigned char *u = (const unsigned char *)p;
+        return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+    }
+
+    uint64_t getLe64(const char *p)
+    {
+        return getLe32(p) | ((uint64_t)getLe32(p + 4) << 32);
+    }
+
+    void putLe32(char *p, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            p[i] = value >> (8 * i);
+    }
+
+    void putLe64(char *p, uint64_t value)
+    {
+        putLe32(p, value);
+        putLe32(p + 4, value >> 32);
+    }
+
+    class WavRepair
+    {
+    public:
+        WavRepair(const std::string &fileName, bool dryRun) :
+            fileName(fileName),
+            dryRun(dryRun),
+            fd(-1),
+            fileSize(0),
+            ds64Offset(0),
+            blockAlign(0),
+            dataOffset(0),
+            headerDataSize(0)
+        {
+        }
+
+        ~WavRepair()
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+
+        bool run()
+        {
+            if (!open() || !parse())
+                return false;
+
+            // The recorded size is valid if the file has that much data
+            uint64_t available = fileSize - dataOffset;
+            uint64_t validSize = headerDataSize < available ? headerDataSize : available;
+
+            uint64_t dataSize;
+            if (!findDataEnd(validSize, available, dataSize))
+                return false;
+
+            // Whole frames only, a partial last frame is completed with zero bytes if possible
+            uint64_t frameEnd = (dataSize + blockAlign - 1) / blockAlign * blockAlign;
+            dataSize = frameEnd <= available ? frameEnd : available / blockAlign * blockAlign;
+
+            uint64_t riffSize = dataOffset + dataSize - 8;
+            bool rf64 = riffSize > 0xFFFFFFFF;
+            if (rf64 && ds64Offset == 0)
+            {
+                ERR(fileName << ": the data exceeds 4GB, but there is no space for the ds64 chunk!");
+                return false;
+            }
+
+            if (dataSize == headerDataSize && dataOffset + dataSize == fileSize)
+            {
+                PRINT(fileName << ": OK, " << dataSize / blockAlign << " frames");
+                return true;
+            }
+
+            PRINT(fileName << ": data size " << dataSize << " bytes (" << dataSize / blockAlign << " frames), header had "
+                  << headerDataSize << ", " << fileSize - dataOffset - dataSize << " bytes cut off"
+                  << (rf64 ? ", RF64" : ""));
+
+            if (dryRun)
+                return true;
+
+            return writeHeader(riffSize, dataSize, rf64) && truncate(dataOffset + dataSize);
+        }
+
+    private:
+        std::string fileName;
+        bool dryRun;
+        int fd;
+        uint64_t fileSize;
+        std::vector<char> header;
+        // Offset of the ds64 chunk, or of a "JUNK" chunk which may become it
+        size_t ds64Offset;
+        u_int blockAlign;
+        size_t dataOffset;
+        uint64_t headerDataSize;
+
+        bool open()
+        {
+            fd = ::open(fileName.c_str(), dryRun ? O_RDONLY : O_RDWR);
+
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0)
+            {
+                ERR(fileName << ": can not open the file!");
+                return false;
+            }
+
+            fileSize = st.st_size;
+            header.resize(fileSize < HEADER_MAX_SIZE ? fileSize : HEADER_MAX_SIZE);
+
+            if (pread(fd, &header[0], header.size(), 0) != (ssize_t)header.size())
+            {
+                ERR(fileName << ": file reading error!");
+                return false;
+            }
+
+            return true;
+        }
+
+        bool parse()
+        {
+            bool isRf64 = header.size() >= 12 && memcmp(&header[0], "RF64", 4) == 0;
+            if (header.size() < 12 || (memcmp(&header[0], "RIFF", 4) != 0 && !isRf64) || memcmp(&header[8], "WAVE", 4) != 0)
+            {
+                ERR(fileName << ": not a WAV file!");
+                return false;
+            }
+
+            uint64_t ds64DataSize = 0;
+
+            for (size_t pos = 12; pos + 8 <= header.size(); )
+            {
+                const char *chunk = &header[pos];
+                uint32_t chunkSize = getLe32(chunk + 4);
+
+                if (memcmp(chunk, "ds64", 4) == 0 || (memcmp(chunk, "JUNK", 4) == 0 && chunkSize >= DS64_SIZE && ds64Offset == 0))
+                {
+                    ds64Offset = pos;
+                    if (memcmp(chunk, "ds64", 4) == 0 && pos + 8 + 16 <= header.size())
+                        ds64DataSize = getLe64(chunk + 16);
+                }
+                else if (memcmp(chunk, "fmt ", 4) == 0 && pos + 8 + 14 <= header.size())
+                    blockAlign = (unsigned char)chunk[20] | ((unsigned char)chunk[21] << 8);
+                else if (memcmp(chunk, "data", 4) == 0)
+                {
+                    dataOffset = pos + 8;
+                    headerDataSize = isRf64 && chunkSize == 0xFFFFFFFF ? ds64DataSize : chunkSize;
+                    break;
+                }
+
+                // Chunks are padded to an even size
+                pos += 8 + (uint64_t)chunkSize + (chunkSize & 1);
+            }
+
+            if (dataOffset == 0 || blockAlign == 0)
+            {
+                ERR(fileName << ": no \"fmt \" or \"data\" chunk in the beginning of the file!");
+                return false;
+            }
+
+            return true;
+        }
+
+        // The end of the data: the last non-zero byte after the valid size
+        bool findDataEnd(uint64_t validSize, uint64_t available, uint64_t &dataSize)
+        {
+            std::vector<char> block(SCAN_BLOCK_SIZE);
+            uint64_t end = available;
+
+            while (end > validSize)
+            {
+                size_t size = end - validSize < block.size() ? end - validSize : block.size();
+                uint64_t offset = dataOffset + end - size;
+
+                if (pread(fd, &block[0], size, offset) != (ssize_t)size)
+                {
+                    ERR(fileName << ": file reading error!");
+                    return false;
+                }
+
+                size_t i = size;
+                while (i > 0 && block[i - 1] == 0)
+                    --i;
+
+                if (i > 0)
+                {
+                    end -= size - i;
+                    break;
+                }
+
+                end -= size;
+            }
+
+            dataSize = end;
+
+            return true;
+        }
+
+        bool writeHeader(uint64_t riffSize, uint64_t dataSize, bool rf64)
+        {
+            memcpy(&header[0], rf64 ? "RF64" : "RIFF", 4);
+            putLe32(&header[4], rf64 ? 0xFFFFFFFF : riffSize);
+            putLe32(&header[dataOffset - 4], rf64 ? 0xFFFFFFFF : dataSize);
+
+            if (ds64Offset)
+            {
+                char *ds64 = &header[ds64Offset];
+                memcpy(ds64, rf64 ? "ds64" : "JUNK", 4);
+
+                // Sizes and the sample count, the table is left as is
+                putLe64(ds64 + 8, rf64 ? riffSize : 0);
+                putLe64(ds64 + 16, rf64 ? dataSize : 0);
+                putLe64(ds64 + 24, rf64 ? dataSize / blockAlign : 0);
+            }
+
+            if (pwrite(fd, &header[0], dataOffset, 0) != (ssize_t)dataOffset)
+            {
+                ERR(fileName << ": header writing error!");
+                return false;
+            }
+
+            return true;
+        }
+
+        bool truncate(uint64_t size)
+        {
+            if (size < fileSize && ftruncate(fd, size) != 0)
+            {
+                ERR(fileName << ": file truncating error!");
+                return false;
+            }
+
+            return true;
+        }
+    };
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option cmdLineOptions[] =
+    {
+        {"help",         no_argument,       NULL, 'h'},
+        {"dry_run",      no_argument,       NULL, 'n'},
+        {0, 0, 0, 0}
+    };
+
+    bool dryRun = false;
+
+    for (int res = 0; res != -1; )
+    {
+        int optionIndex = 0;
+        res = getopt_long(argc, argv, "hn", cmdLineOptions, &optionIndex);
+
+        if (res == 'n')
+            dryRun = true;
+        else if (res == 'h' || res == '?')
+        {
+            PRINT(helpStr);
+            return res == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        PRINT(helpStr);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = optind; i < argc; ++i)
+    {
+        WavRepair repair(argv[i], dryRun);
+        if (!repair.run())
+            ++failed;
+    }
+
+    return failed ? 1 : 0;
+}